@@ -65,7 +65,8 @@ project "GitRepoManager"
         "git2.lib", -- LibGit2
         "Winhttp.lib", -- Windows HTTP lib for LibGit2
         "Crypt32.lib", -- Windows Crypto lib for LibGit2
-        "Rpcrt4.lib" -- Windows Remote Procedure Call lib for LibGit2
+        "Rpcrt4.lib", -- Windows Remote Procedure Call lib for LibGit2
+        "Ws2_32.lib" -- Winsock for the loopback test server
     }
 
     linkoptions {
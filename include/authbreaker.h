@@ -0,0 +1,92 @@
+#ifndef AUTH_BREAKER_H
+#define AUTH_BREAKER_H
+
+#include "credentialstore.h"
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+constexpr uint32_t AUTH_FAILURE_THRESHOLD = 3; // Rejections before a host's breaker opens
+
+//--------------------------------------
+// struct AuthAttempt
+//--------------------------------------
+// Credential requests made by the task running on this thread. libgit2 only
+// asks again after the server turned the last credential down, so a second
+// request is a rejection.
+struct AuthAttempt
+{
+    uint32_t requests{0};
+    bool rejected{false};
+};
+thread_local AuthAttempt authAttempt;
+
+//--------------------------------------
+// class AuthCircuitBreaker
+//--------------------------------------
+// Counts credential rejections per host. Once a host reaches the threshold
+// its breaker opens and every task for it fails before connecting, instead
+// of each repo handshaking with the same bad credential. Any success closes
+// it again, as does a new credential.
+class AuthCircuitBreaker
+{
+public:
+    bool isOpen(const std::string& host)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        auto it = failures.find(host);
+        return it != failures.end() && it->second >= AUTH_FAILURE_THRESHOLD;
+    }
+
+    void recordFailure(const std::string& host)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        uint32_t count = ++failures[host];
+        if (count == AUTH_FAILURE_THRESHOLD) {
+            logMessage(
+                LogLevel::LEVEL_ERROR, "Credentials rejected %u times by %s, failing its tasks", count, host.c_str());
+        }
+    }
+
+    void recordSuccess(const std::string& host)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        failures.erase(host);
+    }
+
+    void reset()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        failures.clear();
+    }
+
+    std::vector<std::string> openHosts()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        std::vector<std::string> hosts;
+        for (const auto& [host, count] : failures) {
+            if (count >= AUTH_FAILURE_THRESHOLD) {
+                hosts.push_back(host);
+            }
+        }
+        return hosts;
+    }
+
+private:
+    std::mutex lock;
+    std::unordered_map<std::string, uint32_t> failures;
+};
+
+//--------------------------------------
+// authBreaker()
+//--------------------------------------
+AuthCircuitBreaker& authBreaker()
+{
+    static AuthCircuitBreaker breaker;
+    return breaker;
+}
+
+#endif
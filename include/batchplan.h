@@ -0,0 +1,561 @@
+#ifndef BATCH_PLAN_H
+#define BATCH_PLAN_H
+
+#include "gitrepo.h"
+#include "repotable.h"
+#include "latencyhistogram.h"
+#include "logsink.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+constexpr double BATCH_PLAN_DEFAULT_SECONDS = 5.0; // Estimate for a task nothing has been timed for yet
+constexpr const char* TASK_TIMINGS_FILE_NAME = "task_timings.cfg";
+constexpr const char* TASK_TIMING_NAMES[GIT_TASK_COUNT] = {"", "fetch", "fastforward", "push", "rebase", ""};
+
+//--------------------------------------
+// enum PlanAction
+//--------------------------------------
+enum class PlanAction
+{
+    SKIP,
+    FETCH,
+    FASTFORWARD,
+    PUSH,
+    BLOCKED_DIRTY,
+    BLOCKED_DIVERGED,
+};
+
+constexpr size_t PLAN_ACTION_COUNT = static_cast<size_t>(PlanAction::BLOCKED_DIVERGED) + 1;
+
+//--------------------------------------
+// PlanActionToString()
+//--------------------------------------
+const char* PlanActionToString(PlanAction action)
+{
+    switch (action) {
+        case PlanAction::SKIP:
+            return "skip";
+        case PlanAction::FETCH:
+            return "fetch";
+        case PlanAction::FASTFORWARD:
+            return "fast-forward";
+        case PlanAction::PUSH:
+            return "push";
+        case PlanAction::BLOCKED_DIRTY:
+            return "blocked: local changes";
+        case PlanAction::BLOCKED_DIVERGED:
+            return "blocked: diverged";
+        default:
+            return "unknown";
+    }
+}
+
+//--------------------------------------
+// enum PlanEstimate
+//--------------------------------------
+// Where an item's estimate came from, best first.
+enum class PlanEstimate
+{
+    HISTORY,
+    HOST,
+    GLOBAL,
+    DEFAULT,
+};
+
+//--------------------------------------
+// PlanEstimateToString()
+//--------------------------------------
+const char* PlanEstimateToString(PlanEstimate source)
+{
+    switch (source) {
+        case PlanEstimate::HISTORY:
+            return "repo history";
+        case PlanEstimate::HOST:
+            return "host p50";
+        case PlanEstimate::GLOBAL:
+            return "all hosts p50";
+        case PlanEstimate::DEFAULT:
+            return "default";
+        default:
+            return "unknown";
+    }
+}
+
+//--------------------------------------
+// planActionTask()
+//--------------------------------------
+GitTask planActionTask(PlanAction action)
+{
+    switch (action) {
+        case PlanAction::FETCH:
+            return GitTask::FETCH;
+        case PlanAction::FASTFORWARD:
+            return GitTask::FASTFORWARD;
+        case PlanAction::PUSH:
+            return GitTask::PUSH;
+        default:
+            return GitTask::NONE;
+    }
+}
+
+//--------------------------------------
+// planAction()
+//--------------------------------------
+// What running goal on a repo would do, judged from its cached state. Local
+// changes are only known to block once a checkout has stopped on them.
+PlanAction planAction(GitTask goal, GitState state, GitTask running, bool blockedByLocalChanges, bool autoStash)
+{
+    if (running != GitTask::NONE || state == GitState::PROCESSING) {
+        return PlanAction::SKIP;
+    }
+    bool diverged = state == GitState::DIVERGED || state == GitState::REBASE;
+    switch (goal) {
+        case GitTask::FETCH:
+            return PlanAction::FETCH;
+        case GitTask::FASTFORWARD:
+            if (diverged) {
+                return PlanAction::BLOCKED_DIVERGED;
+            }
+            if (state == GitState::NONE) {
+                return PlanAction::SKIP;
+            }
+            // Local commits on top can't be fast-forwarded; a fetch at least
+            // shows whether upstream moved too
+            if (state == GitState::PUSH) {
+                return PlanAction::FETCH;
+            }
+            return blockedByLocalChanges && !autoStash ? PlanAction::BLOCKED_DIRTY : PlanAction::FASTFORWARD;
+        case GitTask::PUSH:
+            if (diverged) {
+                return PlanAction::BLOCKED_DIVERGED;
+            }
+            return state == GitState::PUSH ? PlanAction::PUSH : PlanAction::SKIP;
+        default:
+            return PlanAction::SKIP;
+    }
+}
+
+//--------------------------------------
+// struct BatchPlanLanes
+//--------------------------------------
+// How many items run at once: fetches and pushes per remote host (and among
+// repos without one), and fast-forwards through the pipeline's network workers.
+struct BatchPlanLanes
+{
+    uint32_t perHost{FETCHES_PER_HOST};
+    uint32_t pipeline{1};
+};
+
+//--------------------------------------
+// struct PlanItem
+//--------------------------------------
+struct PlanItem
+{
+    RepoId id;
+    std::filesystem::path repoPath{""};
+    std::string host{""};
+    PlanAction action{PlanAction::SKIP};
+    double estimate{0.0}; // Seconds; zero for items that don't run
+    PlanEstimate source{PlanEstimate::DEFAULT};
+};
+
+//--------------------------------------
+// planPool()
+//--------------------------------------
+// Items in one pool compete for its lanes; pools run side by side. Repos
+// without a remote host share one pool, limited like a host's.
+std::pair<bool, std::string> planPool(const PlanItem& item)
+{
+    return {item.action == PlanAction::FASTFORWARD, item.action == PlanAction::FASTFORWARD ? "" : item.host};
+}
+
+//--------------------------------------
+// planPoolLanes()
+//--------------------------------------
+// Zero for no limit.
+uint32_t planPoolLanes(const std::pair<bool, std::string>& pool, const BatchPlanLanes& lanes)
+{
+    return pool.first ? lanes.pipeline : lanes.perHost;
+}
+
+//--------------------------------------
+// simulatePlanWallTime()
+//--------------------------------------
+// Wall time of running items in the given order, each pool handing its next
+// item to whichever lane frees up first.
+double simulatePlanWallTime(const std::vector<const PlanItem*>& order, const BatchPlanLanes& lanes)
+{
+    std::map<std::pair<bool, std::string>, std::vector<double>> laneEnds;
+    double wall = 0.0;
+    for (const PlanItem* item : order) {
+        std::pair<bool, std::string> pool = planPool(*item);
+        uint32_t limit = planPoolLanes(pool, lanes);
+        std::vector<double>& ends = laneEnds[pool];
+        double end = item->estimate;
+        if (limit != 0 && ends.size() >= limit) {
+            auto earliest = std::min_element(ends.begin(), ends.end());
+            end += *earliest;
+            *earliest = end;
+        }
+        else {
+            ends.push_back(end);
+        }
+        wall = end > wall ? end : wall;
+    }
+    return wall;
+}
+
+//--------------------------------------
+// struct BatchPlan
+//--------------------------------------
+struct BatchPlan
+{
+    GitTask goal{GitTask::NONE};
+    std::vector<PlanItem> items; // Items that run, in dispatch order, then the rest in table order
+    size_t runnable{0};          // Leading items that run
+    std::array<size_t, PLAN_ACTION_COUNT> counts{};
+    double workSeconds{0.0};           // Sum of the estimates
+    double wallSeconds{0.0};           // Estimated wall time in dispatch order
+    double tableOrderWallSeconds{0.0}; // Same in table order, as the mass buttons run
+};
+
+//--------------------------------------
+// loadTaskTimings()
+//--------------------------------------
+// Per-repo task times kept from earlier sessions, by repo path. Each line is
+// the path, a tab, then task=seconds/runs for every task timed on the repo.
+std::unordered_map<std::string, RepoTaskTimings> loadTaskTimings(const std::filesystem::path& file)
+{
+    std::unordered_map<std::string, RepoTaskTimings> timings;
+    std::ifstream in(file);
+    std::string line;
+    size_t lineNumber = 0;
+    while (std::getline(in, line)) {
+        lineNumber++;
+        size_t tab = line.find('\t');
+        if (tab == std::string::npos || tab == 0) {
+            continue;
+        }
+        RepoTaskTimings repo;
+        std::istringstream tokens(line.substr(tab + 1));
+        std::string entry;
+        while (tokens >> entry) {
+            size_t equals = entry.find('=');
+            size_t slash = entry.find('/', equals);
+            std::string name = entry.substr(0, equals);
+            size_t task = 0;
+            while (task < GIT_TASK_COUNT && (name.empty() || name != TASK_TIMING_NAMES[task])) {
+                task++;
+            }
+            bool valid = task < GIT_TASK_COUNT && slash != std::string::npos;
+            try {
+                if (valid) {
+                    repo.seconds[task] = std::stod(entry.substr(equals + 1, slash - equals - 1));
+                    repo.runs[task] = static_cast<uint32_t>(std::stoul(entry.substr(slash + 1)));
+                }
+            }
+            catch (const std::exception&) {
+                valid = false;
+            }
+            if (!valid) {
+                logMessage(
+                    LogLevel::LEVEL_WARN,
+                    "%s:%zu: invalid task timing '%s'",
+                    file.string().c_str(),
+                    lineNumber,
+                    entry.c_str());
+            }
+        }
+        timings[line.substr(0, tab)] = repo;
+    }
+    return timings;
+}
+
+//--------------------------------------
+// saveTaskTimings()
+//--------------------------------------
+bool saveTaskTimings(const std::filesystem::path& file, const std::unordered_map<std::string, RepoTaskTimings>& timings)
+{
+    std::ofstream out(file, std::ios::trunc);
+    if (!out) {
+        return false;
+    }
+    std::map<std::string, const RepoTaskTimings*> sorted;
+    for (const auto& [path, repo] : timings) {
+        sorted.emplace(path, &repo);
+    }
+    for (const auto& [path, repo] : sorted) {
+        out << path;
+        char separator = '\t';
+        for (size_t task = 0; task < GIT_TASK_COUNT; task++) {
+            if (repo->runs[task] > 0 && TASK_TIMING_NAMES[task][0] != '\0') {
+                out << separator << TASK_TIMING_NAMES[task] << '=' << repo->seconds[task] << '/' << repo->runs[task];
+                separator = ' ';
+            }
+        }
+        out << '\n';
+    }
+    return static_cast<bool>(out);
+}
+
+//--------------------------------------
+// class PlanEstimator
+//--------------------------------------
+// Seconds a task is expected to take on a repo: its own average when it has
+// run there before, otherwise the median for its host, then for all hosts.
+class PlanEstimator
+{
+public:
+    PlanEstimator()
+    {
+        for (const LatencySeries& series : collectLatencySeries()) {
+            medians[{series.host, series.op}] = static_cast<double>(series.summary.p50) / 1e6;
+        }
+    }
+
+    double estimate(const GitRepo& repo, GitTask task, PlanEstimate& source) const
+    {
+        size_t i = static_cast<size_t>(task);
+        if (repo.timings.runs[i] > 0) {
+            source = PlanEstimate::HISTORY;
+            return repo.timings.seconds[i];
+        }
+        double seconds = 0.0;
+        if (!repo.remoteHost.empty() && median(repo.remoteHost, task, seconds)) {
+            source = PlanEstimate::HOST;
+            return seconds;
+        }
+        if (median("", task, seconds)) {
+            source = PlanEstimate::GLOBAL;
+            return seconds;
+        }
+        source = PlanEstimate::DEFAULT;
+        return BATCH_PLAN_DEFAULT_SECONDS;
+    }
+
+private:
+    // A pipelined fast-forward records its fetch and its checkout separately
+    bool median(const std::string& host, GitTask task, double& seconds) const
+    {
+        switch (task) {
+            case GitTask::FETCH:
+                return find(host, LatencyOp::FETCH, seconds);
+            case GitTask::PUSH:
+                return find(host, LatencyOp::PUSH, seconds);
+            case GitTask::FASTFORWARD: {
+                double fetch = 0.0;
+                double checkout = 0.0;
+                bool fetched = find(host, LatencyOp::FETCH, fetch);
+                bool checkedOut = find(host, LatencyOp::FASTFORWARD, checkout);
+                seconds = fetch + checkout;
+                return fetched || checkedOut;
+            }
+            default:
+                return false;
+        }
+    }
+
+    bool find(const std::string& host, LatencyOp op, double& seconds) const
+    {
+        auto it = medians.find({host, op});
+        if (it == medians.end()) {
+            return false;
+        }
+        seconds = it->second;
+        return true;
+    }
+
+    std::map<std::pair<std::string, LatencyOp>, double> medians; // Empty host for all hosts
+};
+
+//--------------------------------------
+// buildBatchPlan()
+//--------------------------------------
+// Dry run of goal over the given rows. Nothing is queued; the plan only reads
+// cached state. Items that run are ordered longest first within the plan,
+// which keeps a long repo from starting last and finishing alone.
+BatchPlan buildBatchPlan(
+    const RepoTable& table, const std::vector<uint32_t>& rows, GitTask goal, bool autoStash,
+    const BatchPlanLanes& lanes)
+{
+    BatchPlan plan;
+    plan.goal = goal;
+    PlanEstimator estimator;
+    std::vector<PlanItem> idle;
+    for (uint32_t row : rows) {
+        const GitRepo& repo = table.repos[row];
+        PlanItem item;
+        item.id = table.ids[row];
+        item.repoPath = repo.repoPath;
+        item.host = repo.remoteHost;
+        item.action = planAction(goal, table.state(row), table.tasks[row], repo.blockedByLocalChanges, autoStash);
+        plan.counts[static_cast<size_t>(item.action)]++;
+        GitTask task = planActionTask(item.action);
+        if (task == GitTask::NONE) {
+            idle.push_back(std::move(item));
+            continue;
+        }
+        item.estimate = estimator.estimate(repo, task, item.source);
+        plan.workSeconds += item.estimate;
+        plan.items.push_back(std::move(item));
+    }
+
+    std::vector<const PlanItem*> order;
+    for (const PlanItem& item : plan.items) {
+        order.push_back(&item);
+    }
+    plan.tableOrderWallSeconds = simulatePlanWallTime(order, lanes);
+
+    std::stable_sort(plan.items.begin(), plan.items.end(), [](const PlanItem& a, const PlanItem& b) {
+        return a.estimate > b.estimate;
+    });
+    order.clear();
+    for (const PlanItem& item : plan.items) {
+        order.push_back(&item);
+    }
+    plan.wallSeconds = simulatePlanWallTime(order, lanes);
+
+    plan.runnable = plan.items.size();
+    for (PlanItem& item : idle) {
+        plan.items.push_back(std::move(item));
+    }
+    return plan;
+}
+
+//--------------------------------------
+// class BatchPlanRunner
+//--------------------------------------
+// Hands a plan's items to the task pool in plan order. Each pool gets no more
+// items than it has lanes, and the next goes out when one finishes, so the
+// order holds instead of being left to whichever worker wakes first on a host
+// slot. Fast-forwards all go out at once since the pipeline queue keeps order.
+// Only touched under the repo table lock.
+class BatchPlanRunner
+{
+public:
+    void start(const BatchPlan& plan, const BatchPlanLanes& planLanes)
+    {
+        entries.clear();
+        bySlot.clear();
+        inFlight.clear();
+        lanes = planLanes;
+        lanes.pipeline = 0;
+        for (size_t i = 0; i < plan.runnable; i++) {
+            const PlanItem& item = plan.items[i];
+            entries.push_back({item.id, planActionTask(item.action), planPool(item)});
+            bySlot[item.id.slot] = entries.size() - 1;
+        }
+        nextEntry = 0;
+        finished = 0;
+        estimatedSeconds = plan.wallSeconds;
+        started = std::chrono::steady_clock::now();
+    }
+
+    // Sets the task of every row whose turn has come and lists the rows in
+    // plan order. Items whose repo went away or got a task of its own are
+    // dropped.
+    void next(RepoTable& table, std::vector<size_t>& rows)
+    {
+        rows.clear();
+        while (nextEntry < entries.size() && entries[nextEntry].phase != Entry::Phase::QUEUED) {
+            nextEntry++;
+        }
+        for (size_t i = nextEntry; i < entries.size(); i++) {
+            Entry& entry = entries[i];
+            if (entry.phase != Entry::Phase::QUEUED) {
+                continue;
+            }
+            uint32_t limit = planPoolLanes(entry.pool, lanes);
+            uint32_t& running = inFlight[entry.pool];
+            if (limit != 0 && running >= limit) {
+                continue;
+            }
+            std::optional<size_t> row = table.find(entry.id);
+            if (!row.has_value() || table.tasks[row.value()] != GitTask::NONE) {
+                entry.phase = Entry::Phase::DONE;
+                finish();
+                continue;
+            }
+            table.tasks[row.value()] = entry.task;
+            entry.phase = Entry::Phase::RUNNING;
+            running++;
+            rows.push_back(row.value());
+        }
+    }
+
+    void completed(const std::vector<RepoTaskResult>& results)
+    {
+        for (const RepoTaskResult& result : results) {
+            auto it = bySlot.find(result.id.slot);
+            if (it == bySlot.end()) {
+                continue;
+            }
+            Entry& entry = entries[it->second];
+            if (entry.id != result.id || entry.phase != Entry::Phase::RUNNING) {
+                continue;
+            }
+            entry.phase = Entry::Phase::DONE;
+            inFlight[entry.pool]--;
+            finish();
+        }
+    }
+
+    bool running() const { return finished < entries.size(); }
+    size_t total() const { return entries.size(); }
+    size_t done() const { return finished; }
+    double estimate() const { return estimatedSeconds; }
+    double elapsed() const
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    }
+
+private:
+    struct Entry
+    {
+        enum class Phase
+        {
+            QUEUED,
+            RUNNING,
+            DONE,
+        };
+
+        RepoId id;
+        GitTask task{GitTask::NONE};
+        std::pair<bool, std::string> pool;
+        Phase phase{Phase::QUEUED};
+    };
+
+    void finish()
+    {
+        if (++finished == entries.size()) {
+            logMessage(
+                LogLevel::LEVEL_INFO,
+                "Batch plan ran %zu tasks in %.1fs (estimated %.1fs)",
+                entries.size(),
+                elapsed(),
+                estimatedSeconds);
+        }
+    }
+
+    std::vector<Entry> entries; // Plan order
+    std::unordered_map<uint32_t, size_t> bySlot;
+    std::map<std::pair<bool, std::string>, uint32_t> inFlight;
+    BatchPlanLanes lanes;
+    size_t nextEntry{0}; // Entries before this one have all left the queue
+    size_t finished{0};
+    double estimatedSeconds{0.0};
+    std::chrono::steady_clock::time_point started;
+};
+
+#endif
@@ -0,0 +1,326 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include "git2.h"
+#include "gitrepo.h"
+#include "branchmatrix.h"
+#include "gitallocator.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+//--------------------------------------
+// struct StatusBenchmarkConfig
+//--------------------------------------
+struct StatusBenchmarkConfig
+{
+    std::string root{""};
+    unsigned threads{16};
+    unsigned sweeps{5};
+};
+
+//--------------------------------------
+// runStatusSweep()
+//--------------------------------------
+// Opens every repo and computes its state on `threads` workers, the same work
+// a rescan does. Returns the wall time in milliseconds.
+double runStatusSweep(const std::vector<std::filesystem::path>& gitDirectories, const std::vector<uint32_t>& tags, unsigned threads)
+{
+    std::atomic<size_t> next{0};
+    auto worker = [&]() {
+        for (size_t i = next++; i < gitDirectories.size(); i = next++) {
+            TraceTaskScope traceScope(tags[i], TracePhase::STATUS);
+            git_repository* repo = nullptr;
+            if (git_repository_open(&repo, gitDirectories[i].string().c_str()) == 0) {
+                getRepoState(repo);
+            }
+            git_repository_free(repo);
+        }
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> workers;
+    for (unsigned t = 0; t < threads; t++) {
+        workers.emplace_back(worker);
+    }
+    for (std::thread& t : workers) {
+        t.join();
+    }
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+//--------------------------------------
+// runSnapshotSweep()
+//--------------------------------------
+// The rescan fast path: reads each repo's refs from disk and only opens the
+// repos whose refs differ from snapshots. Returns the wall time in
+// milliseconds; unchanged counts the repos libgit2 was skipped for.
+double runSnapshotSweep(
+    const std::vector<DiscoveredRepo>& repos,
+    const std::vector<RefSnapshot>& snapshots,
+    const std::vector<uint32_t>& tags,
+    unsigned threads,
+    size_t& unchanged)
+{
+    std::atomic<size_t> next{0};
+    std::atomic<size_t> skipped{0};
+    auto worker = [&]() {
+        for (size_t i = next++; i < repos.size(); i = next++) {
+            TraceTaskScope traceScope(tags[i], TracePhase::STATUS);
+            if (readRefSnapshot(repos[i].gitDirectory, repos[i].commonDirectory) == snapshots[i]) {
+                skipped++;
+                continue;
+            }
+            git_repository* repo = nullptr;
+            if (git_repository_open(&repo, repos[i].openPath.string().c_str()) == 0) {
+                getRepoState(repo);
+            }
+            git_repository_free(repo);
+        }
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> workers;
+    for (unsigned t = 0; t < threads; t++) {
+        workers.emplace_back(worker);
+    }
+    for (std::thread& t : workers) {
+        t.join();
+    }
+    unchanged = skipped;
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+//--------------------------------------
+// runStatusBenchmark()
+//--------------------------------------
+// Runs status sweeps under each allocator mode and prints the median sweep
+// time. Sweeps alternate between modes so drift in the page cache or the
+// machine's load is spread across all of them. When the allocator was not
+// installed only libgit2's own allocator is measured. A warm rescan over the
+// ref snapshot fast path is measured alongside, against the first mode.
+int runStatusBenchmark(const StatusBenchmarkConfig& config)
+{
+    std::vector<DiscoveredRepo> repos = discoverRepos(config.root);
+    if (repos.empty()) {
+        std::cerr << "No repositories found under " << config.root << std::endl;
+        return EXIT_FAILURE;
+    }
+    std::vector<std::filesystem::path> gitDirectories;
+    std::vector<uint32_t> tags;
+    for (const DiscoveredRepo& repo : repos) {
+        gitDirectories.push_back(repo.openPath);
+        tags.push_back(internTraceTag(repoDisplayPath(repo.openPath).string()));
+    }
+
+    std::vector<AllocatorMode> modes;
+    if (gitAllocatorState().installed) {
+        modes = {AllocatorMode::PASSTHROUGH, AllocatorMode::TRACKING, AllocatorMode::POOLED};
+    }
+    AllocatorMode initialMode = gitAllocatorMode();
+
+    printf(
+        "Status sweeps over %zu repos, %u threads, %u sweeps per mode\n",
+        gitDirectories.size(),
+        config.threads,
+        config.sweeps);
+
+    // Warm the page cache so the first mode measured isn't penalized
+    runStatusSweep(gitDirectories, tags, config.threads);
+    std::vector<RefSnapshot> snapshots;
+    for (const DiscoveredRepo& repo : repos) {
+        snapshots.push_back(readRefSnapshot(repo.gitDirectory, repo.commonDirectory));
+    }
+
+    std::vector<std::vector<double>> times(modes.empty() ? 1 : modes.size());
+    std::vector<double> snapshotTimes;
+    size_t unchanged = 0;
+    for (unsigned sweep = 0; sweep < config.sweeps; sweep++) {
+        for (size_t m = 0; m < times.size(); m++) {
+            if (!modes.empty()) {
+                setGitAllocatorMode(modes[m]);
+            }
+            times[m].push_back(runStatusSweep(gitDirectories, tags, config.threads));
+        }
+        if (!modes.empty()) {
+            setGitAllocatorMode(modes[0]);
+        }
+        snapshotTimes.push_back(runSnapshotSweep(repos, snapshots, tags, config.threads, unchanged));
+    }
+
+    for (size_t m = 0; m < times.size(); m++) {
+        std::sort(times[m].begin(), times[m].end());
+        printf(
+            "  %-12s median %8.1f ms  min %8.1f ms  max %8.1f ms\n",
+            modes.empty() ? "system" : AllocatorModeToString(modes[m]),
+            times[m][times[m].size() / 2],
+            times[m].front(),
+            times[m].back());
+    }
+    std::sort(snapshotTimes.begin(), snapshotTimes.end());
+    double snapshotMedian = snapshotTimes[snapshotTimes.size() / 2];
+    printf(
+        "  %-12s median %8.1f ms  min %8.1f ms  max %8.1f ms  (%.1fx, %zu of %zu repos not opened)\n",
+        "snapshot",
+        snapshotMedian,
+        snapshotTimes.front(),
+        snapshotTimes.back(),
+        snapshotMedian > 0.0 ? times[0][times[0].size() / 2] / snapshotMedian : 0.0,
+        unchanged,
+        repos.size());
+    if (!modes.empty()) {
+        AllocationStats status = operationAllocationStats(TracePhase::STATUS);
+        printf(
+            "  %s allocated in %llu allocations during tracked sweeps, pool hit rate %.1f%%\n",
+            formatBytes(status.totalBytes).c_str(),
+            static_cast<unsigned long long>(status.allocations),
+            poolHitRate() * 100.0);
+        setGitAllocatorMode(initialMode);
+    }
+    return EXIT_SUCCESS;
+}
+
+//--------------------------------------
+// countExclusiveCommits()
+//--------------------------------------
+// Number of commits reachable from `from` but not from `other`, the count
+// 'git rev-list --count other..from' gives. Everything reachable from `other`
+// is marked first, so unlike the date-ordered walks the answer does not
+// depend on commit dates; it loads all history and only referees branches
+// where the two walks disagree.
+bool countExclusiveCommits(git_repository* repo, const git_oid& from, const git_oid& other, uint32_t& count)
+{
+    std::unordered_set<git_oid, OidHash, OidEqual> reachable;
+    auto mark = [&](const git_oid& tip, bool counting) {
+        std::vector<git_oid> pending{tip};
+        while (!pending.empty()) {
+            git_oid oid = pending.back();
+            pending.pop_back();
+            if (!reachable.insert(oid).second) {
+                continue;
+            }
+            git_commit* commit = nullptr;
+            if (git_commit_lookup(&commit, repo, &oid) != 0) {
+                return false;
+            }
+            for (unsigned int p = 0; p < git_commit_parentcount(commit); p++) {
+                pending.push_back(*git_commit_parent_id(commit, p));
+            }
+            git_commit_free(commit);
+            count += counting ? 1 : 0;
+        }
+        return true;
+    };
+    count = 0;
+    return mark(other, false) && mark(from, true);
+}
+
+//--------------------------------------
+// runBranchMatrixBenchmark()
+//--------------------------------------
+// Times the branch matrix of one repo computed in a single shared walk
+// against one git_graph_ahead_behind() per branch. Every run opens the repo
+// afresh so neither starts with a warm object cache, and runs alternate which
+// goes first. Branches where the two disagree are counted exactly, and the
+// benchmark fails if the shared walk is wrong for any of them.
+int runBranchMatrixBenchmark(const std::string& repoPath)
+{
+    std::vector<double> batched;
+    std::vector<double> perBranch;
+    BranchMatrix shared;
+    BranchMatrix reference;
+    for (int run = 0; run < BRANCH_MATRIX_BENCHMARK_RUNS; run++) {
+        for (bool batch : {run % 2 == 0, run % 2 != 0}) {
+            git_repository* repo = nullptr;
+            if (git_repository_open(&repo, repoPath.c_str()) != 0) {
+                std::cerr << "Error opening " << repoPath << ": " << git_error_last()->message << std::endl;
+                return EXIT_FAILURE;
+            }
+            BranchMatrix& matrix = batch ? shared : reference;
+            matrix = batch ? computeBranchMatrix(repo) : computeBranchMatrixPerBranch(repo);
+            git_repository_free(repo);
+            if (!matrix.error.empty()) {
+                std::cerr << "Error computing branch matrix: " << matrix.error << std::endl;
+                return EXIT_FAILURE;
+            }
+            (batch ? batched : perBranch).push_back(matrix.elapsedMs);
+        }
+    }
+
+    if (shared.branches.size() != reference.branches.size()) {
+        std::cerr << "Shared walk found " << shared.branches.size() << " tracked branches, per branch found "
+                  << reference.branches.size() << std::endl;
+        return EXIT_FAILURE;
+    }
+    std::unordered_map<std::string, const BranchStatus*> referenceByName;
+    for (const BranchStatus& branch : reference.branches) {
+        referenceByName.emplace(branch.name, &branch);
+    }
+
+    git_repository* repo = nullptr;
+    if (git_repository_open(&repo, repoPath.c_str()) != 0) {
+        std::cerr << "Error opening " << repoPath << ": " << git_error_last()->message << std::endl;
+        return EXIT_FAILURE;
+    }
+    size_t mismatches = 0;
+    size_t wrong = 0;
+    for (const BranchStatus& a : shared.branches) {
+        auto found = referenceByName.find(a.name);
+        if (found == referenceByName.end()) {
+            std::cerr << "Branch " << a.name << " is missing from the per-branch matrix" << std::endl;
+            git_repository_free(repo);
+            return EXIT_FAILURE;
+        }
+        const BranchStatus& b = *found->second;
+        if (a.ahead == b.ahead && a.behind == b.behind) {
+            continue;
+        }
+        uint32_t ahead = 0;
+        uint32_t behind = 0;
+        if (!countExclusiveCommits(repo, a.local, a.remote, ahead) ||
+            !countExclusiveCommits(repo, a.remote, a.local, behind)) {
+            std::cerr << "Error counting " << a.name << ": " << git_error_last()->message << std::endl;
+            git_repository_free(repo);
+            return EXIT_FAILURE;
+        }
+        bool sharedWrong = a.ahead != ahead || a.behind != behind;
+        printf(
+            "  %s: %u/%u shared walk, %u/%u per branch, %u/%u exact%s\n",
+            a.name.c_str(),
+            a.ahead,
+            a.behind,
+            b.ahead,
+            b.behind,
+            ahead,
+            behind,
+            sharedWrong ? "  <- shared walk wrong" : "");
+        mismatches++;
+        wrong += sharedWrong ? 1 : 0;
+    }
+    git_repository_free(repo);
+
+    std::sort(batched.begin(), batched.end());
+    std::sort(perBranch.begin(), perBranch.end());
+    double batchedMedian = batched[batched.size() / 2];
+    double perBranchMedian = perBranch[perBranch.size() / 2];
+    printf("Branch matrix of %zu tracked branches, %d runs\n", shared.branches.size(), BRANCH_MATRIX_BENCHMARK_RUNS);
+    printf("  per branch   median %8.1f ms\n", perBranchMedian);
+    printf(
+        "  shared walk  median %8.1f ms  (%.1fx, %zu commits loaded)\n",
+        batchedMedian,
+        batchedMedian > 0.0 ? perBranchMedian / batchedMedian : 0.0,
+        shared.walkedCommits);
+    printf("  %zu branches differ, shared walk wrong for %zu\n", mismatches, wrong);
+    return wrong == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+#endif
@@ -0,0 +1,554 @@
+#ifndef BRANCH_MATRIX_H
+#define BRANCH_MATRIX_H
+
+#include "git2.h"
+#include "gitrepo.h"
+#include "repotable.h"
+#include "tasktrace.h"
+#include "logsink.h"
+
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <queue>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+constexpr int BRANCH_MATRIX_BENCHMARK_RUNS = 5;
+constexpr int BRANCH_MATRIX_WALK_SLOP = 5; // Commits walked past the early stop, as git's own SLOP
+
+//--------------------------------------
+// struct BranchStatus
+//--------------------------------------
+struct BranchStatus
+{
+    std::string name{""};     // Local branch shorthand
+    std::string upstream{""}; // Upstream shorthand
+    git_oid local{};
+    git_oid remote{};
+    uint32_t ahead{0};
+    uint32_t behind{0};
+    GitState state{GitState::NONE};
+};
+
+//--------------------------------------
+// struct BranchMatrix
+//--------------------------------------
+// Ahead/behind of every local branch with an upstream.
+struct BranchMatrix
+{
+    std::vector<BranchStatus> branches;
+    size_t walkedCommits{0};
+    double elapsedMs{0.0};
+    std::string error{""};
+};
+
+//--------------------------------------
+// struct OidHash
+//--------------------------------------
+struct OidHash
+{
+    size_t operator()(const git_oid& oid) const
+    {
+        size_t hash;
+        std::memcpy(&hash, oid.id, sizeof(hash));
+        return hash;
+    }
+};
+
+//--------------------------------------
+// struct OidEqual
+//--------------------------------------
+struct OidEqual
+{
+    bool operator()(const git_oid& a, const git_oid& b) const { return git_oid_equal(&a, &b) != 0; }
+};
+
+//--------------------------------------
+// upstreamRefName()
+//--------------------------------------
+// Remote-tracking ref a branch's 'merge' maps to through its remote's fetch
+// refspecs, or the merge ref itself for remote ".". Empty if none matches.
+std::string upstreamRefName(git_remote* remote, const std::string& merge)
+{
+    if (remote == nullptr) {
+        return merge;
+    }
+    for (size_t i = 0; i < git_remote_refspec_count(remote); i++) {
+        const git_refspec* spec = git_remote_get_refspec(remote, i);
+        if (git_refspec_direction(spec) != GIT_DIRECTION_FETCH || !git_refspec_src_matches(spec, merge.c_str())) {
+            continue;
+        }
+        git_buf name = GIT_BUF_INIT;
+        std::string upstream;
+        if (git_refspec_transform(&name, spec, merge.c_str()) == 0) {
+            upstream = name.ptr;
+        }
+        git_buf_dispose(&name);
+        return upstream;
+    }
+    return "";
+}
+
+//--------------------------------------
+// listTrackedBranches()
+//--------------------------------------
+// Local branches whose upstream resolves, with both tips filled in. Upstreams
+// are resolved from one config snapshot and one lookup per remote;
+// git_branch_upstream() rereads the config for every branch, which dominates
+// on repos with hundreds of branches.
+bool listTrackedBranches(git_repository* repo, std::vector<BranchStatus>& branches, std::string& error)
+{
+    git_config* config = nullptr;
+    git_branch_iterator* it = nullptr;
+    if (git_repository_config_snapshot(&config, repo) != 0 || git_branch_iterator_new(&it, repo, GIT_BRANCH_LOCAL) != 0) {
+        error = git_error_last()->message;
+        git_config_free(config);
+        return false;
+    }
+
+    std::unordered_map<std::string, git_remote*> remotes;
+    git_reference* ref = nullptr;
+    git_branch_t type;
+    while (git_branch_next(&ref, &type, it) == 0) {
+        BranchStatus branch;
+        branch.name = git_reference_shorthand(ref);
+        git_buf remoteName = GIT_BUF_INIT;
+        git_buf merge = GIT_BUF_INIT;
+        std::string prefix = "branch." + branch.name;
+        bool tracked = git_reference_target(ref) != nullptr
+                       && git_config_get_string_buf(&remoteName, config, (prefix + ".remote").c_str()) == 0
+                       && git_config_get_string_buf(&merge, config, (prefix + ".merge").c_str()) == 0;
+        std::string upstream;
+        if (tracked) {
+            git_remote* remote = nullptr;
+            if (std::string(remoteName.ptr) != ".") {
+                auto found = remotes.find(remoteName.ptr);
+                if (found == remotes.end()) {
+                    git_remote_lookup(&remote, repo, remoteName.ptr);
+                    found = remotes.emplace(remoteName.ptr, remote).first;
+                }
+                remote = found->second;
+                tracked = remote != nullptr;
+            }
+            upstream = tracked ? upstreamRefName(remote, merge.ptr) : "";
+        }
+        git_buf_dispose(&remoteName);
+        git_buf_dispose(&merge);
+
+        if (!upstream.empty() && git_reference_name_to_id(&branch.remote, repo, upstream.c_str()) == 0) {
+            for (const char* refPrefix : {"refs/remotes/", "refs/heads/"}) {
+                if (upstream.compare(0, std::strlen(refPrefix), refPrefix) == 0) {
+                    upstream.erase(0, std::strlen(refPrefix));
+                    break;
+                }
+            }
+            branch.upstream = upstream;
+            git_oid_cpy(&branch.local, git_reference_target(ref));
+            branches.push_back(std::move(branch));
+        }
+        git_reference_free(ref);
+    }
+
+    for (auto& [name, remote] : remotes) {
+        git_remote_free(remote);
+    }
+    git_branch_iterator_free(it);
+    git_config_free(config);
+    return true;
+}
+
+//--------------------------------------
+// class AheadBehindWalk
+//--------------------------------------
+// Ahead/behind for many branch/upstream pairs in one history walk, instead of
+// one git_graph_ahead_behind() walk per pair. Pair i owns bit 2i for its
+// branch and bit 2i+1 for its upstream; commits are visited newest first and
+// pass the bits that reach them on to their parents. A commit counts as ahead
+// for a pair when only the branch bit reaches it, behind when only the
+// upstream bit does. The walk stops once every queued commit has both or
+// neither bit of each pair, the point git_graph_ahead_behind() stops at for a
+// single pair, so history below every merge base is never loaded and history
+// shared between pairs is loaded once.
+//
+// Commit dates order the walk, as in git's own merge-base search. A commit
+// reached again after skewed dates let the walk pass it is recounted from its
+// new bits. The early stop is only exact while dates never increase from a
+// commit to its parents, so once the walk meets a parent dated after its
+// child it goes on to the end of history instead. BRANCH_MATRIX_WALK_SLOP
+// commits are still walked after the early stop, like rev-list, so skew just
+// below the stop point is seen too.
+class AheadBehindWalk
+{
+public:
+    explicit AheadBehindWalk(git_repository* repo) : repo(repo) { git_repository_odb(&odb, repo); }
+    ~AheadBehindWalk() { git_odb_free(odb); }
+    AheadBehindWalk(const AheadBehindWalk&) = delete;
+    AheadBehindWalk& operator=(const AheadBehindWalk&) = delete;
+
+    bool run(std::vector<BranchStatus>& branches, std::string& error)
+    {
+        std::vector<size_t> pairOf(branches.size(), SIZE_MAX);
+        for (size_t i = 0; i < branches.size(); i++) {
+            if (!git_oid_equal(&branches[i].local, &branches[i].remote)) {
+                pairOf[i] = pairs.size();
+                pairs.push_back({0, 0});
+            }
+        }
+        words = (pairs.size() * 2 + 63) / 64;
+        for (size_t i = 0; i < branches.size(); i++) {
+            if (pairOf[i] == SIZE_MAX) {
+                continue;
+            }
+            for (size_t side = 0; side < 2; side++) {
+                std::optional<uint32_t> index = node(side == 0 ? branches[i].local : branches[i].remote, error);
+                if (!index.has_value()) {
+                    return false;
+                }
+                size_t bit = pairOf[i] * 2 + side;
+                bits[index.value() * words + bit / 64] |= uint64_t(1) << (bit % 64);
+                enqueue(index.value());
+            }
+        }
+
+        int slop = BRANCH_MATRIX_WALK_SLOP;
+        while (!queue.empty() && (unbalancedQueued > 0 || slop > 0 || skewed)) {
+            slop = unbalancedQueued > 0 ? BRANCH_MATRIX_WALK_SLOP : slop - 1;
+            uint32_t index = queue.top().second;
+            queue.pop();
+            nodes[index].queued = false;
+            if (nodes[index].unbalanced) {
+                unbalancedQueued--;
+            }
+            count(index);
+
+            // node() grows nodes and bits, so both are indexed afresh each time
+            for (size_t p = 0; p < nodes[index].parents.size(); p++) {
+                git_oid parentId = nodes[index].parents[p];
+                std::optional<uint32_t> parent = node(parentId, error);
+                if (!parent.has_value()) {
+                    return false;
+                }
+                bool changed = false;
+                for (size_t w = 0; w < words; w++) {
+                    uint64_t merged = bits[parent.value() * words + w] | bits[static_cast<size_t>(index) * words + w];
+                    changed |= merged != bits[parent.value() * words + w];
+                    bits[parent.value() * words + w] = merged;
+                }
+                if (changed) {
+                    enqueue(parent.value());
+                }
+                skewed |= nodes[parent.value()].time > nodes[index].time;
+            }
+        }
+
+        for (size_t i = 0; i < branches.size(); i++) {
+            branches[i].ahead = pairOf[i] == SIZE_MAX ? 0 : pairs[pairOf[i]].ahead;
+            branches[i].behind = pairOf[i] == SIZE_MAX ? 0 : pairs[pairOf[i]].behind;
+            branches[i].state = gitStateFromAheadBehind(branches[i].ahead, branches[i].behind);
+        }
+        return true;
+    }
+
+    size_t walked() const { return nodes.size(); }
+
+private:
+    static constexpr uint64_t BRANCH_BITS = 0x5555555555555555ull; // Even bits; upstream bits are odd
+
+    struct Node
+    {
+        std::vector<git_oid> parents;
+        int64_t time{0};
+        bool queued{false};
+        bool unbalanced{false};
+    };
+
+    struct Pair
+    {
+        uint32_t ahead;
+        uint32_t behind;
+    };
+
+    // Branch bits of pairs reached from the branch only, and from the upstream only
+    static uint64_t aheadBits(uint64_t set) { return set & ~(set >> 1) & BRANCH_BITS; }
+    static uint64_t behindBits(uint64_t set) { return (set >> 1) & ~set & BRANCH_BITS; }
+
+    // Parents and committer time from a raw commit. Only the header is read,
+    // which skips the full parse and object cache of git_commit_lookup().
+    static bool parseCommitHeader(std::string_view data, Node& node)
+    {
+        while (!data.empty() && data[0] != '\n') {
+            size_t end = data.find('\n');
+            std::string_view line = data.substr(0, end);
+            data = end == std::string_view::npos ? std::string_view() : data.substr(end + 1);
+            if (line.compare(0, 7, "parent ") == 0) {
+                git_oid parent;
+                if (line.size() < 7 + GIT_OID_HEXSZ || git_oid_fromstrn(&parent, line.data() + 7, GIT_OID_HEXSZ) != 0) {
+                    return false;
+                }
+                node.parents.push_back(parent);
+            }
+            else if (line.compare(0, 10, "committer ") == 0) {
+                // "committer <name> <<email>> <time> <zone>"
+                size_t email = line.rfind('>');
+                if (email == std::string_view::npos) {
+                    return false;
+                }
+                node.time = std::strtoll(std::string(line.substr(email + 1)).c_str(), nullptr, 10);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Loads a commit the first time it is reached.
+    std::optional<uint32_t> node(const git_oid& oid, std::string& error)
+    {
+        auto it = indices.find(oid);
+        if (it != indices.end()) {
+            return it->second;
+        }
+        git_odb_object* object = nullptr;
+        Node added;
+        if (git_odb_read(&object, odb, &oid) != 0 || git_odb_object_type(object) != GIT_OBJECT_COMMIT
+            || !parseCommitHeader(
+                std::string_view(static_cast<const char*>(git_odb_object_data(object)), git_odb_object_size(object)),
+                added)) {
+            const git_error* e = git_error_last();
+            error = std::string("Error reading commit ") + git_oid_tostr_s(&oid) + (e && e->message ? ": " + std::string(e->message) : "");
+            git_odb_object_free(object);
+            return std::nullopt;
+        }
+        git_odb_object_free(object);
+
+        uint32_t index = static_cast<uint32_t>(nodes.size());
+        nodes.push_back(std::move(added));
+        bits.resize(bits.size() + words, 0);
+        counted.resize(counted.size() + words, 0);
+        indices.emplace(oid, index);
+        return index;
+    }
+
+    void enqueue(uint32_t index)
+    {
+        bool unbalanced = false;
+        for (size_t w = 0; w < words && !unbalanced; w++) {
+            uint64_t set = bits[static_cast<size_t>(index) * words + w];
+            unbalanced = ((set ^ (set >> 1)) & BRANCH_BITS) != 0;
+        }
+        Node& entry = nodes[index];
+        if (entry.queued) {
+            unbalancedQueued = unbalancedQueued + unbalanced - entry.unbalanced;
+        }
+        else {
+            entry.queued = true;
+            queue.emplace(entry.time, index);
+            unbalancedQueued += unbalanced;
+        }
+        entry.unbalanced = unbalanced;
+    }
+
+    // Adds the commit's contribution for its current bits, less whatever was
+    // counted for it on an earlier visit.
+    void count(uint32_t index)
+    {
+        for (size_t w = 0; w < words; w++) {
+            uint64_t set = bits[static_cast<size_t>(index) * words + w];
+            uint64_t& previous = counted[static_cast<size_t>(index) * words + w];
+            for (uint64_t gained = aheadBits(set) & ~aheadBits(previous); gained != 0; gained &= gained - 1) {
+                pairs[(w * 64 + std::countr_zero(gained)) / 2].ahead++;
+            }
+            for (uint64_t lost = aheadBits(previous) & ~aheadBits(set); lost != 0; lost &= lost - 1) {
+                pairs[(w * 64 + std::countr_zero(lost)) / 2].ahead--;
+            }
+            for (uint64_t gained = behindBits(set) & ~behindBits(previous); gained != 0; gained &= gained - 1) {
+                pairs[(w * 64 + std::countr_zero(gained)) / 2].behind++;
+            }
+            for (uint64_t lost = behindBits(previous) & ~behindBits(set); lost != 0; lost &= lost - 1) {
+                pairs[(w * 64 + std::countr_zero(lost)) / 2].behind--;
+            }
+            previous = set;
+        }
+    }
+
+    git_repository* repo;
+    git_odb* odb{nullptr};
+    size_t words{0};
+    std::vector<Pair> pairs;
+    std::vector<Node> nodes;
+    std::vector<uint64_t> bits;    // words per node: pair bits that reach it
+    std::vector<uint64_t> counted; // words per node: bits it was last counted with
+    std::unordered_map<git_oid, uint32_t, OidHash, OidEqual> indices;
+    std::priority_queue<std::pair<int64_t, uint32_t>> queue; // Newest first
+    size_t unbalancedQueued{0};
+    bool skewed{false};
+};
+
+//--------------------------------------
+// computeBranchMatrix()
+//--------------------------------------
+BranchMatrix computeBranchMatrix(git_repository* repo)
+{
+    TraceSpan span(TracePhase::STATUS);
+    auto start = std::chrono::steady_clock::now();
+    BranchMatrix matrix;
+    if (listTrackedBranches(repo, matrix.branches, matrix.error)) {
+        AheadBehindWalk walk(repo);
+        if (!walk.run(matrix.branches, matrix.error)) {
+            matrix.branches.clear();
+        }
+        matrix.walkedCommits = walk.walked();
+    }
+    matrix.elapsedMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    return matrix;
+}
+
+//--------------------------------------
+// computeBranchMatrixPerBranch()
+//--------------------------------------
+// Reference implementation: one git_graph_ahead_behind() per branch.
+BranchMatrix computeBranchMatrixPerBranch(git_repository* repo)
+{
+    auto start = std::chrono::steady_clock::now();
+    BranchMatrix matrix;
+    if (listTrackedBranches(repo, matrix.branches, matrix.error)) {
+        for (BranchStatus& branch : matrix.branches) {
+            size_t ahead = 0, behind = 0;
+            if (git_graph_ahead_behind(&ahead, &behind, repo, &branch.local, &branch.remote) != 0) {
+                matrix.error = git_error_last()->message;
+                matrix.branches.clear();
+                break;
+            }
+            branch.ahead = static_cast<uint32_t>(ahead);
+            branch.behind = static_cast<uint32_t>(behind);
+            branch.state = gitStateFromAheadBehind(ahead, behind);
+        }
+    }
+    matrix.elapsedMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    return matrix;
+}
+
+//--------------------------------------
+// class BranchMatrices
+//--------------------------------------
+// Branch matrices computed on request for individual repos, off the UI
+// thread. Each computation opens its own handle so it can't race a task on
+// the repo's shared one. Finished workers are joined when the next starts,
+// and stop() waits for the rest before libgit2 shuts down.
+class BranchMatrices
+{
+public:
+    ~BranchMatrices() { stop(); }
+
+    void request(RepoId id, const std::filesystem::path& repoPath, uint32_t traceTag)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        Entry& entry = entries[id.slot];
+        if (entry.id == id && entry.pending) {
+            return;
+        }
+        entry = {id, true, std::nullopt};
+        reapWorkers();
+        auto finished = std::make_shared<std::atomic<bool>>(false);
+        std::thread thread([this, id, repoPath, traceTag, finished]() {
+            TraceTaskScope traceScope(traceTag, TracePhase::STATUS);
+            BranchMatrix matrix;
+            git_repository* repo = nullptr;
+            if (git_repository_open(&repo, repoPath.string().c_str()) == 0) {
+                matrix = computeBranchMatrix(repo);
+            }
+            else {
+                matrix.error = git_error_last()->message;
+            }
+            git_repository_free(repo);
+
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                auto it = entries.find(id.slot);
+                if (it != entries.end() && it->second.id == id) {
+                    it->second.pending = false;
+                    it->second.matrix = std::move(matrix);
+                }
+            }
+            *finished = true;
+        });
+        workers.push_back({std::move(thread), finished});
+    }
+
+    // Waits for every running computation.
+    void stop()
+    {
+        std::vector<Worker> joining;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            joining = std::move(workers);
+            workers.clear();
+        }
+        for (Worker& worker : joining) {
+            worker.thread.join();
+        }
+    }
+
+    bool pending(RepoId id)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        auto it = entries.find(id.slot);
+        return it != entries.end() && it->second.id == id && it->second.pending;
+    }
+
+    std::optional<BranchMatrix> get(RepoId id)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        auto it = entries.find(id.slot);
+        if (it == entries.end() || it->second.id != id) {
+            return std::nullopt;
+        }
+        return it->second.matrix;
+    }
+
+private:
+    struct Entry
+    {
+        RepoId id;
+        bool pending{false};
+        std::optional<BranchMatrix> matrix;
+    };
+
+    struct Worker
+    {
+        std::thread thread;
+        std::shared_ptr<std::atomic<bool>> finished;
+    };
+
+    // Caller holds lock.
+    void reapWorkers()
+    {
+        for (size_t i = 0; i < workers.size();) {
+            if (*workers[i].finished) {
+                workers[i].thread.join();
+                workers[i] = std::move(workers.back());
+                workers.pop_back();
+            }
+            else {
+                i++;
+            }
+        }
+    }
+
+    std::mutex lock;
+    std::unordered_map<uint32_t, Entry> entries; // By slot
+    std::vector<Worker> workers;
+};
+
+#endif
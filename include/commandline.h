@@ -0,0 +1,290 @@
+#ifndef COMMAND_LINE_H
+#define COMMAND_LINE_H
+
+#include "loopbackserver.h"
+#include "logsink.h"
+#include "gitallocator.h"
+#include "benchmark.h"
+#include "credentialstore.h"
+#include "fastforwardpipeline.h"
+#include "maintenance.h"
+#include "sharedobjects.h"
+
+#include <cstdlib>
+#include <iostream>
+#include <optional>
+#include <stdexcept>
+#include <string>
+
+//--------------------------------------
+// struct CommandLineOptions
+//--------------------------------------
+struct CommandLineOptions
+{
+    std::optional<LoopbackServerConfig> loopbackServer; // --serve <dir>: run headless as a test server
+    std::optional<std::string> traceFile;               // --trace <file>: dump spans as Chrome trace JSON on exit
+    std::optional<LogLevel> logLevel;                   // --log-level <level>: capture level of the log pane
+    bool libgit2Trace{false};                           // --libgit2-trace: route libgit2 tracing into the log
+    std::optional<std::string> metricsFile;             // --metrics <file>: write latency percentiles as CSV on exit
+    std::optional<AllocatorMode> allocatorMode;         // --allocator <mode>: empty keeps libgit2's own
+    std::optional<StatusBenchmarkConfig> statusBenchmark; // --bench-status <dir>: time status sweeps and exit
+    std::optional<std::string> branchBenchmark;           // --bench-branches <repo>: time the branch matrix and exit
+    std::optional<MaintenanceConfig> maintenance;         // --maintain <dir>: write pack indexes and exit
+    std::optional<SharedObjectsConfig> sharedObjects;     // --share-objects <dir>: report duplicate objects and exit
+    std::optional<Credential> credential;                 // --credential-env <var>: in-memory store instead of the system one
+    uint32_t fastForwardNetworkWorkers{FAST_FORWARD_NETWORK_WORKERS}; // --ff-network-workers <n>
+    uint32_t fastForwardDiskWorkers{FAST_FORWARD_DISK_WORKERS};       // --ff-disk-workers <n>
+    bool fastForwardSubmodules{false};                                // --ff-submodules
+    bool fastForwardAutoStash{false};                                 // --ff-autostash
+    uint32_t fetchesPerHost{FETCHES_PER_HOST};                        // --fetches-per-host <n>
+    bool valid{true};
+};
+
+//--------------------------------------
+// printUsage()
+//--------------------------------------
+void printUsage()
+{
+    std::cout << "Usage: GitRepoManager [options]\n"
+                 "  --trace <file>           Write task spans as Chrome trace-event JSON to <file> on exit\n"
+                 "  --log-level <level>      off, error, warning, info, debug or trace (default: warning)\n"
+                 "  --libgit2-trace          Capture libgit2's internal trace output in the log\n"
+                 "  --metrics <file>         Write per-operation latency percentiles as CSV to <file> on exit\n"
+                 "  --allocator <mode>       system, passthrough, tracking or pooled (default: system)\n"
+                 "  --credential-env <var>   Use the user:pass in environment variable <var> for every host instead of\n"
+                 "                           the system store; kept out of argv so it doesn't show in process lists\n"
+                 "  --ff-network-workers <n> Concurrent fetches in a mass fast-forward (default: 8)\n"
+                 "  --ff-disk-workers <n>    Concurrent checkouts in a mass fast-forward (default: 2)\n"
+                 "  --ff-submodules          Also update submodules, recursively, when fast-forwarding\n"
+                 "  --ff-autostash           Stash local changes that block a fast-forward and re-apply them after\n"
+                 "  --fetches-per-host <n>   Concurrent fetches against one remote host (default: 8)\n"
+                 "  --bench-status <dir>     Time status sweeps under <dir>, per allocator mode with --allocator\n"
+                 "    --bench-threads <n>    Worker threads per sweep (default: 16)\n"
+                 "    --bench-sweeps <n>     Sweeps per allocator mode (default: 5)\n"
+                 "  --bench-branches <repo>  Time the ahead/behind matrix of every tracked branch in <repo>\n"
+                 "  --maintain <dir>         Write multi-pack-index and commit-graph files for the repos under <dir>\n"
+                 "    --maintain-packs <n>   Packs before a multi-pack-index is written (default: 16)\n"
+                 "  --share-objects <dir>    Report object storage duplicated by clones of the same origin under <dir>\n"
+                 "    --share-objects-apply  Move each group onto a shared object store through alternates\n"
+                 "  --serve <dir>            Serve the bare repos under <dir> over smart HTTP on 127.0.0.1\n"
+                 "    --port <n>             Port to listen on (default: any free port)\n"
+                 "    --latency-ms <n>       Delay added before every response\n"
+                 "    --bandwidth-kbps <n>   Per-connection bandwidth limit in KiB/s\n"
+                 "    --auth <user:pass>     Require HTTP Basic credentials\n"
+                 "    --fail-rate <f>        Probability [0, 1] of injecting a failure into a request\n"
+                 "    --fail-modes <list>    Comma separated subset of 500,disconnect,truncate\n"
+                 "    --seed <n>             Seed for failure injection\n"
+              << std::flush;
+}
+
+//--------------------------------------
+// parseCommandLine()
+//--------------------------------------
+CommandLineOptions parseCommandLine(int argc, char** argv)
+{
+    CommandLineOptions options;
+    LoopbackServerConfig serverConfig;
+    bool serve = false;
+    StatusBenchmarkConfig benchmarkConfig;
+    bool benchmark = false;
+    MaintenanceConfig maintenanceConfig;
+    bool maintain = false;
+    SharedObjectsConfig sharedObjectsConfig;
+    bool shareObjects = false;
+
+    for (int i = 1; i < argc && options.valid; i++) {
+        std::string arg = argv[i];
+        auto value = [&]() -> std::string {
+            if (i + 1 >= argc) {
+                std::cerr << "Missing value for " << arg << std::endl;
+                options.valid = false;
+                return "";
+            }
+            return argv[++i];
+        };
+
+        try {
+            if (arg == "--trace") {
+                options.traceFile = value();
+            }
+            else if (arg == "--log-level") {
+                std::string level = value();
+                for (LogLevel candidate :
+                     {LogLevel::LEVEL_NONE, LogLevel::LEVEL_ERROR, LogLevel::LEVEL_WARN, LogLevel::LEVEL_INFO, LogLevel::LEVEL_DEBUG, LogLevel::LEVEL_TRACE}) {
+                    std::string name = LogLevelToString(candidate);
+                    std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) { return std::tolower(c); });
+                    if (name == level) {
+                        options.logLevel = candidate;
+                    }
+                }
+                if (!options.logLevel.has_value()) {
+                    throw std::invalid_argument(level);
+                }
+            }
+            else if (arg == "--libgit2-trace") {
+                options.libgit2Trace = true;
+            }
+            else if (arg == "--metrics") {
+                options.metricsFile = value();
+            }
+            else if (arg == "--allocator") {
+                std::string mode = value();
+                options.allocatorMode = parseAllocatorMode(mode);
+                if (!options.allocatorMode.has_value() && mode != "system") {
+                    throw std::invalid_argument(mode);
+                }
+            }
+            else if (arg == "--credential-env") {
+                std::string variable = value();
+                const char* set = std::getenv(variable.c_str());
+                std::string credential = set == nullptr ? "" : set;
+                size_t colon = credential.find(':');
+                if (colon == std::string::npos) {
+                    secureClear(credential);
+                    throw std::invalid_argument("");
+                }
+                options.credential = Credential(credential.substr(0, colon), credential.substr(colon + 1));
+                secureClear(credential);
+            }
+            else if (arg == "--ff-network-workers") {
+                options.fastForwardNetworkWorkers = static_cast<uint32_t>(std::stoul(value()));
+                if (options.fastForwardNetworkWorkers == 0) {
+                    throw std::invalid_argument("0");
+                }
+            }
+            else if (arg == "--ff-disk-workers") {
+                options.fastForwardDiskWorkers = static_cast<uint32_t>(std::stoul(value()));
+                if (options.fastForwardDiskWorkers == 0) {
+                    throw std::invalid_argument("0");
+                }
+            }
+            else if (arg == "--ff-submodules") {
+                options.fastForwardSubmodules = true;
+            }
+            else if (arg == "--ff-autostash") {
+                options.fastForwardAutoStash = true;
+            }
+            else if (arg == "--fetches-per-host") {
+                options.fetchesPerHost = static_cast<uint32_t>(std::stoul(value()));
+                if (options.fetchesPerHost == 0) {
+                    throw std::invalid_argument("0");
+                }
+            }
+            else if (arg == "--bench-status") {
+                benchmark = true;
+                benchmarkConfig.root = value();
+            }
+            else if (arg == "--bench-threads") {
+                benchmarkConfig.threads = static_cast<unsigned>(std::stoul(value()));
+                if (benchmarkConfig.threads == 0) {
+                    throw std::invalid_argument("0");
+                }
+            }
+            else if (arg == "--bench-sweeps") {
+                benchmarkConfig.sweeps = static_cast<unsigned>(std::stoul(value()));
+                if (benchmarkConfig.sweeps == 0) {
+                    throw std::invalid_argument("0");
+                }
+            }
+            else if (arg == "--bench-branches") {
+                options.branchBenchmark = value();
+            }
+            else if (arg == "--maintain") {
+                maintain = true;
+                maintenanceConfig.root = value();
+            }
+            else if (arg == "--maintain-packs") {
+                maintenanceConfig.packThreshold = std::stoull(value());
+            }
+            else if (arg == "--share-objects") {
+                shareObjects = true;
+                sharedObjectsConfig.root = value();
+            }
+            else if (arg == "--share-objects-apply") {
+                sharedObjectsConfig.apply = true;
+            }
+            else if (arg == "--serve") {
+                serve = true;
+                serverConfig.root = value();
+            }
+            else if (arg == "--port") {
+                unsigned long port = std::stoul(value());
+                if (port > UINT16_MAX) {
+                    throw std::out_of_range(std::to_string(port));
+                }
+                serverConfig.port = static_cast<uint16_t>(port);
+            }
+            else if (arg == "--latency-ms") {
+                serverConfig.latencyMs = static_cast<uint32_t>(std::stoul(value()));
+            }
+            else if (arg == "--bandwidth-kbps") {
+                serverConfig.bandwidthBytesPerSec = std::stoull(value()) * 1024;
+            }
+            else if (arg == "--auth") {
+                std::string auth = value();
+                size_t colon = auth.find(':');
+                serverConfig.authUsername = auth.substr(0, colon);
+                serverConfig.authPassword = colon == std::string::npos ? "" : auth.substr(colon + 1);
+            }
+            else if (arg == "--fail-rate") {
+                serverConfig.failureRate = std::stod(value());
+                // Written to also reject NaN
+                if (!(serverConfig.failureRate >= 0.0 && serverConfig.failureRate <= 1.0)) {
+                    throw std::out_of_range(std::to_string(serverConfig.failureRate));
+                }
+            }
+            else if (arg == "--fail-modes") {
+                std::string modes = value();
+                serverConfig.failureModes = 0;
+                for (size_t start = 0; start <= modes.size();) {
+                    size_t end = modes.find(',', start);
+                    end = end == std::string::npos ? modes.size() : end;
+                    std::string mode = modes.substr(start, end - start);
+                    if (mode == "500") {
+                        serverConfig.failureModes |= LOOPBACK_FAILURE_HTTP_500;
+                    }
+                    else if (mode == "disconnect") {
+                        serverConfig.failureModes |= LOOPBACK_FAILURE_DISCONNECT;
+                    }
+                    else if (mode == "truncate") {
+                        serverConfig.failureModes |= LOOPBACK_FAILURE_TRUNCATE;
+                    }
+                    else {
+                        throw std::invalid_argument(mode);
+                    }
+                    start = end + 1;
+                }
+            }
+            else if (arg == "--seed") {
+                serverConfig.seed = static_cast<uint32_t>(std::stoul(value()));
+            }
+            else {
+                std::cerr << "Unknown option: " << arg << std::endl;
+                options.valid = false;
+            }
+        }
+        catch (const std::exception&) {
+            std::cerr << "Invalid value for " << arg << std::endl;
+            options.valid = false;
+        }
+    }
+
+    if (serve) {
+        options.loopbackServer = serverConfig;
+    }
+    if (benchmark) {
+        options.statusBenchmark = benchmarkConfig;
+    }
+    if (maintain) {
+        options.maintenance = maintenanceConfig;
+    }
+    if (shareObjects) {
+        options.sharedObjects = sharedObjectsConfig;
+    }
+    if (!options.valid) {
+        printUsage();
+    }
+    return options;
+}
+
+#endif
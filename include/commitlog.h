@@ -0,0 +1,243 @@
+#ifndef COMMIT_LOG_H
+#define COMMIT_LOG_H
+
+#include "git2.h"
+#include "repotable.h"
+#include "tasktrace.h"
+#include "logsink.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+constexpr size_t COMMIT_LOG_PAGE_SIZE = 256;              // Commits walked per request
+constexpr size_t COMMIT_LOG_ARENA_BLOCK_SIZE = 64 * 1024; // Bytes per text arena block
+
+//--------------------------------------
+// class TextArena
+//--------------------------------------
+// Append-only string storage in fixed blocks. Stored strings never move, so
+// views into them stay valid for the arena's lifetime.
+class TextArena
+{
+public:
+    std::string_view store(std::string_view text)
+    {
+        char* at = nullptr;
+        if (text.size() > COMMIT_LOG_ARENA_BLOCK_SIZE) {
+            oversized.push_back(std::make_unique<char[]>(text.size()));
+            at = oversized.back().get();
+            reserved += text.size();
+        }
+        else {
+            if (blocks.empty() || used + text.size() > COMMIT_LOG_ARENA_BLOCK_SIZE) {
+                blocks.push_back(std::make_unique<char[]>(COMMIT_LOG_ARENA_BLOCK_SIZE));
+                reserved += COMMIT_LOG_ARENA_BLOCK_SIZE;
+                used = 0;
+            }
+            at = blocks.back().get() + used;
+            used += text.size();
+        }
+        std::memcpy(at, text.data(), text.size());
+        return std::string_view(at, text.size());
+    }
+
+    size_t bytes() const { return reserved; }
+
+private:
+    std::vector<std::unique_ptr<char[]>> blocks;    // The last one is being filled
+    std::vector<std::unique_ptr<char[]>> oversized; // Strings larger than a block
+    size_t used{0};                                 // Bytes used of the last block
+    size_t reserved{0};
+};
+
+//--------------------------------------
+// struct CommitLogEntry
+//--------------------------------------
+struct CommitLogEntry
+{
+    git_oid id;
+    int64_t time;
+    std::string_view summary; // In the log's arena
+    std::string_view author;  // In the log's arena
+};
+
+//--------------------------------------
+// class CommitLog
+//--------------------------------------
+// History of one repo's HEAD, from HEAD back, walked lazily on a thread of its
+// own. Callers say how many commits they want to show; the walker reads pages
+// until it has that many and then sleeps, so opening the log of a huge repo
+// costs one page. The walk uses its own repository handle so it never shares
+// one with a task.
+class CommitLog
+{
+public:
+    CommitLog(std::filesystem::path repoPath, uint32_t traceTag)
+    {
+        worker = std::thread([this, repoPath = std::move(repoPath), traceTag]() { walk(repoPath, traceTag); });
+    }
+
+    ~CommitLog()
+    {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stopping = true;
+        }
+        changed.notify_all();
+        worker.join();
+    }
+
+    CommitLog(const CommitLog&) = delete;
+    CommitLog& operator=(const CommitLog&) = delete;
+
+    // Keeps the walk going until count commits are loaded or history ends.
+    void want(size_t count)
+    {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            if (count <= wanted) {
+                return;
+            }
+            wanted = count;
+        }
+        changed.notify_all();
+    }
+
+    // Entries and their arena text may only be read while holding the lock.
+    std::mutex& mutex() { return lock; }
+    const std::vector<CommitLogEntry>& entries() const { return loaded; }
+    bool finished() const { return done; }
+    const std::string& error() const { return failure; }
+    size_t arenaBytes() const { return arena.bytes(); }
+
+private:
+    void walk(const std::filesystem::path& repoPath, uint32_t traceTag)
+    {
+        setTraceThreadName("commit-log");
+        TraceTaskScope traceScope(traceTag, TracePhase::LOG);
+        git_repository* repo = nullptr;
+        git_revwalk* revwalk = nullptr;
+        // Unsorted is the one order libgit2 walks incrementally; asking for
+        // time or topological order reads the whole history before the first
+        // commit comes out (12 s on a million commits)
+        if (git_repository_open(&repo, repoPath.string().c_str()) != 0 || git_revwalk_new(&revwalk, repo) != 0
+            || git_revwalk_sorting(revwalk, GIT_SORT_NONE) != 0 || git_revwalk_push_head(revwalk) != 0) {
+            const git_error* e = git_error_last();
+            std::lock_guard<std::mutex> guard(lock);
+            failure = e && e->message ? e->message : "Unknown error";
+            done = true;
+            git_revwalk_free(revwalk);
+            git_repository_free(repo);
+            return;
+        }
+
+        struct Parsed
+        {
+            git_oid id;
+            int64_t time;
+            std::string summary;
+            std::string author;
+        };
+        std::vector<Parsed> page;
+        bool ended = false;
+        while (!ended) {
+            {
+                std::unique_lock<std::mutex> guard(lock);
+                changed.wait(guard, [this]() { return stopping || loaded.size() < wanted; });
+                if (stopping) {
+                    break;
+                }
+            }
+
+            // Parse outside the lock so drawing never waits on the odb
+            page.clear();
+            {
+                TraceSpan span(TracePhase::LOG);
+                git_oid id;
+                while (page.size() < COMMIT_LOG_PAGE_SIZE) {
+                    if (git_revwalk_next(&id, revwalk) != 0) {
+                        ended = true;
+                        break;
+                    }
+                    git_commit* commit = nullptr;
+                    if (git_commit_lookup(&commit, repo, &id) != 0) {
+                        continue;
+                    }
+                    const char* summary = git_commit_summary(commit);
+                    const git_signature* author = git_commit_author(commit);
+                    page.push_back(
+                        {id, git_commit_time(commit), summary ? summary : "", author && author->name ? author->name : ""});
+                    git_commit_free(commit);
+                }
+            }
+
+            std::lock_guard<std::mutex> guard(lock);
+            for (const Parsed& parsed : page) {
+                auto author = authors.find(parsed.author);
+                if (author == authors.end()) {
+                    author = authors.insert(arena.store(parsed.author)).first;
+                }
+                loaded.push_back({parsed.id, parsed.time, arena.store(parsed.summary), *author});
+            }
+            done = ended;
+        }
+        git_revwalk_free(revwalk);
+        git_repository_free(repo);
+    }
+
+    std::mutex lock;
+    std::condition_variable changed;
+    std::thread worker;
+    std::vector<CommitLogEntry> loaded;
+    TextArena arena;
+    std::unordered_set<std::string_view> authors; // Interned in the arena; most commits share a few
+    size_t wanted{COMMIT_LOG_PAGE_SIZE};
+    bool done{false};
+    bool stopping{false};
+    std::string failure{""};
+};
+
+//--------------------------------------
+// class CommitLogs
+//--------------------------------------
+// Commit logs open in the UI, by repo. Only the UI thread touches this.
+class CommitLogs
+{
+public:
+    CommitLog* find(RepoId id)
+    {
+        auto it = logs.find(id.slot);
+        return it != logs.end() && it->second.first == id ? it->second.second.get() : nullptr;
+    }
+
+    void open(RepoId id, const std::filesystem::path& repoPath, uint32_t traceTag)
+    {
+        logs[id.slot] = {id, std::make_unique<CommitLog>(repoPath, traceTag)};
+    }
+
+    void close(RepoId id)
+    {
+        auto it = logs.find(id.slot);
+        if (it != logs.end() && it->second.first == id) {
+            logs.erase(it);
+        }
+    }
+
+    // Stops every walker; their handles must be freed before libgit2 shuts down.
+    void closeAll() { logs.clear(); }
+
+private:
+    std::unordered_map<uint32_t, std::pair<RepoId, std::unique_ptr<CommitLog>>> logs; // By slot
+};
+
+#endif
@@ -0,0 +1,488 @@
+#ifndef CONTENT_SEARCH_H
+#define CONTENT_SEARCH_H
+
+#include "git2.h"
+#include "branchmatrix.h"
+#include "tasktrace.h"
+#include "logsink.h"
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <regex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#if defined(_M_X64) || defined(__SSE2__)
+    #include <emmintrin.h>
+    #define CONTENT_SEARCH_SSE2 1
+#endif
+
+constexpr size_t CONTENT_SEARCH_MAX_MATCHES = 10000;            // Matches listed; all are counted
+constexpr size_t CONTENT_SEARCH_MAX_BLOB_SIZE = 8 * 1024 * 1024; // Larger blobs are skipped like binaries
+constexpr size_t CONTENT_SEARCH_MAX_LINE = 240;                 // Bytes of a matching line kept
+constexpr size_t CONTENT_SEARCH_MAX_BLOB_LINES = 100;           // Lines kept per blob; all are counted
+constexpr size_t CONTENT_SEARCH_CACHE_SHARDS = 16;
+constexpr size_t CONTENT_SEARCH_CACHE_LIMIT = 1 << 20; // Blobs remembered per shard
+
+//--------------------------------------
+// struct ContentSearchQuery
+//--------------------------------------
+struct ContentSearchQuery
+{
+    std::string pattern{""};
+    bool regex{false}; // ECMAScript, matched one line at a time
+
+    bool operator==(const ContentSearchQuery& other) const = default;
+};
+
+//--------------------------------------
+// struct ContentSearchRepo
+//--------------------------------------
+struct ContentSearchRepo
+{
+    std::filesystem::path repoPath{""};
+    uint32_t traceTag{0};
+};
+
+//--------------------------------------
+// struct ContentLine
+//--------------------------------------
+struct ContentLine
+{
+    uint32_t line{0}; // 1-based
+    std::string text{""};
+};
+
+//--------------------------------------
+// struct ContentBlobMatches
+//--------------------------------------
+struct ContentBlobMatches
+{
+    size_t count{0};
+    std::vector<ContentLine> lines; // At most CONTENT_SEARCH_MAX_BLOB_LINES
+};
+
+//--------------------------------------
+// struct ContentMatch
+//--------------------------------------
+struct ContentMatch
+{
+    uint32_t repo{0}; // Index into the searched repos
+    uint32_t line{0};
+    std::string path{""};
+    std::string text{""};
+};
+
+//--------------------------------------
+// findLiteral()
+//--------------------------------------
+// First occurrence of needle in haystack at or after from. With SSE2, 16
+// positions are tested at once against the needle's first and last bytes and
+// only positions matching both are compared in full, which skips most of a
+// text even when the first byte alone is common.
+size_t findLiteral(std::string_view haystack, std::string_view needle, size_t from)
+{
+#ifdef CONTENT_SEARCH_SSE2
+    if (needle.size() >= 2) {
+        const __m128i first = _mm_set1_epi8(needle.front());
+        const __m128i last = _mm_set1_epi8(needle.back());
+        const char* data = haystack.data();
+        size_t tail = needle.size() - 1;
+        for (; from + tail + 16 <= haystack.size(); from += 16) {
+            __m128i starts = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + from));
+            __m128i ends = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + from + tail));
+            unsigned hits = static_cast<unsigned>(
+                _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(starts, first), _mm_cmpeq_epi8(ends, last))));
+            while (hits != 0) {
+                size_t at = from + std::countr_zero(hits);
+                if (std::memcmp(data + at + 1, needle.data() + 1, tail - 1) == 0) {
+                    return at;
+                }
+                hits &= hits - 1;
+            }
+        }
+    }
+#endif
+    return haystack.find(needle, from);
+}
+
+//--------------------------------------
+// requiredLiteral()
+//--------------------------------------
+// Longest run of plain characters that every match of an ECMAScript pattern
+// contains, used to skip blobs and lines before running the regex. Empty
+// when no run is certain, e.g. with alternation.
+std::string requiredLiteral(const std::string& pattern)
+{
+    if (pattern.find('|') != std::string::npos) {
+        return "";
+    }
+    std::string best;
+    std::string run;
+    auto endRun = [&]() {
+        if (run.size() > best.size()) {
+            best = run;
+        }
+        run.clear();
+    };
+
+    int depth = 0; // Group contents may be optional or repeated as a whole
+    for (size_t i = 0; i < pattern.size(); i++) {
+        char c = pattern[i];
+        bool plain = false;
+        if (c == '\\' && i + 1 < pattern.size()) {
+            c = pattern[++i];
+            plain = !std::isalnum(static_cast<unsigned char>(c)); // \d, \w, \b... are classes
+            // Operands are not text: \xhh, \uhhhh, \cX and backreference digits
+            size_t operand = c == 'x' ? 2 : c == 'u' ? 4 : c == 'c' ? 1 : 0;
+            i = i + operand < pattern.size() ? i + operand : pattern.size() - 1;
+            bool backreference = c >= '1' && c <= '9';
+            while (backreference && i + 1 < pattern.size() && pattern[i + 1] >= '0' && pattern[i + 1] <= '9') {
+                i++;
+            }
+        }
+        else if (c == '[') {
+            // A ']' first in the class, after any '^', is a member
+            i += i + 1 < pattern.size() && pattern[i + 1] == '^' ? 2 : 1;
+            for (i += i < pattern.size() && pattern[i] == ']' ? 1 : 0; i < pattern.size() && pattern[i] != ']'; i++) {
+                i += pattern[i] == '\\' ? 1 : 0;
+            }
+        }
+        else if (c == '{') {
+            size_t close = pattern.find('}', i); // {m,n} counts are not text
+            i = close == std::string::npos ? pattern.size() : close;
+        }
+        else if (c == '(') {
+            depth++;
+        }
+        else if (c == ')') {
+            depth--;
+        }
+        else {
+            plain = std::strchr(".^$*+?{}", c) == nullptr;
+        }
+
+        char next = i + 1 < pattern.size() ? pattern[i + 1] : '\0';
+        if (!plain || depth != 0 || next == '?' || next == '*' || next == '{') {
+            endRun();
+            continue;
+        }
+        run += c;
+        if (next == '+') {
+            endRun();
+        }
+    }
+    endRun();
+    return best;
+}
+
+//--------------------------------------
+// class ContentMatcher
+//--------------------------------------
+// A compiled query. Regex queries are prefiltered by their required literal,
+// so only lines containing it are handed to std::regex.
+class ContentMatcher
+{
+public:
+    bool compile(const ContentSearchQuery& query, std::string& error)
+    {
+        if (query.pattern.empty()) {
+            error = "Nothing to search for";
+            return false;
+        }
+        if (!query.regex) {
+            literal = query.pattern;
+            return true;
+        }
+        try {
+            regex = std::make_unique<std::regex>(query.pattern, std::regex::ECMAScript | std::regex::optimize);
+        }
+        catch (const std::regex_error& e) {
+            error = std::string("Invalid regex: ") + e.what();
+            return false;
+        }
+        literal = requiredLiteral(query.pattern);
+        return true;
+    }
+
+    // Counts the lines of text that match and keeps the first of them.
+    void scan(std::string_view text, ContentBlobMatches& matches) const
+    {
+        size_t counted = 0;
+        uint32_t lineNumber = 1;
+        size_t position = 0;
+        while (position < text.size()) {
+            size_t lineStart = position;
+            if (!literal.empty()) {
+                size_t found = findLiteral(text, literal, position);
+                if (found == std::string_view::npos) {
+                    return;
+                }
+                lineStart = found;
+                while (lineStart > position && text[lineStart - 1] != '\n') {
+                    lineStart--;
+                }
+            }
+            const void* newline = std::memchr(text.data() + lineStart, '\n', text.size() - lineStart);
+            size_t lineEnd = newline != nullptr ? static_cast<const char*>(newline) - text.data() : text.size();
+            std::string_view line = text.substr(lineStart, lineEnd - lineStart);
+            if (!line.empty() && line.back() == '\r') {
+                line.remove_suffix(1);
+            }
+
+            if (regex == nullptr || std::regex_search(line.begin(), line.end(), *regex)) {
+                matches.count++;
+                if (matches.lines.size() < CONTENT_SEARCH_MAX_BLOB_LINES) {
+                    lineNumber += static_cast<uint32_t>(std::count(text.begin() + counted, text.begin() + lineStart, '\n'));
+                    counted = lineStart;
+                    matches.lines.push_back({lineNumber, std::string(line.substr(0, CONTENT_SEARCH_MAX_LINE))});
+                }
+            }
+            position = lineEnd + 1;
+        }
+    }
+
+private:
+    std::string literal{""};
+    std::unique_ptr<std::regex> regex;
+};
+
+//--------------------------------------
+// class ContentSearch
+//--------------------------------------
+// Searches the HEAD tree of every repo, straight from the object database so
+// build output and other untracked files never get read. Repos are spread
+// over one worker per core. Each blob's result is cached by OID, so a file
+// shared by clones, worktrees or forks is scanned once, and searching again
+// for the same query only rescans blobs that changed. Matches are appended as
+// they are found; binary and oversized blobs are skipped.
+class ContentSearch
+{
+public:
+    ~ContentSearch() { cancel(); }
+
+    // False with error set if the query doesn't compile or a search runs.
+    bool start(std::vector<ContentSearchRepo> repos, const ContentSearchQuery& query, std::string& error)
+    {
+        if (isRunning()) {
+            error = "A search is already running";
+            return false;
+        }
+        joinWorkers();
+        auto compiled = std::make_shared<ContentMatcher>();
+        if (!compiled->compile(query, error)) {
+            return false;
+        }
+        if (!(query == cachedQuery)) {
+            for (CacheShard& shard : cache) {
+                std::lock_guard<std::mutex> guard(shard.lock);
+                shard.blobs.clear();
+            }
+            cachedQuery = query;
+        }
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            found.clear();
+            searched = std::move(repos);
+        }
+        matcher = compiled;
+        matchTotal = 0;
+        nextRepo = 0;
+        done = 0;
+        blobsScanned = 0;
+        blobsCached = 0;
+        bytesScanned = 0;
+        blobsSkipped = 0;
+        cancelled = false;
+
+        unsigned workerCount = std::thread::hardware_concurrency();
+        workerCount = workerCount == 0 ? 4 : workerCount;
+        workerCount = workerCount < searched.size() ? workerCount : static_cast<unsigned>(searched.size());
+        active = workerCount;
+        for (unsigned i = 0; i < workerCount; i++) {
+            workers.emplace_back([this]() { work(); });
+        }
+        return true;
+    }
+
+    void cancel()
+    {
+        cancelled = true;
+        joinWorkers();
+    }
+
+    bool isRunning() const { return active != 0; }
+    size_t progress() const { return done; }
+    size_t repoCount() const { return searched.size(); }
+    size_t matchCount() const { return matchTotal; }
+    size_t scannedBlobs() const { return blobsScanned; }
+    size_t cachedBlobs() const { return blobsCached; }
+    size_t skippedBlobs() const { return blobsSkipped; }
+    uint64_t scannedBytes() const { return bytesScanned; }
+
+    // Matches may only be read while holding the lock. The repo list is
+    // fixed until the next start().
+    std::mutex& mutex() { return lock; }
+    const std::vector<ContentMatch>& matches() const { return found; }
+    const ContentSearchRepo& repo(uint32_t index) const { return searched[index]; }
+
+private:
+    struct CacheShard
+    {
+        std::mutex lock;
+        // Null for blobs without matches, binary or oversized
+        std::unordered_map<git_oid, std::shared_ptr<const ContentBlobMatches>, OidHash, OidEqual> blobs;
+    };
+
+    struct Walk
+    {
+        ContentSearch* search;
+        git_repository* repo;
+        uint32_t repoIndex;
+        std::string path;
+    };
+
+    void work()
+    {
+        setTraceThreadName("search");
+        for (size_t index = nextRepo++; index < searched.size() && !cancelled; index = nextRepo++) {
+            searchRepo(static_cast<uint32_t>(index));
+            done++;
+        }
+        active--;
+    }
+
+    void searchRepo(uint32_t index)
+    {
+        const ContentSearchRepo& target = searched[index];
+        TraceTaskScope traceScope(target.traceTag, TracePhase::SEARCH);
+        git_repository* repo = nullptr;
+        git_object* tree = nullptr;
+        if (git_repository_open(&repo, target.repoPath.string().c_str()) != 0
+            || git_revparse_single(&tree, repo, "HEAD^{tree}") != 0) {
+            const git_error* e = git_error_last();
+            logMessage(
+                LogLevel::LEVEL_WARN,
+                "Search skipped %s: %s",
+                target.repoPath.string().c_str(),
+                e && e->message ? e->message : "no HEAD");
+            git_repository_free(repo);
+            return;
+        }
+
+        Walk walk{this, repo, index, ""};
+        git_tree_walk(
+            reinterpret_cast<git_tree*>(tree),
+            GIT_TREEWALK_PRE,
+            [](const char* root, const git_tree_entry* entry, void* payload) -> int {
+                Walk& walk = *static_cast<Walk*>(payload);
+                if (walk.search->cancelled) {
+                    return -1;
+                }
+                if (git_tree_entry_type(entry) == GIT_OBJECT_BLOB && git_tree_entry_filemode(entry) != GIT_FILEMODE_LINK) {
+                    walk.path.assign(root);
+                    walk.path.append(git_tree_entry_name(entry));
+                    walk.search->searchBlob(walk, *git_tree_entry_id(entry));
+                }
+                return 0;
+            },
+            &walk);
+        git_object_free(tree);
+        git_repository_free(repo);
+    }
+
+    void searchBlob(const Walk& walk, const git_oid& id)
+    {
+        // Sharded by the last byte, since OidHash hashes the first ones
+        CacheShard& shard = cache[id.id[GIT_OID_SHA1_SIZE - 1] % CONTENT_SEARCH_CACHE_SHARDS];
+        std::shared_ptr<const ContentBlobMatches> matches;
+        bool cached = false;
+        {
+            std::lock_guard<std::mutex> guard(shard.lock);
+            auto it = shard.blobs.find(id);
+            if (it != shard.blobs.end()) {
+                matches = it->second;
+                cached = true;
+            }
+        }
+
+        if (cached) {
+            blobsCached++;
+        }
+        else {
+            git_blob* blob = nullptr;
+            if (git_blob_lookup(&blob, walk.repo, &id) != 0) {
+                return;
+            }
+            size_t size = static_cast<size_t>(git_blob_rawsize(blob));
+            if (size > CONTENT_SEARCH_MAX_BLOB_SIZE || git_blob_is_binary(blob)) {
+                blobsSkipped++;
+            }
+            else {
+                TraceSpan span(TracePhase::SEARCH);
+                auto scanned = std::make_shared<ContentBlobMatches>();
+                matcher->scan(std::string_view(static_cast<const char*>(git_blob_rawcontent(blob)), size), *scanned);
+                if (scanned->count != 0) {
+                    matches = scanned;
+                }
+                blobsScanned++;
+                bytesScanned += size;
+            }
+            git_blob_free(blob);
+
+            std::lock_guard<std::mutex> guard(shard.lock);
+            if (shard.blobs.size() < CONTENT_SEARCH_CACHE_LIMIT) {
+                shard.blobs.emplace(id, matches);
+            }
+        }
+
+        if (matches == nullptr) {
+            return;
+        }
+        matchTotal += matches->count;
+        std::lock_guard<std::mutex> guard(lock);
+        for (const ContentLine& line : matches->lines) {
+            if (found.size() >= CONTENT_SEARCH_MAX_MATCHES) {
+                break;
+            }
+            found.push_back({walk.repoIndex, line.line, walk.path, line.text});
+        }
+    }
+
+    void joinWorkers()
+    {
+        for (std::thread& worker : workers) {
+            worker.join();
+        }
+        workers.clear();
+    }
+
+    std::vector<std::thread> workers;
+    std::vector<ContentSearchRepo> searched;
+    std::shared_ptr<const ContentMatcher> matcher;
+    std::mutex lock;
+    std::vector<ContentMatch> found;
+    CacheShard cache[CONTENT_SEARCH_CACHE_SHARDS];
+    ContentSearchQuery cachedQuery;
+    std::atomic<size_t> nextRepo{0};
+    std::atomic<size_t> active{0};
+    std::atomic<size_t> done{0};
+    std::atomic<size_t> matchTotal{0};
+    std::atomic<size_t> blobsScanned{0};
+    std::atomic<size_t> blobsCached{0};
+    std::atomic<size_t> blobsSkipped{0};
+    std::atomic<uint64_t> bytesScanned{0};
+    std::atomic<bool> cancelled{false};
+};
+
+#endif
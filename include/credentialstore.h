@@ -0,0 +1,414 @@
+#ifndef CREDENTIAL_STORE_H
+#define CREDENTIAL_STORE_H
+
+#include "logsink.h"
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#ifdef _WIN32
+#include "cpputils/windows/credential_utils.h"
+#elif defined(__linux__)
+#include <pthread.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+constexpr const char* GIT_REPO_MANAGER_CREDENTIAL_TARGE_NAME = "StopwatchString/Git-Repo-Manager";
+constexpr std::chrono::seconds CREDENTIAL_CACHE_TTL{300};
+
+//--------------------------------------
+// secureClear()
+//--------------------------------------
+// Overwrites the string's buffer before emptying it. Writes go through a
+// volatile pointer so they aren't dropped as dead stores.
+void secureClear(std::string& value)
+{
+    volatile char* data = value.data();
+    for (size_t i = 0; i < value.size(); i++) {
+        data[i] = 0;
+    }
+    value.clear();
+}
+
+//--------------------------------------
+// struct Credential
+//--------------------------------------
+// Username and secret; the secret is zeroed whenever a copy is destroyed.
+struct Credential
+{
+    std::string username{""};
+    std::string secret{""};
+
+    Credential() = default;
+    Credential(std::string username, std::string secret) : username(std::move(username)), secret(std::move(secret)) {}
+    Credential(const Credential&) = default;
+    Credential& operator=(const Credential& other)
+    {
+        if (this != &other) {
+            secureClear(secret);
+            username = other.username;
+            secret = other.secret;
+        }
+        return *this;
+    }
+    ~Credential() { secureClear(secret); }
+};
+
+//--------------------------------------
+// class CredentialStore
+//--------------------------------------
+// Persistent backend. Credentials are keyed by remote host; the empty host
+// holds the default credential used for hosts without their own.
+class CredentialStore
+{
+public:
+    virtual ~CredentialStore() = default;
+    virtual const char* name() const = 0;
+    virtual std::optional<Credential> read(const std::string& host) = 0;
+    virtual bool write(const std::string& host, const Credential& credential) = 0;
+};
+
+//--------------------------------------
+// class MemoryCredentialStore
+//--------------------------------------
+// Process-local stand-in for tests and headless runs; counts reads so callers
+// can check how often the backend was actually hit.
+class MemoryCredentialStore : public CredentialStore
+{
+public:
+    const char* name() const override { return "memory"; }
+
+    std::optional<Credential> read(const std::string& host) override
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        readCount++;
+        auto it = credentials.find(host);
+        if (it == credentials.end()) {
+            return std::nullopt;
+        }
+        return it->second;
+    }
+
+    bool write(const std::string& host, const Credential& credential) override
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        credentials[host] = credential;
+        return true;
+    }
+
+    uint64_t reads() const { return readCount; }
+
+private:
+    std::mutex lock;
+    std::unordered_map<std::string, Credential> credentials;
+    std::atomic<uint64_t> readCount{0};
+};
+
+#ifdef _WIN32
+//--------------------------------------
+// class WindowsCredentialStore
+//--------------------------------------
+// Windows Credential Manager. The default credential keeps the original
+// target name so credentials saved by earlier versions are still found.
+class WindowsCredentialStore : public CredentialStore
+{
+public:
+    const char* name() const override { return "Windows Credential Manager"; }
+
+    std::optional<Credential> read(const std::string& host) override
+    {
+        cpputils::windows::Credential stored = cpputils::windows::readCredential(targetName(host));
+        if (stored.username.empty() && stored.credentialBlob.empty()) {
+            return std::nullopt;
+        }
+        Credential credential(std::move(stored.username), stored.credentialBlob);
+        secureClear(stored.credentialBlob);
+        return credential;
+    }
+
+    bool write(const std::string& host, const Credential& credential) override
+    {
+        cpputils::windows::Credential stored = {credential.username, credential.secret};
+        bool ok = cpputils::windows::writeCredential(targetName(host), stored);
+        secureClear(stored.credentialBlob);
+        return ok;
+    }
+
+private:
+    static std::string targetName(const std::string& host)
+    {
+        return host.empty() ? GIT_REPO_MANAGER_CREDENTIAL_TARGE_NAME
+                            : std::string(GIT_REPO_MANAGER_CREDENTIAL_TARGE_NAME) + "/" + host;
+    }
+};
+#elif defined(__linux__)
+//--------------------------------------
+// class SecretServiceCredentialStore
+//--------------------------------------
+// freedesktop Secret Service (GNOME Keyring, KWallet) through libsecret's
+// secret-tool, run directly rather than through a shell so hosts are never
+// interpreted. The stored secret is "username\nsecret".
+class SecretServiceCredentialStore : public CredentialStore
+{
+public:
+    const char* name() const override { return "Secret Service"; }
+
+    std::optional<Credential> read(const std::string& host) override
+    {
+        std::string output;
+        if (!runSecretTool({"secret-tool", "lookup", "service", GIT_REPO_MANAGER_CREDENTIAL_TARGE_NAME, "host", host},
+                           "",
+                           output)) {
+            secureClear(output);
+            return std::nullopt;
+        }
+        size_t newline = output.find('\n');
+        if (newline == std::string::npos) {
+            secureClear(output);
+            return std::nullopt;
+        }
+        Credential credential(output.substr(0, newline), output.substr(newline + 1));
+        secureClear(output);
+        return credential;
+    }
+
+    bool write(const std::string& host, const Credential& credential) override
+    {
+        std::string label = std::string("Git Repo Manager ") + (host.empty() ? "default" : host);
+        std::string input = credential.username + "\n" + credential.secret;
+        std::string output;
+        bool ok = runSecretTool(
+            {"secret-tool", "store", "--label", label, "service", GIT_REPO_MANAGER_CREDENTIAL_TARGE_NAME, "host", host},
+            input,
+            output);
+        secureClear(input);
+        return ok;
+    }
+
+private:
+    // Feeds input to the tool's stdin and collects its stdout. False if the
+    // tool couldn't run or exited non-zero.
+    static bool runSecretTool(const std::vector<std::string>& args, const std::string& input, std::string& output)
+    {
+        int stdinPipe[2];
+        int stdoutPipe[2];
+        if (pipe(stdinPipe) != 0) {
+            return false;
+        }
+        if (pipe(stdoutPipe) != 0) {
+            close(stdinPipe[0]);
+            close(stdinPipe[1]);
+            return false;
+        }
+
+        std::vector<char*> argv;
+        for (const std::string& arg : args) {
+            argv.push_back(const_cast<char*>(arg.c_str()));
+        }
+        argv.push_back(nullptr);
+
+        pid_t pid = fork();
+        if (pid == 0) {
+            dup2(stdinPipe[0], STDIN_FILENO);
+            dup2(stdoutPipe[1], STDOUT_FILENO);
+            close(stdinPipe[0]);
+            close(stdinPipe[1]);
+            close(stdoutPipe[0]);
+            close(stdoutPipe[1]);
+            execvp(argv[0], argv.data());
+            _exit(127);
+        }
+        close(stdinPipe[0]);
+        close(stdoutPipe[1]);
+        if (pid < 0) {
+            close(stdinPipe[1]);
+            close(stdoutPipe[0]);
+            return false;
+        }
+
+        // Credentials are far smaller than a pipe buffer, so writing all of
+        // the input before reading can't deadlock. SIGPIPE is held back on
+        // this thread in case the tool exits without reading, e.g. when it
+        // isn't installed.
+        sigset_t pipeSignal;
+        sigset_t previousMask;
+        sigemptyset(&pipeSignal);
+        sigaddset(&pipeSignal, SIGPIPE);
+        pthread_sigmask(SIG_BLOCK, &pipeSignal, &previousMask);
+        size_t written = 0;
+        bool brokenPipe = false;
+        while (written < input.size()) {
+            ssize_t count = ::write(stdinPipe[1], input.data() + written, input.size() - written);
+            if (count <= 0) {
+                brokenPipe = errno == EPIPE;
+                break;
+            }
+            written += static_cast<size_t>(count);
+        }
+        close(stdinPipe[1]);
+        if (brokenPipe) {
+            timespec noWait{0, 0};
+            sigtimedwait(&pipeSignal, nullptr, &noWait);
+        }
+        pthread_sigmask(SIG_SETMASK, &previousMask, nullptr);
+
+        char buffer[256];
+        ssize_t count;
+        while ((count = ::read(stdoutPipe[0], buffer, sizeof(buffer))) > 0) {
+            output.append(buffer, static_cast<size_t>(count));
+        }
+        close(stdoutPipe[0]);
+        volatile char* scrub = buffer;
+        for (size_t i = 0; i < sizeof(buffer); i++) {
+            scrub[i] = 0;
+        }
+
+        int status = 0;
+        waitpid(pid, &status, 0);
+        return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    }
+};
+#endif
+
+//--------------------------------------
+// makeSystemCredentialStore()
+//--------------------------------------
+std::unique_ptr<CredentialStore> makeSystemCredentialStore()
+{
+#ifdef _WIN32
+    return std::make_unique<WindowsCredentialStore>();
+#elif defined(__linux__)
+    return std::make_unique<SecretServiceCredentialStore>();
+#else
+    return std::make_unique<MemoryCredentialStore>();
+#endif
+}
+
+//--------------------------------------
+// class CredentialCache
+//--------------------------------------
+// Short-lived cache in front of the store, keyed by host and the username
+// from the remote URL. Lookups for different hosts are serialized on one
+// lock, so workers that all need the same host's credential wait for a single
+// store read instead of each doing their own. A host with no credential is
+// cached as a miss too, until the TTL runs out or a credential is stored.
+// Expired entries are zeroed.
+class CredentialCache
+{
+public:
+    explicit CredentialCache(std::unique_ptr<CredentialStore> store) : backend(std::move(store)) {}
+    ~CredentialCache() { clear(); }
+
+    std::optional<Credential> acquire(const std::string& host, const std::string& username)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        auto now = std::chrono::steady_clock::now();
+        std::string key = host + '\n' + username;
+        auto it = entries.find(key);
+        if (it != entries.end()) {
+            if (now < it->second.expiry) {
+                hitCount++;
+                return it->second.credential; // Empty for a cached miss
+            }
+            entries.erase(it);
+        }
+
+        // A host without its own credential falls back to the default
+        lookupCount++;
+        std::optional<Credential> credential = backend->read(host);
+        if (!credential.has_value() && !host.empty()) {
+            credential = backend->read("");
+        }
+        if (!credential.has_value()) {
+            logMessage(LogLevel::LEVEL_WARN, "No credential stored for %s in %s", host.c_str(), backend->name());
+        }
+        entries[key] = {credential, now + CREDENTIAL_CACHE_TTL};
+        return credential;
+    }
+
+    // Saves to the store and drops cached entries, misses included, the new
+    // credential replaces.
+    bool store(const std::string& host, const Credential& credential)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        bool ok = backend->write(host, credential);
+        if (host.empty()) {
+            entries.clear();
+        }
+        else {
+            eraseHost(host);
+        }
+        return ok;
+    }
+
+    // Drops a host's cached credentials, e.g. after the host rejected them.
+    void invalidate(const std::string& host)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        eraseHost(host);
+    }
+
+    void clear()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        entries.clear();
+    }
+
+    void setStore(std::unique_ptr<CredentialStore> store)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        entries.clear();
+        backend = std::move(store);
+    }
+
+    const char* storeName()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        return backend->name();
+    }
+
+    uint64_t lookups() const { return lookupCount; }
+    uint64_t hits() const { return hitCount; }
+
+private:
+    struct Entry
+    {
+        std::optional<Credential> credential; // Empty when the store had none
+        std::chrono::steady_clock::time_point expiry;
+    };
+
+    void eraseHost(const std::string& host)
+    {
+        std::string prefix = host + '\n';
+        std::erase_if(entries, [&](const auto& entry) { return entry.first.compare(0, prefix.size(), prefix) == 0; });
+    }
+
+    std::mutex lock;
+    std::unique_ptr<CredentialStore> backend;
+    std::unordered_map<std::string, Entry> entries;
+    std::atomic<uint64_t> lookupCount{0};
+    std::atomic<uint64_t> hitCount{0};
+};
+
+//--------------------------------------
+// credentialCache()
+//--------------------------------------
+CredentialCache& credentialCache()
+{
+    static CredentialCache cache(makeSystemCredentialStore());
+    return cache;
+}
+
+#endif
@@ -0,0 +1,647 @@
+#ifndef FAST_FORWARD_PIPELINE_H
+#define FAST_FORWARD_PIPELINE_H
+
+#include "gitrepo.h"
+#include "repotable.h"
+#include "submodules.h"
+#include "tasktrace.h"
+#include "logsink.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+constexpr uint32_t FAST_FORWARD_NETWORK_WORKERS = 8;
+constexpr uint32_t FAST_FORWARD_DISK_WORKERS = 2;
+constexpr size_t FAST_FORWARD_QUEUE_PER_DISK_WORKER = 2; // Fetched repos allowed to wait per checkout worker
+
+//--------------------------------------
+// class BoundedQueue
+//--------------------------------------
+// Blocking FIFO. push() waits while the queue is full and pop() while it is
+// empty; both give up once the queue is closed, pop() only after draining.
+template <typename T>
+class BoundedQueue
+{
+public:
+    explicit BoundedQueue(size_t capacity) : capacity(capacity) {}
+
+    bool push(T item)
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        notFull.wait(guard, [this]() { return closed || items.size() < capacity; });
+        if (closed) {
+            return false;
+        }
+        items.push_back(std::move(item));
+        highWater = items.size() > highWater ? items.size() : highWater;
+        notEmpty.notify_one();
+        return true;
+    }
+
+    bool pop(T& item)
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        notEmpty.wait(guard, [this]() { return closed || !items.empty(); });
+        if (items.empty()) {
+            return false;
+        }
+        item = std::move(items.front());
+        items.pop_front();
+        notFull.notify_one();
+        return true;
+    }
+
+    // Drops anything still queued and wakes every waiter.
+    void close()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        closed = true;
+        items.clear();
+        notFull.notify_all();
+        notEmpty.notify_all();
+    }
+
+    size_t size()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        return items.size();
+    }
+
+    // Deepest the queue has been since the last reset.
+    size_t highWaterMark()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        return highWater;
+    }
+
+    void resetHighWater()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        highWater = items.size();
+    }
+
+    size_t limit() const { return capacity; }
+
+private:
+    std::mutex lock;
+    std::condition_variable notFull;
+    std::condition_variable notEmpty;
+    std::deque<T> items;
+    size_t capacity;
+    size_t highWater{0};
+    bool closed{false};
+};
+
+//--------------------------------------
+// struct PipelineStageStats
+//--------------------------------------
+struct PipelineStageStats
+{
+    uint32_t workers{0};
+    uint64_t jobs{0};
+    double busySeconds{0.0};    // Summed over workers
+    double blockedSeconds{0.0}; // Waiting on a full queue to hand work on
+
+    // Share of the stage's worker time spent working.
+    double utilization(double wallSeconds) const
+    {
+        return workers == 0 || wallSeconds <= 0.0 ? 0.0 : busySeconds / (workers * wallSeconds);
+    }
+};
+
+//--------------------------------------
+// struct FastForwardPipelineStats
+//--------------------------------------
+// One batch: from the first repo submitted to an idle pipeline until the last
+// one in flight finishes.
+struct FastForwardPipelineStats
+{
+    PipelineStageStats network;
+    PipelineStageStats disk;
+    uint64_t repos{0};
+    uint64_t submodules{0};
+    uint64_t rebases{0};
+    uint64_t stashed{0};        // Repos whose local changes were stashed around the checkout
+    uint64_t stashConflicts{0}; // Of those, the ones whose changes didn't re-apply cleanly
+    double wallSeconds{0.0};
+    size_t queueDepth{0}; // Fetched repos waiting for a checkout worker
+    size_t queueHighWater{0};
+    size_t queueCapacity{0};
+};
+
+//--------------------------------------
+// enum SubmodulePhase
+//--------------------------------------
+enum class SubmodulePhase : uint8_t
+{
+    QUEUED,
+    FETCHING,
+    CHECKOUT,
+    DONE,
+    SKIPPED,
+    FAILED,
+};
+
+//--------------------------------------
+// SubmodulePhaseToString()
+//--------------------------------------
+const char* SubmodulePhaseToString(SubmodulePhase phase)
+{
+    switch (phase) {
+        case SubmodulePhase::QUEUED:
+            return "queued";
+        case SubmodulePhase::FETCHING:
+            return "fetching";
+        case SubmodulePhase::CHECKOUT:
+            return "checking out";
+        case SubmodulePhase::DONE:
+            return "done";
+        case SubmodulePhase::SKIPPED:
+            return "skipped";
+        case SubmodulePhase::FAILED:
+            return "failed";
+        default:
+            return "unknown";
+    }
+}
+
+//--------------------------------------
+// struct SubmoduleProgress
+//--------------------------------------
+// Submodules of one superproject in the order they were found. Nested ones
+// are added once their parent is checked out.
+struct SubmoduleProgress
+{
+    static constexpr size_t TOP_LEVEL = SIZE_MAX;
+
+    struct Entry
+    {
+        std::string name{""};
+        size_t parent{TOP_LEVEL}; // Entry of the submodule this one is nested in
+        SubmodulePhase phase{SubmodulePhase::QUEUED};
+    };
+    std::vector<Entry> entries;
+    uint32_t finished{0};
+};
+
+//--------------------------------------
+// class FastForwardPipeline
+//--------------------------------------
+// Mass fast-forwards in two stages. A network pool fetches; each fetched repo
+// goes through a bounded queue to a smaller disk pool that checks it out and
+// moves the branch, so fetches keep going while earlier repos hit the disk.
+// When checkouts fall behind the queue fills and fetches wait, which keeps
+// the number of fetched-but-unapplied repos bounded.
+//
+// With submodule updates on, a superproject's submodules go through the same
+// two stages as jobs of their own once it is checked out, recursively, and
+// the superproject's result is posted after the last of them finishes.
+//
+// Rebases are local, so they skip the fetch and only take a disk worker; a
+// mass rebase then touches no more working trees at once than a mass
+// fast-forward does.
+class FastForwardPipeline
+{
+public:
+    explicit FastForwardPipeline(RepoTaskResults& results) : results(results) {}
+    ~FastForwardPipeline() { stop(); }
+
+    // Pool sizes, at least one each; only takes effect before the first submit().
+    void configure(uint32_t networkWorkers, uint32_t diskWorkers)
+    {
+        std::lock_guard<std::mutex> guard(statsLock);
+        if (!started) {
+            networkWorkerCount = networkWorkers;
+            diskWorkerCount = diskWorkers;
+        }
+    }
+
+    uint32_t networkWorkers()
+    {
+        std::lock_guard<std::mutex> guard(statsLock);
+        return networkWorkerCount;
+    }
+
+    // Also update submodules of repos submitted from now on.
+    void setSubmoduleUpdates(bool enabled) { submoduleUpdates = enabled; }
+    bool updatesSubmodules() const { return submoduleUpdates; }
+
+    // Stash local changes that block the checkout of repos submitted from now on.
+    void setAutoStash(bool enabled) { autoStash = enabled; }
+    bool autoStashes() const { return autoStash; }
+
+    void submit(RepoId id, GitRepo gitRepo, RepoSortKeys sortKeys)
+    {
+        {
+            std::lock_guard<std::mutex> guard(statsLock);
+            beginJob();
+            batch.repos++;
+        }
+        auto job = std::make_unique<Job>();
+        job->id = id;
+        job->gitRepo = std::move(gitRepo);
+        job->sortKeys = sortKeys;
+        job->updateSubmodules = submoduleUpdates;
+        job->autoStash = autoStash;
+        submitted->push(std::move(job));
+    }
+
+    void submitRebase(RepoId id, GitRepo gitRepo, RepoSortKeys sortKeys)
+    {
+        {
+            std::lock_guard<std::mutex> guard(statsLock);
+            beginJob();
+            batch.rebases++;
+        }
+        auto job = std::make_unique<Job>();
+        job->id = id;
+        job->gitRepo = std::move(gitRepo);
+        job->sortKeys = sortKeys;
+        job->rebase = true;
+        submitted->push(std::move(job));
+    }
+
+    // Submodule progress of a superproject still in the pipeline.
+    std::optional<SubmoduleProgress> submoduleProgress(RepoId id)
+    {
+        std::shared_ptr<SubmoduleUpdate> update;
+        {
+            std::lock_guard<std::mutex> guard(statsLock);
+            auto it = submoduleUpdatesInFlight.find(id.slot);
+            if (it == submoduleUpdatesInFlight.end() || it->second->parent->id.generation != id.generation) {
+                return std::nullopt;
+            }
+            update = it->second;
+        }
+        std::lock_guard<std::mutex> guard(update->lock);
+        return update->progress;
+    }
+
+    // The batch in flight, or the last one when idle.
+    FastForwardPipelineStats stats()
+    {
+        std::lock_guard<std::mutex> guard(statsLock);
+        if (inFlight == 0) {
+            return lastBatch;
+        }
+        FastForwardPipelineStats current = batch;
+        current.wallSeconds = secondsSince(batchStart);
+        current.queueDepth = fetched->size();
+        current.queueHighWater = fetched->highWaterMark();
+        return current;
+    }
+
+    bool busy()
+    {
+        std::lock_guard<std::mutex> guard(statsLock);
+        return inFlight > 0;
+    }
+
+    // Finishes the jobs workers hold and drops the queued ones.
+    void stop()
+    {
+        if (submitted == nullptr) {
+            return;
+        }
+        submitted->close();
+        fetched->close();
+        for (std::thread& worker : workers) {
+            worker.join();
+        }
+        workers.clear();
+    }
+
+private:
+    struct SubmoduleUpdate;
+
+    struct Job
+    {
+        RepoId id;
+        GitRepo gitRepo;
+        RepoSortKeys sortKeys;
+        std::stringstream message;
+        bool authRejected{false};
+        double busySeconds{0.0}; // Network and disk time of the repo itself, not its submodules
+        bool updateSubmodules{false};
+        bool autoStash{false};
+        bool rebase{false}; // Nothing to fetch; rebased onto the upstream by a disk worker
+
+        // Set on submodule jobs only
+        std::optional<SubmoduleTarget> submodule;
+        std::shared_ptr<SubmoduleUpdate> update;
+        size_t entry{0}; // Index into update->progress.entries
+    };
+
+    // A superproject waiting on its submodules.
+    struct SubmoduleUpdate
+    {
+        std::mutex lock;
+        std::unique_ptr<Job> parent;
+        uint32_t pending{0};
+        bool failed{false};
+        SubmoduleProgress progress;
+        std::stringstream message;
+    };
+
+    static double secondsSince(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    // Caller holds statsLock.
+    void beginJob()
+    {
+        if (!started) {
+            start();
+        }
+        if (inFlight == 0) {
+            batch = FastForwardPipelineStats();
+            batch.network.workers = networkWorkerCount;
+            batch.disk.workers = diskWorkerCount;
+            batch.queueCapacity = fetched->limit();
+            fetched->resetHighWater();
+            batchStart = std::chrono::steady_clock::now();
+        }
+        inFlight++;
+    }
+
+    void start()
+    {
+        started = true;
+        submitted = std::make_unique<BoundedQueue<std::unique_ptr<Job>>>(SIZE_MAX);
+        size_t fetchedCapacity = diskWorkerCount * FAST_FORWARD_QUEUE_PER_DISK_WORKER;
+        fetched = std::make_unique<BoundedQueue<std::unique_ptr<Job>>>(fetchedCapacity);
+        for (uint32_t i = 0; i < networkWorkerCount; i++) {
+            workers.emplace_back([this, i]() { networkLoop(i); });
+        }
+        for (uint32_t i = 0; i < diskWorkerCount; i++) {
+            workers.emplace_back([this, i]() { diskLoop(i); });
+        }
+    }
+
+    void networkLoop(uint32_t index)
+    {
+        setTraceThreadName("ff-network-" + std::to_string(index));
+        std::unique_ptr<Job> job;
+        while (submitted->pop(job)) {
+            if (job->rebase) {
+                fetched->push(std::move(job));
+                continue;
+            }
+            auto start = std::chrono::steady_clock::now();
+            bool ok;
+            if (job->submodule.has_value()) {
+                setSubmodulePhase(*job, SubmodulePhase::FETCHING);
+                bool skipped = false;
+                {
+                    TraceTaskScope traceScope(job->gitRepo.traceTag, TracePhase::FASTFORWARD);
+                    LatencyTimer latency(LatencyOp::FETCH, job->gitRepo.remoteHost);
+                    ok = fetchSubmodule(job->submodule.value(), submoduleFetches, skipped, job->message);
+                }
+                double busySeconds = secondsSince(start);
+                if (!ok || skipped) {
+                    addStageTime(batch.network, busySeconds, 0.0);
+                    finishSubmodule(std::move(job), ok, skipped, {});
+                    continue;
+                }
+                setSubmodulePhase(*job, SubmodulePhase::CHECKOUT);
+                auto handoff = std::chrono::steady_clock::now();
+                fetched->push(std::move(job));
+                addStageTime(batch.network, busySeconds, secondsSince(handoff));
+                continue;
+            }
+            {
+                TraceTaskScope traceScope(job->gitRepo.traceTag, TracePhase::FASTFORWARD);
+                LatencyTimer latency(LatencyOp::FETCH, job->gitRepo.remoteHost);
+                ok = beginAuthenticatedTask(job->gitRepo);
+                if (ok) {
+                    ok = fastForwardFetch(job->gitRepo, job->message);
+                    endAuthenticatedTask(job->gitRepo, ok);
+                }
+                else {
+                    job->message << job->gitRepo.message;
+                }
+                job->authRejected = authAttempt.rejected;
+            }
+            double busySeconds = secondsSince(start);
+            job->busySeconds += busySeconds;
+
+            if (!ok) {
+                addStageTime(batch.network, busySeconds, 0.0);
+                finish(std::move(job), false);
+                continue;
+            }
+            auto handoff = std::chrono::steady_clock::now();
+            fetched->push(std::move(job));
+            addStageTime(batch.network, busySeconds, secondsSince(handoff));
+        }
+    }
+
+    void diskLoop(uint32_t index)
+    {
+        setTraceThreadName("ff-disk-" + std::to_string(index));
+        std::unique_ptr<Job> job;
+        while (fetched->pop(job)) {
+            auto start = std::chrono::steady_clock::now();
+            if (job->rebase) {
+                GitState state = rebaseRepo(job->gitRepo, job->sortKeys);
+                job->busySeconds = secondsSince(start);
+                addStageTime(batch.disk, job->busySeconds, 0.0);
+                post(*job, state, GitTask::REBASE);
+                endJob();
+                continue;
+            }
+            bool ok;
+            std::vector<SubmoduleTarget> nested;
+            {
+                TraceTaskScope traceScope(job->gitRepo.traceTag, TracePhase::FASTFORWARD);
+                LatencyTimer latency(LatencyOp::FASTFORWARD, job->gitRepo.remoteHost);
+                if (job->submodule.has_value()) {
+                    ok = checkoutSubmodule(job->submodule.value(), nested, job->message);
+                }
+                else {
+                    AutoStash stashed = AutoStash::NONE;
+                    ok = fastForwardCheckout(job->gitRepo, job->message, job->autoStash, &stashed);
+                    if (stashed != AutoStash::NONE) {
+                        std::lock_guard<std::mutex> guard(statsLock);
+                        batch.stashed++;
+                        batch.stashConflicts += stashed == AutoStash::CONFLICTED ? 1 : 0;
+                    }
+                    if (ok && job->updateSubmodules) {
+                        nested = listSubmodules(job->gitRepo.repo.get(), job->message);
+                    }
+                }
+            }
+            double busySeconds = secondsSince(start);
+            addStageTime(batch.disk, busySeconds, 0.0);
+            job->busySeconds += busySeconds;
+
+            if (job->submodule.has_value()) {
+                finishSubmodule(std::move(job), ok, false, std::move(nested));
+            }
+            else if (!nested.empty()) {
+                auto update = std::make_shared<SubmoduleUpdate>();
+                RepoId id = job->id;
+                update->parent = std::move(job);
+                {
+                    std::lock_guard<std::mutex> guard(statsLock);
+                    submoduleUpdatesInFlight[id.slot] = update;
+                }
+                std::lock_guard<std::mutex> guard(update->lock);
+                submitSubmodules(update, std::move(nested), SubmoduleProgress::TOP_LEVEL);
+            }
+            else {
+                finish(std::move(job), ok);
+            }
+        }
+    }
+
+    void setSubmodulePhase(const Job& job, SubmodulePhase phase)
+    {
+        std::lock_guard<std::mutex> guard(job.update->lock);
+        job.update->progress.entries[job.entry].phase = phase;
+    }
+
+    // Caller holds update->lock.
+    void submitSubmodules(
+        const std::shared_ptr<SubmoduleUpdate>& update, std::vector<SubmoduleTarget> targets, size_t parentEntry)
+    {
+        for (SubmoduleTarget& target : targets) {
+            auto job = std::make_unique<Job>();
+            job->id = update->parent->id;
+            job->gitRepo.traceTag = internTraceTag(target.workdir.string());
+            job->gitRepo.remoteHost = remoteHostFromUrl(target.url);
+            job->update = update;
+            job->entry = update->progress.entries.size();
+            update->progress.entries.push_back({target.name, parentEntry, SubmodulePhase::QUEUED});
+            job->submodule = std::move(target);
+            update->pending++;
+            {
+                std::lock_guard<std::mutex> guard(statsLock);
+                beginJob();
+                batch.submodules++;
+            }
+            submitted->push(std::move(job));
+        }
+    }
+
+    // Queues the submodule's own submodules, and once none are left posts
+    // the superproject's result.
+    void finishSubmodule(std::unique_ptr<Job> job, bool ok, bool skipped, std::vector<SubmoduleTarget> nested)
+    {
+        std::shared_ptr<SubmoduleUpdate> update = job->update;
+        std::unique_ptr<Job> parent;
+        {
+            std::lock_guard<std::mutex> guard(update->lock);
+            update->progress.entries[job->entry].phase =
+                !ok ? SubmodulePhase::FAILED : skipped ? SubmodulePhase::SKIPPED : SubmodulePhase::DONE;
+            update->progress.finished++;
+            update->failed |= !ok;
+            update->message << job->message.str();
+            submitSubmodules(update, std::move(nested), job->entry);
+            if (--update->pending == 0) {
+                parent = std::move(update->parent);
+                parent->message << '\n' << update->message.str();
+            }
+        }
+        if (parent != nullptr) {
+            {
+                std::lock_guard<std::mutex> guard(statsLock);
+                submoduleUpdatesInFlight.erase(parent->id.slot);
+            }
+            bool failed = update->failed;
+            finish(std::move(parent), !failed);
+        }
+        endJob();
+    }
+
+    void addStageTime(PipelineStageStats& stage, double busy, double blocked)
+    {
+        std::lock_guard<std::mutex> guard(statsLock);
+        stage.jobs++;
+        stage.busySeconds += busy;
+        stage.blockedSeconds += blocked;
+    }
+
+    void finish(std::unique_ptr<Job> job, bool ok)
+    {
+        GitState state;
+        {
+            TraceTaskScope traceScope(job->gitRepo.traceTag, TracePhase::FASTFORWARD);
+            state = finishFastForward(job->gitRepo, job->sortKeys, job->message, ok);
+        }
+        post(*job, state, GitTask::FASTFORWARD);
+        endJob();
+    }
+
+    void post(Job& job, GitState state, GitTask task)
+    {
+        results.post({job.id,
+                      state,
+                      std::move(job.gitRepo.message),
+                      job.gitRepo.fetchStats,
+                      job.sortKeys,
+                      task,
+                      job.authRejected,
+                      job.busySeconds,
+                      job.gitRepo.blockedByLocalChanges});
+    }
+
+    void endJob()
+    {
+        std::lock_guard<std::mutex> guard(statsLock);
+        if (--inFlight > 0) {
+            return;
+        }
+        submoduleFetches.reset();
+        batch.wallSeconds = secondsSince(batchStart);
+        batch.queueHighWater = fetched->highWaterMark();
+        lastBatch = batch;
+        logMessage(
+            LogLevel::LEVEL_INFO,
+            "Fast-forwarded %llu repos and %llu submodules, rebased %llu repos in %.1fs: network %u workers %.0f%% busy "
+            "(%.1fs blocked on checkout), disk %u workers %.0f%% busy, queue peak %zu of %zu",
+            static_cast<unsigned long long>(batch.repos),
+            static_cast<unsigned long long>(batch.submodules),
+            static_cast<unsigned long long>(batch.rebases),
+            batch.wallSeconds,
+            batch.network.workers,
+            batch.network.utilization(batch.wallSeconds) * 100.0,
+            batch.network.blockedSeconds,
+            batch.disk.workers,
+            batch.disk.utilization(batch.wallSeconds) * 100.0,
+            batch.queueHighWater,
+            batch.queueCapacity);
+    }
+
+    RepoTaskResults& results;
+    uint32_t networkWorkerCount{FAST_FORWARD_NETWORK_WORKERS};
+    uint32_t diskWorkerCount{FAST_FORWARD_DISK_WORKERS};
+    std::atomic<bool> submoduleUpdates{false};
+    std::atomic<bool> autoStash{false};
+    SubmoduleFetches submoduleFetches; // URLs fetched this batch
+    bool started{false};
+    std::unique_ptr<BoundedQueue<std::unique_ptr<Job>>> submitted;
+    std::unique_ptr<BoundedQueue<std::unique_ptr<Job>>> fetched;
+    std::vector<std::thread> workers;
+
+    std::mutex statsLock;
+    uint64_t inFlight{0};
+    std::chrono::steady_clock::time_point batchStart;
+    FastForwardPipelineStats batch;
+    FastForwardPipelineStats lastBatch;
+    std::unordered_map<uint32_t, std::shared_ptr<SubmoduleUpdate>> submoduleUpdatesInFlight; // By parent slot
+};
+
+#endif
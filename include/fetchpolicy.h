@@ -0,0 +1,201 @@
+#ifndef FETCH_POLICY_H
+#define FETCH_POLICY_H
+
+#include "git2.h"
+#include "logsink.h"
+
+#include <algorithm>
+#include <cctype>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+constexpr const char* FETCH_POLICY_FILE_NAME = "fetch_policies.cfg";
+constexpr int FETCH_DEEPEN_LIMIT = 4096; // Shallow repos needing more history than this are unshallowed
+
+//--------------------------------------
+// struct FetchPolicy
+//--------------------------------------
+// One line of the fetch policy file:
+//     <path glob> [depth=<n>|depth=full] [filter=<spec>]
+// Relative globs are matched against the repo's working directory relative to
+// the scanned base directory; '*' stops at '/', '**' does not. The first
+// matching line wins. A depth keeps shallow clones shallow and is ignored for
+// full ones; negative depths are rejected.
+struct FetchPolicy
+{
+    std::string pattern{""};
+    int depth{GIT_FETCH_DEPTH_FULL};
+    std::string filter{""}; // e.g. "blob:none"; libgit2 does not negotiate filters yet
+};
+
+//--------------------------------------
+// struct FetchStats
+//--------------------------------------
+// Received bytes are totalled separately for full and depth-limited fetches.
+// Successive fetches bring in different amounts of history, so there is no
+// honest baseline to compute bytes saved by a depth limit from.
+struct FetchStats
+{
+    uint64_t receivedBytes{0};     // Last fetch
+    uint64_t receivedObjects{0};   // Last fetch
+    uint64_t fullDepthBytes{0};    // All fetches without a depth limit this session
+    uint64_t limitedDepthBytes{0}; // All depth-limited fetches this session
+    int depth{GIT_FETCH_DEPTH_FULL};
+};
+
+//--------------------------------------
+// globMatch()
+//--------------------------------------
+bool globMatch(std::string_view pattern, std::string_view path)
+{
+    if (pattern.empty()) {
+        return path.empty();
+    }
+    if (pattern.substr(0, 2) == "**") {
+        std::string_view rest = pattern.substr(2);
+        if (!rest.empty() && rest.front() == '/') {
+            // "**/" also matches zero directories
+            if (globMatch(rest.substr(1), path)) {
+                return true;
+            }
+        }
+        for (size_t i = 0; i <= path.size(); i++) {
+            if (globMatch(rest, path.substr(i))) {
+                return true;
+            }
+        }
+        return false;
+    }
+    if (pattern.front() == '*') {
+        for (size_t i = 0; i <= path.size(); i++) {
+            if (globMatch(pattern.substr(1), path.substr(i))) {
+                return true;
+            }
+            if (i < path.size() && path[i] == '/') {
+                break;
+            }
+        }
+        return false;
+    }
+    if (path.empty()) {
+        return false;
+    }
+    if (pattern.front() == '?' ? path.front() != '/' : pattern.front() == path.front()) {
+        return globMatch(pattern.substr(1), path.substr(1));
+    }
+    return false;
+}
+
+//--------------------------------------
+// normalizePolicyPath()
+//--------------------------------------
+std::string normalizePolicyPath(const std::filesystem::path& path)
+{
+    std::string out = path.generic_string();
+    while (out.size() > 1 && out.back() == '/') {
+        out.pop_back();
+    }
+#ifdef _WIN32
+    std::transform(out.begin(), out.end(), out.begin(), [](unsigned char c) { return std::tolower(c); });
+#endif
+    return out;
+}
+
+//--------------------------------------
+// loadFetchPolicies()
+//--------------------------------------
+std::vector<FetchPolicy> loadFetchPolicies(const std::filesystem::path& file)
+{
+    std::vector<FetchPolicy> policies;
+    std::ifstream in(file);
+    std::string line;
+    size_t lineNumber = 0;
+    while (std::getline(in, line)) {
+        lineNumber++;
+        std::istringstream tokens(line.substr(0, line.find('#')));
+        FetchPolicy policy;
+        if (!(tokens >> policy.pattern)) {
+            continue;
+        }
+        policy.pattern = normalizePolicyPath(policy.pattern);
+
+        std::string option;
+        while (tokens >> option) {
+            size_t equals = option.find('=');
+            std::string key = option.substr(0, equals);
+            std::string value = equals == std::string::npos ? "" : option.substr(equals + 1);
+            try {
+                if (key == "depth" && value == "full") {
+                    policy.depth = GIT_FETCH_DEPTH_FULL;
+                }
+                else if (key == "depth") {
+                    size_t used = 0;
+                    int depth = std::stoi(value, &used);
+                    if (depth < 0 || used != value.size()) {
+                        throw std::invalid_argument(value);
+                    }
+                    policy.depth = depth;
+                }
+                else if (key == "filter") {
+                    policy.filter = value;
+                }
+                else {
+                    logMessage(
+                        LogLevel::LEVEL_WARN,
+                        "%s:%zu: unknown fetch policy option '%s'",
+                        file.string().c_str(),
+                        lineNumber,
+                        key.c_str());
+                }
+            }
+            catch (const std::exception&) {
+                logMessage(
+                    LogLevel::LEVEL_WARN, "%s:%zu: invalid value for '%s'", file.string().c_str(), lineNumber, key.c_str());
+            }
+        }
+        policies.push_back(policy);
+    }
+    return policies;
+}
+
+//--------------------------------------
+// findFetchPolicy()
+//--------------------------------------
+FetchPolicy findFetchPolicy(
+    const std::vector<FetchPolicy>& policies,
+    const std::filesystem::path& workdir,
+    const std::filesystem::path& baseDirectory)
+{
+    std::string absolute = normalizePolicyPath(workdir);
+    std::string relative = normalizePolicyPath(workdir.lexically_relative(baseDirectory));
+    for (const FetchPolicy& policy : policies) {
+        bool isAbsolute = std::filesystem::path(policy.pattern).is_absolute() || policy.pattern.front() == '/';
+        if (globMatch(policy.pattern, isAbsolute ? absolute : relative)) {
+            return policy;
+        }
+    }
+    return FetchPolicy();
+}
+
+//--------------------------------------
+// recordFetchStats()
+//--------------------------------------
+void recordFetchStats(FetchStats& stats, int depth, const git_indexer_progress* progress)
+{
+    stats.depth = depth;
+    stats.receivedBytes = progress->received_bytes;
+    stats.receivedObjects = progress->received_objects;
+    if (depth == GIT_FETCH_DEPTH_FULL) {
+        stats.fullDepthBytes += stats.receivedBytes;
+    }
+    else {
+        stats.limitedDepthBytes += stats.receivedBytes;
+    }
+}
+
+#endif
@@ -0,0 +1,499 @@
+#ifndef GIT_ALLOCATOR_H
+#define GIT_ALLOCATOR_H
+
+#include "git2.h"
+#include "git2/sys/alloc.h"
+#include "tasktrace.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+constexpr size_t ALLOC_HEADER_SIZE = 16;          // Keeps the 16 byte alignment malloc gives us
+constexpr size_t ALLOC_REPO_SLOTS = 1 << 16;      // Repo tags past this are accounted in slot 0
+constexpr size_t ALLOC_THREAD_CACHE_LIMIT = 256;  // Free blocks kept per size class per thread
+constexpr size_t ALLOC_ACCOUNTING_BATCH = 256;    // Operations between flushes of the shared counters
+constexpr size_t ALLOC_SIZE_CLASSES[] = {32, 48, 64, 96, 128, 192, 256, 384, 512, 1024, 2048, 4096};
+constexpr size_t ALLOC_SIZE_CLASS_COUNT = sizeof(ALLOC_SIZE_CLASSES) / sizeof(ALLOC_SIZE_CLASSES[0]);
+constexpr uint8_t ALLOC_UNPOOLED = 0xFF;
+
+//--------------------------------------
+// enum AllocatorMode
+//--------------------------------------
+// The allocator is installed once before git_libgit2_init(). Every block
+// records how it was allocated, so the mode can be switched at any time.
+enum class AllocatorMode : uint8_t
+{
+    PASSTHROUGH, // malloc/free, no accounting
+    TRACKING,    // malloc/free, bytes accounted per repo and operation
+    POOLED,      // Tracking, with small blocks served from per-thread size class caches
+    COUNT,
+};
+
+//--------------------------------------
+// AllocatorModeToString()
+//--------------------------------------
+const char* AllocatorModeToString(AllocatorMode mode)
+{
+    switch (mode) {
+        case AllocatorMode::PASSTHROUGH:
+            return "passthrough";
+        case AllocatorMode::TRACKING:
+            return "tracking";
+        case AllocatorMode::POOLED:
+            return "pooled";
+        default:
+            return "unknown";
+    }
+}
+
+//--------------------------------------
+// parseAllocatorMode()
+//--------------------------------------
+std::optional<AllocatorMode> parseAllocatorMode(const std::string& name)
+{
+    for (uint8_t mode = 0; mode < static_cast<uint8_t>(AllocatorMode::COUNT); mode++) {
+        if (name == AllocatorModeToString(static_cast<AllocatorMode>(mode))) {
+            return static_cast<AllocatorMode>(mode);
+        }
+    }
+    return std::nullopt;
+}
+
+//--------------------------------------
+// struct AllocationHeader
+//--------------------------------------
+struct AllocationHeader
+{
+    uint64_t size;     // Bytes requested by libgit2
+    uint32_t tag;      // traceTaskContext.tag of the allocating thread
+    uint8_t operation; // traceTaskContext.operation of the allocating thread
+    uint8_t sizeClass; // Index into ALLOC_SIZE_CLASSES, or ALLOC_UNPOOLED
+    uint8_t tracked;   // Allocated while accounting was on
+    uint8_t reserved;
+};
+
+static_assert(sizeof(AllocationHeader) == ALLOC_HEADER_SIZE);
+
+//--------------------------------------
+// struct AllocationStats
+//--------------------------------------
+struct AllocationStats
+{
+    int64_t liveBytes{0};
+    uint64_t totalBytes{0};
+    uint64_t allocations{0};
+};
+
+//--------------------------------------
+// struct AllocationAccount
+//--------------------------------------
+struct AllocationAccount
+{
+    std::atomic<int64_t> liveBytes{0};
+    std::atomic<uint64_t> totalBytes{0};
+    std::atomic<uint64_t> allocations{0};
+
+    void add(int64_t live, uint64_t total, uint64_t count)
+    {
+        liveBytes.fetch_add(live, std::memory_order_relaxed);
+        totalBytes.fetch_add(total, std::memory_order_relaxed);
+        allocations.fetch_add(count, std::memory_order_relaxed);
+    }
+
+    AllocationStats load() const
+    {
+        return {
+            liveBytes.load(std::memory_order_relaxed),
+            totalBytes.load(std::memory_order_relaxed),
+            allocations.load(std::memory_order_relaxed)};
+    }
+};
+
+//--------------------------------------
+// struct GitAllocatorState
+//--------------------------------------
+// Repo accounts are written directly since a repo is usually worked on by one
+// thread at a time. Operation accounts are shared by every worker, so each
+// thread batches its changes to them and flushes every ALLOC_ACCOUNTING_BATCH
+// operations.
+struct GitAllocatorState
+{
+    std::atomic<AllocatorMode> mode{AllocatorMode::PASSTHROUGH};
+    bool installed{false};
+    std::unique_ptr<AllocationAccount[]> repoAccounts;
+    AllocationAccount operationAccounts[TRACE_PHASE_COUNT + 1]; // Last slot: outside any task
+
+    std::mutex poolLock;
+    std::vector<void*> pool[ALLOC_SIZE_CLASS_COUNT];
+    std::atomic<uint64_t> poolHits{0};
+    std::atomic<uint64_t> poolMisses{0};
+};
+
+// Never destroyed: libgit2 frees global state after static destructors may
+// already have run.
+GitAllocatorState& gitAllocatorState()
+{
+    static GitAllocatorState* state = new GitAllocatorState();
+    return *state;
+}
+
+//--------------------------------------
+// struct AllocatorThreadCache
+//--------------------------------------
+struct AllocatorThreadCache
+{
+    std::vector<void*> blocks[ALLOC_SIZE_CLASS_COUNT];
+    int64_t operationLive[TRACE_PHASE_COUNT + 1]{};
+    uint64_t operationTotal[TRACE_PHASE_COUNT + 1]{};
+    uint64_t operationCount[TRACE_PHASE_COUNT + 1]{};
+    uint64_t poolHits{0};
+    uint64_t poolMisses{0};
+    size_t pending{0};
+
+    void flushAccounting()
+    {
+        GitAllocatorState& state = gitAllocatorState();
+        for (size_t i = 0; i <= TRACE_PHASE_COUNT; i++) {
+            if (operationCount[i] != 0 || operationLive[i] != 0) {
+                state.operationAccounts[i].add(operationLive[i], operationTotal[i], operationCount[i]);
+                operationLive[i] = 0;
+                operationTotal[i] = 0;
+                operationCount[i] = 0;
+            }
+        }
+        state.poolHits.fetch_add(poolHits, std::memory_order_relaxed);
+        state.poolMisses.fetch_add(poolMisses, std::memory_order_relaxed);
+        poolHits = 0;
+        poolMisses = 0;
+        pending = 0;
+    }
+
+    ~AllocatorThreadCache();
+};
+
+// libgit2 can still free memory from its own thread-exit hooks after the
+// cache is destroyed; this flag is trivially destructible so it can be
+// checked at any point.
+thread_local bool allocatorThreadCacheDestroyed = false;
+thread_local AllocatorThreadCache allocatorThreadCache;
+
+AllocatorThreadCache::~AllocatorThreadCache()
+{
+    allocatorThreadCacheDestroyed = true;
+    flushAccounting();
+    GitAllocatorState& state = gitAllocatorState();
+    std::lock_guard<std::mutex> lock(state.poolLock);
+    for (size_t i = 0; i < ALLOC_SIZE_CLASS_COUNT; i++) {
+        state.pool[i].insert(state.pool[i].end(), blocks[i].begin(), blocks[i].end());
+        blocks[i].clear();
+    }
+}
+
+AllocatorThreadCache* currentAllocatorThreadCache()
+{
+    return allocatorThreadCacheDestroyed ? nullptr : &allocatorThreadCache;
+}
+
+//--------------------------------------
+// allocationSizeClass()
+//--------------------------------------
+uint8_t allocationSizeClass(size_t blockSize)
+{
+    for (size_t i = 0; i < ALLOC_SIZE_CLASS_COUNT; i++) {
+        if (blockSize <= ALLOC_SIZE_CLASSES[i]) {
+            return static_cast<uint8_t>(i);
+        }
+    }
+    return ALLOC_UNPOOLED;
+}
+
+//--------------------------------------
+// accountAllocation()
+//--------------------------------------
+// Charges to the block's owner, not the current thread. Frees pass negative
+// bytes; reallocs pass the size change with no new allocation.
+void accountAllocation(const AllocationHeader& header, int64_t bytes, uint64_t allocations)
+{
+    GitAllocatorState& state = gitAllocatorState();
+    uint64_t total = bytes > 0 ? static_cast<uint64_t>(bytes) : 0;
+    size_t repoSlot = header.tag < ALLOC_REPO_SLOTS ? header.tag : 0;
+    state.repoAccounts[repoSlot].add(bytes, total, allocations);
+
+    size_t operation = header.operation < TRACE_PHASE_COUNT ? header.operation : TRACE_PHASE_COUNT;
+    AllocatorThreadCache* cache = currentAllocatorThreadCache();
+    if (cache == nullptr) {
+        state.operationAccounts[operation].add(bytes, total, allocations);
+        return;
+    }
+    cache->operationLive[operation] += bytes;
+    cache->operationTotal[operation] += total;
+    cache->operationCount[operation] += allocations;
+    if (++cache->pending >= ALLOC_ACCOUNTING_BATCH) {
+        cache->flushAccounting();
+    }
+}
+
+//--------------------------------------
+// poolAllocate()
+//--------------------------------------
+void* poolAllocate(uint8_t sizeClass)
+{
+    AllocatorThreadCache* cache = currentAllocatorThreadCache();
+    if (cache != nullptr) {
+        std::vector<void*>& blocks = cache->blocks[sizeClass];
+        if (blocks.empty()) {
+            // Refill half a cache's worth at once so the shared lock is rarely taken
+            GitAllocatorState& state = gitAllocatorState();
+            std::lock_guard<std::mutex> lock(state.poolLock);
+            std::vector<void*>& shared = state.pool[sizeClass];
+            size_t take = shared.size() < ALLOC_THREAD_CACHE_LIMIT / 2 ? shared.size() : ALLOC_THREAD_CACHE_LIMIT / 2;
+            blocks.insert(blocks.end(), shared.end() - take, shared.end());
+            shared.resize(shared.size() - take);
+        }
+        if (!blocks.empty()) {
+            void* block = blocks.back();
+            blocks.pop_back();
+            cache->poolHits++;
+            return block;
+        }
+        cache->poolMisses++;
+    }
+    return malloc(ALLOC_SIZE_CLASSES[sizeClass]);
+}
+
+//--------------------------------------
+// poolFree()
+//--------------------------------------
+void poolFree(void* block, uint8_t sizeClass)
+{
+    AllocatorThreadCache* cache = currentAllocatorThreadCache();
+    if (cache == nullptr) {
+        GitAllocatorState& state = gitAllocatorState();
+        std::lock_guard<std::mutex> lock(state.poolLock);
+        state.pool[sizeClass].push_back(block);
+        return;
+    }
+
+    std::vector<void*>& blocks = cache->blocks[sizeClass];
+    if (blocks.size() >= ALLOC_THREAD_CACHE_LIMIT) {
+        // Hand half back so threads that only free (e.g. the UI dropping
+        // repos) don't hoard blocks other workers could use
+        GitAllocatorState& state = gitAllocatorState();
+        std::lock_guard<std::mutex> lock(state.poolLock);
+        state.pool[sizeClass].insert(state.pool[sizeClass].end(), blocks.begin() + blocks.size() / 2, blocks.end());
+        blocks.resize(blocks.size() / 2);
+    }
+    blocks.push_back(block);
+}
+
+//--------------------------------------
+// releaseBlock()
+//--------------------------------------
+void releaseBlock(AllocationHeader* header)
+{
+    if (header->sizeClass == ALLOC_UNPOOLED) {
+        free(header);
+    }
+    else {
+        poolFree(header, header->sizeClass);
+    }
+}
+
+//--------------------------------------
+// gitAllocatorMalloc()
+//--------------------------------------
+void* gitAllocatorMalloc(size_t size, const char* file, int line)
+{
+    (void)file;
+    (void)line;
+    if (size > SIZE_MAX - ALLOC_HEADER_SIZE) {
+        return nullptr;
+    }
+
+    AllocatorMode mode = gitAllocatorState().mode.load(std::memory_order_relaxed);
+    uint8_t sizeClass = mode == AllocatorMode::POOLED ? allocationSizeClass(size + ALLOC_HEADER_SIZE) : ALLOC_UNPOOLED;
+    void* block = sizeClass == ALLOC_UNPOOLED ? malloc(size + ALLOC_HEADER_SIZE) : poolAllocate(sizeClass);
+    if (block == nullptr) {
+        return nullptr;
+    }
+
+    AllocationHeader* header = static_cast<AllocationHeader*>(block);
+    header->size = size;
+    header->tag = traceTaskContext.tag;
+    header->operation = static_cast<uint8_t>(traceTaskContext.operation);
+    header->sizeClass = sizeClass;
+    header->tracked = mode != AllocatorMode::PASSTHROUGH;
+    header->reserved = 0;
+    if (header->tracked) {
+        accountAllocation(*header, static_cast<int64_t>(size), 1);
+    }
+    return static_cast<char*>(block) + ALLOC_HEADER_SIZE;
+}
+
+//--------------------------------------
+// gitAllocatorFree()
+//--------------------------------------
+void gitAllocatorFree(void* ptr)
+{
+    if (ptr == nullptr) {
+        return;
+    }
+
+    AllocationHeader* header = reinterpret_cast<AllocationHeader*>(static_cast<char*>(ptr) - ALLOC_HEADER_SIZE);
+    if (header->tracked) {
+        accountAllocation(*header, -static_cast<int64_t>(header->size), 0);
+    }
+    releaseBlock(header);
+}
+
+//--------------------------------------
+// gitAllocatorRealloc()
+//--------------------------------------
+// Growth stays with the block's original owner, so a buffer built up over a
+// task is charged to that task.
+void* gitAllocatorRealloc(void* ptr, size_t size, const char* file, int line)
+{
+    if (ptr == nullptr) {
+        return gitAllocatorMalloc(size, file, line);
+    }
+    if (size > SIZE_MAX - ALLOC_HEADER_SIZE) {
+        return nullptr;
+    }
+
+    AllocationHeader* header = reinterpret_cast<AllocationHeader*>(static_cast<char*>(ptr) - ALLOC_HEADER_SIZE);
+    int64_t delta = static_cast<int64_t>(size) - static_cast<int64_t>(header->size);
+    size_t blockSize = size + ALLOC_HEADER_SIZE;
+
+    // Still fits the size class it came from
+    if (header->sizeClass != ALLOC_UNPOOLED && blockSize <= ALLOC_SIZE_CLASSES[header->sizeClass]) {
+        header->size = size;
+        if (header->tracked) {
+            accountAllocation(*header, delta, 0);
+        }
+        return ptr;
+    }
+
+    // Large blocks, or any unpooled block outside pooled mode, resize in place
+    bool pooled = gitAllocatorState().mode.load(std::memory_order_relaxed) == AllocatorMode::POOLED;
+    if (header->sizeClass == ALLOC_UNPOOLED && (!pooled || allocationSizeClass(blockSize) == ALLOC_UNPOOLED)) {
+        AllocationHeader* resized = static_cast<AllocationHeader*>(realloc(header, blockSize));
+        if (resized == nullptr) {
+            return nullptr;
+        }
+        resized->size = size;
+        if (resized->tracked) {
+            accountAllocation(*resized, delta, 0);
+        }
+        return reinterpret_cast<char*>(resized) + ALLOC_HEADER_SIZE;
+    }
+
+    // Moving between pooled and unpooled storage
+    uint8_t sizeClass = pooled ? allocationSizeClass(blockSize) : ALLOC_UNPOOLED;
+    void* block = sizeClass == ALLOC_UNPOOLED ? malloc(blockSize) : poolAllocate(sizeClass);
+    if (block == nullptr) {
+        return nullptr;
+    }
+    AllocationHeader* moved = static_cast<AllocationHeader*>(block);
+    *moved = *header;
+    moved->size = size;
+    moved->sizeClass = sizeClass;
+    memcpy(static_cast<char*>(block) + ALLOC_HEADER_SIZE, ptr, header->size < size ? header->size : size);
+    releaseBlock(header);
+    if (moved->tracked) {
+        accountAllocation(*moved, delta, 0);
+    }
+    return static_cast<char*>(block) + ALLOC_HEADER_SIZE;
+}
+
+//--------------------------------------
+// installGitAllocator()
+//--------------------------------------
+// Must run before git_libgit2_init(): anything libgit2 allocated with another
+// allocator would otherwise come back here to be freed.
+bool installGitAllocator(AllocatorMode mode)
+{
+    GitAllocatorState& state = gitAllocatorState();
+    state.repoAccounts = std::make_unique<AllocationAccount[]>(ALLOC_REPO_SLOTS);
+    state.mode = mode;
+
+    git_allocator allocator;
+    allocator.gmalloc = gitAllocatorMalloc;
+    allocator.grealloc = gitAllocatorRealloc;
+    allocator.gfree = gitAllocatorFree;
+    state.installed = git_libgit2_opts(GIT_OPT_SET_ALLOCATOR, &allocator) == 0;
+    return state.installed;
+}
+
+//--------------------------------------
+// setGitAllocatorMode()
+//--------------------------------------
+void setGitAllocatorMode(AllocatorMode mode)
+{
+    gitAllocatorState().mode = mode;
+}
+
+//--------------------------------------
+// gitAllocatorMode()
+//--------------------------------------
+AllocatorMode gitAllocatorMode()
+{
+    return gitAllocatorState().mode.load(std::memory_order_relaxed);
+}
+
+//--------------------------------------
+// repoAllocationStats()
+//--------------------------------------
+AllocationStats repoAllocationStats(uint32_t tag)
+{
+    GitAllocatorState& state = gitAllocatorState();
+    if (!state.installed || tag == 0 || tag >= ALLOC_REPO_SLOTS) {
+        return AllocationStats();
+    }
+    return state.repoAccounts[tag].load();
+}
+
+//--------------------------------------
+// operationAllocationStats()
+//--------------------------------------
+// TracePhase::COUNT gives allocations made outside any task. Lags the repo
+// accounts by up to one batch per thread.
+AllocationStats operationAllocationStats(TracePhase operation)
+{
+    GitAllocatorState& state = gitAllocatorState();
+    return state.installed ? state.operationAccounts[static_cast<size_t>(operation)].load() : AllocationStats();
+}
+
+//--------------------------------------
+// totalAllocationStats()
+//--------------------------------------
+AllocationStats totalAllocationStats()
+{
+    AllocationStats total;
+    for (size_t i = 0; i <= TRACE_PHASE_COUNT; i++) {
+        AllocationStats stats = operationAllocationStats(static_cast<TracePhase>(i));
+        total.liveBytes += stats.liveBytes;
+        total.totalBytes += stats.totalBytes;
+        total.allocations += stats.allocations;
+    }
+    return total;
+}
+
+//--------------------------------------
+// poolHitRate()
+//--------------------------------------
+double poolHitRate()
+{
+    GitAllocatorState& state = gitAllocatorState();
+    uint64_t hits = state.poolHits.load(std::memory_order_relaxed);
+    uint64_t misses = state.poolMisses.load(std::memory_order_relaxed);
+    return hits + misses == 0 ? 0.0 : static_cast<double>(hits) / (hits + misses);
+}
+
+#endif
@@ -2,17 +2,29 @@
 #define GIT_REPO_H
 
 #include "git2.h"
-#include "cpputils/windows/credential_utils.h"
+#include "git2/sys/errors.h"
+#include "credentialstore.h"
+#include "authbreaker.h"
+#include "fetchpolicy.h"
+#include "repodiscovery.h"
+#include "tasktrace.h"
+#include "logsink.h"
+#include "latencyhistogram.h"
+#include "hostlimiter.h"
+#include "refsnapshot.h"
 
+#include <algorithm>
 #include <filesystem>
 #include <array>
+#include <chrono>
+#include <condition_variable>
 #include <mutex>
 #include <optional>
 #include <memory>
 #include <thread>
 #include <sstream>
-
-constexpr const char* GIT_REPO_MANAGER_CREDENTIAL_TARGE_NAME = "StopwatchString/Git-Repo-Manager";
+#include <unordered_map>
+#include <vector>
 
 //--------------------------------------
 // enum GitState
@@ -29,6 +41,8 @@ enum class GitState
     ERROR_STATE,
 };
 
+constexpr size_t GIT_STATE_COUNT = static_cast<size_t>(GitState::ERROR_STATE) + 1;
+
 //--------------------------------------
 // GitStateToString()
 //--------------------------------------
@@ -66,6 +80,23 @@ std::string GitStateToString(const GitState& state)
     return stateStr;
 }
 
+//--------------------------------------
+// formatBytes()
+//--------------------------------------
+std::string formatBytes(uint64_t bytes)
+{
+    constexpr const char* units[] = {"B", "KiB", "MiB", "GiB", "TiB"};
+    double value = static_cast<double>(bytes);
+    size_t unit = 0;
+    while (value >= 1024.0 && unit + 1 < std::size(units)) {
+        value /= 1024.0;
+        unit++;
+    }
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), unit == 0 ? "%.0f %s" : "%.1f %s", value, units[unit]);
+    return buffer;
+}
+
 //--------------------------------------
 // enum GitTask
 //--------------------------------------
@@ -75,75 +106,181 @@ enum class GitTask
     FETCH,
     FASTFORWARD,
     PUSH,
+    REBASE,
     PROCESSING,
 };
 
+constexpr size_t GIT_TASK_COUNT = static_cast<size_t>(GitTask::PROCESSING) + 1;
+constexpr double TASK_TIMING_WEIGHT = 0.3; // Weight of the newest run in a repo's average task time
+
 //--------------------------------------
-// struct GitRepo
+// struct RepoTaskTimings
 //--------------------------------------
-struct GitRepo
+// Moving average of how long each task took on one repo, so estimates follow
+// a repo as it grows without one slow run dominating.
+struct RepoTaskTimings
 {
-    git_repository* repo{nullptr};
-    std::filesystem::path repoPath{""};
-    GitState state{GitState::NONE};
-    std::string message{""};
-    std::unique_ptr<std::mutex> processingMutex{std::make_unique<std::mutex>()};
-    GitTask task{GitTask::NONE};
+    std::array<double, GIT_TASK_COUNT> seconds{};
+    std::array<uint32_t, GIT_TASK_COUNT> runs{};
 
-    GitRepo() = default;
+    void record(GitTask task, double taken)
+    {
+        size_t i = static_cast<size_t>(task);
+        seconds[i] = runs[i] == 0 ? taken : seconds[i] + TASK_TIMING_WEIGHT * (taken - seconds[i]);
+        runs[i]++;
+    }
+};
 
-    GitRepo(git_repository* repo, std::filesystem::path repoPath, GitState state, std::string message) :
-        repo(repo), repoPath(repoPath), state(state), message(message)
-    {}
+//--------------------------------------
+// struct RepoSortKeys
+//--------------------------------------
+// Status values the list can be sorted by, 16 bytes per repo. Times are
+// seconds since the epoch, 0 when unknown.
+struct RepoSortKeys
+{
+    uint32_t ahead{0};
+    uint32_t behind{0};
+    uint32_t commitTime{0}; // Checked out commit
+    uint32_t fetchTime{0};  // Last successful fetch this session
 
-    GitRepo(const GitRepo& other) :
-        repo(other.repo), repoPath(other.repoPath), state(other.state), message(other.message)
-    {}
+    bool operator==(const RepoSortKeys& other) const = default;
+};
 
-    GitRepo(GitRepo&& other) = default;
+//--------------------------------------
+// struct GitRepo
+//--------------------------------------
+// Cold per-repo data; state and task live in RepoTable's hot arrays. Tasks run
+// on a worker's own copy, which keeps the repository open through the shared
+// handle even if a rescan drops the table entry mid-task.
+struct GitRepo
+{
+    std::shared_ptr<git_repository> repo{nullptr};
+    std::filesystem::path repoPath{""};
+    std::string branch{""}; // Checked out branch at scan time, empty if HEAD is detached or unborn
+    std::string message{""};
+    FetchPolicy fetchPolicy;
+    FetchStats fetchStats;
+    uint32_t traceTag{0};
+    std::string remoteHost{""}; // Host of 'origin', keys the per-host latency histograms
+    RepoLayout layout{RepoLayout::STANDARD};
+    std::filesystem::path commonDirectory{""};       // Shared by worktrees of one repo; fetches are shared too
+    std::chrono::steady_clock::time_point taskQueued; // When the running task was handed to a worker
+    RefSnapshot refSnapshot;                          // HEAD and upstream when the repo was last opened
+    GitState snapshotState{GitState::NONE};           // State computed from refSnapshot
+    RepoTaskTimings timings;                          // Kept across rescans
+    bool blockedByLocalChanges{false};                // Last fast-forward checkout stopped on local changes
 };
 
-const static std::array<GitRepo, 8> testRepos = {
-    GitRepo(nullptr, "C:\\testRepo1\\.git\\", GitState::NONE, "test message 1"),
-    GitRepo(nullptr, "C:\\testRepo2\\.git\\", GitState::UPTODATE, "test message 2"),
-    GitRepo(nullptr, "C:\\testRepo3\\.git\\", GitState::PUSH, "test message 3"),
-    GitRepo(nullptr, "C:\\testRepo4\\.git\\", GitState::FASTFORWARD, "test message 4 \n Is this on the next line?"),
-    GitRepo(nullptr, "C:\\testRepo5\\.git\\", GitState::DIVERGED, "test message 5"),
-    GitRepo(nullptr, "C:\\testRepo6\\.git\\", GitState::REBASE, "test message 6"),
-    GitRepo(nullptr, "C:\\testRepo7\\.get\\", GitState::PROCESSING, "test message 7"),
-    GitRepo(nullptr, "C:\\testRepo8\\.get\\", GitState::ERROR_STATE, "test message 8"),
+//--------------------------------------
+// struct TestRepo
+//--------------------------------------
+struct TestRepo
+{
+    const char* repoPath;
+    GitState state;
+    const char* message;
 };
 
+const static std::array<TestRepo, 8> testRepos = {{
+    {"C:\\testRepo1\\.git\\", GitState::NONE, "test message 1"},
+    {"C:\\testRepo2\\.git\\", GitState::UPTODATE, "test message 2"},
+    {"C:\\testRepo3\\.git\\", GitState::PUSH, "test message 3"},
+    {"C:\\testRepo4\\.git\\", GitState::FASTFORWARD, "test message 4 \n Is this on the next line?"},
+    {"C:\\testRepo5\\.git\\", GitState::DIVERGED, "test message 5"},
+    {"C:\\testRepo6\\.git\\", GitState::REBASE, "test message 6"},
+    {"C:\\testRepo7\\.get\\", GitState::PROCESSING, "test message 7"},
+    {"C:\\testRepo8\\.get\\", GitState::ERROR_STATE, "test message 8"},
+}};
+
 //--------------------------------------
 // credentialAcquireCallback()
 //--------------------------------------
 int credentialAcquireCallback(
     git_cred** out, const char* url, const char* username_from_url, unsigned int allowed_types, void* payload)
 {
-    cpputils::windows::Credential credential
-        = cpputils::windows::readCredential(GIT_REPO_MANAGER_CREDENTIAL_TARGE_NAME);
-    return git_cred_userpass_plaintext_new(out, credential.username.c_str(), credential.credentialBlob.c_str());
+    if ((allowed_types & GIT_CREDENTIAL_USERPASS_PLAINTEXT) == 0) {
+        return GIT_PASSTHROUGH;
+    }
+    std::string host = url != nullptr ? remoteHostFromUrl(url) : "";
+
+    // Asked again, so the credential just sent was turned down. Stop here
+    // rather than let libgit2 retry it, and drop it from the cache so the
+    // next task reads the store again.
+    if (authAttempt.requests > 0) {
+        authAttempt.rejected = true;
+        authBreaker().recordFailure(host);
+        credentialCache().invalidate(host);
+        git_error_set_str(GIT_ERROR_NET, ("Credentials rejected by " + host).c_str());
+        return GIT_EAUTH;
+    }
+    if (authBreaker().isOpen(host)) {
+        authAttempt.rejected = true;
+        std::string error = "Credentials rejected by " + host + "; enter a new credential to retry";
+        git_error_set_str(GIT_ERROR_NET, error.c_str());
+        return GIT_EAUTH;
+    }
+    authAttempt.requests++;
+
+    std::optional<Credential> credential
+        = credentialCache().acquire(host, username_from_url != nullptr ? username_from_url : "");
+    if (!credential.has_value()) {
+        return GIT_PASSTHROUGH;
+    }
+    return git_cred_userpass_plaintext_new(out, credential->username.c_str(), credential->secret.c_str());
+}
+
+//--------------------------------------
+// gitStateFromAheadBehind()
+//--------------------------------------
+GitState gitStateFromAheadBehind(size_t ahead, size_t behind)
+{
+    if (ahead == 0 && behind == 0) {
+        return GitState::UPTODATE;
+    }
+    if (ahead == 0) {
+        return GitState::FASTFORWARD;
+    }
+    if (behind == 0) {
+        return GitState::PUSH;
+    }
+    return GitState::DIVERGED;
 }
 
 //--------------------------------------
 // getRepoState()
 //--------------------------------------
-GitState getRepoState(git_repository* repo)
+// Also refreshes the ahead/behind counts and HEAD commit time in sortKeys when
+// given; the fetch time is left to the caller.
+GitState getRepoState(git_repository* repo, RepoSortKeys* sortKeys = nullptr)
 {
+    TraceSpan span(TracePhase::STATUS);
+    LatencyTimer latency(LatencyOp::STATUS, "");
+
     // Get reference to repo head
     git_reference* head_ref = nullptr;
     int error = git_repository_head(&head_ref, repo);
     if (error != 0) {
-        const git_error* e = git_error_last();
-        std::cerr << "Error retrieving HEAD: " << git_error_last()->message << std::endl;
+        logMessage(LogLevel::LEVEL_ERROR, "Error retrieving HEAD: %s", git_error_last()->message);
         return GitState::NONE;
     }
 
+    // Time of the checked out commit
+    if (sortKeys != nullptr) {
+        sortKeys->ahead = 0;
+        sortKeys->behind = 0;
+        git_commit* head_commit = nullptr;
+        if (git_reference_peel(reinterpret_cast<git_object**>(&head_commit), head_ref, GIT_OBJECT_COMMIT) == 0) {
+            git_time_t time = git_commit_time(head_commit);
+            sortKeys->commitTime = time > 0 ? static_cast<uint32_t>(time) : 0;
+            git_commit_free(head_commit);
+        }
+    }
+
     // Get current branch name
     const char* branch_name = nullptr;
     git_branch_name(&branch_name, head_ref);
     if (branch_name == nullptr) {
-        std::cerr << "Error determining branch name." << std::endl;
+        logMessage(LogLevel::LEVEL_ERROR, "Error determining branch name.");
         git_reference_free(head_ref);
         return GitState::NONE;
     }
@@ -153,10 +290,10 @@ GitState getRepoState(git_repository* repo)
     error = git_branch_upstream(&upstream_ref, head_ref);
     if (error != 0) {
         if (error == GIT_ENOTFOUND) {
-            std::cout << "No upstream branch configured." << std::endl;
+            logMessage(LogLevel::LEVEL_INFO, "No upstream branch configured.");
         }
         else {
-            std::cerr << "Error getting upstream branch: " << git_error_last()->message << std::endl;
+            logMessage(LogLevel::LEVEL_ERROR, "Error getting upstream branch: %s", git_error_last()->message);
         }
         git_reference_free(head_ref);
         return GitState::NONE;
@@ -171,25 +308,18 @@ GitState getRepoState(git_repository* repo)
     const git_oid* upstream_oid = git_reference_target(upstream_ref);
     size_t ahead = 0, behind = 0;
     error = git_graph_ahead_behind(&ahead, &behind, repo, local_oid, upstream_oid);
+    if (error == 0 && sortKeys != nullptr) {
+        sortKeys->ahead = static_cast<uint32_t>(ahead < UINT32_MAX ? ahead : UINT32_MAX);
+        sortKeys->behind = static_cast<uint32_t>(behind < UINT32_MAX ? behind : UINT32_MAX);
+    }
 
     // Determine repostate
     GitState state = GitState::NONE;
     if (error != 0) {
-        std::cerr << "Error calculating ahead/behind: " << git_error_last()->message << std::endl;
+        logMessage(LogLevel::LEVEL_ERROR, "Error calculating ahead/behind: %s", git_error_last()->message);
     }
     else {
-        if (ahead == 0 && behind == 0) {
-            state = GitState::UPTODATE;
-        }
-        else if (ahead == 0 && behind > 0) {
-            state = GitState::FASTFORWARD;
-        }
-        else if (ahead > 0 && behind == 0) {
-            state = GitState::PUSH;
-        }
-        else {
-            state = GitState::DIVERGED;
-        }
+        state = gitStateFromAheadBehind(ahead, behind);
     }
 
     git_reference_free(upstream_ref);
@@ -197,65 +327,536 @@ GitState getRepoState(git_repository* repo)
     return state;
 }
 
+//--------------------------------------
+// findGitDirectories()
+//--------------------------------------
+// Path to open for every repo under root, in traversal order.
+std::vector<std::filesystem::path> findGitDirectories(const std::filesystem::path& root)
+{
+    std::vector<std::filesystem::path> gitDirectories;
+    for (DiscoveredRepo& repo : discoverRepos(root)) {
+        gitDirectories.push_back(std::move(repo.openPath));
+    }
+    return gitDirectories;
+}
+
+//--------------------------------------
+// commonDirectoryPrefixLength()
+//--------------------------------------
+// Length of the leading directories every path shares, up to and including
+// the last separator. A single path shares nothing, so its name stays visible.
+size_t commonDirectoryPrefixLength(const std::vector<std::string>& paths)
+{
+    if (paths.size() < 2) {
+        return 0;
+    }
+    size_t prefix = paths[0].size();
+    for (const std::string& path : paths) {
+        prefix = std::mismatch(paths[0].begin(), paths[0].begin() + prefix, path.begin(), path.end()).first
+                 - paths[0].begin();
+    }
+    if (prefix == 0) {
+        return 0;
+    }
+    size_t separator = paths[0].find_last_of("/\\", prefix - 1);
+    return separator == std::string::npos ? 0 : separator + 1;
+}
+
 //--------------------------------------
 // makeGitRepo()
 //--------------------------------------
-std::optional<GitRepo> makeGitRepo(const std::filesystem::path& repoPath)
+std::optional<GitRepo> makeGitRepo(const std::filesystem::path& repoPath, GitState& state, RepoSortKeys& sortKeys)
 {
+    auto discoveryStart = std::chrono::steady_clock::now();
     GitRepo gitRepo;
+    gitRepo.traceTag = internTraceTag(repoDisplayPath(repoPath).string());
+    TraceTaskScope traceScope(gitRepo.traceTag, TracePhase::OPEN);
 
     // Open Repo
-    gitRepo.repo = nullptr;
-    int error = git_repository_open(&gitRepo.repo, repoPath.string().c_str());
+    git_repository* repo = nullptr;
+    int error;
+    {
+        TraceSpan span(TracePhase::OPEN);
+        error = git_repository_open(&repo, repoPath.string().c_str());
+    }
     if (error != 0) {
         const git_error* e = git_error_last();
-        std::cerr << "Error opening repository: " << (e && e->message ? e->message : "Unknown error") << std::endl;
+        logMessage(LogLevel::LEVEL_ERROR, "Error opening repository: %s", e && e->message ? e->message : "Unknown error");
         return std::nullopt;
     }
+    gitRepo.repo = std::shared_ptr<git_repository>(repo, git_repository_free);
 
     // Get repo state
-    std::optional<GitState> state = getRepoState(gitRepo.repo);
-    if (!state.has_value()) {
-        std::cerr << "Error getting repository state: " << repoPath << std::endl;
-        git_repository_free(gitRepo.repo);
-        return std::nullopt;
-    }
-    gitRepo.state = state.value();
+    state = getRepoState(repo, &sortKeys);
 
     // Set repo path
     gitRepo.repoPath = repoPath;
 
+    // Checked out branch
+    git_reference* head = nullptr;
+    if (git_repository_head(&head, repo) == 0) {
+        if (git_reference_is_branch(head)) {
+            gitRepo.branch = git_reference_shorthand(head);
+        }
+        git_reference_free(head);
+    }
+
+    // Remote host for per-host metrics
+    git_remote* origin = nullptr;
+    if (git_remote_lookup(&origin, repo, "origin") == 0) {
+        const char* url = git_remote_url(origin);
+        gitRepo.remoteHost = url ? remoteHostFromUrl(url) : "";
+        git_remote_free(origin);
+    }
+
+    recordLatency(
+        LatencyOp::DISCOVERY,
+        gitRepo.remoteHost,
+        std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - discoveryStart)
+            .count());
     return gitRepo;
 }
 
 //--------------------------------------
-// fetchRepo()
+// rescanGitRepo()
+//--------------------------------------
+// Rescan entry point: previous, when given, is the repo's entry from the last
+// scan with its current sort keys in sortKeys. If HEAD and the upstream read
+// straight from disk match what it was opened with, it is reused as is and
+// libgit2 is skipped; otherwise the repo is opened afresh, keeping its task
+// timings and whether local changes blocked its last fast-forward. Callers
+// clear the snapshot of an entry whose handle a task is still using, which
+// forces the open.
+std::optional<GitRepo> rescanGitRepo(
+    const DiscoveredRepo& discovered, const GitRepo* previous, GitState& state, RepoSortKeys& sortKeys)
+{
+    RefSnapshot snapshot = readRefSnapshot(discovered.gitDirectory, discovered.commonDirectory);
+    if (previous != nullptr && previous->repo != nullptr && snapshot == previous->refSnapshot) {
+        GitRepo gitRepo = *previous;
+        gitRepo.message.clear();
+        gitRepo.layout = discovered.layout;
+        gitRepo.commonDirectory = discovered.commonDirectory;
+        state = gitRepo.snapshotState;
+        return gitRepo;
+    }
+
+    sortKeys = RepoSortKeys();
+    std::optional<GitRepo> gitRepo = makeGitRepo(discovered.openPath, state, sortKeys);
+    if (gitRepo.has_value()) {
+        gitRepo->layout = discovered.layout;
+        gitRepo->commonDirectory = discovered.commonDirectory;
+        gitRepo->refSnapshot = snapshot;
+        gitRepo->snapshotState = state;
+        if (previous != nullptr) {
+            gitRepo->timings = previous->timings;
+            gitRepo->blockedByLocalChanges = previous->blockedByLocalChanges;
+        }
+    }
+    return gitRepo;
+}
+
+//--------------------------------------
+// fetchTransferProgressCallback()
 //--------------------------------------
-void fetchRepo(GitRepo& gitRepo)
+// Moves the fetch timeline from negotiation to transfer once pack data
+// arrives, and on to indexing once every object has been received.
+int fetchTransferProgressCallback(const git_indexer_progress* stats, void* payload)
 {
-    std::this_thread::sleep_for(std::chrono::seconds(3));
-    gitRepo.message = "Fetched";
-    gitRepo.task = GitTask::NONE;
-    gitRepo.state = getRepoState(gitRepo.repo);
+    TraceTimeline* timeline = static_cast<TraceTimeline*>(payload);
+    if (stats->total_objects > 0 && stats->received_objects == stats->total_objects) {
+        timeline->enter(TracePhase::INDEX);
+    }
+    else {
+        timeline->enter(TracePhase::TRANSFER);
+    }
+    return 0;
 }
 
 //--------------------------------------
-// fastfowardRepo()
+// upstreamReachesHead()
 //--------------------------------------
-void fastfowardRepo(GitRepo& gitRepo)
+// Whether the checked out branch's local tip is in its origin branch's
+// history, as far as this repo's objects go. True when there is nothing to
+// compare, e.g. a detached HEAD or no origin branch.
+bool upstreamReachesHead(git_repository* repo)
 {
-    bool ok = true;
+    git_reference* head_ref = NULL;
+    const char* branch_name = NULL;
+    if (git_repository_head(&head_ref, repo) != 0 || git_branch_name(&branch_name, head_ref) != 0) {
+        git_reference_free(head_ref);
+        return true;
+    }
+    char remote_branch_ref[256];
+    snprintf(remote_branch_ref, sizeof(remote_branch_ref), "refs/remotes/origin/%s", branch_name);
+    git_reference* remote_ref = NULL;
+    bool reaches = true;
+    if (git_reference_lookup(&remote_ref, repo, remote_branch_ref) == 0) {
+        const git_oid* local_oid = git_reference_target(head_ref);
+        const git_oid* remote_oid = git_reference_target(remote_ref);
+        reaches = git_oid_equal(local_oid, remote_oid) || git_graph_descendant_of(repo, remote_oid, local_oid) == 1;
+        git_reference_free(remote_ref);
+    }
+    git_reference_free(head_ref);
+    return reaches;
+}
+
+//--------------------------------------
+// fetchOrigin()
+//--------------------------------------
+// Fetches 'origin' honouring the repo's fetch policy. Connect, download and
+// tip update are issued separately so each shows up as its own trace span.
+//
+// A depth limit only applies to repos that are already shallow. In a full
+// clone libgit2 would graft the fetched tip as a root commit, cutting it off
+// from local history so that every fast-forward after it sees a divergence.
+// A shallow repo whose local tip falls below the fetched depth is deepened,
+// doubling the depth, until the upstream reaches it again.
+bool fetchOrigin(GitRepo& gitRepo, std::stringstream& message)
+{
+    TraceSpan fetchSpan(TracePhase::FETCH);
+
+    git_remote* remote = NULL;
+    if (git_remote_lookup(&remote, gitRepo.repo.get(), "origin") != 0) {
+        message << "Error looking up remote 'origin': " << git_error_last()->message;
+        return false;
+    }
+
+    HostSlot hostSlot(gitRepo.remoteHost);
+    git_fetch_options fetch_opts = GIT_FETCH_OPTIONS_INIT;
+    fetch_opts.callbacks.credentials = credentialAcquireCallback;
+    bool shallow = git_repository_is_shallow(gitRepo.repo.get()) == 1;
+    fetch_opts.depth = shallow ? gitRepo.fetchPolicy.depth : GIT_FETCH_DEPTH_FULL;
+    if (!shallow && gitRepo.fetchPolicy.depth != GIT_FETCH_DEPTH_FULL) {
+        message << "Depth " << gitRepo.fetchPolicy.depth << " ignored; the repo is a full clone\n";
+    }
+    if (!gitRepo.fetchPolicy.filter.empty()) {
+        // libgit2 has no object filter negotiation, so the depth limit is all the transport can apply
+        message << "Filter '" << gitRepo.fetchPolicy.filter << "' is not supported by the transport; fetching unfiltered\n";
+    }
+
+    uint64_t receivedBytes = 0;
+    int error = 0;
+    for (bool deepen = false; error == 0; deepen = true) {
+        if (deepen) {
+            if (fetch_opts.depth == GIT_FETCH_DEPTH_FULL || fetch_opts.depth == GIT_FETCH_DEPTH_UNSHALLOW
+                || upstreamReachesHead(gitRepo.repo.get())) {
+                break;
+            }
+            fetch_opts.depth = fetch_opts.depth >= FETCH_DEEPEN_LIMIT ? GIT_FETCH_DEPTH_UNSHALLOW : fetch_opts.depth * 2;
+            git_remote_disconnect(remote);
+        }
+
+        {
+            TraceSpan span(TracePhase::CONNECT);
+            git_remote_connect_options connect_opts = GIT_REMOTE_CONNECT_OPTIONS_INIT;
+            connect_opts.callbacks = fetch_opts.callbacks;
+            error = git_remote_connect_ext(remote, GIT_DIRECTION_FETCH, &connect_opts);
+        }
+
+        if (error == 0) {
+            TraceTimeline timeline(TracePhase::NEGOTIATE);
+            fetch_opts.callbacks.transfer_progress = fetchTransferProgressCallback;
+            fetch_opts.callbacks.payload = &timeline;
+            error = git_remote_download(remote, NULL, &fetch_opts);
+            fetch_opts.callbacks.transfer_progress = NULL;
+            fetch_opts.callbacks.payload = NULL;
+        }
+
+        if (error == 0) {
+            TraceSpan span(TracePhase::UPDATE_TIPS);
+            error = git_remote_update_tips(
+                remote, &fetch_opts.callbacks, fetch_opts.update_fetchhead, fetch_opts.download_tags, NULL);
+            if (error == 0 && git_remote_prune_refs(remote)) {
+                error = git_remote_prune(remote, &fetch_opts.callbacks);
+            }
+        }
+
+        if (error == 0) {
+            recordFetchStats(gitRepo.fetchStats, fetch_opts.depth, git_remote_stats(remote));
+            receivedBytes += gitRepo.fetchStats.receivedBytes;
+        }
+    }
+
+    if (error != 0) {
+        message << "Error fetching from remote 'origin': " << git_error_last()->message;
+        git_remote_free(remote);
+        return false;
+    }
+
+    message << "Successfully fetched from remote 'origin' (" << formatBytes(receivedBytes);
+    if (fetch_opts.depth == GIT_FETCH_DEPTH_UNSHALLOW) {
+        message << ", unshallowed to reach the local branch";
+    }
+    else if (fetch_opts.depth != GIT_FETCH_DEPTH_FULL) {
+        message << ", depth " << fetch_opts.depth;
+    }
+    message << ")\n";
+
+    git_remote_disconnect(remote);
+    git_remote_free(remote);
+    return true;
+}
+
+//--------------------------------------
+// class SharedFetches
+//--------------------------------------
+// Worktrees of one repo share its remote-tracking refs and objects, so one
+// fetch serves them all. A fetch that started after a task was queued is as
+// good as the task's own; tasks that find one running wait for it instead of
+// fetching again. Failed fetches aren't shared, so the next task retries.
+class SharedFetches
+{
+public:
+    // True if the caller should fetch and then call end(); false if a fresh
+    // fetch already succeeded, which fetchedBy then names.
+    bool begin(const std::filesystem::path& commonDirectory,
+               std::chrono::steady_clock::time_point queued,
+               std::string& fetchedBy)
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        Entry& entry = entries[commonDirectory.string()];
+        changed.wait(guard, [&]() { return !entry.inFlight; });
+        if (entry.succeeded && entry.started >= queued) {
+            fetchedBy = entry.fetchedBy;
+            return false;
+        }
+        entry.inFlight = true;
+        entry.started = std::chrono::steady_clock::now();
+        return true;
+    }
+
+    void end(const std::filesystem::path& commonDirectory, bool ok, const std::string& fetchedBy)
+    {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            Entry& entry = entries[commonDirectory.string()];
+            entry.inFlight = false;
+            entry.succeeded = ok;
+            entry.fetchedBy = fetchedBy;
+        }
+        changed.notify_all();
+    }
+
+private:
+    struct Entry
+    {
+        bool inFlight{false};
+        bool succeeded{false};
+        std::chrono::steady_clock::time_point started;
+        std::string fetchedBy{""};
+    };
+
+    std::mutex lock;
+    std::condition_variable changed;
+    std::unordered_map<std::string, Entry> entries;
+};
+
+//--------------------------------------
+// sharedFetches()
+//--------------------------------------
+SharedFetches& sharedFetches()
+{
+    static SharedFetches fetches;
+    return fetches;
+}
+
+//--------------------------------------
+// fetchSharedOrigin()
+//--------------------------------------
+// fetchOrigin(), skipped when another worktree of the repo just fetched.
+bool fetchSharedOrigin(GitRepo& gitRepo, std::stringstream& message)
+{
+    if (gitRepo.commonDirectory.empty()) {
+        return fetchOrigin(gitRepo, message);
+    }
+    std::string fetchedBy;
+    if (!sharedFetches().begin(gitRepo.commonDirectory, gitRepo.taskQueued, fetchedBy)) {
+        message << "Already fetched with " << fetchedBy << "\n";
+        return true;
+    }
+    bool ok = fetchOrigin(gitRepo, message);
+    sharedFetches().end(gitRepo.commonDirectory, ok, repoDisplayPath(gitRepo.repoPath).string());
+    return ok;
+}
+
+//--------------------------------------
+// fetchRepo()
+//--------------------------------------
+GitState fetchRepo(GitRepo& gitRepo, RepoSortKeys& sortKeys)
+{
+    TraceTaskScope traceScope(gitRepo.traceTag, TracePhase::FETCH);
 
     std::stringstream message;
+    bool ok;
+    {
+        LatencyTimer latency(LatencyOp::FETCH, gitRepo.remoteHost);
+        ok = fetchSharedOrigin(gitRepo, message);
+    }
+    if (ok) {
+        sortKeys.fetchTime = static_cast<uint32_t>(
+            std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count());
+    }
+
+    gitRepo.message = message.str();
+    logMessage(ok ? LogLevel::LEVEL_INFO : LogLevel::LEVEL_ERROR, "Fetch: %s", gitRepo.message.c_str());
+    return ok ? getRepoState(gitRepo.repo.get(), &sortKeys) : GitState::ERROR_STATE;
+}
+
+//--------------------------------------
+// fastForwardFetch()
+//--------------------------------------
+// Network half of a fast-forward: fetches origin for the checked out branch.
+bool fastForwardFetch(GitRepo& gitRepo, std::stringstream& message)
+{
+    git_reference* head_ref = NULL;
+    const char* branch_name = NULL;
+
+    // Get the current branch
+    if (git_repository_head(&head_ref, gitRepo.repo.get()) != 0) {
+        message << "Error getting current branch: " << git_error_last()->message;
+        return false;
+    }
+
+    if (git_branch_name(&branch_name, head_ref) != 0) {
+        message << "Error getting branch name: " << git_error_last()->message;
+        git_reference_free(head_ref);
+        return false;
+    }
+
+    message << "Fast-forwarding branch: " << branch_name << '\n';
+    git_reference_free(head_ref);
+
+    // Fetch from the remote
+    return fetchSharedOrigin(gitRepo, message);
+}
+
+//--------------------------------------
+// enum AutoStash
+//--------------------------------------
+// What a fast-forward did with local changes that were in the way.
+enum class AutoStash : uint8_t
+{
+    NONE,       // Nothing was in the way; no stash was made
+    REAPPLIED,  // Stashed and re-applied cleanly
+    CONFLICTED, // Stashed, but re-applying conflicted; the changes remain in stash@{0}
+};
+
+//--------------------------------------
+// AutoStashToString()
+//--------------------------------------
+const char* AutoStashToString(AutoStash autoStash)
+{
+    switch (autoStash) {
+        case AutoStash::NONE:
+            return "none";
+        case AutoStash::REAPPLIED:
+            return "re-applied";
+        case AutoStash::CONFLICTED:
+            return "conflicted";
+        default:
+            return "unknown";
+    }
+}
+
+//--------------------------------------
+// listIndexConflicts()
+//--------------------------------------
+void listIndexConflicts(git_index* index, std::stringstream& message)
+{
+    git_index_conflict_iterator* conflicts = NULL;
+    if (git_index_conflict_iterator_new(&conflicts, index) != 0) {
+        return;
+    }
+    const git_index_entry* ancestor = NULL;
+    const git_index_entry* ours = NULL;
+    const git_index_entry* theirs = NULL;
+    while (git_index_conflict_next(&ancestor, &ours, &theirs, conflicts) == 0) {
+        const git_index_entry* entry = ours != NULL ? ours : theirs != NULL ? theirs : ancestor;
+        message << "  " << entry->path << '\n';
+    }
+    git_index_conflict_iterator_free(conflicts);
+}
+
+//--------------------------------------
+// stashLocalChanges()
+//--------------------------------------
+bool stashLocalChanges(git_repository* repo, std::stringstream& message)
+{
+    git_signature* stasher = NULL;
+    if (git_signature_default(&stasher, repo) != 0
+        && git_signature_now(&stasher, "GitRepoManager", "GitRepoManager@localhost") != 0) {
+        message << "Error creating stash signature: " << git_error_last()->message << '\n';
+        return false;
+    }
+    git_oid stash_id;
+    int error = git_stash_save(&stash_id, repo, stasher, "autostash before fast-forward", GIT_STASH_DEFAULT);
+    git_signature_free(stasher);
+    if (error != 0) {
+        message << "Error stashing local changes: " << git_error_last()->message << '\n';
+        return false;
+    }
+    message << "Stashed local changes as " << std::string(git_oid_tostr_s(&stash_id), 0, 10) << '\n';
+    return true;
+}
+
+//--------------------------------------
+// reapplyStash()
+//--------------------------------------
+// Applies stash@{0} and drops it if that went cleanly. Like 'git stash pop',
+// changes that conflict with the new commit are written with conflict
+// markers and the stash is kept.
+AutoStash reapplyStash(git_repository* repo, std::stringstream& message)
+{
+    git_stash_apply_options apply_opts = GIT_STASH_APPLY_OPTIONS_INIT;
+    int error = git_stash_apply(repo, 0, &apply_opts);
+    if (error != 0) {
+        message << "Error re-applying local changes, kept in stash@{0}: " << git_error_last()->message << '\n';
+        return AutoStash::CONFLICTED;
+    }
+
+    git_index* index = NULL;
+    bool conflicted = git_repository_index(&index, repo) == 0 && git_index_has_conflicts(index);
+    if (conflicted) {
+        message << "Local changes conflict with the incoming commits, kept in stash@{0}; resolve:\n";
+        listIndexConflicts(index, message);
+    }
+    git_index_free(index);
+    if (conflicted) {
+        return AutoStash::CONFLICTED;
+    }
+    git_stash_drop(repo, 0);
+    message << "Local changes re-applied cleanly.\n";
+    return AutoStash::REAPPLIED;
+}
+
+//--------------------------------------
+// fastForwardCheckout()
+//--------------------------------------
+// Disk half of a fast-forward: checks out the fetched upstream commit and
+// moves the branch to it. Refuses when the branch has commits upstream lacks.
+//
+// Local changes that don't touch the incoming files are carried over by the
+// safe checkout as they are. With autoStash, changes that are in the way are
+// stashed, the checkout retried and the stash re-applied on the new commit.
+// The safe checkout's own conflict pass is the dirty check: it reads the
+// index's cached stat data, so a tree without blocking changes never pays
+// for a stash.
+bool fastForwardCheckout(
+    GitRepo& gitRepo, std::stringstream& message, bool autoStash = false, AutoStash* stashed = nullptr)
+{
+    TraceSpan span(TracePhase::CHECKOUT);
+    git_repository* repo = gitRepo.repo.get();
+    bool ok = true;
 
     // Gross method of control loop that keeps indentation flat... not sure about it.
-    auto fetch = [&]() {
+    AutoStash stash = AutoStash::NONE;
+    auto checkout = [&]() {
         int error;
         git_reference* head_ref = NULL;
         const char* branch_name = NULL;
 
         // Get the current branch
-        if ((error = git_repository_head(&head_ref, gitRepo.repo)) != 0) {
+        if ((error = git_repository_head(&head_ref, repo)) != 0) {
             message << "Error getting current branch: " << git_error_last()->message;
             ok = false;
             return;
@@ -268,52 +869,40 @@ void fastfowardRepo(GitRepo& gitRepo)
             return;
         }
 
-        message << "Fast-forwarding branch: " << branch_name << '\n';
-
-        // Get the remote for the branch
-        git_remote* remote = NULL;
-        if ((error = git_remote_lookup(&remote, gitRepo.repo, "origin")) != 0) {
-            message << "Error looking up remote 'origin': " << git_error_last()->message;
-            git_reference_free(head_ref);
-            ok = false;
-            return;
-        }
-
-        // Fetch from the remote
-        git_fetch_options fetch_opts = GIT_FETCH_OPTIONS_INIT;
-        fetch_opts.callbacks.credentials = credentialAcquireCallback;
-        if ((error = git_remote_fetch(remote, NULL, &fetch_opts, NULL)) != 0) {
-            message << "Error fetching from remote 'origin': " << git_error_last()->message;
-            git_remote_free(remote);
-            git_reference_free(head_ref);
-            ok = false;
-            return;
-        }
-
-        message << "Successfully fetched from remote 'origin'\n";
-
         // Get the remote branch reference
         char remote_branch_ref[256];
         snprintf(remote_branch_ref, sizeof(remote_branch_ref), "refs/remotes/origin/%s", branch_name);
 
         git_reference* remote_ref = NULL;
-        if ((error = git_reference_lookup(&remote_ref, gitRepo.repo, remote_branch_ref)) != 0) {
+        if ((error = git_reference_lookup(&remote_ref, repo, remote_branch_ref)) != 0) {
             message << "Error looking up remote branch '" << remote_branch_ref << "': " << git_error_last()->message;
-            git_remote_free(remote);
             git_reference_free(head_ref);
             ok = false;
             return;
         }
 
         // Perform the fast-forward
+        const git_oid* local_oid = git_reference_target(head_ref);
         const git_oid* remote_oid = git_reference_target(remote_ref);
-        git_index* index = NULL;
+        if (git_oid_equal(local_oid, remote_oid)) {
+            message << "Already up to date.";
+            git_reference_free(remote_ref);
+            git_reference_free(head_ref);
+            return;
+        }
+        if (git_graph_descendant_of(repo, remote_oid, local_oid) != 1) {
+            message << "Branch has diverged from '" << remote_branch_ref << "'; cannot fast-forward.";
+            git_reference_free(remote_ref);
+            git_reference_free(head_ref);
+            ok = false;
+            return;
+        }
 
         // Ensure the working directory is clean
-        if ((error = git_repository_index(&index, gitRepo.repo)) != 0) {
+        git_index* index = NULL;
+        if ((error = git_repository_index(&index, repo)) != 0) {
             message << "Error accessing repository index: " << git_error_last()->message;
             git_reference_free(remote_ref);
-            git_remote_free(remote);
             git_reference_free(head_ref);
             ok = false;
             return;
@@ -323,48 +912,406 @@ void fastfowardRepo(GitRepo& gitRepo)
             message << "Working directory has conflicts; cannot fast-forward.";
             git_index_free(index);
             git_reference_free(remote_ref);
-            git_remote_free(remote);
             git_reference_free(head_ref);
             ok = false;
             return;
         }
 
+        // Bring the working tree up to the remote commit; a safe checkout
+        // stops rather than overwrite local changes
+        git_object* remote_commit = NULL;
+        git_checkout_options checkout_opts = GIT_CHECKOUT_OPTIONS_INIT;
+        checkout_opts.checkout_strategy = GIT_CHECKOUT_SAFE;
+        if ((error = git_object_lookup(&remote_commit, repo, remote_oid, GIT_OBJECT_COMMIT)) == 0) {
+            error = git_checkout_tree(repo, remote_commit, &checkout_opts);
+            if (error == GIT_ECONFLICT && autoStash && stashLocalChanges(repo, message)) {
+                stash = AutoStash::REAPPLIED; // Pending until the branch has moved
+                error = git_checkout_tree(repo, remote_commit, &checkout_opts);
+            }
+            gitRepo.blockedByLocalChanges = error == GIT_ECONFLICT;
+        }
+        if (error != 0) {
+            message << "Error checking out remote commit: " << git_error_last()->message;
+            ok = false;
+
+            // Still blocked after stashing, likely by untracked files; put
+            // the changes back where they were
+            if (stash == AutoStash::REAPPLIED) {
+                bool restored = git_stash_pop(repo, 0, NULL) == 0;
+                message << (restored ? "\nRestored the stashed changes." : "\nLocal changes are kept in stash@{0}.");
+                stash = restored ? AutoStash::NONE : AutoStash::CONFLICTED;
+            }
+        }
+
         // Update the branch reference to the remote commit
-        if ((error = git_reference_set_target(&head_ref, head_ref, remote_oid, NULL)) != 0) {
+        else if ((error = git_reference_set_target(&head_ref, head_ref, remote_oid, NULL)) != 0) {
             message << "Error updating branch to remote commit: " << git_error_last()->message;
+            if (stash == AutoStash::REAPPLIED) {
+                message << "\nLocal changes are kept in stash@{0}.";
+                stash = AutoStash::CONFLICTED;
+            }
+            ok = false;
         }
         else {
             message << "Fast-forward completed successfully.";
+            if (stash == AutoStash::REAPPLIED) {
+                message << '\n';
+                stash = reapplyStash(repo, message);
+            }
         }
 
         // Cleanup
+        git_object_free(remote_commit);
         git_index_free(index);
         git_reference_free(remote_ref);
+        git_reference_free(head_ref);
+    };
+    checkout();
+    if (stashed != nullptr) {
+        *stashed = stash;
+    }
+    return ok;
+}
+
+//--------------------------------------
+// finishFastForward()
+//--------------------------------------
+GitState finishFastForward(GitRepo& gitRepo, RepoSortKeys& sortKeys, const std::stringstream& message, bool ok)
+{
+    gitRepo.message = message.str();
+    logMessage(ok ? LogLevel::LEVEL_INFO : LogLevel::LEVEL_ERROR, "Fast-forward: %s", gitRepo.message.c_str());
+    return ok ? getRepoState(gitRepo.repo.get(), &sortKeys) : GitState::ERROR_STATE;
+}
+
+//--------------------------------------
+// fastfowardRepo()
+//--------------------------------------
+// Both halves on one thread. Mass fast-forwards go through
+// FastForwardPipeline instead, which overlaps them across repos.
+GitState fastfowardRepo(GitRepo& gitRepo, RepoSortKeys& sortKeys)
+{
+    TraceTaskScope traceScope(gitRepo.traceTag, TracePhase::FASTFORWARD);
+    TraceSpan traceSpan(TracePhase::FASTFORWARD);
+    std::optional<LatencyTimer> latency(std::in_place, LatencyOp::FASTFORWARD, gitRepo.remoteHost);
+
+    std::stringstream message;
+    bool ok = fastForwardFetch(gitRepo, message) && fastForwardCheckout(gitRepo, message);
+    latency.reset();
+
+    return finishFastForward(gitRepo, sortKeys, message, ok);
+}
+
+//--------------------------------------
+// struct PushResult
+//--------------------------------------
+struct PushResult
+{
+    std::stringstream* message;
+    bool rejected{false};
+};
+
+//--------------------------------------
+// pushUpdateReferenceCallback()
+//--------------------------------------
+int pushUpdateReferenceCallback(const char* refname, const char* status, void* payload)
+{
+    PushResult* result = static_cast<PushResult*>(payload);
+    if (status != NULL) {
+        *result->message << "Remote rejected " << refname << ": " << status << '\n';
+        result->rejected = true;
+    }
+    return 0;
+}
+
+//--------------------------------------
+// pushRepo()
+//--------------------------------------
+GitState pushRepo(GitRepo& gitRepo, RepoSortKeys& sortKeys)
+{
+    TraceTaskScope traceScope(gitRepo.traceTag, TracePhase::PUSH);
+    TraceSpan traceSpan(TracePhase::PUSH);
+    std::optional<LatencyTimer> latency(std::in_place, LatencyOp::PUSH, gitRepo.remoteHost);
+
+    bool ok = true;
+
+    std::stringstream message;
+
+    auto push = [&]() {
+        git_reference* head_ref = NULL;
+        if (git_repository_head(&head_ref, gitRepo.repo.get()) != 0) {
+            message << "Error getting current branch: " << git_error_last()->message;
+            ok = false;
+            return;
+        }
+
+        if (!git_reference_is_branch(head_ref)) {
+            message << "HEAD is detached; nothing to push.";
+            git_reference_free(head_ref);
+            ok = false;
+            return;
+        }
+
+        git_remote* remote = NULL;
+        if (git_remote_lookup(&remote, gitRepo.repo.get(), "origin") != 0) {
+            message << "Error looking up remote 'origin': " << git_error_last()->message;
+            git_reference_free(head_ref);
+            ok = false;
+            return;
+        }
+
+        // Push the current branch to the branch of the same name on origin
+        std::string refspec = std::string(git_reference_name(head_ref)) + ":" + git_reference_name(head_ref);
+        char* refspecs[] = {refspec.data()};
+        git_strarray refspecArray = {refspecs, 1};
+
+        PushResult result = {&message};
+        git_push_options push_opts = GIT_PUSH_OPTIONS_INIT;
+        push_opts.callbacks.credentials = credentialAcquireCallback;
+        push_opts.callbacks.push_update_reference = pushUpdateReferenceCallback;
+        push_opts.callbacks.payload = &result;
+
+        int error;
+        {
+            TraceSpan span(TracePhase::CONNECT);
+            git_remote_connect_options connect_opts = GIT_REMOTE_CONNECT_OPTIONS_INIT;
+            connect_opts.callbacks = push_opts.callbacks;
+            error = git_remote_connect_ext(remote, GIT_DIRECTION_PUSH, &connect_opts);
+        }
+
+        if (error == 0) {
+            error = git_remote_push(remote, &refspecArray, &push_opts);
+        }
+
+        if (error != 0) {
+            message << "Error pushing to remote 'origin': " << git_error_last()->message;
+            ok = false;
+        }
+        else if (result.rejected) {
+            ok = false;
+        }
+        else {
+            message << "Pushed " << refspec.substr(0, refspec.find(':')) << " to 'origin'";
+        }
+
         git_remote_free(remote);
         git_reference_free(head_ref);
     };
-    fetch();
+    push();
+    latency.reset();
 
     gitRepo.message = message.str();
-    gitRepo.task = GitTask::NONE;
+    logMessage(ok ? LogLevel::LEVEL_INFO : LogLevel::LEVEL_ERROR, "Push: %s", gitRepo.message.c_str());
+    return ok ? getRepoState(gitRepo.repo.get(), &sortKeys) : GitState::ERROR_STATE;
+}
 
-    if (ok) {
-        gitRepo.state = getRepoState(gitRepo.repo);
+//--------------------------------------
+// rebaseRepo()
+//--------------------------------------
+// Replays the branch's own commits onto its upstream with libgit2's in-memory
+// rebase, so no rebase state is written and nothing on disk changes until
+// every commit has applied. The result is then checked out once and the
+// branch moved to it. On a conflict the repo is left exactly as it was and
+// REBASE is returned with the conflicting paths in the message.
+GitState rebaseRepo(GitRepo& gitRepo, RepoSortKeys& sortKeys)
+{
+    TraceTaskScope traceScope(gitRepo.traceTag, TracePhase::REBASE);
+    TraceSpan traceSpan(TracePhase::REBASE);
+    git_repository* repo = gitRepo.repo.get();
+    std::stringstream message;
+
+    git_reference* head_ref = NULL;
+    git_reference* upstream_ref = NULL;
+    git_annotated_commit* branch = NULL;
+    git_annotated_commit* upstream = NULL;
+    git_rebase* rebase = NULL;
+    git_signature* committer = NULL;
+    git_commit* rebased_commit = NULL;
+    git_reference* rebased_ref = NULL;
+
+    auto run = [&]() -> GitState {
+        if (git_repository_state(repo) != GIT_REPOSITORY_STATE_NONE) {
+            message << "A merge, rebase or cherry-pick is already in progress.";
+            return GitState::ERROR_STATE;
+        }
+        if (git_repository_head(&head_ref, repo) != 0) {
+            message << "Error getting current branch: " << git_error_last()->message;
+            return GitState::ERROR_STATE;
+        }
+        if (!git_reference_is_branch(head_ref)) {
+            message << "HEAD is detached; nothing to rebase.";
+            return GitState::ERROR_STATE;
+        }
+        if (git_branch_upstream(&upstream_ref, head_ref) != 0) {
+            message << "Error getting upstream branch: " << git_error_last()->message;
+            return GitState::ERROR_STATE;
+        }
+
+        size_t ahead = 0, behind = 0;
+        if (git_graph_ahead_behind(
+                &ahead, &behind, repo, git_reference_target(head_ref), git_reference_target(upstream_ref))
+            != 0) {
+            message << "Error calculating ahead/behind: " << git_error_last()->message;
+            return GitState::ERROR_STATE;
+        }
+        if (ahead == 0 || behind == 0) {
+            message << "Not diverged from '" << git_reference_shorthand(upstream_ref) << "'; nothing to rebase.";
+            return getRepoState(repo, &sortKeys);
+        }
+
+        git_rebase_options rebase_opts = GIT_REBASE_OPTIONS_INIT;
+        rebase_opts.inmemory = 1;
+        if (git_annotated_commit_from_ref(&branch, repo, head_ref) != 0
+            || git_annotated_commit_from_ref(&upstream, repo, upstream_ref) != 0
+            || git_rebase_init(&rebase, repo, branch, upstream, NULL, &rebase_opts) != 0) {
+            message << "Error starting rebase: " << git_error_last()->message;
+            return GitState::ERROR_STATE;
+        }
+        if (git_signature_default(&committer, repo) != 0) {
+            message << "Error reading user.name and user.email for the rebased commits: " << git_error_last()->message;
+            return GitState::ERROR_STATE;
+        }
+
+        // Each commit is merged into an in-memory index; the first one that
+        // conflicts ends the attempt before anything has been written
+        git_oid rebased;
+        git_oid_cpy(&rebased, git_reference_target(upstream_ref));
+        size_t applied = 0;
+        size_t skipped = 0;
+        git_rebase_operation* operation = NULL;
+        int error;
+        while ((error = git_rebase_next(&operation, rebase)) == 0) {
+            git_index* index = NULL;
+            if (git_rebase_inmemory_index(&index, rebase) != 0) {
+                message << "Error reading rebase index: " << git_error_last()->message;
+                return GitState::ERROR_STATE;
+            }
+            if (git_index_has_conflicts(index)) {
+                message << "Rebase onto '" << git_reference_shorthand(upstream_ref) << "' conflicts applying "
+                        << std::string(git_oid_tostr_s(&operation->id), 0, 10) << " in:\n";
+                listIndexConflicts(index, message);
+                git_index_free(index);
+                return GitState::REBASE;
+            }
+            git_index_free(index);
+
+            git_oid commit_id;
+            error = git_rebase_commit(&commit_id, rebase, NULL, committer, NULL, NULL);
+            if (error == GIT_EAPPLIED) {
+                skipped++;
+                continue;
+            }
+            if (error != 0) {
+                message << "Error committing rebased commit: " << git_error_last()->message;
+                return GitState::ERROR_STATE;
+            }
+            git_oid_cpy(&rebased, &commit_id);
+            applied++;
+        }
+        if (error != GIT_ITEROVER) {
+            message << "Error applying commit: " << git_error_last()->message;
+            return GitState::ERROR_STATE;
+        }
+
+        // One checkout from the old HEAD to the result; a safe checkout stops
+        // before writing anything if local changes are in the way
+        git_checkout_options checkout_opts = GIT_CHECKOUT_OPTIONS_INIT;
+        checkout_opts.checkout_strategy = GIT_CHECKOUT_SAFE;
+        if (git_commit_lookup(&rebased_commit, repo, &rebased) != 0
+            || git_checkout_tree(repo, reinterpret_cast<git_object*>(rebased_commit), &checkout_opts) != 0) {
+            message << "Error checking out rebased commit: " << git_error_last()->message;
+            return GitState::ERROR_STATE;
+        }
+        std::string reflog
+            = std::string("rebase (in-memory): onto ") + git_oid_tostr_s(git_reference_target(upstream_ref));
+        if (git_reference_set_target(&rebased_ref, head_ref, &rebased, reflog.c_str()) != 0) {
+            message << "Error updating branch to rebased commit: " << git_error_last()->message;
+            return GitState::ERROR_STATE;
+        }
+
+        message << "Rebased " << applied << " commits onto '" << git_reference_shorthand(upstream_ref) << "'";
+        if (skipped > 0) {
+            message << ", dropped " << skipped << " already upstream";
+        }
+        return getRepoState(repo, &sortKeys);
+    };
+    GitState state = run();
+
+    git_reference_free(rebased_ref);
+    git_commit_free(rebased_commit);
+    git_signature_free(committer);
+    git_rebase_free(rebase);
+    git_annotated_commit_free(upstream);
+    git_annotated_commit_free(branch);
+    git_reference_free(upstream_ref);
+    git_reference_free(head_ref);
+
+    gitRepo.message = message.str();
+    logMessage(
+        state == GitState::ERROR_STATE ? LogLevel::LEVEL_ERROR : LogLevel::LEVEL_INFO,
+        "Rebase: %s",
+        gitRepo.message.c_str());
+    return state;
+}
+
+//--------------------------------------
+// beginAuthenticatedTask()
+//--------------------------------------
+// Resets this thread's authAttempt for a task that may talk to the remote.
+// False, with the message set, when the remote host's breaker is open.
+bool beginAuthenticatedTask(GitRepo& gitRepo)
+{
+    authAttempt = AuthAttempt();
+    if (authBreaker().isOpen(gitRepo.remoteHost)) {
+        authAttempt.rejected = true;
+        gitRepo.message = "Credentials rejected by " + gitRepo.remoteHost + "; enter a new credential to retry";
+        return false;
     }
-    else {
-        gitRepo.state = GitState::ERROR_STATE;
+    return true;
+}
+
+//--------------------------------------
+// endAuthenticatedTask()
+//--------------------------------------
+void endAuthenticatedTask(const GitRepo& gitRepo, bool ok)
+{
+    if (ok && authAttempt.requests > 0 && !authAttempt.rejected) {
+        authBreaker().recordSuccess(gitRepo.remoteHost);
     }
 }
 
 //--------------------------------------
-// pushRepo()
+// runGitTask()
 //--------------------------------------
-void pushRepo(GitRepo& gitRepo)
+// Runs on a worker thread against the worker's own copy of the repo. Returns
+// the repo's state afterwards and updates sortKeys to match. Afterwards
+// authAttempt.rejected tells whether the remote turned the credential down.
+GitState runGitTask(GitTask task, GitRepo& gitRepo, RepoSortKeys& sortKeys)
 {
-    std::this_thread::sleep_for(std::chrono::seconds(3));
-    gitRepo.message = "Pushed";
-    gitRepo.task = GitTask::NONE;
-    gitRepo.state = getRepoState(gitRepo.repo);
+    // Purely local, so no credential or host breaker is involved
+    if (task == GitTask::REBASE) {
+        return rebaseRepo(gitRepo, sortKeys);
+    }
+    if (!beginAuthenticatedTask(gitRepo)) {
+        return GitState::ERROR_STATE;
+    }
+
+    GitState state;
+    switch (task) {
+        case GitTask::FETCH:
+            state = fetchRepo(gitRepo, sortKeys);
+            break;
+        case GitTask::FASTFORWARD:
+            state = fastfowardRepo(gitRepo, sortKeys);
+            break;
+        case GitTask::PUSH:
+            state = pushRepo(gitRepo, sortKeys);
+            break;
+        default:
+            state = GitState::NONE;
+            break;
+    }
+    endAuthenticatedTask(gitRepo, state != GitState::ERROR_STATE);
+    return state;
 }
 
 #endif
@@ -0,0 +1,95 @@
+#ifndef HOST_LIMITER_H
+#define HOST_LIMITER_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+constexpr uint32_t FETCHES_PER_HOST = 8; // Concurrent fetches allowed against one remote host
+
+//--------------------------------------
+// class HostLimiter
+//--------------------------------------
+// Caps concurrent connections per remote host so a batch spread over many
+// workers doesn't hammer one server. Hosts are independent of each other.
+class HostLimiter
+{
+public:
+    void setLimit(uint32_t perHost)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        limit = perHost;
+        released.notify_all();
+    }
+
+    uint32_t perHost()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        return limit;
+    }
+
+    void acquire(const std::string& host)
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        released.wait(guard, [&]() { return active[host] < limit; });
+        active[host]++;
+    }
+
+    void release(const std::string& host)
+    {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            if (--active[host] == 0) {
+                active.erase(host);
+            }
+        }
+        released.notify_all();
+    }
+
+private:
+    std::mutex lock;
+    std::condition_variable released;
+    std::unordered_map<std::string, uint32_t> active;
+    uint32_t limit{FETCHES_PER_HOST};
+};
+
+//--------------------------------------
+// hostLimiter()
+//--------------------------------------
+HostLimiter& hostLimiter()
+{
+    static HostLimiter limiter;
+    return limiter;
+}
+
+//--------------------------------------
+// class HostSlot
+//--------------------------------------
+// Holds one of the host's connection slots for the scope. An empty host isn't
+// limited.
+class HostSlot
+{
+public:
+    explicit HostSlot(std::string host) : host(std::move(host))
+    {
+        if (!this->host.empty()) {
+            hostLimiter().acquire(this->host);
+        }
+    }
+    ~HostSlot()
+    {
+        if (!host.empty()) {
+            hostLimiter().release(host);
+        }
+    }
+    HostSlot(const HostSlot&) = delete;
+    HostSlot& operator=(const HostSlot&) = delete;
+
+private:
+    std::string host;
+};
+
+#endif
@@ -0,0 +1,376 @@
+#ifndef INCOMING_PREVIEW_H
+#define INCOMING_PREVIEW_H
+
+#include "git2.h"
+#include "repotable.h"
+#include "tasktrace.h"
+#include "logsink.h"
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+constexpr size_t INCOMING_PREVIEW_MAX_COMMITS = 200; // Commits listed; all are counted
+constexpr size_t INCOMING_PREVIEW_MAX_FILES = 500;   // Files listed; all are counted
+constexpr size_t INCOMING_PREVIEW_CACHE_SIZE = 256;  // Previews kept, oldest dropped first
+
+//--------------------------------------
+// struct IncomingCommit
+//--------------------------------------
+struct IncomingCommit
+{
+    git_oid id{};
+    std::string summary{""};
+    std::string author{""};
+};
+
+//--------------------------------------
+// struct IncomingFile
+//--------------------------------------
+struct IncomingFile
+{
+    std::string path{""};
+    std::string oldPath{""}; // Differs from path for renames
+    git_delta_t status{GIT_DELTA_UNMODIFIED};
+    bool binary{false};
+    size_t insertions{0};
+    size_t deletions{0};
+};
+
+//--------------------------------------
+// struct IncomingPreview
+//--------------------------------------
+// What a fast-forward from head to upstream would bring in.
+struct IncomingPreview
+{
+    git_oid head{};
+    git_oid upstream{};
+    size_t commitCount{0};
+    std::vector<IncomingCommit> commits; // Newest first, at most INCOMING_PREVIEW_MAX_COMMITS
+    size_t fileCount{0};
+    std::vector<IncomingFile> files; // At most INCOMING_PREVIEW_MAX_FILES
+    size_t insertions{0};
+    size_t deletions{0};
+    std::string error{""};
+};
+
+//--------------------------------------
+// incomingPreviewKey()
+//--------------------------------------
+std::string incomingPreviewKey(const git_oid& head, const git_oid& upstream, bool renames)
+{
+    char key[2 * GIT_OID_HEXSZ + 2];
+    git_oid_fmt(key, &head);
+    git_oid_fmt(key + GIT_OID_HEXSZ, &upstream);
+    key[2 * GIT_OID_HEXSZ] = renames ? 'r' : '-';
+    key[2 * GIT_OID_HEXSZ + 1] = '\0';
+    return key;
+}
+
+//--------------------------------------
+// resolveIncomingRange()
+//--------------------------------------
+// HEAD and its upstream, the range a fast-forward would cover.
+bool resolveIncomingRange(git_repository* repo, git_oid& head, git_oid& upstream, std::string& error)
+{
+    git_reference* headRef = nullptr;
+    git_reference* upstreamRef = nullptr;
+    bool ok = git_repository_head(&headRef, repo) == 0 && git_branch_upstream(&upstreamRef, headRef) == 0
+              && git_reference_target(headRef) != nullptr && git_reference_target(upstreamRef) != nullptr;
+    if (ok) {
+        git_oid_cpy(&head, git_reference_target(headRef));
+        git_oid_cpy(&upstream, git_reference_target(upstreamRef));
+    }
+    else {
+        const git_error* e = git_error_last();
+        error = e && e->message ? e->message : "HEAD has no upstream";
+    }
+    git_reference_free(upstreamRef);
+    git_reference_free(headRef);
+    return ok;
+}
+
+//--------------------------------------
+// computeIncomingPreview()
+//--------------------------------------
+// Commits in upstream but not head, and the diffstat between the two trees.
+// Returns false, leaving preview partial, when cancelled is raised.
+bool computeIncomingPreview(
+    git_repository* repo, IncomingPreview& preview, bool renames, const std::atomic<bool>& cancelled)
+{
+    TraceSpan span(TracePhase::STATUS);
+
+    // Commit list
+    git_revwalk* walk = nullptr;
+    if (git_revwalk_new(&walk, repo) != 0 || git_revwalk_sorting(walk, GIT_SORT_TOPOLOGICAL | GIT_SORT_TIME) != 0
+        || git_revwalk_push(walk, &preview.upstream) != 0 || git_revwalk_hide(walk, &preview.head) != 0) {
+        preview.error = git_error_last()->message;
+        git_revwalk_free(walk);
+        return true;
+    }
+    git_oid id;
+    while (!cancelled && git_revwalk_next(&id, walk) == 0) {
+        preview.commitCount++;
+        if (preview.commits.size() >= INCOMING_PREVIEW_MAX_COMMITS) {
+            continue;
+        }
+        git_commit* commit = nullptr;
+        if (git_commit_lookup(&commit, repo, &id) == 0) {
+            const char* summary = git_commit_summary(commit);
+            const git_signature* author = git_commit_author(commit);
+            preview.commits.push_back({id, summary ? summary : "", author && author->name ? author->name : ""});
+            git_commit_free(commit);
+        }
+    }
+    git_revwalk_free(walk);
+    if (cancelled) {
+        return false;
+    }
+
+    // Diffstat; the progress callback lets a collapse abort a large diff
+    git_commit* headCommit = nullptr;
+    git_commit* upstreamCommit = nullptr;
+    git_tree* headTree = nullptr;
+    git_tree* upstreamTree = nullptr;
+    git_diff* diff = nullptr;
+    git_diff_options diffOptions = GIT_DIFF_OPTIONS_INIT;
+    diffOptions.progress_cb = [](const git_diff*, const char*, const char*, void* payload) -> int {
+        return static_cast<const std::atomic<bool>*>(payload)->load() ? GIT_EUSER : 0;
+    };
+    diffOptions.payload = const_cast<std::atomic<bool>*>(&cancelled);
+    bool ok = git_commit_lookup(&headCommit, repo, &preview.head) == 0
+              && git_commit_lookup(&upstreamCommit, repo, &preview.upstream) == 0
+              && git_commit_tree(&headTree, headCommit) == 0 && git_commit_tree(&upstreamTree, upstreamCommit) == 0
+              && git_diff_tree_to_tree(&diff, repo, headTree, upstreamTree, &diffOptions) == 0;
+    if (ok && renames) {
+        git_diff_find_options findOptions = GIT_DIFF_FIND_OPTIONS_INIT;
+        findOptions.flags = GIT_DIFF_FIND_RENAMES;
+        ok = git_diff_find_similar(diff, &findOptions) == 0;
+    }
+    if (!ok && !cancelled) {
+        preview.error = git_error_last()->message;
+    }
+
+    if (ok) {
+        preview.fileCount = git_diff_num_deltas(diff);
+        for (size_t i = 0; i < preview.fileCount && !cancelled; i++) {
+            const git_diff_delta* delta = git_diff_get_delta(diff, i);
+            IncomingFile file;
+            file.path = delta->new_file.path;
+            file.oldPath = delta->old_file.path;
+            file.status = delta->status;
+            git_patch* patch = nullptr;
+            size_t context = 0;
+            if (git_patch_from_diff(&patch, diff, i) == 0 && patch != nullptr) {
+                git_patch_line_stats(&context, &file.insertions, &file.deletions, patch);
+            }
+            git_patch_free(patch);
+            file.binary = (delta->flags & GIT_DIFF_FLAG_BINARY) != 0;
+            preview.insertions += file.insertions;
+            preview.deletions += file.deletions;
+            if (preview.files.size() < INCOMING_PREVIEW_MAX_FILES) {
+                preview.files.push_back(std::move(file));
+            }
+        }
+    }
+
+    git_diff_free(diff);
+    git_tree_free(upstreamTree);
+    git_tree_free(headTree);
+    git_commit_free(upstreamCommit);
+    git_commit_free(headCommit);
+    return !cancelled;
+}
+
+//--------------------------------------
+// class IncomingPreviews
+//--------------------------------------
+// Incoming-changes previews computed on request in background jobs. Results
+// are cached by HEAD/upstream pair, so reopening a repo whose refs haven't
+// moved, or another worktree at the same pair, costs only resolving the refs.
+// A job is cancelled when its row is collapsed and nothing is kept from it.
+// Finished workers are joined when the next job starts, and stop() cancels
+// and waits for the rest before libgit2 shuts down.
+class IncomingPreviews
+{
+public:
+    ~IncomingPreviews() { stop(); }
+
+    // Starts a job unless one is running or done for the same rename setting.
+    void request(RepoId id, const std::filesystem::path& repoPath, uint32_t traceTag, bool renames)
+    {
+        auto cancelled = std::make_shared<std::atomic<bool>>(false);
+        auto finished = std::make_shared<std::atomic<bool>>(false);
+        std::lock_guard<std::mutex> requestGuard(lock);
+        Job& job = jobs[id.slot];
+        if (job.id == id && (job.pending || (job.preview != nullptr && job.renames == renames))) {
+            return;
+        }
+        job = {id, renames, true, cancelled, nullptr};
+        reapWorkers();
+        active++;
+        std::thread thread([this, id, repoPath, traceTag, renames, cancelled, finished]() {
+            TraceTaskScope traceScope(traceTag, TracePhase::STATUS);
+            auto computed = std::make_shared<IncomingPreview>();
+            std::shared_ptr<const IncomingPreview> preview = computed;
+            bool complete = true;
+            git_repository* repo = nullptr;
+            if (git_repository_open(&repo, repoPath.string().c_str()) != 0) {
+                computed->error = git_error_last()->message;
+            }
+            else if (resolveIncomingRange(repo, computed->head, computed->upstream, computed->error)) {
+                std::string key = incomingPreviewKey(computed->head, computed->upstream, renames);
+                std::shared_ptr<const IncomingPreview> cached = find(key);
+                if (cached != nullptr) {
+                    preview = cached;
+                }
+                else {
+                    complete = computeIncomingPreview(repo, *computed, renames, *cancelled);
+                    if (complete && computed->error.empty()) {
+                        remember(key, computed);
+                    }
+                }
+            }
+            git_repository_free(repo);
+
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                auto it = jobs.find(id.slot);
+                if (it != jobs.end() && it->second.id == id && it->second.cancelled == cancelled) {
+                    if (complete) {
+                        it->second.pending = false;
+                        it->second.preview = preview;
+                    }
+                    else {
+                        jobs.erase(it);
+                    }
+                }
+            }
+            active--;
+            *finished = true;
+        });
+        workers.push_back({std::move(thread), cancelled, finished});
+    }
+
+    // Cancels every running job and waits for it.
+    void stop()
+    {
+        std::vector<Worker> joining;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            joining = std::move(workers);
+            workers.clear();
+        }
+        for (Worker& worker : joining) {
+            *worker.cancelled = true;
+            worker.thread.join();
+        }
+    }
+
+    bool pending(RepoId id)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        auto it = jobs.find(id.slot);
+        return it != jobs.end() && it->second.id == id && it->second.pending;
+    }
+
+    std::shared_ptr<const IncomingPreview> get(RepoId id)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        auto it = jobs.find(id.slot);
+        return it != jobs.end() && it->second.id == id ? it->second.preview : nullptr;
+    }
+
+    // Drops the repo's preview; a running job is cancelled. Called every
+    // frame for collapsed rows, so it returns early while no job runs.
+    void cancel(RepoId id)
+    {
+        if (active == 0) {
+            return;
+        }
+        std::lock_guard<std::mutex> guard(lock);
+        auto it = jobs.find(id.slot);
+        if (it != jobs.end() && it->second.id == id && it->second.pending) {
+            *it->second.cancelled = true;
+            jobs.erase(it);
+        }
+    }
+
+    // The repo's refs may have moved; the next request resolves them again.
+    void forget(RepoId id)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        auto it = jobs.find(id.slot);
+        if (it != jobs.end() && it->second.id == id && !it->second.pending) {
+            jobs.erase(it);
+        }
+    }
+
+private:
+    struct Job
+    {
+        RepoId id;
+        bool renames{false};
+        bool pending{false};
+        std::shared_ptr<std::atomic<bool>> cancelled;
+        std::shared_ptr<const IncomingPreview> preview;
+    };
+
+    struct Worker
+    {
+        std::thread thread;
+        std::shared_ptr<std::atomic<bool>> cancelled;
+        std::shared_ptr<std::atomic<bool>> finished;
+    };
+
+    // Caller holds lock.
+    void reapWorkers()
+    {
+        for (size_t i = 0; i < workers.size();) {
+            if (*workers[i].finished) {
+                workers[i].thread.join();
+                workers[i] = std::move(workers.back());
+                workers.pop_back();
+            }
+            else {
+                i++;
+            }
+        }
+    }
+
+    std::shared_ptr<const IncomingPreview> find(const std::string& key)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        auto it = cache.find(key);
+        return it != cache.end() ? it->second : nullptr;
+    }
+
+    void remember(const std::string& key, std::shared_ptr<const IncomingPreview> preview)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (!cache.emplace(key, std::move(preview)).second) {
+            return;
+        }
+        cacheOrder.push_back(key);
+        if (cacheOrder.size() > INCOMING_PREVIEW_CACHE_SIZE) {
+            cache.erase(cacheOrder.front());
+            cacheOrder.pop_front();
+        }
+    }
+
+    std::mutex lock;
+    std::unordered_map<uint32_t, Job> jobs; // By slot
+    std::unordered_map<std::string, std::shared_ptr<const IncomingPreview>> cache;
+    std::deque<std::string> cacheOrder; // Oldest first
+    std::atomic<size_t> active{0};
+    std::vector<Worker> workers;
+};
+
+#endif
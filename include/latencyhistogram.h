@@ -0,0 +1,305 @@
+#ifndef LATENCY_HISTOGRAM_H
+#define LATENCY_HISTOGRAM_H
+
+#include "git2.h"
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Log-linear buckets: exact below 16us, then 16 sub-buckets per power of two
+// (~6% relative error) up to 2^40us, which is about 12 days.
+constexpr int LATENCY_SUB_BUCKET_BITS = 4;
+constexpr int LATENCY_MAX_MAGNITUDE = 40;
+constexpr size_t LATENCY_SUB_BUCKETS = size_t(1) << LATENCY_SUB_BUCKET_BITS;
+constexpr size_t LATENCY_BUCKET_COUNT = (LATENCY_MAX_MAGNITUDE - LATENCY_SUB_BUCKET_BITS + 1) * LATENCY_SUB_BUCKETS;
+
+//--------------------------------------
+// enum LatencyOp
+//--------------------------------------
+enum class LatencyOp : uint8_t
+{
+    FETCH,
+    FASTFORWARD,
+    PUSH,
+    STATUS,
+    DISCOVERY,
+    COUNT,
+};
+
+constexpr size_t LATENCY_OP_COUNT = static_cast<size_t>(LatencyOp::COUNT);
+
+//--------------------------------------
+// LatencyOpToString()
+//--------------------------------------
+const char* LatencyOpToString(LatencyOp op)
+{
+    switch (op) {
+        case LatencyOp::FETCH:
+            return "fetch";
+        case LatencyOp::FASTFORWARD:
+            return "fast-forward";
+        case LatencyOp::PUSH:
+            return "push";
+        case LatencyOp::STATUS:
+            return "status";
+        case LatencyOp::DISCOVERY:
+            return "discovery";
+        default:
+            return "unknown";
+    }
+}
+
+//--------------------------------------
+// struct LatencySummary
+//--------------------------------------
+// All values in microseconds.
+struct LatencySummary
+{
+    uint64_t count{0};
+    uint64_t p50{0};
+    uint64_t p90{0};
+    uint64_t p99{0};
+    uint64_t max{0};
+};
+
+//--------------------------------------
+// class LatencyHistogram
+//--------------------------------------
+// Lock-free: recording is a handful of relaxed atomic adds, so any number of
+// worker threads can record while the UI summarizes.
+class LatencyHistogram
+{
+public:
+    void record(uint64_t micros)
+    {
+        buckets[bucketIndex(micros)].fetch_add(1, std::memory_order_relaxed);
+        count.fetch_add(1, std::memory_order_relaxed);
+        uint64_t previous = maximum.load(std::memory_order_relaxed);
+        while (micros > previous && !maximum.compare_exchange_weak(previous, micros, std::memory_order_relaxed)) {}
+    }
+
+    LatencySummary summarize() const
+    {
+        std::array<uint64_t, LATENCY_BUCKET_COUNT> snapshot;
+        uint64_t total = 0;
+        for (size_t i = 0; i < LATENCY_BUCKET_COUNT; i++) {
+            snapshot[i] = buckets[i].load(std::memory_order_relaxed);
+            total += snapshot[i];
+        }
+
+        LatencySummary summary;
+        summary.count = total;
+        summary.max = maximum.load(std::memory_order_relaxed);
+        if (total == 0) {
+            return summary;
+        }
+
+        auto percentile = [&](double fraction) {
+            uint64_t target = static_cast<uint64_t>(fraction * total + 0.999999);
+            uint64_t seen = 0;
+            for (size_t i = 0; i < LATENCY_BUCKET_COUNT; i++) {
+                seen += snapshot[i];
+                if (seen >= target) {
+                    uint64_t bound = bucketUpperBound(i);
+                    return bound < summary.max ? bound : summary.max;
+                }
+            }
+            return summary.max;
+        };
+        summary.p50 = percentile(0.50);
+        summary.p90 = percentile(0.90);
+        summary.p99 = percentile(0.99);
+        return summary;
+    }
+
+    static size_t bucketIndex(uint64_t micros)
+    {
+        constexpr uint64_t limit = (uint64_t(1) << LATENCY_MAX_MAGNITUDE) - 1;
+        if (micros > limit) {
+            micros = limit;
+        }
+        if (micros < LATENCY_SUB_BUCKETS) {
+            return static_cast<size_t>(micros);
+        }
+        int shift = static_cast<int>(std::bit_width(micros)) - 1 - LATENCY_SUB_BUCKET_BITS;
+        size_t sub = static_cast<size_t>(micros >> shift) & (LATENCY_SUB_BUCKETS - 1);
+        return ((shift + 1) << LATENCY_SUB_BUCKET_BITS) + sub;
+    }
+
+    static uint64_t bucketUpperBound(size_t index)
+    {
+        if (index < LATENCY_SUB_BUCKETS) {
+            return index;
+        }
+        int shift = static_cast<int>(index >> LATENCY_SUB_BUCKET_BITS) - 1;
+        uint64_t sub = index & (LATENCY_SUB_BUCKETS - 1);
+        return ((LATENCY_SUB_BUCKETS + sub + 1) << shift) - 1;
+    }
+
+private:
+    std::array<std::atomic<uint64_t>, LATENCY_BUCKET_COUNT> buckets{};
+    std::atomic<uint64_t> count{0};
+    std::atomic<uint64_t> maximum{0};
+};
+
+using LatencyHistogramSet = std::array<LatencyHistogram, LATENCY_OP_COUNT>;
+
+//--------------------------------------
+// struct LatencyRegistry
+//--------------------------------------
+// Global histograms plus one set per remote host. Host sets are created on
+// first use and never removed, so references to them stay valid.
+struct LatencyRegistry
+{
+    LatencyHistogramSet global;
+    std::mutex hostsLock;
+    std::map<std::string, std::unique_ptr<LatencyHistogramSet>> hosts;
+};
+
+LatencyRegistry& latencyRegistry()
+{
+    static LatencyRegistry registry;
+    return registry;
+}
+
+//--------------------------------------
+// remoteHostFromUrl()
+//--------------------------------------
+// "https://user@host:443/x.git" and "git@host:x.git" both give "host"; local
+// paths give "local".
+std::string remoteHostFromUrl(const std::string& url)
+{
+    size_t scheme = url.find("://");
+    size_t start = scheme == std::string::npos ? 0 : scheme + 3;
+    if (scheme == std::string::npos && (url.find(':') == std::string::npos || url.find(':') == 1)) {
+        return "local";
+    }
+    if (url.compare(0, 7, "file://") == 0) {
+        return "local";
+    }
+    size_t at = url.find('@', start);
+    size_t slash = url.find('/', start);
+    if (at != std::string::npos && (slash == std::string::npos || at < slash)) {
+        start = at + 1;
+    }
+    size_t end = url.find_first_of(":/", start);
+    return url.substr(start, end == std::string::npos ? std::string::npos : end - start);
+}
+
+//--------------------------------------
+// recordLatency()
+//--------------------------------------
+void recordLatency(LatencyOp op, const std::string& host, uint64_t micros)
+{
+    LatencyRegistry& registry = latencyRegistry();
+    registry.global[static_cast<size_t>(op)].record(micros);
+    if (host.empty()) {
+        return;
+    }
+
+    LatencyHistogramSet* hostSet;
+    {
+        std::lock_guard<std::mutex> lock(registry.hostsLock);
+        std::unique_ptr<LatencyHistogramSet>& entry = registry.hosts[host];
+        if (!entry) {
+            entry = std::make_unique<LatencyHistogramSet>();
+        }
+        hostSet = entry.get();
+    }
+    (*hostSet)[static_cast<size_t>(op)].record(micros);
+}
+
+//--------------------------------------
+// class LatencyTimer
+//--------------------------------------
+// Records the lifetime of the scope into the global and per-host histograms.
+class LatencyTimer
+{
+public:
+    LatencyTimer(LatencyOp op, std::string host) : op(op), host(std::move(host)) {}
+    ~LatencyTimer()
+    {
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        recordLatency(op, host, std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count());
+    }
+
+    LatencyTimer(const LatencyTimer&) = delete;
+    LatencyTimer& operator=(const LatencyTimer&) = delete;
+
+private:
+    LatencyOp op;
+    std::string host;
+    std::chrono::steady_clock::time_point start{std::chrono::steady_clock::now()};
+};
+
+//--------------------------------------
+// struct LatencySeries
+//--------------------------------------
+struct LatencySeries
+{
+    LatencyOp op;
+    std::string host; // Empty for the global series
+    LatencySummary summary;
+};
+
+//--------------------------------------
+// collectLatencySeries()
+//--------------------------------------
+// Global series first, then per host; series with no samples are skipped.
+std::vector<LatencySeries> collectLatencySeries()
+{
+    LatencyRegistry& registry = latencyRegistry();
+    std::vector<LatencySeries> series;
+    for (size_t op = 0; op < LATENCY_OP_COUNT; op++) {
+        LatencySummary summary = registry.global[op].summarize();
+        if (summary.count > 0) {
+            series.push_back({static_cast<LatencyOp>(op), "", summary});
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(registry.hostsLock);
+    for (const auto& [host, set] : registry.hosts) {
+        for (size_t op = 0; op < LATENCY_OP_COUNT; op++) {
+            LatencySummary summary = (*set)[op].summarize();
+            if (summary.count > 0) {
+                series.push_back({static_cast<LatencyOp>(op), host, summary});
+            }
+        }
+    }
+    return series;
+}
+
+//--------------------------------------
+// writeLatencyMetrics()
+//--------------------------------------
+// CSV with one row per series, latencies in milliseconds. The libgit2 version
+// is recorded so runs before and after an upgrade can be compared.
+bool writeLatencyMetrics(const std::string& path)
+{
+    std::ofstream out(path);
+    if (!out) {
+        return false;
+    }
+
+    int major = 0, minor = 0, revision = 0;
+    git_libgit2_version(&major, &minor, &revision);
+    out << "# libgit2 " << major << "." << minor << "." << revision << "\n";
+    out << "operation,host,count,p50_ms,p90_ms,p99_ms,max_ms\n";
+    for (const LatencySeries& s : collectLatencySeries()) {
+        out << LatencyOpToString(s.op) << "," << (s.host.empty() ? "*" : s.host) << "," << s.summary.count << ","
+            << s.summary.p50 / 1000.0 << "," << s.summary.p90 / 1000.0 << "," << s.summary.p99 / 1000.0 << ","
+            << s.summary.max / 1000.0 << "\n";
+    }
+    return static_cast<bool>(out);
+}
+
+#endif
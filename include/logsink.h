@@ -0,0 +1,200 @@
+#ifndef LOG_SINK_H
+#define LOG_SINK_H
+
+#include "git2.h"
+#include "tasktrace.h"
+
+#include <atomic>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+constexpr size_t LOG_CAPACITY = 4096;     // Entries kept, oldest overwritten first
+constexpr size_t LOG_MESSAGE_SIZE = 256; // Longer messages are truncated
+
+//--------------------------------------
+// enum LogLevel
+//--------------------------------------
+// Ordered like git_trace_level_t so libgit2 levels map across directly.
+enum class LogLevel : uint8_t
+{
+    LEVEL_NONE = GIT_TRACE_NONE,
+    LEVEL_ERROR = GIT_TRACE_ERROR,
+    LEVEL_WARN = GIT_TRACE_WARN,
+    LEVEL_INFO = GIT_TRACE_INFO,
+    LEVEL_DEBUG = GIT_TRACE_DEBUG,
+    LEVEL_TRACE = GIT_TRACE_TRACE,
+};
+
+//--------------------------------------
+// LogLevelToString()
+//--------------------------------------
+const char* LogLevelToString(LogLevel level)
+{
+    switch (level) {
+        case LogLevel::LEVEL_NONE:
+            return "OFF";
+        case LogLevel::LEVEL_ERROR:
+            return "ERROR";
+        case LogLevel::LEVEL_WARN:
+            return "WARNING";
+        case LogLevel::LEVEL_INFO:
+            return "INFO";
+        case LogLevel::LEVEL_DEBUG:
+            return "DEBUG";
+        case LogLevel::LEVEL_TRACE:
+            return "TRACE";
+        default:
+            return "";
+    }
+}
+
+//--------------------------------------
+// enum class LogSource
+//--------------------------------------
+enum class LogSource : uint8_t
+{
+    APP,
+    LIBGIT2,
+};
+
+//--------------------------------------
+// struct LogEntry
+//--------------------------------------
+struct LogEntry
+{
+    uint64_t timeNs{0};
+    uint32_t repoTag{0}; // internTraceTag() of the repo the message came from, 0 if none
+    uint32_t taskId{0};
+    LogLevel level{LogLevel::LEVEL_NONE};
+    LogSource source{LogSource::APP};
+    char text[LOG_MESSAGE_SIZE]{};
+};
+
+//--------------------------------------
+// class LogSink
+//--------------------------------------
+// Bounded in-memory log. Messages above the capture level return after a
+// single relaxed load; captured ones are formatted on the caller's stack and
+// copied in under a short lock.
+class LogSink
+{
+public:
+    LogSink() : entries(LOG_CAPACITY) {}
+
+    bool enabled(LogLevel level) const
+    {
+        return static_cast<uint8_t>(level) <= captureLevel.load(std::memory_order_relaxed);
+    }
+
+    void write(LogLevel level, LogSource source, const char* text)
+    {
+        LogEntry entry;
+        entry.timeNs = traceNowNs();
+        entry.repoTag = traceTaskContext.tag;
+        entry.taskId = traceTaskContext.taskId;
+        entry.level = level;
+        entry.source = source;
+        strncpy(entry.text, text, LOG_MESSAGE_SIZE - 1);
+
+        std::lock_guard<std::mutex> guard(lock);
+        entries[head % LOG_CAPACITY] = entry;
+        head++;
+        changes++;
+    }
+
+    void setCaptureLevel(LogLevel level) { captureLevel = static_cast<uint8_t>(level); }
+    LogLevel getCaptureLevel() const { return static_cast<LogLevel>(captureLevel.load()); }
+
+    void clear()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        tail = head;
+        changes++;
+    }
+
+    // Copies out the retained entries matching repoTag (0 matches all), oldest first.
+    void snapshot(std::vector<LogEntry>& out, uint32_t repoTag = 0)
+    {
+        out.clear();
+        std::lock_guard<std::mutex> guard(lock);
+        uint64_t begin = head > LOG_CAPACITY ? head - LOG_CAPACITY : 0;
+        if (begin < tail) {
+            begin = tail;
+        }
+        for (uint64_t i = begin; i < head; i++) {
+            const LogEntry& entry = entries[i % LOG_CAPACITY];
+            if (repoTag == 0 || entry.repoTag == repoTag) {
+                out.push_back(entry);
+            }
+        }
+    }
+
+    // Bumped by every write and clear, so viewers only re-snapshot on change.
+    uint64_t changeCount() const
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        return changes;
+    }
+
+private:
+    std::atomic<uint8_t> captureLevel{static_cast<uint8_t>(LogLevel::LEVEL_WARN)};
+    mutable std::mutex lock;
+    std::vector<LogEntry> entries;
+    uint64_t head{0};
+    uint64_t tail{0};
+    uint64_t changes{0};
+};
+
+LogSink& logSink()
+{
+    static LogSink sink;
+    return sink;
+}
+
+//--------------------------------------
+// logMessage()
+//--------------------------------------
+void logMessage(LogLevel level, const char* format, ...)
+{
+    LogSink& sink = logSink();
+    if (!sink.enabled(level)) {
+        return;
+    }
+
+    char text[LOG_MESSAGE_SIZE];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(text, sizeof(text), format, args);
+    va_end(args);
+    sink.write(level, LogSource::APP, text);
+}
+
+//--------------------------------------
+// libgit2TraceCallback()
+//--------------------------------------
+void libgit2TraceCallback(git_trace_level_t level, const char* msg)
+{
+    LogLevel logLevel = level == GIT_TRACE_FATAL ? LogLevel::LEVEL_ERROR : static_cast<LogLevel>(level);
+    if (logSink().enabled(logLevel)) {
+        logSink().write(logLevel, LogSource::LIBGIT2, msg);
+    }
+}
+
+//--------------------------------------
+// setLibgit2Tracing()
+//--------------------------------------
+// Routes libgit2's internal trace output into the log sink at the current
+// capture level. Returns false when libgit2 was built without tracing.
+bool setLibgit2Tracing(bool enable)
+{
+    LogLevel level = logSink().getCaptureLevel();
+    if (!enable || level == LogLevel::LEVEL_NONE) {
+        return git_trace_set(GIT_TRACE_NONE, nullptr) == 0;
+    }
+    return git_trace_set(static_cast<git_trace_level_t>(level), libgit2TraceCallback) == 0;
+}
+
+#endif
@@ -0,0 +1,105 @@
+#ifndef LOOPBACK_SERVER_H
+#define LOOPBACK_SERVER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+//--------------------------------------
+// enum LoopbackFailure
+//--------------------------------------
+// Faults the server may inject into a request, combined as a bitmask in
+// LoopbackServerConfig::failureModes.
+enum LoopbackFailure : uint32_t
+{
+    LOOPBACK_FAILURE_HTTP_500 = 1 << 0,   // Reply "500 Internal Server Error"
+    LOOPBACK_FAILURE_DISCONNECT = 1 << 1, // Close the connection without replying
+    LOOPBACK_FAILURE_TRUNCATE = 1 << 2,   // Send half of the response body, then close
+    LOOPBACK_FAILURE_ALL = LOOPBACK_FAILURE_HTTP_500 | LOOPBACK_FAILURE_DISCONNECT | LOOPBACK_FAILURE_TRUNCATE,
+};
+
+//--------------------------------------
+// struct LoopbackServerConfig
+//--------------------------------------
+struct LoopbackServerConfig
+{
+    std::filesystem::path root{""};         // Directory holding the bare repos to serve
+    uint16_t port{0};                       // 0 picks a free port
+    uint32_t latencyMs{0};                  // Delay added before every response
+    uint64_t bandwidthBytesPerSec{0};       // 0 is unthrottled, applied per connection
+    std::string authUsername{""};           // Empty disables the Basic auth challenge
+    std::string authPassword{""};
+    double failureRate{0.0};                // Probability [0, 1] that a request is faulted
+    uint32_t failureModes{LOOPBACK_FAILURE_ALL};
+    uint32_t seed{1};                       // Seed for failure injection, for reproducible runs
+};
+
+//--------------------------------------
+// struct LoopbackServerStats
+//--------------------------------------
+struct LoopbackServerStats
+{
+    uint64_t connections{0};
+    uint64_t requests{0};
+    uint64_t authChallenges{0};
+    uint64_t injectedFailures{0};
+    uint64_t bytesReceived{0};
+    uint64_t bytesSent{0};
+};
+
+//--------------------------------------
+// class LoopbackServer
+//--------------------------------------
+// Serves a directory of bare repositories over the git smart HTTP protocol
+// (upload-pack and receive-pack, protocol v0) on 127.0.0.1 so the fetch, push
+// and credential paths can be exercised without a real remote.
+class LoopbackServer
+{
+public:
+    explicit LoopbackServer(LoopbackServerConfig config);
+    ~LoopbackServer();
+
+    LoopbackServer(const LoopbackServer&) = delete;
+    LoopbackServer& operator=(const LoopbackServer&) = delete;
+
+    // Binds and starts accepting. Returns false and fills error on failure.
+    bool start(std::string& error);
+    void stop();
+
+    uint16_t port() const { return boundPort; }
+    std::string url() const { return "http://127.0.0.1:" + std::to_string(boundPort) + "/"; }
+    LoopbackServerStats stats() const;
+
+private:
+    void acceptLoop();
+    void serveConnection(intptr_t socket, uint64_t connectionIndex);
+
+    LoopbackServerConfig config;
+    intptr_t listenSocket{-1};
+    uint16_t boundPort{0};
+    std::atomic<bool> running{false};
+    std::thread acceptThread;
+    std::mutex connectionsLock;
+    std::condition_variable connectionsDone;
+    std::vector<intptr_t> openSockets;
+
+    std::atomic<uint64_t> connections{0};
+    std::atomic<uint64_t> requests{0};
+    std::atomic<uint64_t> authChallenges{0};
+    std::atomic<uint64_t> injectedFailures{0};
+    std::atomic<uint64_t> bytesReceived{0};
+    std::atomic<uint64_t> bytesSent{0};
+};
+
+//--------------------------------------
+// runLoopbackServer()
+//--------------------------------------
+// Runs the server in the foreground until interrupted and prints its stats.
+int runLoopbackServer(const LoopbackServerConfig& config);
+
+#endif
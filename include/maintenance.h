@@ -0,0 +1,508 @@
+#ifndef MAINTENANCE_H
+#define MAINTENANCE_H
+
+#include "git2.h"
+#include "git2/sys/midx.h"
+#include "git2/sys/commit_graph.h"
+#include "gitrepo.h"
+#include "tasktrace.h"
+#include "logsink.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+constexpr size_t MAINTENANCE_PACK_THRESHOLD = 16;      // Packs before a multi-pack-index is worth writing
+constexpr size_t MAINTENANCE_GRAPH_PACK_THRESHOLD = 4; // Packs written after the commit-graph before it is rewritten
+constexpr double MAINTENANCE_DUTY_CYCLE = 0.25;        // Share of wall time the background worker may spend working
+constexpr auto MAINTENANCE_MIN_PAUSE = std::chrono::milliseconds(100);
+constexpr size_t MAINTENANCE_BENCHMARK_COMMITS = 5000; // Commits looked up per benchmark run
+constexpr int MAINTENANCE_BENCHMARK_RUNS = 3;          // Best of, each on a freshly opened repository
+
+//--------------------------------------
+// struct PackLayout
+//--------------------------------------
+struct PackLayout
+{
+    size_t packs{0};
+    size_t uncoveredPacks{0}; // Packs the multi-pack-index doesn't list, all of them without one
+    bool multiPackIndex{false};
+    bool commitGraph{false};
+    size_t packsSinceCommitGraph{0}; // Packs written after the commit-graph, whose commits it lacks
+};
+
+//--------------------------------------
+// struct MaintenanceResult
+//--------------------------------------
+struct MaintenanceResult
+{
+    std::filesystem::path gitDirectory{""};
+    PackLayout before;
+    PackLayout after;
+    bool maintained{false};     // Needed maintenance; false when only inspected
+    size_t commits{0};          // Commits looked up by each benchmark run
+    double lookupBeforeUs{0.0}; // Mean time per commit lookup
+    double lookupAfterUs{0.0};
+    bool ok{true};
+    std::string message{""};
+};
+
+//--------------------------------------
+// objectsDirectory()
+//--------------------------------------
+std::filesystem::path objectsDirectory(git_repository* repo)
+{
+    git_buf path = GIT_BUF_INIT;
+    if (git_repository_item_path(&path, repo, GIT_REPOSITORY_ITEM_OBJECTS) != 0) {
+        return std::filesystem::path();
+    }
+    std::filesystem::path result = path.ptr;
+    git_buf_dispose(&path);
+    return result;
+}
+
+//--------------------------------------
+// readBigEndian()
+//--------------------------------------
+uint64_t readBigEndian(std::string_view bytes, size_t at, size_t size)
+{
+    uint64_t value = 0;
+    for (size_t i = 0; i < size; i++) {
+        value = (value << 8) | static_cast<unsigned char>(bytes[at + i]);
+    }
+    return value;
+}
+
+//--------------------------------------
+// readMultiPackIndexPacks()
+//--------------------------------------
+// Pack names, without extension, from the PNAM chunk of a multi-pack-index:
+// a 12 byte header whose 7th byte is the chunk count, then a table of
+// (id, offset) pairs ended by a terminating entry. False if the file can't be
+// read that way.
+bool readMultiPackIndexPacks(const std::filesystem::path& path, std::unordered_set<std::string>& packs)
+{
+    MappedFile file(path);
+    std::string_view midx = file.view();
+    if (midx.size() < 12 || midx.substr(0, 4) != "MIDX") {
+        return false;
+    }
+    size_t chunks = static_cast<unsigned char>(midx[6]);
+    if (12 + (chunks + 1) * 12 > midx.size()) {
+        return false;
+    }
+    for (size_t chunk = 0; chunk < chunks; chunk++) {
+        size_t entry = 12 + chunk * 12;
+        if (midx.substr(entry, 4) != "PNAM") {
+            continue;
+        }
+        uint64_t begin = readBigEndian(midx, entry + 4, 8);
+        uint64_t end = readBigEndian(midx, entry + 16, 8);
+        if (begin > end || end > midx.size()) {
+            return false;
+        }
+        std::string_view names = midx.substr(begin, end - begin);
+        while (!names.empty()) {
+            size_t length = names.find('\0');
+            std::string_view name = names.substr(0, length);
+            if (!name.empty()) {
+                packs.insert(std::filesystem::path(name).stem().string());
+            }
+            names.remove_prefix(length == std::string_view::npos ? names.size() : length + 1);
+        }
+        return true;
+    }
+    return false;
+}
+
+//--------------------------------------
+// inspectPackLayout()
+//--------------------------------------
+// Fetches add a pack each, so packs newer than the commit-graph stand in for
+// the commits it is missing.
+PackLayout inspectPackLayout(const std::filesystem::path& objects)
+{
+    PackLayout layout;
+    std::error_code error;
+    std::filesystem::path graphPath = objects / "info" / "commit-graph";
+    if (!std::filesystem::exists(graphPath, error)) {
+        graphPath = objects / "info" / "commit-graphs" / "commit-graph-chain";
+    }
+    layout.commitGraph = std::filesystem::exists(graphPath, error);
+    std::filesystem::file_time_type graphWritten = std::filesystem::file_time_type::max();
+    if (layout.commitGraph) {
+        graphWritten = std::filesystem::last_write_time(graphPath, error);
+        graphWritten = error ? std::filesystem::file_time_type::max() : graphWritten;
+    }
+
+    std::filesystem::path midxPath = objects / "pack" / "multi-pack-index";
+    layout.multiPackIndex = std::filesystem::exists(midxPath, error);
+    std::unordered_set<std::string> covered;
+    if (layout.multiPackIndex && !readMultiPackIndexPacks(midxPath, covered)) {
+        covered.clear();
+    }
+    for (const auto& entry : std::filesystem::directory_iterator(objects / "pack", error)) {
+        if (entry.path().extension() == ".idx") {
+            layout.packs++;
+            layout.uncoveredPacks += covered.count(entry.path().stem().string()) == 0 ? 1 : 0;
+            std::error_code timeError;
+            std::filesystem::file_time_type written = entry.last_write_time(timeError);
+            layout.packsSinceCommitGraph += !timeError && written > graphWritten ? 1 : 0;
+        }
+    }
+    return layout;
+}
+
+//--------------------------------------
+// needsMaintenance()
+//--------------------------------------
+// A multi-pack-index only pays off across many packs, so it is (re)written
+// once that many aren't covered by it; fetches since it was written add
+// packs it doesn't know. A commit-graph helps any repo with history, so its
+// absence qualifies. Rewriting it walks all history, so a few fetches' worth
+// of commits are left to the object database first.
+bool needsMaintenance(const PackLayout& layout, size_t packThreshold)
+{
+    return layout.uncoveredPacks >= packThreshold || !layout.commitGraph
+           || layout.packsSinceCommitGraph >= MAINTENANCE_GRAPH_PACK_THRESHOLD;
+}
+
+//--------------------------------------
+// benchmarkCommitLookups()
+//--------------------------------------
+// Walks back from HEAD looking up each commit, the same object access status
+// and ahead/behind checks do. Each run opens the repository afresh so its
+// object cache is cold and newly written index files are picked up. Returns
+// the best mean microseconds per commit.
+double benchmarkCommitLookups(const std::filesystem::path& gitDirectory, size_t& commits)
+{
+    double best = 0.0;
+    commits = 0;
+    for (int run = 0; run < MAINTENANCE_BENCHMARK_RUNS; run++) {
+        git_repository* repo = nullptr;
+        git_revwalk* walk = nullptr;
+        if (git_repository_open(&repo, gitDirectory.string().c_str()) != 0 || git_revwalk_new(&walk, repo) != 0
+            || git_revwalk_push_head(walk) != 0) {
+            git_revwalk_free(walk);
+            git_repository_free(repo);
+            return 0.0;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        size_t count = 0;
+        git_oid oid;
+        while (count < MAINTENANCE_BENCHMARK_COMMITS && git_revwalk_next(&oid, walk) == 0) {
+            git_commit* commit = nullptr;
+            if (git_commit_lookup(&commit, repo, &oid) == 0) {
+                git_commit_tree_id(commit);
+                git_commit_free(commit);
+            }
+            count++;
+        }
+        double elapsed = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+        git_revwalk_free(walk);
+        git_repository_free(repo);
+
+        double perCommit = count > 0 ? elapsed / count : 0.0;
+        if (run == 0 || perCommit < best) {
+            best = perCommit;
+        }
+        commits = count;
+    }
+    return best;
+}
+
+//--------------------------------------
+// writeMultiPackIndex()
+//--------------------------------------
+bool writeMultiPackIndex(const std::filesystem::path& objects, std::string& error)
+{
+    std::filesystem::path packDirectory = objects / "pack";
+    git_midx_writer* writer = nullptr;
+    if (git_midx_writer_new(&writer, packDirectory.string().c_str()) != 0) {
+        error = git_error_last()->message;
+        return false;
+    }
+
+    bool ok = true;
+    std::error_code iterateError;
+    for (const auto& entry : std::filesystem::directory_iterator(packDirectory, iterateError)) {
+        if (entry.path().extension() != ".idx") {
+            continue;
+        }
+        if (git_midx_writer_add(writer, entry.path().filename().string().c_str()) != 0) {
+            error = git_error_last()->message;
+            ok = false;
+            break;
+        }
+    }
+    if (ok && git_midx_writer_commit(writer) != 0) {
+        error = git_error_last()->message;
+        ok = false;
+    }
+    git_midx_writer_free(writer);
+    return ok;
+}
+
+//--------------------------------------
+// writeCommitGraph()
+//--------------------------------------
+// Covers every commit reachable from any ref.
+bool writeCommitGraph(git_repository* repo, const std::filesystem::path& objects, std::string& error)
+{
+    std::filesystem::path infoDirectory = objects / "info";
+    std::error_code createError;
+    std::filesystem::create_directories(infoDirectory, createError);
+
+    git_commit_graph_writer_options options = GIT_COMMIT_GRAPH_WRITER_OPTIONS_INIT;
+    git_commit_graph_writer* writer = nullptr;
+    git_revwalk* walk = nullptr;
+    bool ok = git_commit_graph_writer_new(&writer, infoDirectory.string().c_str(), &options) == 0
+              && git_revwalk_new(&walk, repo) == 0 && git_revwalk_push_glob(walk, "*") == 0
+              && git_commit_graph_writer_add_revwalk(writer, walk) == 0 && git_commit_graph_writer_commit(writer) == 0;
+    if (!ok) {
+        error = git_error_last()->message;
+    }
+    git_revwalk_free(walk);
+    git_commit_graph_writer_free(writer);
+    return ok;
+}
+
+//--------------------------------------
+// maintainRepo()
+//--------------------------------------
+// Writes whichever index files the repo is missing or has outgrown and
+// benchmarks commit lookups before and after. Repos that need nothing are
+// only inspected.
+MaintenanceResult maintainRepo(const std::filesystem::path& gitDirectory, size_t packThreshold)
+{
+    MaintenanceResult result;
+    result.gitDirectory = gitDirectory;
+    TraceTaskScope traceScope(internTraceTag(repoDisplayPath(gitDirectory).string()), TracePhase::MAINTENANCE);
+    TraceSpan span(TracePhase::MAINTENANCE);
+
+    git_repository* repo = nullptr;
+    if (git_repository_open(&repo, gitDirectory.string().c_str()) != 0) {
+        result.ok = false;
+        result.message = git_error_last()->message;
+        return result;
+    }
+    std::filesystem::path objects = objectsDirectory(repo);
+    result.before = inspectPackLayout(objects);
+    result.after = result.before;
+    if (!needsMaintenance(result.before, packThreshold)) {
+        git_repository_free(repo);
+        return result;
+    }
+
+    result.maintained = true;
+    result.lookupBeforeUs = benchmarkCommitLookups(gitDirectory, result.commits);
+    std::string error;
+    if (result.before.uncoveredPacks >= packThreshold) {
+        if (writeMultiPackIndex(objects, error)) {
+            result.message += "Wrote multi-pack-index over " + std::to_string(result.before.packs) + " packs ("
+                              + std::to_string(result.before.uncoveredPacks) + " new). ";
+        }
+        else {
+            result.ok = false;
+            result.message += "Error writing multi-pack-index: " + error + " ";
+        }
+    }
+    if (!result.before.commitGraph || result.before.packsSinceCommitGraph >= MAINTENANCE_GRAPH_PACK_THRESHOLD) {
+        if (writeCommitGraph(repo, objects, error)) {
+            result.message += result.before.commitGraph
+                                  ? "Refreshed commit-graph, " + std::to_string(result.before.packsSinceCommitGraph)
+                                        + " packs behind."
+                                  : "Wrote commit-graph.";
+        }
+        else {
+            result.ok = false;
+            result.message += "Error writing commit-graph: " + error;
+        }
+    }
+    git_repository_free(repo);
+
+    result.after = inspectPackLayout(objects);
+    result.lookupAfterUs = benchmarkCommitLookups(gitDirectory, result.commits);
+    logMessage(
+        result.ok ? LogLevel::LEVEL_INFO : LogLevel::LEVEL_ERROR,
+        "Maintenance: %s (commit lookup %.2f us -> %.2f us)",
+        result.message.c_str(),
+        result.lookupBeforeUs,
+        result.lookupAfterUs);
+    return result;
+}
+
+//--------------------------------------
+// lowerThreadPriority()
+//--------------------------------------
+// Background priority for the calling thread, CPU and where the platform
+// ties them together, disk as well.
+void lowerThreadPriority()
+{
+#ifdef _WIN32
+    SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_BEGIN);
+#elif defined(__linux__)
+    // Linux nice values are per thread
+    setpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)), 19);
+#endif
+}
+
+//--------------------------------------
+// class MaintenanceRunner
+//--------------------------------------
+// Works through repos one at a time on a low priority background thread,
+// pausing between repos so it uses at most MAINTENANCE_DUTY_CYCLE of the
+// wall clock and never competes with interactive tasks for long.
+class MaintenanceRunner
+{
+public:
+    ~MaintenanceRunner() { cancel(); }
+
+    // False if a run is already going.
+    bool start(std::vector<std::filesystem::path> gitDirectories, size_t packThreshold)
+    {
+        if (isRunning()) {
+            return false;
+        }
+        if (worker.joinable()) {
+            worker.join();
+        }
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            completed.clear();
+        }
+        total = gitDirectories.size();
+        done = 0;
+        cancelled = false;
+        running = true;
+        worker = std::thread([this, gitDirectories = std::move(gitDirectories), packThreshold]() {
+            setTraceThreadName("maintenance");
+            lowerThreadPriority();
+            for (const std::filesystem::path& gitDirectory : gitDirectories) {
+                if (cancelled) {
+                    break;
+                }
+                auto start = std::chrono::steady_clock::now();
+                MaintenanceResult result = maintainRepo(gitDirectory, packThreshold);
+                {
+                    std::lock_guard<std::mutex> guard(lock);
+                    completed.push_back(std::move(result));
+                }
+                done++;
+
+                auto worked = std::chrono::steady_clock::now() - start;
+                auto pause = std::chrono::duration_cast<std::chrono::milliseconds>(
+                    worked * ((1.0 - MAINTENANCE_DUTY_CYCLE) / MAINTENANCE_DUTY_CYCLE));
+                pause = pause > MAINTENANCE_MIN_PAUSE ? pause : MAINTENANCE_MIN_PAUSE;
+                std::unique_lock<std::mutex> guard(lock);
+                wake.wait_for(guard, pause, [this]() { return cancelled.load(); });
+            }
+            running = false;
+        });
+        return true;
+    }
+
+    void cancel()
+    {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            cancelled = true;
+        }
+        wake.notify_all();
+        if (worker.joinable()) {
+            worker.join();
+        }
+    }
+
+    bool isRunning() const { return running; }
+    size_t progress() const { return done; }
+    size_t repoCount() const { return total; }
+
+    std::vector<MaintenanceResult> results()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        return completed;
+    }
+
+private:
+    std::thread worker;
+    std::mutex lock;
+    std::condition_variable wake;
+    std::vector<MaintenanceResult> completed;
+    std::atomic<bool> running{false};
+    std::atomic<bool> cancelled{false};
+    std::atomic<size_t> done{0};
+    std::atomic<size_t> total{0};
+};
+
+//--------------------------------------
+// struct MaintenanceConfig
+//--------------------------------------
+struct MaintenanceConfig
+{
+    std::string root{""};
+    size_t packThreshold{MAINTENANCE_PACK_THRESHOLD};
+};
+
+//--------------------------------------
+// runMaintenance()
+//--------------------------------------
+// Headless maintenance over every repo under root, printing each repo's
+// pack layout and commit lookup times before and after.
+int runMaintenance(const MaintenanceConfig& config)
+{
+    std::vector<std::filesystem::path> gitDirectories = findGitDirectories(config.root);
+    if (gitDirectories.empty()) {
+        std::cerr << "No repositories found under " << config.root << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    MaintenanceRunner runner;
+    runner.start(gitDirectories, config.packThreshold);
+    while (runner.isRunning()) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+
+    int failures = 0;
+    size_t maintained = 0;
+    printf("%-50s %6s %5s %5s %12s %12s\n", "Repo", "Packs", "MIDX", "Graph", "Before (us)", "After (us)");
+    for (const MaintenanceResult& result : runner.results()) {
+        failures += result.ok ? 0 : 1;
+        if (!result.maintained && result.ok) {
+            continue;
+        }
+        maintained++;
+        printf(
+            "%-50s %6zu %5s %5s %12.2f %12.2f %s\n",
+            repoDisplayPath(result.gitDirectory).string().c_str(),
+            result.before.packs,
+            result.after.multiPackIndex ? "yes" : "no",
+            result.after.commitGraph ? "yes" : "no",
+            result.lookupBeforeUs,
+            result.lookupAfterUs,
+            result.ok ? "" : result.message.c_str());
+    }
+    printf("%zu of %zu repos needed maintenance, %d failed\n", maintained, gitDirectories.size(), failures);
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+#endif
@@ -0,0 +1,335 @@
+#ifndef REF_SNAPSHOT_H
+#define REF_SNAPSHOT_H
+
+#include "git2.h"
+
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+constexpr int REF_SNAPSHOT_MAX_SYMREF_DEPTH = 5;
+
+//--------------------------------------
+// struct RefSnapshot
+//--------------------------------------
+// The refs a repo's state is computed from. Equal snapshots mean equal state,
+// ahead/behind counts, HEAD commit time and checked out branch.
+struct RefSnapshot
+{
+    bool valid{false};         // False when the refs couldn't be read without libgit2
+    std::string headRef{""};   // Branch HEAD points at, empty if detached
+    git_oid head{};            // Zero if HEAD is unborn
+    git_oid upstream{};        // Zero without an upstream
+
+    bool operator==(const RefSnapshot& other) const
+    {
+        return valid && other.valid && headRef == other.headRef && git_oid_equal(&head, &other.head)
+               && git_oid_equal(&upstream, &other.upstream);
+    }
+};
+
+//--------------------------------------
+// class MappedFile
+//--------------------------------------
+// Read-only view of a whole file; empty if it is missing or empty.
+class MappedFile
+{
+public:
+    explicit MappedFile(const std::filesystem::path& path)
+    {
+#ifdef _WIN32
+        HANDLE file = CreateFileW(
+            path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING,
+            FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE) {
+            return;
+        }
+        LARGE_INTEGER fileSize;
+        if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0) {
+            mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if (mapping != nullptr) {
+                data = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+                size = data != nullptr ? static_cast<size_t>(fileSize.QuadPart) : 0;
+            }
+        }
+        CloseHandle(file);
+#else
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return;
+        }
+        struct stat info;
+        if (fstat(fd, &info) == 0 && info.st_size > 0) {
+            void* view = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+            if (view != MAP_FAILED) {
+                data = static_cast<const char*>(view);
+                size = static_cast<size_t>(info.st_size);
+            }
+        }
+        close(fd);
+#endif
+    }
+
+    ~MappedFile()
+    {
+#ifdef _WIN32
+        if (data != nullptr) {
+            UnmapViewOfFile(data);
+        }
+        if (mapping != nullptr) {
+            CloseHandle(mapping);
+        }
+#else
+        if (data != nullptr) {
+            munmap(const_cast<char*>(data), size);
+        }
+#endif
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    std::string_view view() const { return std::string_view(data != nullptr ? data : "", size); }
+
+private:
+    const char* data{nullptr};
+    size_t size{0};
+#ifdef _WIN32
+    HANDLE mapping{nullptr};
+#endif
+};
+
+//--------------------------------------
+// trimRefLine()
+//--------------------------------------
+std::string_view trimRefLine(std::string_view line)
+{
+    while (!line.empty() && std::strchr(" \t\r\n", line.back()) != nullptr) {
+        line.remove_suffix(1);
+    }
+    while (!line.empty() && std::strchr(" \t", line.front()) != nullptr) {
+        line.remove_prefix(1);
+    }
+    return line;
+}
+
+//--------------------------------------
+// readSmallFile()
+//--------------------------------------
+bool readSmallFile(const std::filesystem::path& path, std::string& contents)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        return false;
+    }
+    std::ostringstream buffer;
+    buffer << file.rdbuf();
+    contents = buffer.str();
+    return true;
+}
+
+//--------------------------------------
+// parseRefOid()
+//--------------------------------------
+bool parseRefOid(std::string_view hex, git_oid& oid)
+{
+    return hex.size() == GIT_OID_HEXSZ && git_oid_fromstrn(&oid, hex.data(), hex.size()) == 0;
+}
+
+//--------------------------------------
+// findPackedRef()
+//--------------------------------------
+// Looks refName up in a mapped packed-refs file, whose lines are
+// "<oid> <ref>", with "^<oid>" lines holding peeled tags.
+bool findPackedRef(std::string_view packedRefs, const std::string& refName, git_oid& oid)
+{
+    std::string needle = " " + refName;
+    for (size_t at = packedRefs.find(needle); at != std::string_view::npos; at = packedRefs.find(needle, at + 1)) {
+        size_t end = at + needle.size();
+        if (end < packedRefs.size() && packedRefs[end] != '\n' && packedRefs[end] != '\r') {
+            continue;
+        }
+        size_t lineStart = packedRefs.rfind('\n', at);
+        lineStart = lineStart == std::string_view::npos ? 0 : lineStart + 1;
+        if (parseRefOid(packedRefs.substr(lineStart, at - lineStart), oid)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+//--------------------------------------
+// class RefReader
+//--------------------------------------
+// Resolves refs straight from a git directory's files: loose refs first,
+// then packed-refs. Worktree-local refs (HEAD) come from the git directory,
+// shared refs from the common directory.
+class RefReader
+{
+public:
+    RefReader(std::filesystem::path gitDirectory, std::filesystem::path commonDirectory)
+        : gitDirectory(std::move(gitDirectory)), commonDirectory(std::move(commonDirectory)),
+          packedRefs(this->commonDirectory / "packed-refs")
+    {
+    }
+
+    // Zero oid and true for a ref that doesn't exist; false if the ref
+    // can't be read this way.
+    bool resolve(std::string refName, git_oid& oid, std::string* resolvedName = nullptr)
+    {
+        std::string contents;
+        for (int depth = 0; depth < REF_SNAPSHOT_MAX_SYMREF_DEPTH; depth++) {
+            const std::filesystem::path& base = refName == "HEAD" ? gitDirectory : commonDirectory;
+            if (!readSmallFile(base / refName, contents)) {
+                if (resolvedName != nullptr) {
+                    *resolvedName = refName;
+                }
+                if (!findPackedRef(packedRefs.view(), refName, oid)) {
+                    std::memset(&oid, 0, sizeof(oid));
+                }
+                return true;
+            }
+            std::string_view line = trimRefLine(contents);
+            if (line.compare(0, 5, "ref: ") == 0) {
+                refName = std::string(line.substr(5));
+                continue;
+            }
+            if (resolvedName != nullptr) {
+                *resolvedName = refName;
+            }
+            return parseRefOid(line, oid);
+        }
+        return false;
+    }
+
+private:
+    std::filesystem::path gitDirectory;
+    std::filesystem::path commonDirectory;
+    MappedFile packedRefs;
+};
+
+//--------------------------------------
+// readBranchUpstream()
+//--------------------------------------
+// Remote-tracking ref of branch from the repo's config, empty without one.
+// False when the config needs more than this reader understands: includes,
+// or a remote whose fetch refspec isn't the default one.
+bool readBranchUpstream(const std::filesystem::path& commonDirectory, const std::string& branch, std::string& upstream)
+{
+    upstream.clear();
+    std::string config;
+    if (!readSmallFile(commonDirectory / "config", config)) {
+        return false;
+    }
+
+    std::string section;
+    std::string remote;
+    std::string merge;
+    std::vector<std::pair<std::string, std::string>> fetchSpecs; // Remote name, refspec
+    std::istringstream lines(config);
+    std::string rawLine;
+    while (std::getline(lines, rawLine)) {
+        std::string_view line = trimRefLine(rawLine);
+        if (line.empty() || line[0] == '#' || line[0] == ';') {
+            continue;
+        }
+        if (line[0] == '[') {
+            section = std::string(line);
+            if (section.compare(0, 8, "[include") == 0) {
+                return false;
+            }
+            continue;
+        }
+        size_t equals = line.find('=');
+        if (equals == std::string_view::npos) {
+            continue;
+        }
+        std::string key(trimRefLine(line.substr(0, equals)));
+        std::string_view value = trimRefLine(line.substr(equals + 1));
+        if (value.size() >= 2 && value.front() == '"' && value.back() == '"') {
+            value = value.substr(1, value.size() - 2);
+        }
+        for (char& c : key) {
+            c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+        }
+        if (section == "[branch \"" + branch + "\"]") {
+            if (key == "remote") {
+                remote = value;
+            }
+            else if (key == "merge") {
+                merge = value;
+            }
+        }
+        else if (section.compare(0, 9, "[remote \"") == 0 && key == "fetch") {
+            fetchSpecs.emplace_back(section.substr(9, section.size() - 11), std::string(value));
+        }
+    }
+
+    if (remote.empty() || merge.empty()) {
+        return true;
+    }
+    if (remote == ".") {
+        upstream = merge;
+        return true;
+    }
+    std::string defaultSpec = "refs/heads/*:refs/remotes/" + remote + "/*";
+    size_t specs = 0;
+    for (const auto& [name, spec] : fetchSpecs) {
+        if (name != remote) {
+            continue;
+        }
+        specs++;
+        if (spec != defaultSpec && spec != "+" + defaultSpec) {
+            return false;
+        }
+    }
+    if (specs != 1 || merge.compare(0, 11, "refs/heads/") != 0) {
+        return false;
+    }
+    upstream = "refs/remotes/" + remote + "/" + merge.substr(11);
+    return true;
+}
+
+//--------------------------------------
+// readRefSnapshot()
+//--------------------------------------
+// HEAD and upstream commits without opening the repo. The result is invalid
+// whenever something would need libgit2 to interpret, so callers fall back to
+// a full open rather than trust a guess.
+RefSnapshot readRefSnapshot(const std::filesystem::path& gitDirectory, const std::filesystem::path& commonDirectory)
+{
+    RefSnapshot snapshot;
+    RefReader reader(gitDirectory, commonDirectory);
+    std::string headName;
+    if (!reader.resolve("HEAD", snapshot.head, &headName)) {
+        return snapshot;
+    }
+    if (headName.compare(0, 11, "refs/heads/") == 0) {
+        snapshot.headRef = headName;
+        std::string upstream;
+        if (!readBranchUpstream(commonDirectory, headName.substr(11), upstream)) {
+            return snapshot;
+        }
+        if (!upstream.empty() && !reader.resolve(upstream, snapshot.upstream)) {
+            return snapshot;
+        }
+    }
+    snapshot.valid = true;
+    return snapshot;
+}
+
+#endif
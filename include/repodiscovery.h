@@ -0,0 +1,228 @@
+#ifndef REPO_DISCOVERY_H
+#define REPO_DISCOVERY_H
+
+#include "tasktrace.h"
+#include "logsink.h"
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+//--------------------------------------
+// enum RepoLayout
+//--------------------------------------
+enum class RepoLayout : uint8_t
+{
+    STANDARD,        // Working tree with a '.git' directory
+    LINKED_WORKTREE, // '.git' file pointing into another repo's worktrees/
+    SUBMODULE,       // '.git' file pointing into a superproject's modules/
+    GITFILE,         // Any other '.git' file, e.g. from --separate-git-dir
+    BARE,
+};
+
+//--------------------------------------
+// RepoLayoutToString()
+//--------------------------------------
+const char* RepoLayoutToString(RepoLayout layout)
+{
+    switch (layout) {
+        case RepoLayout::STANDARD:
+            return "standard";
+        case RepoLayout::LINKED_WORKTREE:
+            return "worktree";
+        case RepoLayout::SUBMODULE:
+            return "submodule";
+        case RepoLayout::GITFILE:
+            return "gitfile";
+        case RepoLayout::BARE:
+            return "bare";
+        default:
+            return "unknown";
+    }
+}
+
+//--------------------------------------
+// struct DiscoveredRepo
+//--------------------------------------
+struct DiscoveredRepo
+{
+    std::filesystem::path openPath{""};        // '.git' entry, or the directory of a bare repo
+    std::filesystem::path gitDirectory{""};    // Resolved git directory
+    std::filesystem::path commonDirectory{""}; // Objects and refs, shared by every worktree of a repo
+    RepoLayout layout{RepoLayout::STANDARD};
+};
+
+//--------------------------------------
+// repoDisplayPath()
+//--------------------------------------
+// Working directory for repos found through '.git', the repo itself if bare.
+std::filesystem::path repoDisplayPath(const std::filesystem::path& openPath)
+{
+    std::filesystem::path name = openPath.filename();
+    return name.empty() || name == ".git" ? openPath.parent_path() : openPath;
+}
+
+//--------------------------------------
+// readFirstLine()
+//--------------------------------------
+std::string readFirstLine(const std::filesystem::path& file)
+{
+    std::ifstream stream(file);
+    std::string line;
+    std::getline(stream, line);
+    while (!line.empty() && (line.back() == '\r' || line.back() == ' ')) {
+        line.pop_back();
+    }
+    return line;
+}
+
+//--------------------------------------
+// readGitfile()
+//--------------------------------------
+// Target of a "gitdir: <path>" file; relative targets are relative to the
+// file's directory.
+std::optional<std::filesystem::path> readGitfile(const std::filesystem::path& gitfile)
+{
+    constexpr std::string_view prefix = "gitdir: ";
+    std::string line = readFirstLine(gitfile);
+    if (line.compare(0, prefix.size(), prefix) != 0) {
+        return std::nullopt;
+    }
+    std::filesystem::path target = line.substr(prefix.size());
+    if (target.is_relative()) {
+        target = gitfile.parent_path() / target;
+    }
+    return target.lexically_normal();
+}
+
+//--------------------------------------
+// readCommonDirectory()
+//--------------------------------------
+// A linked worktree's git directory names the main one in its 'commondir'
+// file; any other git directory is its own.
+std::filesystem::path readCommonDirectory(const std::filesystem::path& gitDirectory)
+{
+    std::string line = readFirstLine(gitDirectory / "commondir");
+    std::filesystem::path common = line.empty() ? gitDirectory : std::filesystem::path(line);
+    if (common.is_relative()) {
+        common = gitDirectory / common;
+    }
+    // "../.." normalizes with a trailing separator; drop it so paths compare equal
+    common = common.lexically_normal();
+    return common.has_filename() ? common : common.parent_path();
+}
+
+//--------------------------------------
+// isGitDirectory()
+//--------------------------------------
+// git's own test: a HEAD file plus objects and refs directories.
+bool isGitDirectory(const std::filesystem::path& directory)
+{
+    std::error_code error;
+    return std::filesystem::is_regular_file(directory / "HEAD", error)
+           && std::filesystem::is_directory(directory / "objects", error)
+           && std::filesystem::is_directory(directory / "refs", error);
+}
+
+//--------------------------------------
+// isBareConfig()
+//--------------------------------------
+// Whether a git directory's config sets core.bare. Git directories that only
+// look bare, like one made by --separate-git-dir, are found via their gitfile.
+bool isBareConfig(const std::filesystem::path& directory)
+{
+    std::ifstream config(directory / "config");
+    std::string line;
+    bool core = false;
+    while (std::getline(config, line)) {
+        line.erase(0, line.find_first_not_of(" \t"));
+        if (!line.empty() && line[0] == '[') {
+            core = line.compare(0, 6, "[core]") == 0;
+        }
+        else if (core && line.compare(0, 4, "bare") == 0) {
+            return line.find("true") != std::string::npos;
+        }
+    }
+    return false;
+}
+
+//--------------------------------------
+// isSubmoduleGitDirectory()
+//--------------------------------------
+// Submodule git directories live at <superproject git dir>/modules/<name>,
+// where the name may itself contain slashes.
+bool isSubmoduleGitDirectory(const std::filesystem::path& gitDirectory)
+{
+    for (std::filesystem::path path = gitDirectory; path.has_relative_path(); path = path.parent_path()) {
+        if (path.filename() == "modules" && isGitDirectory(path.parent_path())) {
+            return true;
+        }
+    }
+    return false;
+}
+
+//--------------------------------------
+// discoverRepos()
+//--------------------------------------
+// Every repo under root: '.git' directories, '.git' files and bare repos, in
+// traversal order. Repos are resolved from their gitfile and commondir alone,
+// without opening them, and git directories themselves are not descended into.
+std::vector<DiscoveredRepo> discoverRepos(const std::filesystem::path& root)
+{
+    TraceSpan span(TracePhase::SCAN);
+    std::vector<DiscoveredRepo> repos;
+    try {
+        auto it = std::filesystem::recursive_directory_iterator(
+            root, std::filesystem::directory_options::skip_permission_denied);
+        for (; it != std::filesystem::recursive_directory_iterator(); ++it) {
+            const std::filesystem::directory_entry& entry = *it;
+            std::error_code error;
+            bool directory = entry.is_directory(error);
+            DiscoveredRepo repo;
+            repo.openPath = entry.path();
+
+            if (entry.path().filename() == ".git" && directory) {
+                it.disable_recursion_pending();
+                repo.gitDirectory = entry.path();
+                repo.layout = RepoLayout::STANDARD;
+            }
+            else if (entry.path().filename() == ".git" && entry.is_regular_file(error)) {
+                std::optional<std::filesystem::path> target = readGitfile(entry.path());
+                if (!target.has_value()) {
+                    logMessage(LogLevel::LEVEL_WARN, "Ignoring %s: not a gitfile", entry.path().string().c_str());
+                    continue;
+                }
+                repo.gitDirectory = target.value();
+                if (std::filesystem::exists(repo.gitDirectory / "commondir", error)) {
+                    repo.layout = RepoLayout::LINKED_WORKTREE;
+                }
+                else {
+                    repo.layout = isSubmoduleGitDirectory(repo.gitDirectory) ? RepoLayout::SUBMODULE : RepoLayout::GITFILE;
+                }
+            }
+            else if (directory && isGitDirectory(entry.path())) {
+                it.disable_recursion_pending();
+                if (!isBareConfig(entry.path())) {
+                    continue;
+                }
+                repo.gitDirectory = entry.path();
+                repo.layout = RepoLayout::BARE;
+            }
+            else {
+                continue;
+            }
+            repo.commonDirectory = readCommonDirectory(repo.gitDirectory);
+            repos.push_back(std::move(repo));
+        }
+    }
+    catch (const std::filesystem::filesystem_error& e) {
+        logMessage(LogLevel::LEVEL_ERROR, "Error accessing %s: %s", root.string().c_str(), e.what());
+    }
+    return repos;
+}
+
+#endif
@@ -0,0 +1,359 @@
+#ifndef REPO_FILTER_H
+#define REPO_FILTER_H
+
+#include "repotable.h"
+
+#include <bit>
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#if defined(_M_X64) || defined(__SSE2__)
+    #include <emmintrin.h>
+    #define REPO_FILTER_SSE2 1
+#endif
+
+constexpr int FILTER_SCORE_MATCH = 16;
+constexpr int FILTER_SCORE_CONSECUTIVE = 12; // Follows the previous matched character
+constexpr int FILTER_SCORE_BOUNDARY = 10;    // Starts a path component or word
+constexpr int FILTER_SCORE_NAME = 4;         // Inside the repo's own directory name or branch
+constexpr int FILTER_MAX_GAP_PENALTY = 8;    // One point per skipped byte, up to this per gap
+constexpr uint32_t FILTER_END_PENDING = UINT32_MAX;
+constexpr size_t FILTER_ARENA_PADDING = 16; // Lets the byte search load whole blocks past the last entry
+
+//--------------------------------------
+// struct RepoFilterMatch
+//--------------------------------------
+struct RepoFilterMatch
+{
+    uint32_t row;
+    uint32_t end; // Arena offset just past the leftmost match of the query so far, or FILTER_END_PENDING
+};
+
+//--------------------------------------
+// filterCharacterBit()
+//--------------------------------------
+// Letters and digits get a bit each; everything else shares the rest. Shared
+// bits only make pruning less selective, never wrong.
+uint64_t filterCharacterBit(unsigned char c)
+{
+    if (c >= 'a' && c <= 'z') {
+        return uint64_t(1) << (c - 'a');
+    }
+    if (c >= '0' && c <= '9') {
+        return uint64_t(1) << (26 + c - '0');
+    }
+    return uint64_t(1) << (36 + c % 28);
+}
+
+//--------------------------------------
+// filterCharacterMask()
+//--------------------------------------
+uint64_t filterCharacterMask(std::string_view text)
+{
+    uint64_t mask = 0;
+    for (char c : text) {
+        mask |= filterCharacterBit(static_cast<unsigned char>(c));
+    }
+    return mask;
+}
+
+//--------------------------------------
+// isFilterBoundary()
+//--------------------------------------
+bool isFilterBoundary(char c)
+{
+    return c == '/' || c == '\\' || c == '-' || c == '_' || c == '.' || c == ' ';
+}
+
+//--------------------------------------
+// fuzzyMatchFrom()
+//--------------------------------------
+// Leftmost subsequence match of query in text starting at `from`. memchr does
+// the skipping between matched characters, which libc vectorizes.
+std::optional<int> fuzzyMatchFrom(
+    std::string_view text, size_t from, size_t nameStart, std::string_view query, size_t* firstIndex = nullptr)
+{
+    int score = 0;
+    size_t previous = SIZE_MAX;
+    size_t position = from;
+    for (char c : query) {
+        if (position >= text.size()) {
+            return std::nullopt;
+        }
+        const void* found = memchr(text.data() + position, c, text.size() - position);
+        if (found == nullptr) {
+            return std::nullopt;
+        }
+        size_t index = static_cast<const char*>(found) - text.data();
+        if (previous == SIZE_MAX && firstIndex != nullptr) {
+            *firstIndex = index;
+        }
+
+        score += FILTER_SCORE_MATCH;
+        if (previous != SIZE_MAX && index == previous + 1) {
+            score += FILTER_SCORE_CONSECUTIVE;
+        }
+        else if (previous != SIZE_MAX) {
+            size_t gap = index - previous - 1;
+            score -= static_cast<int>(gap < FILTER_MAX_GAP_PENALTY ? gap : FILTER_MAX_GAP_PENALTY);
+        }
+        if (index == 0 || isFilterBoundary(text[index - 1])) {
+            score += FILTER_SCORE_BOUNDARY;
+        }
+        if (index >= nameStart) {
+            score += FILTER_SCORE_NAME;
+        }
+        previous = index;
+        position = index + 1;
+    }
+    return score;
+}
+
+//--------------------------------------
+// fuzzyMatch()
+//--------------------------------------
+// Also tries matching entirely inside the repo name and branch, which the
+// leftmost match misses when the query's first character also appears
+// earlier in the path.
+std::optional<int> fuzzyMatch(std::string_view text, size_t nameStart, std::string_view query)
+{
+    size_t firstIndex = 0;
+    std::optional<int> score = fuzzyMatchFrom(text, 0, nameStart, query, &firstIndex);
+    if (score.has_value() && firstIndex < nameStart) {
+        std::optional<int> nameScore = fuzzyMatchFrom(text, nameStart, nameStart, query);
+        if (nameScore.has_value() && nameScore.value() > score.value()) {
+            score = nameScore;
+        }
+    }
+    return score;
+}
+
+//--------------------------------------
+// findFilterByte()
+//--------------------------------------
+// memchr for the short spans of one entry, inlined to avoid the call
+// overhead. May read up to 15 bytes past end, which the arena pads for.
+const char* findFilterByte(const char* begin, const char* end, char c)
+{
+#ifdef REPO_FILTER_SSE2
+    const __m128i needle = _mm_set1_epi8(c);
+    for (const char* block = begin; block < end; block += 16) {
+        __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block));
+        int hits = _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, needle));
+        if (hits != 0) {
+            const char* found = block + std::countr_zero(static_cast<unsigned>(hits));
+            return found < end ? found : nullptr;
+        }
+    }
+    return nullptr;
+#else
+    return static_cast<const char*>(memchr(begin, c, end - begin));
+#endif
+}
+
+//--------------------------------------
+// collectMaskCandidates()
+//--------------------------------------
+// Writes the indices of the masks containing every bit of queryMask to out,
+// which must have room for count entries. Returns how many were written.
+size_t collectMaskCandidates(const uint64_t* masks, size_t count, uint64_t queryMask, uint32_t* out)
+{
+    size_t found = 0;
+    size_t i = 0;
+#ifdef REPO_FILTER_SSE2
+    const __m128i query = _mm_set1_epi64x(static_cast<long long>(queryMask));
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 2 <= count; i += 2) {
+        __m128i entries = _mm_loadu_si128(reinterpret_cast<const __m128i*>(masks + i));
+        __m128i missing = _mm_andnot_si128(entries, query); // Query bits each entry lacks
+        int zeroBytes = _mm_movemask_epi8(_mm_cmpeq_epi8(missing, zero));
+        out[found] = static_cast<uint32_t>(i);
+        found += (zeroBytes & 0x00FF) == 0x00FF;
+        out[found] = static_cast<uint32_t>(i + 1);
+        found += (zeroBytes & 0xFF00) == 0xFF00;
+    }
+#endif
+    for (; i < count; i++) {
+        out[found] = static_cast<uint32_t>(i);
+        found += (masks[i] & queryMask) == queryMask;
+    }
+    return found;
+}
+
+//--------------------------------------
+// class RepoFilter
+//--------------------------------------
+// Case-insensitive fuzzy filter over each repo's path (below the directory
+// all repos share) and branch. The index
+// keeps every entry lowercased in one arena with a character mask per entry;
+// the first query character is pruned against all masks at once, SIMD where
+// available, and exact for letters and digits.
+//
+// Matching is leftmost subsequence, so each match remembers where it ended
+// and the next character is found with one memchr from there. Results are
+// kept for each prefix of the query: typing refines the previous prefix's
+// matches, and deleting returns the cached prefix without any matching.
+// Scores, which rank matches in the list, are only computed on request.
+class RepoFilter
+{
+public:
+    // Matches in table order. Valid until the next call.
+    const std::vector<RepoFilterMatch>& apply(const RepoTable& table, std::string_view rawQuery)
+    {
+        if (table.revision() != builtRevision) {
+            build(table);
+            matchRevision++;
+        }
+
+        std::string query;
+        for (char c : rawQuery) {
+            if (c != ' ') {
+                query += static_cast<char>(tolower(static_cast<unsigned char>(c)));
+            }
+        }
+
+        // Keep the levels shared with the previous query, then extend one
+        // character at a time
+        size_t common = 0;
+        while (common < query.size() && common < levelQuery.size() && query[common] == levelQuery[common]) {
+            common++;
+        }
+        matchRevision += query != levelQuery ? 1 : 0;
+        while (levels.size() > common + 1) {
+            spareLevels.push_back(std::move(levels.back()));
+            levels.pop_back();
+        }
+        levelQuery = query.substr(0, common);
+        for (size_t length = common + 1; length <= query.size(); length++) {
+            refine(query[length - 1]);
+        }
+        return levels.back();
+    }
+
+    // Match quality of a row against the current query, higher is better.
+    int score(uint32_t row) const
+    {
+        std::optional<int> result = fuzzyMatch(entryText(row), nameStarts[row], levelQuery);
+        return result.value_or(0);
+    }
+
+    const std::string& query() const { return levelQuery; }
+
+    // Changes whenever the matches apply() returns do.
+    uint64_t revision() const { return matchRevision; }
+
+private:
+    void build(const RepoTable& table)
+    {
+        arena.clear();
+        offsets.assign(1, 0);
+        nameStarts.clear();
+        masks.clear();
+        levels.assign(1, std::vector<RepoFilterMatch>());
+        levelQuery.clear();
+
+        // Every repo sits under the scanned directory, so that shared prefix
+        // would only slow matching and let queries like "dev" match everything
+        std::vector<std::string> paths;
+        paths.reserve(table.size());
+        for (const GitRepo& repo : table.repos) {
+            paths.push_back(repoDisplayPath(repo.repoPath).string());
+        }
+        size_t prefix = commonDirectoryPrefixLength(paths);
+
+        for (size_t row = 0; row < table.size(); row++) {
+            const GitRepo& repo = table.repos[row];
+            size_t start = arena.size();
+            arena.append(paths[row], prefix);
+            arena += ' ';
+            arena += repo.branch;
+            for (size_t i = start; i < arena.size(); i++) {
+                arena[i] = static_cast<char>(tolower(static_cast<unsigned char>(arena[i])));
+            }
+
+            std::string_view text(arena.data() + start, arena.size() - start);
+            size_t separator = text.substr(0, text.size() - repo.branch.size() - 1).find_last_of("/\\");
+            nameStarts.push_back(static_cast<uint32_t>(separator == std::string_view::npos ? 0 : separator + 1));
+            masks.push_back(filterCharacterMask(text));
+            offsets.push_back(static_cast<uint32_t>(arena.size()));
+            levels[0].push_back({static_cast<uint32_t>(row), static_cast<uint32_t>(start)});
+        }
+        arena.append(FILTER_ARENA_PADDING, '\0');
+        candidates.resize(masks.size());
+        builtRevision = table.revision();
+    }
+
+    std::string_view entryText(uint32_t row) const
+    {
+        return std::string_view(arena.data() + offsets[row], offsets[row + 1] - offsets[row]);
+    }
+
+    // Offset just past the first c at or after from in row's entry, or FILTER_END_PENDING.
+    uint32_t findFrom(uint32_t row, uint32_t from, char c) const
+    {
+        const char* found = findFilterByte(arena.data() + from, arena.data() + offsets[row + 1], c);
+        return found == nullptr ? FILTER_END_PENDING : static_cast<uint32_t>(found - arena.data() + 1);
+    }
+
+    void refine(char c)
+    {
+        uint64_t bit = filterCharacterBit(static_cast<unsigned char>(c));
+        std::vector<RepoFilterMatch> matches;
+        if (!spareLevels.empty()) {
+            matches = std::move(spareLevels.back());
+            spareLevels.pop_back();
+            matches.clear();
+        }
+
+        if (levelQuery.empty()) {
+            // Letters and digits own their mask bit, so surviving the mask is
+            // a match; where it ended is found when the next character needs it
+            size_t count = collectMaskCandidates(masks.data(), masks.size(), bit, candidates.data());
+            bool exact = isalnum(static_cast<unsigned char>(c)) != 0;
+            matches.reserve(count);
+            for (size_t i = 0; i < count; i++) {
+                uint32_t row = candidates[i];
+                uint32_t end = exact ? FILTER_END_PENDING : findFrom(row, offsets[row], c);
+                if (exact || end != FILTER_END_PENDING) {
+                    matches.push_back({row, end});
+                }
+            }
+        }
+        else {
+            const std::vector<RepoFilterMatch>& previous = levels.back();
+            matches.reserve(previous.size());
+            for (const RepoFilterMatch& match : previous) {
+                if ((masks[match.row] & bit) == 0) {
+                    continue;
+                }
+                uint32_t from = match.end != FILTER_END_PENDING ? match.end
+                                                                : findFrom(match.row, offsets[match.row], levelQuery[0]);
+                uint32_t end = findFrom(match.row, from, c);
+                if (end != FILTER_END_PENDING) {
+                    matches.push_back({match.row, end});
+                }
+            }
+        }
+
+        levels.push_back(std::move(matches));
+        levelQuery += c;
+    }
+
+    std::string arena;
+    std::vector<uint32_t> offsets;    // Entry i spans arena[offsets[i], offsets[i + 1])
+    std::vector<uint32_t> nameStarts; // Offset of the repo's directory name within its entry
+    std::vector<uint64_t> masks;
+    std::vector<uint32_t> candidates;
+    std::vector<std::vector<RepoFilterMatch>> levels; // levels[n]: matches for the first n query characters
+    std::vector<std::vector<RepoFilterMatch>> spareLevels;
+    std::string levelQuery;
+    uint64_t builtRevision{UINT64_MAX};
+    uint64_t matchRevision{0};
+};
+
+#endif
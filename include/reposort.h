@@ -0,0 +1,170 @@
+#ifndef REPO_SORT_H
+#define REPO_SORT_H
+
+#include "repotable.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <vector>
+
+//--------------------------------------
+// enum RepoSortColumn
+//--------------------------------------
+enum class RepoSortColumn : uint8_t
+{
+    SCAN,         // Order the repos were found in
+    STATE,
+    AHEAD_BEHIND, // Commits ahead plus commits behind upstream
+    COMMIT_TIME,
+    FETCH_TIME,
+    COUNT,
+};
+
+//--------------------------------------
+// RepoSortColumnToString()
+//--------------------------------------
+const char* RepoSortColumnToString(RepoSortColumn column)
+{
+    switch (column) {
+        case RepoSortColumn::SCAN:
+            return "Scan order";
+        case RepoSortColumn::STATE:
+            return "State";
+        case RepoSortColumn::AHEAD_BEHIND:
+            return "Ahead/behind";
+        case RepoSortColumn::COMMIT_TIME:
+            return "Last commit";
+        case RepoSortColumn::FETCH_TIME:
+            return "Last fetch";
+        default:
+            return "unknown";
+    }
+}
+
+//--------------------------------------
+// repoSortKey()
+//--------------------------------------
+uint64_t repoSortKey(const RepoTable& table, size_t row, RepoSortColumn column)
+{
+    const RepoSortKeys& keys = table.sortKeys(row);
+    switch (column) {
+        case RepoSortColumn::STATE:
+            return static_cast<uint64_t>(table.state(row));
+        case RepoSortColumn::AHEAD_BEHIND:
+            return static_cast<uint64_t>(keys.ahead) + keys.behind;
+        case RepoSortColumn::COMMIT_TIME:
+            return keys.commitTime;
+        case RepoSortColumn::FETCH_TIME:
+            return keys.fetchTime;
+        default:
+            return 0;
+    }
+}
+
+//--------------------------------------
+// class RepoSorter
+//--------------------------------------
+// Row order for the list, sorted by one column with the row as tie-break.
+// Each row's key is cached, so the order always agrees with the cache; when
+// the table's change log reports a row, only that row's key is refreshed and
+// the row is moved by binary search into its new place, shifting just the
+// rows in between. A full sort only happens when rows are added or removed,
+// the column or direction changes, or the sorter falls behind the log.
+class RepoSorter
+{
+public:
+    // Rows in sorted order. Valid until the next call.
+    const std::vector<uint32_t>& apply(const RepoTable& table, RepoSortColumn column, bool descending)
+    {
+        if (table.revision() != builtRevision || column != sortColumn || descending != sortDescending) {
+            build(table, column, descending);
+            return order;
+        }
+
+        std::optional<std::span<const RepoRowChange>> changes = table.changesSince(cursor);
+        if (!changes.has_value()) {
+            build(table, column, descending);
+            return order;
+        }
+        for (const RepoRowChange& change : changes.value()) {
+            reposition(table, change.row);
+        }
+        cursor = table.changeCursor();
+        return order;
+    }
+
+    // Index of row in the sorted order.
+    uint32_t position(uint32_t row) const { return positions[row]; }
+
+    // Changes whenever the order does.
+    uint64_t revision() const { return orderRevision; }
+
+private:
+    uint64_t key(const RepoTable& table, size_t row) const
+    {
+        uint64_t value = repoSortKey(table, row, sortColumn);
+        return sortDescending ? ~value : value;
+    }
+
+    bool before(uint32_t a, uint32_t b) const { return rowKeys[a] != rowKeys[b] ? rowKeys[a] < rowKeys[b] : a < b; }
+
+    void build(const RepoTable& table, RepoSortColumn column, bool descending)
+    {
+        sortColumn = column;
+        sortDescending = descending;
+        rowKeys.resize(table.size());
+        order.resize(table.size());
+        for (size_t row = 0; row < table.size(); row++) {
+            rowKeys[row] = key(table, row);
+            order[row] = static_cast<uint32_t>(row);
+        }
+        std::sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b) { return before(a, b); });
+        positions.resize(table.size());
+        updatePositions(0, order.size());
+        builtRevision = table.revision();
+        cursor = table.changeCursor();
+    }
+
+    void reposition(const RepoTable& table, uint32_t row)
+    {
+        uint64_t updated = key(table, row);
+        if (updated == rowKeys[row]) {
+            return;
+        }
+        rowKeys[row] = updated;
+
+        auto compare = [this](uint32_t a, uint32_t b) { return before(a, b); };
+        size_t from = positions[row];
+        if (from > 0 && before(row, order[from - 1])) {
+            size_t to = std::upper_bound(order.begin(), order.begin() + from, row, compare) - order.begin();
+            std::rotate(order.begin() + to, order.begin() + from, order.begin() + from + 1);
+            updatePositions(to, from + 1);
+        }
+        else if (from + 1 < order.size() && before(order[from + 1], row)) {
+            size_t to = std::lower_bound(order.begin() + from + 1, order.end(), row, compare) - order.begin();
+            std::rotate(order.begin() + from, order.begin() + from + 1, order.begin() + to);
+            updatePositions(from, to);
+        }
+    }
+
+    void updatePositions(size_t begin, size_t end)
+    {
+        orderRevision++;
+        for (size_t i = begin; i < end; i++) {
+            positions[order[i]] = static_cast<uint32_t>(i);
+        }
+    }
+
+    RepoSortColumn sortColumn{RepoSortColumn::SCAN};
+    bool sortDescending{false};
+    std::vector<uint64_t> rowKeys;   // Key each row is currently placed by
+    std::vector<uint32_t> order;     // Rows, sorted
+    std::vector<uint32_t> positions; // Index of each row in order
+    uint64_t builtRevision{UINT64_MAX};
+    uint64_t cursor{0};
+    uint64_t orderRevision{0};
+};
+
+#endif
@@ -0,0 +1,295 @@
+#ifndef REPO_TABLE_H
+#define REPO_TABLE_H
+
+#include "gitrepo.h"
+
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <utility>
+#include <vector>
+
+constexpr uint32_t REPO_SLOT_FREE = UINT32_MAX;
+constexpr size_t REPO_CHANGE_LOG_LIMIT = 4096; // Older changes are dropped; readers that far behind rebuild
+
+//--------------------------------------
+// struct RepoId
+//--------------------------------------
+// Slot plus the slot's generation when the id was handed out. Removing a repo
+// bumps its slot's generation, so ids still held by workers stop resolving
+// instead of aliasing whatever repo reuses the slot.
+struct RepoId
+{
+    uint32_t slot{REPO_SLOT_FREE};
+    uint32_t generation{0};
+
+    bool operator==(const RepoId& other) const = default;
+};
+
+//--------------------------------------
+// struct RepoRowChange
+//--------------------------------------
+struct RepoRowChange
+{
+    uint32_t row;
+    GitState previous;
+    GitState current;
+};
+
+//--------------------------------------
+// class RepoTable
+//--------------------------------------
+// Slot map over struct-of-arrays storage. Rows are kept dense (removal moves
+// the last row into the hole) so loops over the hot arrays touch nothing but
+// packed state and task bytes; the cold GitRepo records sit in their own
+// array and are only read when a row is drawn or a task is started.
+//
+// States and sort keys are written through setState() and setSortKeys() so
+// views that aggregate or order by them can follow the change log instead of
+// rescanning every row.
+class RepoTable
+{
+public:
+    // Hot, one entry per row
+    std::vector<GitTask> tasks;
+    // Cold, one entry per row
+    std::vector<GitRepo> repos;
+    std::vector<RepoId> ids;
+
+    size_t size() const { return ids.size(); }
+    bool empty() const { return ids.empty(); }
+
+    // Bumped whenever rows are added, removed or moved, so views holding row
+    // indices know to rebuild.
+    uint64_t revision() const { return rowRevision; }
+
+    GitState state(size_t row) const { return states[row]; }
+    const std::vector<GitState>& stateColumn() const { return states; }
+    const RepoSortKeys& sortKeys(size_t row) const { return keys[row]; }
+
+    void setState(size_t row, GitState state)
+    {
+        if (states[row] == state) {
+            return;
+        }
+        logChange(row, state);
+        states[row] = state;
+    }
+
+    // Logged with an unchanged state, so sorted views reposition the row.
+    void setSortKeys(size_t row, const RepoSortKeys& sortKeys)
+    {
+        if (keys[row] == sortKeys) {
+            return;
+        }
+        logChange(row, states[row]);
+        keys[row] = sortKeys;
+    }
+
+    // Position a reader has consumed the change log up to.
+    uint64_t changeCursor() const { return changeLogBase + changeLog.size(); }
+
+    // Changes recorded after cursor, oldest first, or nullopt when some were
+    // already dropped. Row indices refer to the current revision.
+    std::optional<std::span<const RepoRowChange>> changesSince(uint64_t cursor) const
+    {
+        if (cursor < changeLogBase) {
+            return std::nullopt;
+        }
+        return std::span<const RepoRowChange>(changeLog).subspan(static_cast<size_t>(cursor - changeLogBase));
+    }
+
+    RepoId insert(GitRepo repo, GitState state, const RepoSortKeys& sortKeys = RepoSortKeys())
+    {
+        RepoId id;
+        if (freeSlots.empty()) {
+            id.slot = static_cast<uint32_t>(slots.size());
+            slots.push_back(Slot());
+        }
+        else {
+            id.slot = freeSlots.back();
+            freeSlots.pop_back();
+        }
+        Slot& slot = slots[id.slot];
+        id.generation = slot.generation;
+        slot.row = static_cast<uint32_t>(ids.size());
+        structureChanged();
+
+        states.push_back(state);
+        keys.push_back(sortKeys);
+        tasks.push_back(GitTask::NONE);
+        repos.push_back(std::move(repo));
+        ids.push_back(id);
+        return id;
+    }
+
+    // Row of a live repo, or nullopt if it was removed.
+    std::optional<size_t> find(RepoId id) const
+    {
+        if (id.slot >= slots.size()) {
+            return std::nullopt;
+        }
+        const Slot& slot = slots[id.slot];
+        if (slot.generation != id.generation || slot.row == REPO_SLOT_FREE) {
+            return std::nullopt;
+        }
+        return slot.row;
+    }
+
+    bool contains(RepoId id) const { return find(id).has_value(); }
+
+    void remove(RepoId id)
+    {
+        std::optional<size_t> found = find(id);
+        if (!found.has_value()) {
+            return;
+        }
+        size_t row = found.value();
+        size_t last = ids.size() - 1;
+        if (row != last) {
+            states[row] = states[last];
+            keys[row] = keys[last];
+            tasks[row] = tasks[last];
+            repos[row] = std::move(repos[last]);
+            ids[row] = ids[last];
+            slots[ids[row].slot].row = static_cast<uint32_t>(row);
+        }
+        states.pop_back();
+        keys.pop_back();
+        tasks.pop_back();
+        repos.pop_back();
+        ids.pop_back();
+        releaseSlot(id.slot);
+        structureChanged();
+    }
+
+    void clear()
+    {
+        for (const RepoId& id : ids) {
+            releaseSlot(id.slot);
+        }
+        states.clear();
+        keys.clear();
+        tasks.clear();
+        repos.clear();
+        ids.clear();
+        structureChanged();
+    }
+
+private:
+    struct Slot
+    {
+        uint32_t generation{0};
+        uint32_t row{REPO_SLOT_FREE};
+    };
+
+    void logChange(size_t row, GitState state)
+    {
+        if (changeLog.size() >= REPO_CHANGE_LOG_LIMIT) {
+            size_t dropped = changeLog.size() / 2;
+            changeLog.erase(changeLog.begin(), changeLog.begin() + dropped);
+            changeLogBase += dropped;
+        }
+        changeLog.push_back({static_cast<uint32_t>(row), states[row], state});
+    }
+
+    // Row indices in the log are meaningless once rows move
+    void structureChanged()
+    {
+        rowRevision++;
+        changeLogBase += changeLog.size();
+        changeLog.clear();
+    }
+
+    void releaseSlot(uint32_t index)
+    {
+        slots[index].generation++;
+        slots[index].row = REPO_SLOT_FREE;
+        freeSlots.push_back(index);
+    }
+
+    std::vector<GitState> states;
+    std::vector<RepoSortKeys> keys;
+    std::vector<Slot> slots;
+    std::vector<uint32_t> freeSlots;
+    std::vector<RepoRowChange> changeLog;
+    uint64_t changeLogBase{0};
+    uint64_t rowRevision{0};
+};
+
+//--------------------------------------
+// struct RepoTaskResult
+//--------------------------------------
+struct RepoTaskResult
+{
+    RepoId id;
+    GitState state{GitState::NONE};
+    std::string message{""};
+    FetchStats fetchStats;
+    RepoSortKeys sortKeys;
+    GitTask task{GitTask::NONE};
+    bool authRejected{false}; // Failed on a rejected credential; requeued once a new one is entered
+    double seconds{0.0};      // Time the task took, recorded into the repo's timings when it succeeded
+    bool blockedByLocalChanges{false};
+};
+
+//--------------------------------------
+// class RepoTaskResults
+//--------------------------------------
+// Workers never touch the table. They post here and the main thread applies
+// results whose id still resolves, dropping any that outlived a rescan.
+class RepoTaskResults
+{
+public:
+    void post(RepoTaskResult result)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        pending.push_back(std::move(result));
+    }
+
+    // Swaps the posted results into out, leaving the queue empty.
+    void drain(std::vector<RepoTaskResult>& out)
+    {
+        out.clear();
+        std::lock_guard<std::mutex> guard(lock);
+        std::swap(out, pending);
+    }
+
+private:
+    std::mutex lock;
+    std::vector<RepoTaskResult> pending;
+};
+
+//--------------------------------------
+// applyRepoTaskResults()
+//--------------------------------------
+// Returns the number of results applied.
+size_t applyRepoTaskResults(RepoTable& table, const std::vector<RepoTaskResult>& results)
+{
+    size_t applied = 0;
+    for (const RepoTaskResult& result : results) {
+        std::optional<size_t> row = table.find(result.id);
+        if (!row.has_value()) {
+            continue;
+        }
+        table.setState(row.value(), result.state);
+        // A failed task may have filled in only some keys; keep the last good ones
+        if (result.state != GitState::ERROR_STATE) {
+            table.setSortKeys(row.value(), result.sortKeys);
+        }
+        table.tasks[row.value()] = GitTask::NONE;
+        table.repos[row.value()].message = result.message;
+        table.repos[row.value()].fetchStats = result.fetchStats;
+        if (result.task == GitTask::FASTFORWARD) {
+            table.repos[row.value()].blockedByLocalChanges = result.blockedByLocalChanges;
+        }
+        if (result.state != GitState::ERROR_STATE && result.seconds > 0.0) {
+            table.repos[row.value()].timings.record(result.task, result.seconds);
+        }
+        applied++;
+    }
+    return applied;
+}
+
+#endif
@@ -0,0 +1,178 @@
+#ifndef REPO_TREE_H
+#define REPO_TREE_H
+
+#include "repotable.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+constexpr uint32_t REPO_TREE_NONE = UINT32_MAX;
+constexpr uint32_t REPO_TREE_ROOT = 0;
+
+//--------------------------------------
+// struct RepoTreeNode
+//--------------------------------------
+struct RepoTreeNode
+{
+    std::string name{""};               // Path below the parent; single-child directory chains are joined
+    uint32_t parent{REPO_TREE_NONE};
+    uint32_t row{REPO_TREE_NONE};       // Table row of the repo at this directory, if any
+    std::vector<uint32_t> children;     // Sorted by name
+    std::array<uint32_t, GIT_STATE_COUNT> counts{}; // Repos in this subtree by state
+    uint32_t repoCount{0};
+};
+
+//--------------------------------------
+// class RepoTree
+//--------------------------------------
+// Directory tree over the repo table. Each node's counts cover its whole
+// subtree; a state change only walks the changed repo's ancestors, driven by
+// the table's change log. The tree is rebuilt when rows are added or removed.
+class RepoTree
+{
+public:
+    void sync(const RepoTable& table)
+    {
+        if (table.revision() != builtRevision) {
+            build(table);
+            return;
+        }
+
+        std::optional<std::span<const RepoRowChange>> changes = table.changesSince(cursor);
+        if (!changes.has_value()) {
+            recount(table);
+            return;
+        }
+        for (const RepoRowChange& change : changes.value()) {
+            for (uint32_t node = rowNodes[change.row]; node != REPO_TREE_NONE; node = treeNodes[node].parent) {
+                treeNodes[node].counts[static_cast<size_t>(change.previous)]--;
+                treeNodes[node].counts[static_cast<size_t>(change.current)]++;
+            }
+        }
+        cursor = table.changeCursor();
+    }
+
+    const RepoTreeNode& node(uint32_t index) const { return treeNodes[index]; }
+    bool empty() const { return treeNodes.size() <= 1 && treeNodes[0].row == REPO_TREE_NONE; }
+
+    // Rows of every repo in the subtree, including the node's own.
+    void collectRows(uint32_t index, std::vector<uint32_t>& rows) const
+    {
+        const RepoTreeNode& node = treeNodes[index];
+        if (node.row != REPO_TREE_NONE) {
+            rows.push_back(node.row);
+        }
+        for (uint32_t child : node.children) {
+            collectRows(child, rows);
+        }
+    }
+
+private:
+    void build(const RepoTable& table)
+    {
+        std::vector<std::string> paths;
+        paths.reserve(table.size());
+        for (const GitRepo& repo : table.repos) {
+            paths.push_back(repoDisplayPath(repo.repoPath).string());
+        }
+        size_t prefix = commonDirectoryPrefixLength(paths);
+
+        // One node per directory first, keyed by its path below the prefix
+        std::vector<RepoTreeNode> full(1);
+        std::unordered_map<std::string_view, uint32_t> directories;
+        for (size_t row = 0; row < paths.size(); row++) {
+            std::string_view relative = std::string_view(paths[row]).substr(prefix);
+            uint32_t parent = REPO_TREE_ROOT;
+            size_t begin = 0;
+            while (begin < relative.size()) {
+                size_t end = relative.find_first_of("/\\", begin);
+                if (end == std::string_view::npos) {
+                    end = relative.size();
+                }
+                if (end > begin) {
+                    auto [it, inserted] = directories.emplace(relative.substr(0, end), static_cast<uint32_t>(full.size()));
+                    if (inserted) {
+                        RepoTreeNode node;
+                        node.name = std::string(relative.substr(begin, end - begin));
+                        node.parent = parent;
+                        full[parent].children.push_back(it->second);
+                        full.push_back(std::move(node));
+                    }
+                    parent = it->second;
+                }
+                begin = end + 1;
+            }
+            full[parent].row = static_cast<uint32_t>(row);
+        }
+
+        // Copy out with single-child chains joined, so "team/product/component"
+        // with nothing in between takes one line
+        treeNodes.clear();
+        treeNodes.push_back(RepoTreeNode());
+        treeNodes[REPO_TREE_ROOT].row = full[REPO_TREE_ROOT].row;
+        rowNodes.assign(table.size(), REPO_TREE_NONE);
+        if (full[REPO_TREE_ROOT].row != REPO_TREE_NONE) {
+            rowNodes[full[REPO_TREE_ROOT].row] = REPO_TREE_ROOT;
+        }
+        copyChildren(full, REPO_TREE_ROOT, REPO_TREE_ROOT);
+
+        recount(table);
+        builtRevision = table.revision();
+    }
+
+    void copyChildren(const std::vector<RepoTreeNode>& full, uint32_t from, uint32_t to)
+    {
+        std::vector<uint32_t> children = full[from].children;
+        std::sort(children.begin(), children.end(), [&](uint32_t a, uint32_t b) { return full[a].name < full[b].name; });
+        for (uint32_t child : children) {
+            uint32_t source = child;
+            std::string name = full[source].name;
+            while (full[source].row == REPO_TREE_NONE && full[source].children.size() == 1) {
+                source = full[source].children[0];
+                name += "/" + full[source].name;
+            }
+
+            uint32_t index = static_cast<uint32_t>(treeNodes.size());
+            RepoTreeNode node;
+            node.name = std::move(name);
+            node.parent = to;
+            node.row = full[source].row;
+            treeNodes.push_back(std::move(node));
+            treeNodes[to].children.push_back(index);
+            if (full[source].row != REPO_TREE_NONE) {
+                rowNodes[full[source].row] = index;
+            }
+            copyChildren(full, source, index);
+        }
+    }
+
+    void recount(const RepoTable& table)
+    {
+        for (RepoTreeNode& node : treeNodes) {
+            node.counts.fill(0);
+            node.repoCount = 0;
+        }
+        for (size_t row = 0; row < rowNodes.size(); row++) {
+            size_t state = static_cast<size_t>(table.state(row));
+            for (uint32_t node = rowNodes[row]; node != REPO_TREE_NONE; node = treeNodes[node].parent) {
+                treeNodes[node].counts[state]++;
+                treeNodes[node].repoCount++;
+            }
+        }
+        cursor = table.changeCursor();
+    }
+
+    std::vector<RepoTreeNode> treeNodes{RepoTreeNode()};
+    std::vector<uint32_t> rowNodes; // Node holding each table row
+    uint64_t builtRevision{UINT64_MAX};
+    uint64_t cursor{0};
+};
+
+#endif
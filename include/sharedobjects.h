@@ -0,0 +1,624 @@
+#ifndef SHARED_OBJECTS_H
+#define SHARED_OBJECTS_H
+
+#include "git2.h"
+#include "git2/sys/odb_backend.h"
+#include "gitrepo.h"
+#include "maintenance.h"
+#include "tasktrace.h"
+#include "logsink.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+constexpr const char* SHARED_OBJECTS_DIRECTORY = ".git-shared-objects"; // Under the base directory
+
+//--------------------------------------
+// struct SharedObjectMember
+//--------------------------------------
+struct SharedObjectMember
+{
+    std::filesystem::path gitDirectory{""};
+    std::filesystem::path objects{""};
+    uint64_t objectBytes{0};
+    std::string alternate{""}; // First entry of objects/info/alternates, absolute; empty if none
+    bool alternateMissing{false}; // The alternate doesn't exist, so objects only it held are gone
+};
+
+//--------------------------------------
+// struct SharedObjectGroup
+//--------------------------------------
+// Repos cloned from the same origin with the same root commit. Worktrees of
+// one repo share its object directory and count as a single member.
+struct SharedObjectGroup
+{
+    std::string originUrl{""};
+    std::string rootCommit{""};
+    std::filesystem::path store{""}; // Shared object directory the group converts to
+    std::vector<SharedObjectMember> members;
+    uint64_t duplicateBytes{0}; // Object storage that sharing could free, at most
+
+    bool isShared(const SharedObjectMember& member) const
+    {
+        return !member.alternate.empty() && std::filesystem::path(member.alternate) == store;
+    }
+};
+
+//--------------------------------------
+// normalizeOriginUrl()
+//--------------------------------------
+// "https://host/team/repo.git/" and "https://host/team/repo" are one origin.
+std::string normalizeOriginUrl(std::string url)
+{
+    while (!url.empty() && url.back() == '/') {
+        url.pop_back();
+    }
+    if (url.size() > 4 && url.compare(url.size() - 4, 4, ".git") == 0) {
+        url.resize(url.size() - 4);
+    }
+    return url;
+}
+
+//--------------------------------------
+// findRootCommit()
+//--------------------------------------
+// Follows first parents from HEAD to the commit that has none.
+bool findRootCommit(git_repository* repo, std::string& rootCommit)
+{
+    git_revwalk* walk = nullptr;
+    if (git_revwalk_new(&walk, repo) != 0 || git_revwalk_push_head(walk) != 0) {
+        git_revwalk_free(walk);
+        return false;
+    }
+    git_revwalk_simplify_first_parent(walk);
+    git_oid oid;
+    git_oid root;
+    bool found = false;
+    while (git_revwalk_next(&oid, walk) == 0) {
+        git_oid_cpy(&root, &oid);
+        found = true;
+    }
+    git_revwalk_free(walk);
+    if (found) {
+        rootCommit = git_oid_tostr_s(&root);
+    }
+    return found;
+}
+
+//--------------------------------------
+// directorySize()
+//--------------------------------------
+uint64_t directorySize(const std::filesystem::path& directory)
+{
+    uint64_t bytes = 0;
+    std::error_code error;
+    for (auto it = std::filesystem::recursive_directory_iterator(directory, error);
+         !error && it != std::filesystem::recursive_directory_iterator();
+         it.increment(error)) {
+        std::error_code sizeError;
+        if (it->is_regular_file(sizeError)) {
+            uint64_t size = it->file_size(sizeError);
+            bytes += sizeError ? 0 : size;
+        }
+    }
+    return bytes;
+}
+
+//--------------------------------------
+// readAlternate()
+//--------------------------------------
+// Relative entries are relative to the objects directory, as git reads them.
+std::string readAlternate(const std::filesystem::path& objects)
+{
+    std::ifstream file(objects / "info" / "alternates");
+    std::string line;
+    while (std::getline(file, line)) {
+        if (!line.empty() && line[0] != '#') {
+            return (objects / line).lexically_normal().generic_string();
+        }
+    }
+    return "";
+}
+
+//--------------------------------------
+// alternateEntry()
+//--------------------------------------
+// The store relative to the objects directory, so the repo, its base
+// directory, or a drive letter can move without orphaning it. Absolute when
+// no relative path exists, e.g. across Windows drives.
+std::string alternateEntry(const std::filesystem::path& objects, const std::filesystem::path& store)
+{
+    std::error_code error;
+    std::filesystem::path relative = std::filesystem::relative(store, objects, error);
+    if (error || relative.empty()) {
+        logMessage(
+            LogLevel::LEVEL_WARN,
+            "No relative path from %s to %s, writing the absolute one",
+            objects.string().c_str(),
+            store.string().c_str());
+        return store.generic_string();
+    }
+    return relative.generic_string();
+}
+
+//--------------------------------------
+// sharedStorePath()
+//--------------------------------------
+// Named by root commit plus a hash of the origin so forks that share history
+// but not an origin get separate stores.
+std::filesystem::path sharedStorePath(
+    const std::filesystem::path& storeRoot, const std::string& originUrl, const std::string& rootCommit)
+{
+    git_oid urlHash;
+    git_odb_hash(&urlHash, originUrl.data(), originUrl.size(), GIT_OBJECT_BLOB);
+    std::string name = rootCommit.substr(0, 16) + "-" + std::string(git_oid_tostr_s(&urlHash)).substr(0, 8);
+    return std::filesystem::absolute(storeRoot / SHARED_OBJECTS_DIRECTORY / name).lexically_normal();
+}
+
+//--------------------------------------
+// analyzeSharedObjects()
+//--------------------------------------
+// Groups the repos by origin and root commit and reports how much object
+// storage each group duplicates. Only groups with two or more object
+// directories are returned, largest duplication first.
+std::vector<SharedObjectGroup> analyzeSharedObjects(
+    const std::vector<std::filesystem::path>& gitDirectories, const std::filesystem::path& storeRoot)
+{
+    std::map<std::pair<std::string, std::string>, SharedObjectGroup> groups;
+    std::unordered_set<std::string> seenObjects;
+    for (const std::filesystem::path& gitDirectory : gitDirectories) {
+        TraceTaskScope traceScope(internTraceTag(repoDisplayPath(gitDirectory).string()), TracePhase::MAINTENANCE);
+        git_repository* repo = nullptr;
+        if (git_repository_open(&repo, gitDirectory.string().c_str()) != 0) {
+            continue;
+        }
+        std::string originUrl;
+        git_remote* origin = nullptr;
+        if (git_remote_lookup(&origin, repo, "origin") == 0) {
+            originUrl = git_remote_url(origin) ? normalizeOriginUrl(git_remote_url(origin)) : "";
+            git_remote_free(origin);
+        }
+        std::string rootCommit;
+        std::filesystem::path objects = objectsDirectory(repo);
+        bool eligible = !originUrl.empty() && findRootCommit(repo, rootCommit) && !objects.empty();
+        git_repository_free(repo);
+        if (!eligible || !seenObjects.insert(objects.lexically_normal().string()).second) {
+            continue;
+        }
+
+        SharedObjectGroup& group = groups[{originUrl, rootCommit}];
+        group.originUrl = originUrl;
+        group.rootCommit = rootCommit;
+        SharedObjectMember member;
+        member.gitDirectory = gitDirectory;
+        member.objects = objects;
+        member.objectBytes = directorySize(objects);
+        member.alternate = readAlternate(objects);
+        member.alternateMissing = !member.alternate.empty() && !std::filesystem::is_directory(member.alternate);
+        if (member.alternateMissing) {
+            logMessage(
+                LogLevel::LEVEL_ERROR,
+                "%s: alternate %s doesn't exist",
+                repoDisplayPath(gitDirectory).string().c_str(),
+                member.alternate.c_str());
+        }
+        group.members.push_back(std::move(member));
+    }
+
+    std::vector<SharedObjectGroup> result;
+    for (auto& [key, group] : groups) {
+        if (group.members.size() < 2) {
+            continue;
+        }
+        group.store = sharedStorePath(storeRoot, group.originUrl, group.rootCommit);
+
+        // Without a store yet, the largest member seeds it and keeps its bytes
+        uint64_t unshared = 0;
+        uint64_t largest = 0;
+        for (const SharedObjectMember& member : group.members) {
+            if (member.alternate.empty()) {
+                unshared += member.objectBytes;
+                largest = member.objectBytes > largest ? member.objectBytes : largest;
+            }
+        }
+        group.duplicateBytes = std::filesystem::exists(group.store / "pack") ? unshared : unshared - largest;
+        result.push_back(std::move(group));
+    }
+    std::sort(result.begin(), result.end(), [](const SharedObjectGroup& a, const SharedObjectGroup& b) {
+        return a.duplicateBytes > b.duplicateBytes;
+    });
+    return result;
+}
+
+//--------------------------------------
+// listPackFiles()
+//--------------------------------------
+// Pack names without extension.
+std::vector<std::string> listPackFiles(const std::filesystem::path& packDirectory)
+{
+    std::vector<std::string> packs;
+    std::error_code error;
+    for (const auto& entry : std::filesystem::directory_iterator(packDirectory, error)) {
+        if (entry.path().extension() == ".pack") {
+            packs.push_back(entry.path().stem().string());
+        }
+    }
+    return packs;
+}
+
+//--------------------------------------
+// seedSharedStore()
+//--------------------------------------
+// Links the donor's packs into the new store, copying where the filesystem
+// can't hard link. The donor's loose objects stay its own.
+bool seedSharedStore(const std::filesystem::path& store, const std::filesystem::path& donorObjects, std::string& error)
+{
+    std::error_code fsError;
+    std::filesystem::create_directories(store / "pack", fsError);
+    std::filesystem::create_directories(store / "info", fsError);
+    if (fsError) {
+        error = fsError.message();
+        return false;
+    }
+    for (const std::string& pack : listPackFiles(donorObjects / "pack")) {
+        // The index goes last so the pack is never visible half-copied
+        for (const char* extension : {".pack", ".idx"}) {
+            std::filesystem::path from = donorObjects / "pack" / (pack + extension);
+            std::filesystem::path to = store / "pack" / (pack + extension);
+            if (std::filesystem::exists(to)) {
+                continue;
+            }
+            std::filesystem::create_hard_link(from, to, fsError);
+            if (fsError) {
+                fsError.clear();
+                std::filesystem::copy_file(from, to, fsError);
+            }
+            if (fsError) {
+                error = "Error seeding " + to.string() + ": " + fsError.message();
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+//--------------------------------------
+// collectObjectIds()
+//--------------------------------------
+int collectObjectIdsCallback(const git_oid* id, void* payload)
+{
+    static_cast<std::vector<git_oid>*>(payload)->push_back(*id);
+    return 0;
+}
+
+//--------------------------------------
+// shareRepoObjects()
+//--------------------------------------
+// Points one repo at the shared store. Objects the store lacks are packed
+// into a new local pack, the alternates file is written, and only after
+// every object is confirmed reachable from the store and the new pack are
+// the old packs and loose objects deleted. Returns the bytes freed.
+bool shareRepoObjects(
+    const std::filesystem::path& gitDirectory,
+    const std::filesystem::path& objects,
+    const std::filesystem::path& store,
+    uint64_t& freedBytes,
+    std::string& error)
+{
+    freedBytes = 0;
+    std::filesystem::path packDirectory = objects / "pack";
+    std::error_code fsError;
+    for (const auto& entry : std::filesystem::directory_iterator(packDirectory, fsError)) {
+        std::filesystem::path extension = entry.path().extension();
+        if (extension == ".keep" || extension == ".promisor") {
+            error = "Kept or promisor packs, left as is";
+            return false;
+        }
+    }
+    uint64_t bytesBefore = directorySize(objects);
+
+    // Everything stored locally right now, before anything changes
+    git_odb* localOdb = nullptr;
+    git_odb* storeOdb = nullptr;
+    std::vector<git_oid> localObjects;
+    std::vector<std::string> oldPacks = listPackFiles(packDirectory);
+    bool ok = git_odb_open(&localOdb, objects.string().c_str()) == 0
+              && git_odb_foreach(localOdb, collectObjectIdsCallback, &localObjects) == 0
+              && git_odb_open(&storeOdb, store.string().c_str()) == 0;
+    git_odb_free(localOdb);
+    if (!ok) {
+        git_odb_free(storeOdb);
+        error = git_error_last()->message;
+        return false;
+    }
+
+    // Pack what only this repo has
+    git_repository* repo = nullptr;
+    git_packbuilder* builder = nullptr;
+    size_t unique = 0;
+    ok = git_repository_open(&repo, gitDirectory.string().c_str()) == 0 && git_packbuilder_new(&builder, repo) == 0;
+    for (size_t i = 0; ok && i < localObjects.size(); i++) {
+        if (!git_odb_exists(storeOdb, &localObjects[i])) {
+            ok = git_packbuilder_insert(builder, &localObjects[i], nullptr) == 0;
+            unique++;
+        }
+    }
+    git_odb_free(storeOdb);
+    if (ok && unique > 0) {
+        ok = git_packbuilder_write(builder, packDirectory.string().c_str(), 0, nullptr, nullptr) == 0;
+    }
+    if (!ok) {
+        error = git_error_last()->message;
+    }
+    git_packbuilder_free(builder);
+    git_repository_free(repo);
+    if (!ok) {
+        return false;
+    }
+
+    std::vector<std::string> newPacks;
+    for (const std::string& pack : listPackFiles(packDirectory)) {
+        if (std::find(oldPacks.begin(), oldPacks.end(), pack) == oldPacks.end()) {
+            newPacks.push_back(pack);
+        }
+    }
+
+    {
+        std::filesystem::create_directories(objects / "info", fsError);
+        std::ofstream alternates(objects / "info" / "alternates", std::ios::trunc);
+        alternates << alternateEntry(objects, store) << "\n";
+        if (!alternates) {
+            error = "Error writing " + (objects / "info" / "alternates").string();
+            return false;
+        }
+    }
+
+    // Check against the store as the alternates file resolves it and the new
+    // pack alone, not the old packs
+    git_odb* check = nullptr;
+    std::string written = readAlternate(objects);
+    ok = git_odb_new(&check) == 0 && git_odb_add_disk_alternate(check, written.c_str()) == 0;
+    for (size_t i = 0; ok && i < newPacks.size(); i++) {
+        git_odb_backend* backend = nullptr;
+        std::filesystem::path index = packDirectory / (newPacks[i] + ".idx");
+        ok = git_odb_backend_one_pack(&backend, index.string().c_str()) == 0
+             && git_odb_add_backend(check, backend, 1) == 0;
+    }
+    size_t missing = 0;
+    for (size_t i = 0; ok && i < localObjects.size(); i++) {
+        missing += git_odb_exists(check, &localObjects[i]) ? 0 : 1;
+    }
+    git_odb_free(check);
+    if (!ok || missing > 0) {
+        std::filesystem::remove(objects / "info" / "alternates", fsError);
+        error = missing > 0 ? std::to_string(missing) + " objects missing from the shared store, left as is"
+                            : git_error_last()->message;
+        return false;
+    }
+
+    // Safe to drop the local copies now
+    for (const std::string& pack : oldPacks) {
+        for (const char* extension : {".idx", ".pack", ".rev", ".bitmap", ".mtimes"}) {
+            std::filesystem::remove(packDirectory / (pack + extension), fsError);
+        }
+    }
+    std::filesystem::remove(packDirectory / "multi-pack-index", fsError);
+    for (const git_oid& oid : localObjects) {
+        std::string hex = git_oid_tostr_s(&oid);
+        std::filesystem::remove(objects / hex.substr(0, 2) / hex.substr(2), fsError);
+    }
+
+    uint64_t bytesAfter = directorySize(objects);
+    freedBytes = bytesBefore > bytesAfter ? bytesBefore - bytesAfter : 0;
+    return true;
+}
+
+//--------------------------------------
+// shareGroupObjects()
+//--------------------------------------
+// Converts every member of the group that doesn't use an alternate yet.
+// Members already pointing somewhere else are left alone. Returns the bytes
+// freed across the group.
+uint64_t shareGroupObjects(SharedObjectGroup& group, std::string& message)
+{
+    TraceSpan span(TracePhase::MAINTENANCE);
+    std::error_code fsError;
+    if (!std::filesystem::exists(group.store / "pack", fsError)) {
+        const SharedObjectMember* donor = nullptr;
+        for (const SharedObjectMember& member : group.members) {
+            if (member.alternate.empty() && (donor == nullptr || member.objectBytes > donor->objectBytes)) {
+                donor = &member;
+            }
+        }
+        std::string error = "no repo to seed it from";
+        if (donor == nullptr || !seedSharedStore(group.store, donor->objects, error)) {
+            message = "Error creating shared store: " + error;
+            return 0;
+        }
+    }
+
+    uint64_t freed = 0;
+    size_t converted = 0;
+    size_t failed = 0;
+    for (SharedObjectMember& member : group.members) {
+        if (!member.alternate.empty()) {
+            continue;
+        }
+        TraceTaskScope traceScope(internTraceTag(repoDisplayPath(member.gitDirectory).string()), TracePhase::MAINTENANCE);
+        uint64_t memberFreed = 0;
+        std::string error;
+        if (shareRepoObjects(member.gitDirectory, member.objects, group.store, memberFreed, error)) {
+            member.alternate = group.store.generic_string();
+            member.objectBytes = directorySize(member.objects);
+            freed += memberFreed;
+            converted++;
+        }
+        else {
+            logMessage(
+                LogLevel::LEVEL_ERROR,
+                "Error sharing objects of %s: %s",
+                repoDisplayPath(member.gitDirectory).string().c_str(),
+                error.c_str());
+            failed++;
+        }
+    }
+    group.duplicateBytes = 0;
+    message = "Shared " + std::to_string(converted) + " repos, freed " + formatBytes(freed)
+              + (failed > 0 ? ", " + std::to_string(failed) + " failed (see log)" : "");
+    logMessage(LogLevel::LEVEL_INFO, "%s: %s", group.originUrl.c_str(), message.c_str());
+    return freed;
+}
+
+//--------------------------------------
+// class SharedObjectsRunner
+//--------------------------------------
+// Runs analysis or a group conversion on a background thread for the UI.
+class SharedObjectsRunner
+{
+public:
+    ~SharedObjectsRunner()
+    {
+        if (worker.joinable()) {
+            worker.join();
+        }
+    }
+
+    bool analyze(std::vector<std::filesystem::path> gitDirectories, std::filesystem::path storeRoot)
+    {
+        return run([this, gitDirectories = std::move(gitDirectories), storeRoot = std::move(storeRoot)]() {
+            std::vector<SharedObjectGroup> analyzed = analyzeSharedObjects(gitDirectories, storeRoot);
+            std::lock_guard<std::mutex> guard(lock);
+            groups = std::move(analyzed);
+            status = std::to_string(groups.size()) + " groups of repos with a common origin";
+        });
+    }
+
+    // Repos of the group must not have tasks running meanwhile.
+    bool share(size_t index)
+    {
+        return run([this, index]() {
+            SharedObjectGroup group;
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                if (index >= groups.size()) {
+                    return;
+                }
+                group = groups[index];
+            }
+            std::string message;
+            shareGroupObjects(group, message);
+            std::lock_guard<std::mutex> guard(lock);
+            if (index < groups.size() && groups[index].store == group.store) {
+                groups[index] = std::move(group);
+            }
+            status = message;
+        });
+    }
+
+    bool isRunning() const { return running; }
+
+    std::vector<SharedObjectGroup> results(std::string& statusOut)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        statusOut = status;
+        return groups;
+    }
+
+private:
+    template <typename Work>
+    bool run(Work work)
+    {
+        if (running) {
+            return false;
+        }
+        if (worker.joinable()) {
+            worker.join();
+        }
+        running = true;
+        worker = std::thread([this, work = std::move(work)]() {
+            setTraceThreadName("shared-objects");
+            work();
+            running = false;
+        });
+        return true;
+    }
+
+    std::thread worker;
+    std::mutex lock;
+    std::vector<SharedObjectGroup> groups;
+    std::string status{""};
+    std::atomic<bool> running{false};
+};
+
+//--------------------------------------
+// struct SharedObjectsConfig
+//--------------------------------------
+struct SharedObjectsConfig
+{
+    std::string root{""};
+    bool apply{false}; // Convert; otherwise only report
+};
+
+//--------------------------------------
+// runSharedObjects()
+//--------------------------------------
+// Headless report of duplicated object storage under root, converting each
+// group to a shared store when asked to.
+int runSharedObjects(const SharedObjectsConfig& config)
+{
+    std::vector<std::filesystem::path> gitDirectories = findGitDirectories(config.root);
+    if (gitDirectories.empty()) {
+        std::cerr << "No repositories found under " << config.root << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::vector<SharedObjectGroup> groups = analyzeSharedObjects(gitDirectories, config.root);
+    uint64_t duplicated = 0;
+    for (SharedObjectGroup& group : groups) {
+        size_t shared = std::count_if(group.members.begin(), group.members.end(), [&](const SharedObjectMember& m) {
+            return group.isShared(m);
+        });
+        printf(
+            "%s (root %.12s): %zu repos, %zu shared, %s duplicated\n",
+            group.originUrl.c_str(),
+            group.rootCommit.c_str(),
+            group.members.size(),
+            shared,
+            formatBytes(group.duplicateBytes).c_str());
+        for (const SharedObjectMember& member : group.members) {
+            printf(
+                "  %-60s %12s%s\n",
+                repoDisplayPath(member.gitDirectory).string().c_str(),
+                formatBytes(member.objectBytes).c_str(),
+                member.alternateMissing    ? "  missing alternate"
+                : group.isShared(member)   ? "  shared"
+                : member.alternate.empty() ? ""
+                                           : "  other alternate");
+        }
+        duplicated += group.duplicateBytes;
+        if (config.apply) {
+            std::string message;
+            shareGroupObjects(group, message);
+            printf("  %s\n", message.c_str());
+        }
+    }
+    printf("%zu groups, %s duplicated%s\n",
+           groups.size(),
+           formatBytes(duplicated).c_str(),
+           config.apply ? "" : " (run with --share-objects-apply to convert)");
+    return EXIT_SUCCESS;
+}
+
+#endif
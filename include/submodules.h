@@ -0,0 +1,268 @@
+#ifndef SUBMODULES_H
+#define SUBMODULES_H
+
+#include "git2.h"
+#include "gitrepo.h"
+#include "tasktrace.h"
+#include "logsink.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+//--------------------------------------
+// struct SubmoduleTarget
+//--------------------------------------
+// One submodule to bring to the commit its superproject records.
+struct SubmoduleTarget
+{
+    std::string name{""};
+    std::filesystem::path workdir{""};
+    std::string url{""}; // Resolved against the superproject's remote
+    git_oid commit{};    // Recorded in the superproject's index
+};
+
+//--------------------------------------
+// listSubmodules()
+//--------------------------------------
+// Submodules of repo that 'git submodule update' would touch: recorded in the
+// index, with update = checkout. Others are noted in message and left alone.
+std::vector<SubmoduleTarget> listSubmodules(git_repository* repo, std::stringstream& message)
+{
+    struct Payload
+    {
+        git_repository* repo;
+        std::stringstream& message;
+        std::vector<SubmoduleTarget> targets;
+    } payload{repo, message, {}};
+
+    const char* workdir = git_repository_workdir(repo);
+    if (workdir == nullptr) {
+        return {};
+    }
+    git_submodule_foreach(
+        repo,
+        [](git_submodule* submodule, const char* name, void* data) -> int {
+            Payload& payload = *static_cast<Payload*>(data);
+            const git_oid* commit = git_submodule_index_id(submodule);
+            git_submodule_update_t strategy = git_submodule_update_strategy(submodule);
+            if (commit == nullptr || strategy == GIT_SUBMODULE_UPDATE_NONE) {
+                return 0;
+            }
+            if (strategy != GIT_SUBMODULE_UPDATE_CHECKOUT && strategy != GIT_SUBMODULE_UPDATE_DEFAULT) {
+                payload.message << "Submodule " << name << ": only update = checkout is supported, skipped\n";
+                return 0;
+            }
+
+            SubmoduleTarget target;
+            target.name = name;
+            target.workdir = std::filesystem::path(git_repository_workdir(payload.repo)) / git_submodule_path(submodule);
+            target.workdir = target.workdir.lexically_normal();
+            git_buf url = GIT_BUF_INIT;
+            if (git_submodule_url(submodule) != nullptr
+                && git_submodule_resolve_url(&url, payload.repo, git_submodule_url(submodule)) == 0) {
+                target.url = url.ptr;
+            }
+            git_buf_dispose(&url);
+            git_oid_cpy(&target.commit, commit);
+            payload.targets.push_back(std::move(target));
+            return 0;
+        },
+        &payload);
+    return std::move(payload.targets);
+}
+
+//--------------------------------------
+// class SubmoduleFetches
+//--------------------------------------
+// URLs fetched in the current batch. The first submodule to need a URL
+// fetches it from the network; any other submodule of the same URL waits for
+// that fetch and then copies from the fetched repo's object store locally.
+class SubmoduleFetches
+{
+public:
+    enum class Claim
+    {
+        FETCH,  // Caller fetches, then calls complete()
+        LOCAL,  // Fetch from source instead
+        FAILED, // The network fetch for this URL already failed
+    };
+
+    Claim claim(const std::string& url, const std::filesystem::path& gitDirectory, std::filesystem::path& source)
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        auto it = urls.find(url);
+        if (it == urls.end()) {
+            urls[url] = {gitDirectory, true, false};
+            return Claim::FETCH;
+        }
+        changed.wait(guard, [&]() { return !urls[url].inFlight; });
+        source = urls[url].gitDirectory;
+        return urls[url].ok ? Claim::LOCAL : Claim::FAILED;
+    }
+
+    void complete(const std::string& url, bool ok)
+    {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            urls[url].inFlight = false;
+            urls[url].ok = ok;
+        }
+        changed.notify_all();
+    }
+
+    void reset()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        urls.clear();
+    }
+
+private:
+    struct Fetch
+    {
+        std::filesystem::path gitDirectory;
+        bool inFlight{false};
+        bool ok{false};
+    };
+
+    std::mutex lock;
+    std::condition_variable changed;
+    std::unordered_map<std::string, Fetch> urls;
+};
+
+//--------------------------------------
+// fetchFromLocalCopy()
+//--------------------------------------
+// Mirrors another clone's remote-tracking refs, and the objects behind them,
+// from its git directory on disk.
+bool fetchFromLocalCopy(git_repository* repo, const std::filesystem::path& source, std::stringstream& message)
+{
+    git_remote* remote = nullptr;
+    char* refspec = const_cast<char*>("+refs/remotes/origin/*:refs/remotes/origin/*");
+    git_strarray refspecs = {&refspec, 1};
+    git_fetch_options fetchOptions = GIT_FETCH_OPTIONS_INIT;
+    bool ok = git_remote_create_anonymous(&remote, repo, source.generic_string().c_str()) == 0
+              && git_remote_fetch(remote, &refspecs, &fetchOptions, nullptr) == 0;
+    if (!ok) {
+        message << "Error copying from " << source.string() << ": " << git_error_last()->message << "\n";
+    }
+    git_remote_free(remote);
+    return ok;
+}
+
+//--------------------------------------
+// fetchSubmodule()
+//--------------------------------------
+// Network half of a submodule update. Nothing is fetched when the recorded
+// commit is already present. Uninitialized submodules are skipped, like
+// 'git submodule update' without --init does.
+bool fetchSubmodule(const SubmoduleTarget& target, SubmoduleFetches& fetches, bool& skipped, std::stringstream& message)
+{
+    skipped = false;
+    git_repository* repo = nullptr;
+    if (git_repository_open(&repo, target.workdir.string().c_str()) != 0) {
+        message << "Submodule " << target.name << ": not initialized, skipped\n";
+        skipped = true;
+        return true;
+    }
+    std::shared_ptr<git_repository> handle(repo, git_repository_free);
+
+    git_odb* odb = nullptr;
+    bool present = git_repository_odb(&odb, repo) == 0 && git_odb_exists(odb, &target.commit);
+    git_odb_free(odb);
+    if (present) {
+        return true;
+    }
+
+    if (target.url.empty()) {
+        message << "Submodule " << target.name << ": no URL configured\n";
+        return false;
+    }
+    std::filesystem::path gitDirectory = git_repository_commondir(repo);
+    std::filesystem::path source;
+    bool ok = false;
+    switch (fetches.claim(target.url, gitDirectory, source)) {
+        case SubmoduleFetches::Claim::FETCH: {
+            GitRepo gitRepo;
+            gitRepo.repo = handle;
+            gitRepo.repoPath = target.workdir / ".git";
+            gitRepo.remoteHost = remoteHostFromUrl(target.url);
+            gitRepo.traceTag = internTraceTag(target.workdir.string());
+            TraceTaskScope traceScope(gitRepo.traceTag, TracePhase::FETCH);
+            ok = beginAuthenticatedTask(gitRepo);
+            if (ok) {
+                ok = fetchOrigin(gitRepo, message);
+                endAuthenticatedTask(gitRepo, ok);
+            }
+            else {
+                message << "Submodule " << target.name << ": " << gitRepo.message << "\n";
+            }
+            fetches.complete(target.url, ok);
+            break;
+        }
+        case SubmoduleFetches::Claim::LOCAL:
+            ok = fetchFromLocalCopy(repo, source, message);
+            break;
+        case SubmoduleFetches::Claim::FAILED:
+            message << "Submodule " << target.name << ": fetch of " << target.url << " already failed this batch\n";
+            return false;
+    }
+    if (!ok) {
+        return false;
+    }
+
+    present = git_repository_odb(&odb, repo) == 0 && git_odb_exists(odb, &target.commit);
+    git_odb_free(odb);
+    if (!present) {
+        message << "Submodule " << target.name << ": commit " << git_oid_tostr_s(&target.commit)
+                << " not found on its remote\n";
+    }
+    return present;
+}
+
+//--------------------------------------
+// checkoutSubmodule()
+//--------------------------------------
+// Disk half: checks out the recorded commit with a detached HEAD, the way
+// 'git submodule update' does. Returns the submodule's own submodules.
+bool checkoutSubmodule(const SubmoduleTarget& target, std::vector<SubmoduleTarget>& nested, std::stringstream& message)
+{
+    TraceSpan span(TracePhase::CHECKOUT);
+    git_repository* repo = nullptr;
+    if (git_repository_open(&repo, target.workdir.string().c_str()) != 0) {
+        message << "Submodule " << target.name << ": error opening: " << git_error_last()->message << "\n";
+        return false;
+    }
+
+    bool ok = true;
+    git_oid head;
+    if (git_reference_name_to_id(&head, repo, "HEAD") != 0 || !git_oid_equal(&head, &target.commit)) {
+        git_object* commit = nullptr;
+        git_checkout_options checkoutOptions = GIT_CHECKOUT_OPTIONS_INIT;
+        checkoutOptions.checkout_strategy = GIT_CHECKOUT_SAFE;
+        ok = git_object_lookup(&commit, repo, &target.commit, GIT_OBJECT_COMMIT) == 0
+             && git_checkout_tree(repo, commit, &checkoutOptions) == 0
+             && git_repository_set_head_detached(repo, &target.commit) == 0;
+        if (ok) {
+            message << "Submodule " << target.name << ": checked out " << std::string(git_oid_tostr_s(&target.commit), 0, 10)
+                    << "\n";
+        }
+        else {
+            message << "Submodule " << target.name << ": error checking out: " << git_error_last()->message << "\n";
+        }
+        git_object_free(commit);
+    }
+    if (ok) {
+        nested = listSubmodules(repo, message);
+    }
+    git_repository_free(repo);
+    return ok;
+}
+
+#endif
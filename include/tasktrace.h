@@ -0,0 +1,472 @@
+#ifndef TASK_TRACE_H
+#define TASK_TRACE_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+constexpr size_t TRACE_RING_CAPACITY = 4096; // Spans kept per thread, oldest overwritten first
+constexpr const char* TRACE_DEFAULT_FILE_NAME = "trace.json";
+
+//--------------------------------------
+// enum TracePhase
+//--------------------------------------
+enum class TracePhase : uint8_t
+{
+    SCAN,
+    OPEN,
+    STATUS,
+    FETCH,
+    CONNECT,
+    NEGOTIATE,
+    TRANSFER,
+    INDEX,
+    UPDATE_TIPS,
+    FASTFORWARD,
+    CHECKOUT,
+    PUSH,
+    REBASE,
+    MAINTENANCE,
+    LOG,
+    SEARCH,
+    COUNT,
+};
+
+constexpr size_t TRACE_PHASE_COUNT = static_cast<size_t>(TracePhase::COUNT);
+
+//--------------------------------------
+// TracePhaseToString()
+//--------------------------------------
+const char* TracePhaseToString(TracePhase phase)
+{
+    switch (phase) {
+        case TracePhase::SCAN:
+            return "scan";
+        case TracePhase::OPEN:
+            return "open";
+        case TracePhase::STATUS:
+            return "status";
+        case TracePhase::FETCH:
+            return "fetch";
+        case TracePhase::CONNECT:
+            return "connect";
+        case TracePhase::NEGOTIATE:
+            return "negotiate";
+        case TracePhase::TRANSFER:
+            return "transfer";
+        case TracePhase::INDEX:
+            return "index";
+        case TracePhase::UPDATE_TIPS:
+            return "update tips";
+        case TracePhase::FASTFORWARD:
+            return "fast-forward";
+        case TracePhase::CHECKOUT:
+            return "checkout";
+        case TracePhase::PUSH:
+            return "push";
+        case TracePhase::REBASE:
+            return "rebase";
+        case TracePhase::MAINTENANCE:
+            return "maintenance";
+        case TracePhase::LOG:
+            return "log";
+        case TracePhase::SEARCH:
+            return "search";
+        default:
+            return "unknown";
+    }
+}
+
+//--------------------------------------
+// traceNowNs()
+//--------------------------------------
+uint64_t traceNowNs()
+{
+    static const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+}
+
+//--------------------------------------
+// struct TraceEvent
+//--------------------------------------
+struct TraceEvent
+{
+    uint64_t beginNs;
+    uint64_t endNs;
+    uint32_t tag;
+    uint32_t threadIndex;
+    TracePhase phase;
+};
+
+//--------------------------------------
+// class TraceRing
+//--------------------------------------
+// Single-writer ring of completed spans. The owning thread appends without
+// locking; readers copy slots out under a per-slot sequence number and drop
+// any slot that was overwritten mid-copy.
+class TraceRing
+{
+public:
+    void push(TracePhase phase, uint32_t tag, uint64_t beginNs, uint64_t endNs)
+    {
+        uint64_t index = head.load(std::memory_order_relaxed);
+        Slot& slot = slots[index % TRACE_RING_CAPACITY];
+        slot.sequence.store(2 * index + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        slot.beginNs.store(beginNs, std::memory_order_relaxed);
+        slot.endNs.store(endNs, std::memory_order_relaxed);
+        slot.packed.store(
+            (uint64_t(tag) << 32) | (uint64_t(threadIndex) << 8) | static_cast<uint8_t>(phase),
+            std::memory_order_relaxed);
+        slot.sequence.store(2 * index + 2, std::memory_order_release);
+        head.store(index + 1, std::memory_order_release);
+    }
+
+    void collect(std::vector<TraceEvent>& out) const
+    {
+        uint64_t end = head.load(std::memory_order_acquire);
+        uint64_t begin = end > TRACE_RING_CAPACITY ? end - TRACE_RING_CAPACITY : 0;
+        for (uint64_t index = begin; index < end; index++) {
+            const Slot& slot = slots[index % TRACE_RING_CAPACITY];
+            uint64_t before = slot.sequence.load(std::memory_order_acquire);
+            TraceEvent event;
+            event.beginNs = slot.beginNs.load(std::memory_order_relaxed);
+            event.endNs = slot.endNs.load(std::memory_order_relaxed);
+            uint64_t packed = slot.packed.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (before != 2 * index + 2 || slot.sequence.load(std::memory_order_relaxed) != before) {
+                continue;
+            }
+            event.tag = static_cast<uint32_t>(packed >> 32);
+            event.threadIndex = static_cast<uint32_t>((packed >> 8) & 0xFFFFFF);
+            event.phase = static_cast<TracePhase>(packed & 0xFF);
+            out.push_back(event);
+        }
+    }
+
+    uint32_t threadIndex{0};
+    bool inUse{false};
+
+private:
+    struct Slot
+    {
+        std::atomic<uint64_t> sequence{0};
+        std::atomic<uint64_t> beginNs{0};
+        std::atomic<uint64_t> endNs{0};
+        std::atomic<uint64_t> packed{0}; // tag << 32 | threadIndex << 8 | phase
+    };
+
+    std::atomic<uint64_t> head{0};
+    Slot slots[TRACE_RING_CAPACITY];
+};
+
+//--------------------------------------
+// struct TraceRegistry
+//--------------------------------------
+// Rings outlive their threads so spans from finished workers can still be
+// dumped; a ring is handed to the next new thread once its owner exits.
+struct TraceRegistry
+{
+    std::atomic<bool> enabled{true};
+    std::mutex lock;
+    std::vector<std::unique_ptr<TraceRing>> rings;
+    std::vector<std::string> tagNames{""};
+    std::unordered_map<std::string, uint32_t> tagIndex;
+    std::unordered_map<uint32_t, std::string> threadNames;
+    uint32_t nextThreadIndex{1};
+};
+
+TraceRegistry& traceRegistry()
+{
+    static TraceRegistry registry;
+    return registry;
+}
+
+//--------------------------------------
+// struct TraceTaskContext
+//--------------------------------------
+// Kept trivially destructible so it stays readable from allocator and log
+// callbacks that libgit2 makes while a thread is being torn down.
+struct TraceTaskContext
+{
+    uint32_t tag{0};
+    uint32_t taskId{0};
+    TracePhase operation{TracePhase::COUNT}; // COUNT when no task is running
+};
+
+thread_local TraceTaskContext traceTaskContext;
+
+//--------------------------------------
+// struct TraceThreadState
+//--------------------------------------
+struct TraceThreadState
+{
+    TraceRing* ring{nullptr};
+
+    TraceRing& acquireRing()
+    {
+        if (ring == nullptr) {
+            TraceRegistry& registry = traceRegistry();
+            std::lock_guard<std::mutex> lock(registry.lock);
+            for (std::unique_ptr<TraceRing>& candidate : registry.rings) {
+                if (!candidate->inUse) {
+                    ring = candidate.get();
+                    break;
+                }
+            }
+            if (ring == nullptr) {
+                registry.rings.push_back(std::make_unique<TraceRing>());
+                ring = registry.rings.back().get();
+            }
+            ring->inUse = true;
+            ring->threadIndex = registry.nextThreadIndex++;
+        }
+        return *ring;
+    }
+
+    ~TraceThreadState()
+    {
+        if (ring != nullptr) {
+            std::lock_guard<std::mutex> lock(traceRegistry().lock);
+            ring->inUse = false;
+        }
+    }
+};
+
+thread_local TraceThreadState traceThreadState;
+
+//--------------------------------------
+// internTraceTag()
+//--------------------------------------
+// Maps a repo path (or any label) to a small integer carried by every span.
+uint32_t internTraceTag(const std::string& name)
+{
+    TraceRegistry& registry = traceRegistry();
+    std::lock_guard<std::mutex> lock(registry.lock);
+    auto [it, inserted] = registry.tagIndex.emplace(name, static_cast<uint32_t>(registry.tagNames.size()));
+    if (inserted) {
+        registry.tagNames.push_back(name);
+    }
+    return it->second;
+}
+
+//--------------------------------------
+// setTraceThreadName()
+//--------------------------------------
+void setTraceThreadName(const std::string& name)
+{
+    uint32_t threadIndex = traceThreadState.acquireRing().threadIndex;
+    std::lock_guard<std::mutex> lock(traceRegistry().lock);
+    traceRegistry().threadNames[threadIndex] = name;
+}
+
+//--------------------------------------
+// recordTraceSpan()
+//--------------------------------------
+void recordTraceSpan(TracePhase phase, uint64_t beginNs, uint64_t endNs)
+{
+    traceThreadState.acquireRing().push(phase, traceTaskContext.tag, beginNs, endNs);
+}
+
+//--------------------------------------
+// class TraceTaskScope
+//--------------------------------------
+// Tags every span recorded on this thread while in scope with a repo and the
+// operation being run, and gives the task a fresh id so its log lines can be
+// grouped.
+class TraceTaskScope
+{
+public:
+    TraceTaskScope(uint32_t tag, TracePhase operation) : previous(traceTaskContext)
+    {
+        static std::atomic<uint32_t> nextTaskId{1};
+        traceTaskContext.tag = tag;
+        traceTaskContext.taskId = nextTaskId++;
+        traceTaskContext.operation = operation;
+    }
+
+    ~TraceTaskScope() { traceTaskContext = previous; }
+
+    TraceTaskScope(const TraceTaskScope&) = delete;
+    TraceTaskScope& operator=(const TraceTaskScope&) = delete;
+
+private:
+    TraceTaskContext previous;
+};
+
+//--------------------------------------
+// traceTagName()
+//--------------------------------------
+std::string traceTagName(uint32_t tag)
+{
+    TraceRegistry& registry = traceRegistry();
+    std::lock_guard<std::mutex> lock(registry.lock);
+    return tag < registry.tagNames.size() ? registry.tagNames[tag] : std::string();
+}
+
+//--------------------------------------
+// class TraceSpan
+//--------------------------------------
+class TraceSpan
+{
+public:
+    explicit TraceSpan(TracePhase phase) : phase(phase)
+    {
+        if (traceRegistry().enabled.load(std::memory_order_relaxed)) {
+            beginNs = traceNowNs();
+        }
+    }
+
+    ~TraceSpan()
+    {
+        if (beginNs != 0) {
+            recordTraceSpan(phase, beginNs, traceNowNs());
+        }
+    }
+
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+
+private:
+    TracePhase phase;
+    uint64_t beginNs{0};
+};
+
+//--------------------------------------
+// class TraceTimeline
+//--------------------------------------
+// Sequential phases whose boundaries are only visible from callbacks, such as
+// negotiate -> transfer -> index inside git_remote_download().
+class TraceTimeline
+{
+public:
+    explicit TraceTimeline(TracePhase first) { enter(first); }
+    ~TraceTimeline() { finish(); }
+
+    void enter(TracePhase next)
+    {
+        if (active && next == phase) {
+            return;
+        }
+        finish();
+        if (traceRegistry().enabled.load(std::memory_order_relaxed)) {
+            phase = next;
+            beginNs = traceNowNs();
+            active = true;
+        }
+    }
+
+    void finish()
+    {
+        if (active) {
+            recordTraceSpan(phase, beginNs, traceNowNs());
+            active = false;
+        }
+    }
+
+    TracePhase current() const { return phase; }
+
+private:
+    TracePhase phase{TracePhase::NEGOTIATE};
+    uint64_t beginNs{0};
+    bool active{false};
+};
+
+//--------------------------------------
+// escapeJson()
+//--------------------------------------
+std::string escapeJson(const std::string& in)
+{
+    std::string out;
+    out.reserve(in.size());
+    for (char c : in) {
+        switch (c) {
+            case '"':
+                out += "\\\"";
+                break;
+            case '\\':
+                out += "\\\\";
+                break;
+            case '\n':
+                out += "\\n";
+                break;
+            case '\t':
+                out += "\\t";
+                break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20) {
+                    char escaped[8];
+                    snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                    out += escaped;
+                }
+                else {
+                    out += c;
+                }
+                break;
+        }
+    }
+    return out;
+}
+
+//--------------------------------------
+// writeChromeTrace()
+//--------------------------------------
+// Writes every retained span as Chrome trace-event JSON (loads in Perfetto
+// and chrome://tracing). Returns the number of spans written, or -1 if the
+// file could not be opened.
+int64_t writeChromeTrace(const std::string& path)
+{
+    std::vector<TraceEvent> events;
+    std::vector<std::string> tagNames;
+    std::unordered_map<uint32_t, std::string> threadNames;
+    {
+        TraceRegistry& registry = traceRegistry();
+        std::lock_guard<std::mutex> lock(registry.lock);
+        for (const std::unique_ptr<TraceRing>& ring : registry.rings) {
+            ring->collect(events);
+        }
+        tagNames = registry.tagNames;
+        threadNames = registry.threadNames;
+    }
+    std::sort(events.begin(), events.end(), [](const TraceEvent& a, const TraceEvent& b) {
+        return a.beginNs < b.beginNs;
+    });
+
+    std::ofstream out(path, std::ios::binary);
+    if (!out) {
+        return -1;
+    }
+
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    bool first = true;
+    for (const auto& [threadIndex, name] : threadNames) {
+        out << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << threadIndex
+            << ",\"args\":{\"name\":\"" << escapeJson(name) << "\"}}";
+        first = false;
+    }
+    char timing[64];
+    for (const TraceEvent& event : events) {
+        snprintf(
+            timing,
+            sizeof(timing),
+            "\"ts\":%.3f,\"dur\":%.3f",
+            event.beginNs / 1000.0,
+            (event.endNs - event.beginNs) / 1000.0);
+        const std::string& repo = event.tag < tagNames.size() ? tagNames[event.tag] : tagNames[0];
+        out << (first ? "" : ",\n") << "{\"name\":\"" << TracePhaseToString(event.phase)
+            << "\",\"cat\":\"git\",\"ph\":\"X\"," << timing << ",\"pid\":1,\"tid\":" << event.threadIndex
+            << ",\"args\":{\"repo\":\"" << escapeJson(repo) << "\"}}";
+        first = false;
+    }
+    out << "\n]}\n";
+    return static_cast<int64_t>(events.size());
+}
+
+#endif
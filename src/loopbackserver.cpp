@@ -0,0 +1,1003 @@
+#ifdef _WIN32
+    #define NOMINMAX
+    #define WIN32_LEAN_AND_MEAN
+    #include <winsock2.h>
+    #include <ws2tcpip.h>
+#else
+    #include <arpa/inet.h>
+    #include <netinet/in.h>
+    #include <sys/socket.h>
+    #include <unistd.h>
+#endif
+
+#include "loopbackserver.h"
+#include "git2.h"
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <random>
+#include <string_view>
+
+namespace {
+
+#ifdef _WIN32
+using SocketHandle = SOCKET;
+constexpr SocketHandle INVALID_SOCKET_HANDLE = INVALID_SOCKET;
+#else
+using SocketHandle = int;
+constexpr SocketHandle INVALID_SOCKET_HANDLE = -1;
+#endif
+
+constexpr size_t SEND_CHUNK_SIZE = 16 * 1024;
+constexpr size_t MAX_HEADER_SIZE = 64 * 1024;
+constexpr uint64_t MAX_BODY_SIZE = 256 * 1024 * 1024; // Request bodies are held in memory whole
+constexpr const char* ZERO_OID_HEX = "0000000000000000000000000000000000000000";
+constexpr const char* UPLOAD_PACK_CAPABILITIES = "ofs-delta no-progress agent=git-repo-manager-loopback";
+constexpr const char* RECEIVE_PACK_CAPABILITIES = "report-status delete-refs ofs-delta agent=git-repo-manager-loopback";
+
+std::atomic<bool> interruptRequested{false};
+
+//--------------------------------------
+// closeSocket()
+//--------------------------------------
+void closeSocket(SocketHandle socket)
+{
+#ifdef _WIN32
+    closesocket(socket);
+#else
+    close(socket);
+#endif
+}
+
+//--------------------------------------
+// shutdownSocket()
+//--------------------------------------
+void shutdownSocket(SocketHandle socket)
+{
+#ifdef _WIN32
+    shutdown(socket, SD_BOTH);
+#else
+    shutdown(socket, SHUT_RDWR);
+#endif
+}
+
+//--------------------------------------
+// struct Throttle
+//--------------------------------------
+// Paces writes on one connection to the configured bandwidth.
+struct Throttle
+{
+    uint64_t bytesPerSec{0};
+    uint64_t bytesSent{0};
+    std::chrono::steady_clock::time_point start{std::chrono::steady_clock::now()};
+
+    void pace(size_t justSent)
+    {
+        bytesSent += justSent;
+        if (bytesPerSec == 0) {
+            return;
+        }
+        auto due = start + std::chrono::microseconds(bytesSent * 1000000 / bytesPerSec);
+        std::this_thread::sleep_until(due);
+    }
+};
+
+//--------------------------------------
+// sendAll()
+//--------------------------------------
+bool sendAll(SocketHandle socket, const char* data, size_t size, Throttle& throttle, std::atomic<uint64_t>& counter)
+{
+    while (size > 0) {
+        int chunk = static_cast<int>(std::min(size, SEND_CHUNK_SIZE));
+        int sent = send(socket, data, chunk, 0);
+        if (sent <= 0) {
+            return false;
+        }
+        counter += sent;
+        throttle.pace(sent);
+        data += sent;
+        size -= sent;
+    }
+    return true;
+}
+
+//--------------------------------------
+// struct HttpRequest
+//--------------------------------------
+struct HttpRequest
+{
+    std::string method;
+    std::string path;
+    std::string query;
+    std::map<std::string, std::string> headers; // Keys lowercased
+    std::string body;
+    bool keepAlive{true};
+    int rejectStatus{0}; // 400 for framing that can't be parsed, 413 for a body over MAX_BODY_SIZE; the
+                         // connection is closed after answering
+
+    std::string header(const std::string& key) const
+    {
+        auto it = headers.find(key);
+        return it == headers.end() ? std::string() : it->second;
+    }
+};
+
+//--------------------------------------
+// class Connection
+//--------------------------------------
+// Buffered reader over one accepted socket.
+class Connection
+{
+public:
+    Connection(SocketHandle socket, std::atomic<uint64_t>& received) : socket(socket), received(received) {}
+
+    // Reads at least one more byte into the buffer.
+    bool fill()
+    {
+        char chunk[SEND_CHUNK_SIZE];
+        int count = recv(socket, chunk, sizeof(chunk), 0);
+        if (count <= 0) {
+            return false;
+        }
+        received += count;
+        buffer.append(chunk, count);
+        return true;
+    }
+
+    bool readLine(std::string& line)
+    {
+        size_t end;
+        while ((end = buffer.find("\r\n", offset)) == std::string::npos) {
+            if (buffer.size() - offset > MAX_HEADER_SIZE || !fill()) {
+                return false;
+            }
+        }
+        line.assign(buffer, offset, end - offset);
+        offset = end + 2;
+        compact();
+        return true;
+    }
+
+    bool readExact(size_t count, std::string& out)
+    {
+        while (buffer.size() - offset < count) {
+            if (!fill()) {
+                return false;
+            }
+        }
+        out.append(buffer, offset, count);
+        offset += count;
+        compact();
+        return true;
+    }
+
+    SocketHandle socket;
+
+private:
+    void compact()
+    {
+        if (offset > SEND_CHUNK_SIZE) {
+            buffer.erase(0, offset);
+            offset = 0;
+        }
+    }
+
+    std::atomic<uint64_t>& received;
+    std::string buffer;
+    size_t offset{0};
+};
+
+//--------------------------------------
+// parseNumber()
+//--------------------------------------
+// Whole of text as a number in base; false for anything else, including
+// overflow. Request bytes come from the client, so nothing here may throw.
+bool parseNumber(std::string_view text, int base, uint64_t& value)
+{
+    const char* end = text.data() + text.size();
+    std::from_chars_result result = std::from_chars(text.data(), end, value, base);
+    return !text.empty() && result.ec == std::errc() && result.ptr == end;
+}
+
+//--------------------------------------
+// percentDecode()
+//--------------------------------------
+// Escapes that aren't two hex digits are kept as they are.
+std::string percentDecode(std::string_view in)
+{
+    std::string out;
+    out.reserve(in.size());
+    uint64_t byte = 0;
+    for (size_t i = 0; i < in.size(); i++) {
+        if (in[i] == '%' && i + 2 < in.size() && parseNumber(in.substr(i + 1, 2), 16, byte)) {
+            out.push_back(static_cast<char>(byte));
+            i += 2;
+        }
+        else {
+            out.push_back(in[i]);
+        }
+    }
+    return out;
+}
+
+//--------------------------------------
+// readRequest()
+//--------------------------------------
+bool readRequest(Connection& connection, HttpRequest& request, Throttle& throttle, std::atomic<uint64_t>& sent)
+{
+    std::string line;
+    do {
+        if (!connection.readLine(line)) {
+            return false;
+        }
+    } while (line.empty());
+
+    size_t methodEnd = line.find(' ');
+    size_t targetEnd = line.find(' ', methodEnd + 1);
+    if (methodEnd == std::string::npos || targetEnd == std::string::npos) {
+        return false;
+    }
+    request.method = line.substr(0, methodEnd);
+    std::string target = line.substr(methodEnd + 1, targetEnd - methodEnd - 1);
+    bool http10 = line.compare(targetEnd + 1, std::string::npos, "HTTP/1.0") == 0;
+
+    size_t queryStart = target.find('?');
+    request.path = percentDecode(std::string_view(target).substr(0, queryStart));
+    request.query = queryStart == std::string::npos ? "" : target.substr(queryStart + 1);
+
+    while (connection.readLine(line) && !line.empty()) {
+        size_t colon = line.find(':');
+        if (colon == std::string::npos) {
+            continue;
+        }
+        std::string key = line.substr(0, colon);
+        std::transform(key.begin(), key.end(), key.begin(), [](unsigned char c) { return std::tolower(c); });
+        size_t valueStart = line.find_first_not_of(" \t", colon + 1);
+        request.headers[key] = valueStart == std::string::npos ? "" : line.substr(valueStart);
+    }
+
+    std::string connectionHeader = request.header("connection");
+    std::transform(connectionHeader.begin(), connectionHeader.end(), connectionHeader.begin(), [](unsigned char c) {
+        return std::tolower(c);
+    });
+    request.keepAlive = http10 ? connectionHeader == "keep-alive" : connectionHeader != "close";
+
+    if (request.header("expect") == "100-continue") {
+        constexpr std::string_view cont = "HTTP/1.1 100 Continue\r\n\r\n";
+        sendAll(connection.socket, cont.data(), cont.size(), throttle, sent);
+    }
+
+    if (request.header("transfer-encoding") == "chunked") {
+        while (true) {
+            if (!connection.readLine(line)) {
+                return false;
+            }
+            // Chunk extensions follow a ';'
+            uint64_t chunkSize = 0;
+            if (!parseNumber(std::string_view(line).substr(0, line.find(';')), 16, chunkSize)) {
+                request.rejectStatus = 400;
+                return true;
+            }
+            if (chunkSize > MAX_BODY_SIZE - request.body.size()) {
+                request.rejectStatus = 413;
+                return true;
+            }
+            if (chunkSize == 0) {
+                // Trailers end with an empty line
+                while (connection.readLine(line) && !line.empty()) {}
+                break;
+            }
+            std::string crlf;
+            if (!connection.readExact(static_cast<size_t>(chunkSize), request.body) || !connection.readExact(2, crlf)) {
+                return false;
+            }
+        }
+    }
+    else if (std::string length = request.header("content-length"); !length.empty()) {
+        uint64_t contentLength = 0;
+        if (!parseNumber(length, 10, contentLength)) {
+            request.rejectStatus = 400;
+            return true;
+        }
+        if (contentLength > MAX_BODY_SIZE) {
+            request.rejectStatus = 413;
+            return true;
+        }
+        if (!connection.readExact(static_cast<size_t>(contentLength), request.body)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+//--------------------------------------
+// struct HttpResponse
+//--------------------------------------
+struct HttpResponse
+{
+    int status{200};
+    std::string reason{"OK"};
+    std::string contentType{"text/plain"};
+    std::vector<std::string> extraHeaders;
+    std::string body;
+};
+
+//--------------------------------------
+// sendResponse()
+//--------------------------------------
+bool sendResponse(
+    SocketHandle socket,
+    const HttpResponse& response,
+    bool keepAlive,
+    bool truncate,
+    Throttle& throttle,
+    std::atomic<uint64_t>& sent)
+{
+    std::string head = "HTTP/1.1 " + std::to_string(response.status) + " " + response.reason + "\r\n";
+    head += "Content-Type: " + response.contentType + "\r\n";
+    head += "Content-Length: " + std::to_string(response.body.size()) + "\r\n";
+    head += "Cache-Control: no-cache\r\n";
+    head += keepAlive ? "Connection: keep-alive\r\n" : "Connection: close\r\n";
+    for (const std::string& header : response.extraHeaders) {
+        head += header + "\r\n";
+    }
+    head += "\r\n";
+
+    size_t bodySize = truncate ? response.body.size() / 2 : response.body.size();
+    return sendAll(socket, head.data(), head.size(), throttle, sent)
+        && sendAll(socket, response.body.data(), bodySize, throttle, sent);
+}
+
+//--------------------------------------
+// base64Encode()
+//--------------------------------------
+std::string base64Encode(std::string_view in)
+{
+    constexpr const char* alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string out;
+    size_t i = 0;
+    for (; i + 2 < in.size(); i += 3) {
+        uint32_t n = (uint8_t(in[i]) << 16) | (uint8_t(in[i + 1]) << 8) | uint8_t(in[i + 2]);
+        out += {alphabet[(n >> 18) & 63], alphabet[(n >> 12) & 63], alphabet[(n >> 6) & 63], alphabet[n & 63]};
+    }
+    if (i + 1 == in.size()) {
+        uint32_t n = uint8_t(in[i]) << 16;
+        out += {alphabet[(n >> 18) & 63], alphabet[(n >> 12) & 63], '=', '='};
+    }
+    else if (i + 2 == in.size()) {
+        uint32_t n = (uint8_t(in[i]) << 16) | (uint8_t(in[i + 1]) << 8);
+        out += {alphabet[(n >> 18) & 63], alphabet[(n >> 12) & 63], alphabet[(n >> 6) & 63], '='};
+    }
+    return out;
+}
+
+//--------------------------------------
+// Pkt-line helpers
+//--------------------------------------
+void appendPkt(std::string& out, std::string_view payload)
+{
+    char length[5];
+    snprintf(length, sizeof(length), "%04x", static_cast<unsigned>(payload.size() + 4));
+    out.append(length, 4);
+    out.append(payload);
+}
+
+void appendFlush(std::string& out)
+{
+    out.append("0000");
+}
+
+// Reads pkt-lines from data starting at offset. Stops after the first flush
+// when stopAtFlush is set, otherwise at the end of data. Returns false on a
+// malformed stream.
+bool readPkts(const std::string& data, size_t& offset, std::vector<std::string>& lines, bool stopAtFlush)
+{
+    while (offset + 4 <= data.size()) {
+        uint64_t length = 0;
+        if (!parseNumber(std::string_view(data).substr(offset, 4), 16, length)) {
+            return false;
+        }
+        if (length == 0) {
+            offset += 4;
+            if (stopAtFlush) {
+                return true;
+            }
+            continue;
+        }
+        if (length < 4 || offset + length > data.size()) {
+            return false;
+        }
+        std::string line = data.substr(offset + 4, length - 4);
+        if (!line.empty() && line.back() == '\n') {
+            line.pop_back();
+        }
+        lines.push_back(std::move(line));
+        offset += length;
+    }
+    return !stopAtFlush;
+}
+
+std::string oidToHex(const git_oid* oid)
+{
+    char hex[GIT_OID_MAX_HEXSIZE + 1];
+    git_oid_tostr(hex, sizeof(hex), oid);
+    return hex;
+}
+
+std::string lastGitError()
+{
+    const git_error* e = git_error_last();
+    return e && e->message ? e->message : "Unknown error";
+}
+
+//--------------------------------------
+// openServedRepo()
+//--------------------------------------
+// Maps a URL path with its service suffix removed onto a repository under
+// root, refusing anything that escapes it.
+git_repository* openServedRepo(const std::filesystem::path& root, std::string_view urlPath)
+{
+    std::filesystem::path relative = std::filesystem::path(std::string(urlPath)).relative_path();
+    for (const auto& part : relative) {
+        if (part == "..") {
+            return nullptr;
+        }
+    }
+    git_repository* repo = nullptr;
+    if (git_repository_open_ext(&repo, (root / relative).string().c_str(), GIT_REPOSITORY_OPEN_NO_SEARCH, nullptr)
+        != 0) {
+        return nullptr;
+    }
+    return repo;
+}
+
+//--------------------------------------
+// advertiseRefs()
+//--------------------------------------
+std::string advertiseRefs(git_repository* repo, const char* service, const char* capabilities, bool includeHead)
+{
+    std::vector<std::pair<std::string, std::string>> refs; // name, oid hex
+
+    git_oid oid;
+    if (includeHead && git_reference_name_to_id(&oid, repo, "HEAD") == 0) {
+        refs.emplace_back("HEAD", oidToHex(&oid));
+    }
+
+    git_reference_iterator* iter = nullptr;
+    std::vector<std::pair<std::string, std::string>> sorted;
+    if (git_reference_iterator_new(&iter, repo) == 0) {
+        git_reference* ref = nullptr;
+        while (git_reference_next(&ref, iter) == 0) {
+            git_reference* resolved = nullptr;
+            if (git_reference_resolve(&resolved, ref) == 0) {
+                const git_oid* target = git_reference_target(resolved);
+                sorted.emplace_back(git_reference_name(ref), oidToHex(target));
+
+                // Annotated tags also advertise the object they point at
+                git_object* object = nullptr;
+                if (git_object_lookup(&object, repo, target, GIT_OBJECT_TAG) == 0) {
+                    git_object* peeled = nullptr;
+                    if (git_tag_peel(&peeled, reinterpret_cast<git_tag*>(object)) == 0) {
+                        sorted.emplace_back(std::string(git_reference_name(ref)) + "^{}", oidToHex(git_object_id(peeled)));
+                        git_object_free(peeled);
+                    }
+                    git_object_free(object);
+                }
+                git_reference_free(resolved);
+            }
+            git_reference_free(ref);
+        }
+        git_reference_iterator_free(iter);
+    }
+    std::sort(sorted.begin(), sorted.end());
+    refs.insert(refs.end(), sorted.begin(), sorted.end());
+
+    std::string out;
+    appendPkt(out, std::string("# service=") + service + "\n");
+    appendFlush(out);
+    if (refs.empty()) {
+        appendPkt(out, std::string(ZERO_OID_HEX) + " capabilities^{}" + '\0' + capabilities + "\n");
+    }
+    for (size_t i = 0; i < refs.size(); i++) {
+        std::string line = refs[i].second + " " + refs[i].first;
+        if (i == 0) {
+            line += '\0';
+            line += capabilities;
+        }
+        appendPkt(out, line + "\n");
+    }
+    appendFlush(out);
+    return out;
+}
+
+//--------------------------------------
+// uploadPack()
+//--------------------------------------
+// Stateless upload-pack without multi_ack: each negotiation round answers with
+// a single ACK or NAK, and the round that carries "done" also gets the pack.
+HttpResponse uploadPack(git_repository* repo, const std::string& body)
+{
+    HttpResponse response;
+    response.contentType = "application/x-git-upload-pack-result";
+
+    std::vector<std::string> lines;
+    size_t offset = 0;
+    if (!readPkts(body, offset, lines, false)) {
+        response.status = 400;
+        response.reason = "Bad Request";
+        response.contentType = "text/plain";
+        response.body = "malformed pkt-line stream";
+        return response;
+    }
+
+    std::vector<git_oid> wants;
+    std::vector<git_oid> common;
+    bool done = false;
+    git_odb* odb = nullptr;
+    git_repository_odb(&odb, repo);
+    for (const std::string& line : lines) {
+        git_oid oid;
+        if (line.compare(0, 5, "want ") == 0 && git_oid_fromstrn(&oid, line.c_str() + 5, GIT_OID_SHA1_HEXSIZE) == 0) {
+            wants.push_back(oid);
+        }
+        else if (line.compare(0, 5, "have ") == 0 && git_oid_fromstrn(&oid, line.c_str() + 5, GIT_OID_SHA1_HEXSIZE) == 0) {
+            if (odb && git_odb_exists(odb, &oid)) {
+                common.push_back(oid);
+            }
+        }
+        else if (line == "done") {
+            done = true;
+        }
+    }
+    git_odb_free(odb);
+
+    if (common.empty()) {
+        appendPkt(response.body, "NAK\n");
+    }
+    else {
+        appendPkt(response.body, "ACK " + oidToHex(&common.front()) + "\n");
+    }
+    if (!done) {
+        return response;
+    }
+
+    git_packbuilder* packbuilder = nullptr;
+    git_revwalk* walk = nullptr;
+    git_buf pack = GIT_BUF_INIT;
+    bool ok = git_packbuilder_new(&packbuilder, repo) == 0 && git_revwalk_new(&walk, repo) == 0;
+    for (const git_oid& want : wants) {
+        if (!ok) {
+            break;
+        }
+        git_object* object = nullptr;
+        if (git_object_lookup(&object, repo, &want, GIT_OBJECT_ANY) != 0) {
+            ok = false;
+            break;
+        }
+        git_object_t type = git_object_type(object);
+        if (type == GIT_OBJECT_TAG) {
+            ok = git_packbuilder_insert(packbuilder, &want, nullptr) == 0;
+        }
+        if (type == GIT_OBJECT_COMMIT || type == GIT_OBJECT_TAG) {
+            ok = ok && git_revwalk_push(walk, &want) == 0;
+        }
+        else {
+            ok = git_packbuilder_insert_recur(packbuilder, &want, nullptr) == 0;
+        }
+        git_object_free(object);
+    }
+    for (const git_oid& have : common) {
+        git_revwalk_hide(walk, &have);
+    }
+    ok = ok && git_packbuilder_insert_walk(packbuilder, walk) == 0 && git_packbuilder_write_buf(&pack, packbuilder) == 0;
+
+    if (ok) {
+        response.body.append(pack.ptr, pack.size);
+    }
+    else {
+        response.status = 500;
+        response.reason = "Internal Server Error";
+        response.contentType = "text/plain";
+        response.body = "pack generation failed: " + lastGitError();
+    }
+
+    git_buf_dispose(&pack);
+    git_revwalk_free(walk);
+    git_packbuilder_free(packbuilder);
+    return response;
+}
+
+//--------------------------------------
+// receivePack()
+//--------------------------------------
+HttpResponse receivePack(git_repository* repo, const std::string& body)
+{
+    HttpResponse response;
+    response.contentType = "application/x-git-receive-pack-result";
+
+    std::vector<std::string> commands;
+    size_t offset = 0;
+    if (!readPkts(body, offset, commands, true)) {
+        response.status = 400;
+        response.reason = "Bad Request";
+        response.contentType = "text/plain";
+        response.body = "malformed pkt-line stream";
+        return response;
+    }
+
+    // Index the pack that follows the command list, if any
+    std::string unpackStatus = "ok";
+    if (offset < body.size()) {
+        git_odb* odb = nullptr;
+        git_odb_writepack* writepack = nullptr;
+        git_indexer_progress stats = {};
+        if (git_repository_odb(&odb, repo) != 0 || git_odb_write_pack(&writepack, odb, nullptr, nullptr) != 0
+            || writepack->append(writepack, body.data() + offset, body.size() - offset, &stats) != 0
+            || writepack->commit(writepack, &stats) != 0) {
+            unpackStatus = lastGitError();
+        }
+        if (writepack) {
+            writepack->free(writepack);
+        }
+        git_odb_free(odb);
+    }
+
+    appendPkt(response.body, "unpack " + unpackStatus + "\n");
+    for (const std::string& command : commands) {
+        std::string line = command.substr(0, command.find('\0'));
+        if (line.size() < 2 * GIT_OID_SHA1_HEXSIZE + 3) {
+            continue;
+        }
+        git_oid oldOid, newOid;
+        git_oid_fromstrn(&oldOid, line.c_str(), GIT_OID_SHA1_HEXSIZE);
+        git_oid_fromstrn(&newOid, line.c_str() + GIT_OID_SHA1_HEXSIZE + 1, GIT_OID_SHA1_HEXSIZE);
+        std::string refName = line.substr(2 * GIT_OID_SHA1_HEXSIZE + 2);
+
+        if (unpackStatus != "ok") {
+            appendPkt(response.body, "ng " + refName + " unpacker error\n");
+            continue;
+        }
+
+        git_oid current;
+        bool exists = git_reference_name_to_id(&current, repo, refName.c_str()) == 0;
+        if (exists ? !git_oid_equal(&current, &oldOid) : !git_oid_is_zero(&oldOid)) {
+            appendPkt(response.body, "ng " + refName + " stale info\n");
+            continue;
+        }
+
+        int error = 0;
+        if (git_oid_is_zero(&newOid)) {
+            error = exists ? git_reference_remove(repo, refName.c_str()) : 0;
+        }
+        else {
+            git_reference* ref = nullptr;
+            error = git_reference_create(&ref, repo, refName.c_str(), &newOid, 1, "push via loopback server");
+            git_reference_free(ref);
+        }
+        appendPkt(response.body, error == 0 ? "ok " + refName + "\n" : "ng " + refName + " " + lastGitError() + "\n");
+    }
+    appendFlush(response.body);
+    return response;
+}
+
+//--------------------------------------
+// handleRequest()
+//--------------------------------------
+HttpResponse handleRequest(const LoopbackServerConfig& config, const HttpRequest& request)
+{
+    constexpr std::string_view infoRefsSuffix = "/info/refs";
+    constexpr std::string_view uploadPackSuffix = "/git-upload-pack";
+    constexpr std::string_view receivePackSuffix = "/git-receive-pack";
+
+    auto endsWith = [](std::string_view s, std::string_view suffix) {
+        return s.size() >= suffix.size() && s.substr(s.size() - suffix.size()) == suffix;
+    };
+
+    HttpResponse response;
+    std::string_view path = request.path;
+    std::string_view repoPath;
+    enum class Route { NONE, ADVERTISE_UPLOAD, ADVERTISE_RECEIVE, UPLOAD, RECEIVE } route = Route::NONE;
+
+    if (request.method == "GET" && endsWith(path, infoRefsSuffix)) {
+        repoPath = path.substr(0, path.size() - infoRefsSuffix.size());
+        if (request.query.find("service=git-upload-pack") != std::string::npos) {
+            route = Route::ADVERTISE_UPLOAD;
+        }
+        else if (request.query.find("service=git-receive-pack") != std::string::npos) {
+            route = Route::ADVERTISE_RECEIVE;
+        }
+    }
+    else if (request.method == "POST" && endsWith(path, uploadPackSuffix)) {
+        repoPath = path.substr(0, path.size() - uploadPackSuffix.size());
+        route = Route::UPLOAD;
+    }
+    else if (request.method == "POST" && endsWith(path, receivePackSuffix)) {
+        repoPath = path.substr(0, path.size() - receivePackSuffix.size());
+        route = Route::RECEIVE;
+    }
+
+    if (route == Route::NONE) {
+        response.status = 404;
+        response.reason = "Not Found";
+        response.body = "only the smart HTTP protocol is served";
+        return response;
+    }
+
+    git_repository* repo = openServedRepo(config.root, repoPath);
+    if (repo == nullptr) {
+        response.status = 404;
+        response.reason = "Not Found";
+        response.body = "repository not found";
+        return response;
+    }
+
+    switch (route) {
+        case Route::ADVERTISE_UPLOAD:
+            response.contentType = "application/x-git-upload-pack-advertisement";
+            response.body = advertiseRefs(repo, "git-upload-pack", UPLOAD_PACK_CAPABILITIES, true);
+            break;
+        case Route::ADVERTISE_RECEIVE:
+            response.contentType = "application/x-git-receive-pack-advertisement";
+            response.body = advertiseRefs(repo, "git-receive-pack", RECEIVE_PACK_CAPABILITIES, false);
+            break;
+        case Route::UPLOAD:
+            response = uploadPack(repo, request.body);
+            break;
+        case Route::RECEIVE:
+            response = receivePack(repo, request.body);
+            break;
+        default:
+            break;
+    }
+
+    git_repository_free(repo);
+    return response;
+}
+
+//--------------------------------------
+// handleInterrupt()
+//--------------------------------------
+void handleInterrupt(int)
+{
+    interruptRequested = true;
+}
+
+} // namespace
+
+//--------------------------------------
+// LoopbackServer::LoopbackServer()
+//--------------------------------------
+LoopbackServer::LoopbackServer(LoopbackServerConfig config) : config(std::move(config)) {}
+
+//--------------------------------------
+// LoopbackServer::~LoopbackServer()
+//--------------------------------------
+LoopbackServer::~LoopbackServer()
+{
+    stop();
+}
+
+//--------------------------------------
+// LoopbackServer::start()
+//--------------------------------------
+bool LoopbackServer::start(std::string& error)
+{
+#ifdef _WIN32
+    WSADATA wsaData;
+    if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0) {
+        error = "WSAStartup failed";
+        return false;
+    }
+#endif
+
+    SocketHandle listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (listener == INVALID_SOCKET_HANDLE) {
+        error = "Unable to create socket";
+        return false;
+    }
+
+    int reuse = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&reuse), sizeof(reuse));
+
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(config.port);
+    if (bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(listener, SOMAXCONN) != 0) {
+        error = "Unable to bind 127.0.0.1:" + std::to_string(config.port);
+        closeSocket(listener);
+        return false;
+    }
+
+    socklen_t addressLength = sizeof(address);
+    getsockname(listener, reinterpret_cast<sockaddr*>(&address), &addressLength);
+    boundPort = ntohs(address.sin_port);
+
+    listenSocket = static_cast<intptr_t>(listener);
+    running = true;
+    acceptThread = std::thread([this]() { acceptLoop(); });
+    return true;
+}
+
+//--------------------------------------
+// LoopbackServer::stop()
+//--------------------------------------
+void LoopbackServer::stop()
+{
+    if (!running.exchange(false)) {
+        return;
+    }
+
+    SocketHandle listener = static_cast<SocketHandle>(listenSocket);
+    shutdownSocket(listener);
+    closeSocket(listener);
+    acceptThread.join();
+
+    // Unblock in-flight connections and wait for their threads to finish
+    std::unique_lock<std::mutex> lock(connectionsLock);
+    for (intptr_t socket : openSockets) {
+        shutdownSocket(static_cast<SocketHandle>(socket));
+    }
+    connectionsDone.wait(lock, [this]() { return openSockets.empty(); });
+    lock.unlock();
+
+#ifdef _WIN32
+    WSACleanup();
+#endif
+}
+
+//--------------------------------------
+// LoopbackServer::stats()
+//--------------------------------------
+LoopbackServerStats LoopbackServer::stats() const
+{
+    LoopbackServerStats out;
+    out.connections = connections;
+    out.requests = requests;
+    out.authChallenges = authChallenges;
+    out.injectedFailures = injectedFailures;
+    out.bytesReceived = bytesReceived;
+    out.bytesSent = bytesSent;
+    return out;
+}
+
+//--------------------------------------
+// LoopbackServer::acceptLoop()
+//--------------------------------------
+void LoopbackServer::acceptLoop()
+{
+    while (running) {
+        SocketHandle client = accept(static_cast<SocketHandle>(listenSocket), nullptr, nullptr);
+        if (client == INVALID_SOCKET_HANDLE) {
+            if (!running) {
+                break;
+            }
+            continue;
+        }
+
+        uint64_t connectionIndex = connections++;
+        {
+            std::lock_guard<std::mutex> lock(connectionsLock);
+            openSockets.push_back(static_cast<intptr_t>(client));
+        }
+        std::thread t = std::thread([this, client, connectionIndex]() {
+            serveConnection(static_cast<intptr_t>(client), connectionIndex);
+        });
+        t.detach();
+    }
+}
+
+//--------------------------------------
+// LoopbackServer::serveConnection()
+//--------------------------------------
+void LoopbackServer::serveConnection(intptr_t socketValue, uint64_t connectionIndex)
+{
+    SocketHandle socket = static_cast<SocketHandle>(socketValue);
+    Connection connection(socket, bytesReceived);
+    Throttle throttle;
+    throttle.bytesPerSec = config.bandwidthBytesPerSec;
+
+    std::mt19937 rng(config.seed ^ static_cast<uint32_t>(connectionIndex * 2654435761u));
+    std::uniform_real_distribution<double> roll(0.0, 1.0);
+    std::vector<LoopbackFailure> failureModes;
+    for (LoopbackFailure mode : {LOOPBACK_FAILURE_HTTP_500, LOOPBACK_FAILURE_DISCONNECT, LOOPBACK_FAILURE_TRUNCATE}) {
+        if (config.failureModes & mode) {
+            failureModes.push_back(mode);
+        }
+    }
+
+    std::string expectedAuthorization;
+    if (!config.authUsername.empty()) {
+        expectedAuthorization = "Basic " + base64Encode(config.authUsername + ":" + config.authPassword);
+    }
+
+    HttpRequest request;
+    while (running && readRequest(connection, request, throttle, bytesSent)) {
+        requests++;
+        if (request.rejectStatus != 0) {
+            HttpResponse response;
+            response.status = request.rejectStatus;
+            response.reason = request.rejectStatus == 413 ? "Payload Too Large" : "Bad Request";
+            response.body = request.rejectStatus == 413 ? "request body too large" : "malformed request framing";
+            sendResponse(socket, response, false, false, throttle, bytesSent);
+            break;
+        }
+
+        LoopbackFailure failure = static_cast<LoopbackFailure>(0);
+        if (!failureModes.empty() && roll(rng) < config.failureRate) {
+            failure = failureModes[rng() % failureModes.size()];
+            injectedFailures++;
+        }
+
+        HttpResponse response;
+        if (failure == LOOPBACK_FAILURE_DISCONNECT) {
+            break;
+        }
+        else if (failure == LOOPBACK_FAILURE_HTTP_500) {
+            response.status = 500;
+            response.reason = "Internal Server Error";
+            response.body = "injected failure";
+        }
+        else if (!expectedAuthorization.empty() && request.header("authorization") != expectedAuthorization) {
+            authChallenges++;
+            response.status = 401;
+            response.reason = "Unauthorized";
+            response.extraHeaders.push_back("WWW-Authenticate: Basic realm=\"git-repo-manager loopback\"");
+            response.body = "authentication required";
+        }
+        else {
+            response = handleRequest(config, request);
+        }
+
+        if (config.latencyMs > 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(config.latencyMs));
+        }
+
+        bool keepAlive = request.keepAlive && failure == 0;
+        bool truncate = failure == LOOPBACK_FAILURE_TRUNCATE;
+        if (!sendResponse(socket, response, keepAlive, truncate, throttle, bytesSent) || !keepAlive) {
+            break;
+        }
+        request = HttpRequest();
+    }
+
+    closeSocket(socket);
+    std::lock_guard<std::mutex> lock(connectionsLock);
+    openSockets.erase(std::find(openSockets.begin(), openSockets.end(), socketValue));
+    connectionsDone.notify_all();
+}
+
+//--------------------------------------
+// runLoopbackServer()
+//--------------------------------------
+int runLoopbackServer(const LoopbackServerConfig& config)
+{
+    LoopbackServer server(config);
+    std::string error;
+    if (!server.start(error)) {
+        std::cerr << "Error starting loopback server: " << error << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::cout << "Serving " << config.root.string() << " on " << server.url() << " (Ctrl+C to stop)" << std::endl;
+    std::signal(SIGINT, handleInterrupt);
+    while (!interruptRequested) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    server.stop();
+
+    LoopbackServerStats stats = server.stats();
+    std::cout << "connections: " << stats.connections << "\n"
+              << "requests: " << stats.requests << "\n"
+              << "auth challenges: " << stats.authChallenges << "\n"
+              << "injected failures: " << stats.injectedFailures << "\n"
+              << "bytes received: " << stats.bytesReceived << "\n"
+              << "bytes sent: " << stats.bytesSent << std::endl;
+    return EXIT_SUCCESS;
+}
@@ -4,23 +4,94 @@
 #include "GLFW/glfw3.h"
 #include "git2.h"
 #include "gitrepo.h"
-#include "cpputils/windows/credential_utils.h"
+#include "repotable.h"
+#include "repofilter.h"
+#include "repotree.h"
+#include "reposort.h"
+#include "fastforwardpipeline.h"
+#include "maintenance.h"
+#include "sharedobjects.h"
+#include "branchmatrix.h"
+#include "commitlog.h"
+#include "incomingpreview.h"
+#include "contentsearch.h"
+#include "batchplan.h"
+#include "commandline.h"
 
 #include <cstdio>
+#include <ctime>
 #include <iostream>
 #include <string>
 #include <array>
+#include <atomic>
 #include <filesystem>
 #include <mutex>
 #include <optional>
+#include <set>
+#include <tuple>
 #include <unordered_map>
 #include <algorithm>
 
 constexpr bool TEST_REPOS_OVERRIDE = false;
 std::string baseDirectory = "C:\\dev";
-bool reloadDirectory = true;
-std::vector<GitRepo> gitRepos;
-std::mutex gitReposLock;
+std::atomic<bool> reloadDirectory = true;
+std::atomic<bool> scanInProgress = false;
+RepoTable repoTable;
+std::mutex repoTableLock;
+RepoTaskResults repoTaskResults;
+std::vector<RepoTaskResult> completedTasks;
+FastForwardPipeline fastForwardPipeline(repoTaskResults);
+MaintenanceRunner maintenanceRunner;
+SharedObjectsRunner sharedObjectsRunner;
+std::vector<RepoId> sharingRepos; // Held busy while their objects move to a shared store
+BranchMatrices branchMatrices;
+CommitLogs commitLogs;
+IncomingPreviews incomingPreviews;
+bool incomingPreviewRenames = false;
+
+// Content search
+std::array<char, 256> contentSearchInput{};
+bool contentSearchRegex = false;
+ContentSearch contentSearch;
+std::string contentSearchError;
+
+// Batch plan
+int batchPlanGoal = 0;
+BatchPlan batchPlan;
+BatchPlanRunner batchPlanRunner;
+std::vector<size_t> plannedRows;
+std::unordered_map<std::string, RepoTaskTimings> taskTimings; // By repo path; saved across sessions
+
+// Repo filter
+std::array<char, 256> repoFilterInput{};
+RepoFilter repoFilter;
+bool repoFilterRanked = true; // Best matches first, the sort order breaking ties
+
+// Repo sort
+RepoSortColumn repoSortColumn = RepoSortColumn::SCAN;
+bool repoSortDescending = true;
+RepoSorter repoSorter;
+std::vector<uint32_t> sortedMatches; // Filter matches in list order
+std::vector<int> matchScores;        // By row: filter score, zero for rows the filter drops
+uint64_t sortedMatchesFilterRevision = UINT64_MAX;
+uint64_t sortedMatchesSortRevision = UINT64_MAX;
+bool sortedMatchesRanked = false;
+
+// Repo tree
+bool repoTreeView = false;
+RepoTree repoTree;
+std::vector<uint32_t> repoTreeRows;
+
+std::vector<FetchPolicy> fetchPolicies;
+std::string traceOutputPath = TRACE_DEFAULT_FILE_NAME;
+std::string traceDumpResult;
+
+// Log pane
+bool libgit2TraceEnabled = false;
+bool libgit2TraceAvailable = true;
+uint32_t logRepoFilter = 0;
+std::vector<LogEntry> logEntries;
+uint64_t logEntriesChangeCount = UINT64_MAX;
 float gitStatusSize = 0.0f;
 
 // Credential Input
@@ -28,64 +99,47 @@ std::array<char, 1000> usernameInput;
 std::array<char, 1000> credentialInput;
 bool credentialHasBeenInput = false;
 bool credentialResult = false;
+std::vector<std::pair<RepoId, GitTask>> authRejectedTasks; // Retried when a new credential is entered
+
+//--------------------------------------
+// gitStateColor()
+//--------------------------------------
+ImVec4 gitStateColor(const GitState& state)
+{
+    switch (state) {
+        case GitState::NONE:
+            return {1.0f, 0.0f, 0.0f, 1.0f};
+        case GitState::UPTODATE:
+            return {0.21f, 0.77f, 0.1f, 1.0f};
+        case GitState::PUSH:
+            return {0.77f, 0.459f, 0.09f, 1.0f};
+        case GitState::FASTFORWARD:
+            return {0.77f, 0.8f, 0.145f, 1.0f};
+        case GitState::DIVERGED:
+            return {1.0f, 0.0f, 0.0f, 1.0f};
+        case GitState::REBASE:
+            return {0.784f, 0.22f, 0.82f, 1.0f};
+        case GitState::PROCESSING:
+            return {0.1f, 0.1f, 0.9f, 1.0f};
+        case GitState::ERROR_STATE:
+            return {1.0f, 0.1f, 0.1f, 1.0f};
+        default:
+            return {1.0f, 1.0f, 1.0f, 1.0f};
+    }
+}
 
 //--------------------------------------
 // renderGitState()
 //--------------------------------------
 void renderGitState(const GitState& state)
 {
-    std::string stateStr = GitStateToString(state);
-
     ImGui::Text("[");
 
     std::string displayStr = GitStateToString(state);
     ImVec2 stateSize = ImGui::CalcTextSize(displayStr.c_str());
 
     ImGui::SameLine();
-    switch (state) {
-        case GitState::NONE: {
-            constexpr static ImVec4 color = {1.0f, 0.0f, 0.0f, 1.0f};
-            ImGui::TextColored(color, displayStr.c_str());
-            break;
-        }
-        case GitState::UPTODATE: {
-            constexpr static ImVec4 color = {0.21f, 0.77f, 0.1f, 1.0f};
-            ImGui::TextColored(color, displayStr.c_str());
-            break;
-        }
-        case GitState::PUSH: {
-            constexpr static ImVec4 color = {0.77f, 0.459f, 0.09f, 1.0f};
-            ImGui::TextColored(color, displayStr.c_str());
-            break;
-        }
-        case GitState::FASTFORWARD: {
-            constexpr static ImVec4 color = {0.77f, 0.8f, 0.145f, 1.0f};
-            ImGui::TextColored(color, displayStr.c_str());
-            break;
-        }
-        case GitState::DIVERGED: {
-            constexpr static ImVec4 color = {1.0f, 0.0f, 0.0f, 1.0f};
-            ImGui::TextColored(color, displayStr.c_str());
-            break;
-        }
-        case GitState::REBASE: {
-            constexpr static ImVec4 color = {0.784f, 0.22f, 0.82f, 1.0f};
-            ImGui::TextColored(color, displayStr.c_str());
-            break;
-        }
-        case GitState::PROCESSING: {
-            constexpr static ImVec4 color = {0.1f, 0.1f, 0.9f, 1.0f};
-            ImGui::TextColored(color, displayStr.c_str());
-            break;
-        }
-        case GitState::ERROR_STATE: {
-            constexpr static ImVec4 color = {1.0f, 0.1f, 0.1f, 1.0f};
-            ImGui::TextColored(color, displayStr.c_str());
-            break;
-        }
-        default:
-            break;
-    }
+    ImGui::TextColored(gitStateColor(state), displayStr.c_str());
 
     ImGui::SameLine();
     ImGui::Text("]");
@@ -99,7 +153,9 @@ void renderGitState(const GitState& state)
 //--------------------------------------
 void renderSelectionBar()
 {
-    reloadDirectory = ImGui::Button("Rescan");
+    if (ImGui::Button("Rescan")) {
+        reloadDirectory = true;
+    }
     ImGui::SameLine();
     if (ImGui::Button("Choose Folder")) {
         std::string result = cpputils::windows::OpenWindowsFolderDialogue();
@@ -109,7 +165,17 @@ void renderSelectionBar()
         }
     }
     ImGui::SameLine();
+    if (ImGui::Button("Dump Trace")) {
+        int64_t spans = writeChromeTrace(traceOutputPath);
+        traceDumpResult = spans < 0 ? "Error writing " + traceOutputPath
+                                    : "Wrote " + std::to_string(spans) + " spans to " + traceOutputPath;
+    }
+    ImGui::SameLine();
     ImGui::Text(baseDirectory.c_str());
+    if (!traceDumpResult.empty()) {
+        ImGui::SameLine();
+        ImGui::Text(traceDumpResult.c_str());
+    }
 }
 
 //--------------------------------------
@@ -119,93 +185,1102 @@ void renderMassRepoToolbar()
 {
     ImGui::Text("All Repos: ");
     ImGui::SameLine();
+    GitTask massTask = GitTask::NONE;
     if (ImGui::Button("Fetch")) {
-        if (gitReposLock.try_lock()) {
-            for (GitRepo& repo : gitRepos) {
-                if (repo.task == GitTask::NONE) {
-                    repo.task = GitTask::FETCH;
-                }
+        massTask = GitTask::FETCH;
+    }
+    ImGui::SameLine();
+    if (ImGui::Button("Fast Forward")) {
+        massTask = GitTask::FASTFORWARD;
+    }
+    ImGui::SameLine();
+    if (ImGui::Button("Push")) {
+        massTask = GitTask::PUSH;
+    }
+    ImGui::SameLine();
+    if (ImGui::Button("Rebase Diverged")) {
+        massTask = GitTask::REBASE;
+    }
+
+    std::lock_guard<std::mutex> lock(repoTableLock);
+    if (massTask != GitTask::NONE) {
+        for (size_t row = 0; row < repoTable.size(); row++) {
+            // Rebasing only means something for repos that have diverged
+            bool applies = massTask != GitTask::REBASE || repoTable.state(row) == GitState::DIVERGED;
+            if (repoTable.tasks[row] == GitTask::NONE && applies) {
+                repoTable.tasks[row] = massTask;
             }
-            gitReposLock.unlock();
         }
     }
+
+    // Transfer totals of every repo this session, by fetch depth
+    uint64_t full = 0;
+    uint64_t limited = 0;
+    for (const GitRepo& repo : repoTable.repos) {
+        full += repo.fetchStats.fullDepthBytes;
+        limited += repo.fetchStats.limitedDepthBytes;
+    }
+    if (full > 0 || limited > 0) {
+        ImGui::SameLine();
+        ImGui::Text(
+            "Fetched: %s at full depth, %s depth-limited", formatBytes(full).c_str(), formatBytes(limited).c_str());
+    }
+}
+
+//--------------------------------------
+// renderSubmoduleProgress()
+//--------------------------------------
+// Submodules nested in parent, each followed by its own, indented.
+void renderSubmoduleProgress(const SubmoduleProgress& progress, size_t parent)
+{
+    for (size_t i = 0; i < progress.entries.size(); i++) {
+        const SubmoduleProgress::Entry& entry = progress.entries[i];
+        if (entry.parent != parent) {
+            continue;
+        }
+        ImVec4 color = entry.phase == SubmodulePhase::FAILED ? ImVec4(1.0f, 0.1f, 0.1f, 1.0f)
+                       : entry.phase == SubmodulePhase::DONE ? ImVec4(0.1f, 1.0f, 0.1f, 1.0f)
+                                                             : ImVec4(0.6f, 0.6f, 0.6f, 1.0f);
+        ImGui::TextColored(color, "%s: %s", entry.name.c_str(), SubmodulePhaseToString(entry.phase));
+        ImGui::Indent();
+        renderSubmoduleProgress(progress, i);
+        ImGui::Unindent();
+    }
+}
+
+//--------------------------------------
+// renderBranchMatrix()
+//--------------------------------------
+void renderBranchMatrix(size_t row)
+{
+    RepoId id = repoTable.ids[row];
+    const GitRepo& repo = repoTable.repos[row];
+    bool pending = branchMatrices.pending(id);
+    if (ImGui::SmallButton("Branches") && !pending) {
+        branchMatrices.request(id, repo.repoPath, repo.traceTag);
+    }
+    if (pending) {
+        ImGui::SameLine();
+        ImGui::TextDisabled("Computing...");
+        return;
+    }
+    std::optional<BranchMatrix> matrix = branchMatrices.get(id);
+    if (!matrix.has_value()) {
+        return;
+    }
+    if (!matrix->error.empty()) {
+        ImGui::TextColored(ImVec4(1.0f, 0.1f, 0.1f, 1.0f), "%s", matrix->error.c_str());
+        return;
+    }
     ImGui::SameLine();
-    if (ImGui::Button("Fast Forward")) {
-        if (gitReposLock.try_lock()) {
-            for (GitRepo& repo : gitRepos) {
-                if (repo.task == GitTask::NONE) {
-                    repo.task = GitTask::FASTFORWARD;
+    ImGui::TextDisabled(
+        "%zu tracked branches, %zu commits walked in %.1f ms",
+        matrix->branches.size(),
+        matrix->walkedCommits,
+        matrix->elapsedMs);
+    if (matrix->branches.empty()) {
+        return;
+    }
+    if (ImGui::BeginTable("Branches", 5, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg | ImGuiTableFlags_SizingFixedFit)) {
+        ImGui::TableSetupColumn("Branch");
+        ImGui::TableSetupColumn("Upstream");
+        ImGui::TableSetupColumn("Ahead");
+        ImGui::TableSetupColumn("Behind");
+        ImGui::TableSetupColumn("State");
+        ImGui::TableHeadersRow();
+        for (const BranchStatus& branch : matrix->branches) {
+            ImGui::TableNextRow();
+            ImGui::TableNextColumn();
+            ImGui::Text("%s", branch.name.c_str());
+            ImGui::TableNextColumn();
+            ImGui::Text("%s", branch.upstream.c_str());
+            ImGui::TableNextColumn();
+            ImGui::Text("%u", branch.ahead);
+            ImGui::TableNextColumn();
+            ImGui::Text("%u", branch.behind);
+            ImGui::TableNextColumn();
+            ImGui::TextColored(gitStateColor(branch.state), "%s", GitStateToString(branch.state).c_str());
+        }
+        ImGui::EndTable();
+    }
+}
+
+//--------------------------------------
+// renderCommitLog()
+//--------------------------------------
+// Only the visible rows are drawn, and the walk is kept a page ahead of them.
+void renderCommitLog(size_t row)
+{
+    RepoId id = repoTable.ids[row];
+    CommitLog* log = commitLogs.find(id);
+    if (ImGui::SmallButton(log == nullptr ? "Commits" : "Hide Commits")) {
+        if (log == nullptr) {
+            commitLogs.open(id, repoTable.repos[row].repoPath, repoTable.repos[row].traceTag);
+        }
+        else {
+            commitLogs.close(id);
+        }
+        return;
+    }
+    if (log == nullptr) {
+        return;
+    }
+
+    size_t visibleEnd = 0;
+    {
+        std::lock_guard<std::mutex> lock(log->mutex());
+        const std::vector<CommitLogEntry>& entries = log->entries();
+        if (!log->error().empty()) {
+            ImGui::TextColored(ImVec4(1.0f, 0.1f, 0.1f, 1.0f), "%s", log->error().c_str());
+            return;
+        }
+        ImGui::SameLine();
+        ImGui::TextDisabled(
+            "%zu%s commits, %s of text",
+            entries.size(),
+            log->finished() ? "" : "+",
+            formatBytes(log->arenaBytes()).c_str());
+
+        ImGui::BeginChild("CommitLog", ImVec2(0, 250));
+        ImGuiListClipper clipper;
+        clipper.Begin(static_cast<int>(entries.size() + (log->finished() ? 0 : 1)));
+        while (clipper.Step()) {
+            for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; i++) {
+                if (static_cast<size_t>(i) == entries.size()) {
+                    ImGui::TextDisabled("Loading...");
+                    continue;
                 }
+                const CommitLogEntry& entry = entries[i];
+                char date[32] = "";
+                std::time_t time = static_cast<std::time_t>(entry.time);
+                std::strftime(date, sizeof(date), "%Y-%m-%d %H:%M", std::localtime(&time));
+                ImGui::TextDisabled("%.10s", git_oid_tostr_s(&entry.id));
+                ImGui::SameLine();
+                ImGui::Text("%s", date);
+                ImGui::SameLine();
+                ImGui::Text(
+                    "%.*s: %.*s",
+                    static_cast<int>(entry.author.size()),
+                    entry.author.data(),
+                    static_cast<int>(entry.summary.size()),
+                    entry.summary.data());
+            }
+            if (static_cast<size_t>(clipper.DisplayEnd) > visibleEnd) {
+                visibleEnd = static_cast<size_t>(clipper.DisplayEnd);
             }
-            gitReposLock.unlock();
         }
+        ImGui::EndChild();
+    }
+    log->want(visibleEnd + COMMIT_LOG_PAGE_SIZE);
+}
+
+//--------------------------------------
+// renderIncomingPreview()
+//--------------------------------------
+// What Fast Forward would bring in, computed when the row is first expanded.
+void renderIncomingPreview(size_t row)
+{
+    RepoId id = repoTable.ids[row];
+    const GitRepo& repo = repoTable.repos[row];
+    ImGui::Checkbox("Detect renames", &incomingPreviewRenames);
+    incomingPreviews.request(id, repo.repoPath, repo.traceTag, incomingPreviewRenames);
+    std::shared_ptr<const IncomingPreview> preview = incomingPreviews.get(id);
+    if (preview == nullptr) {
+        ImGui::SameLine();
+        ImGui::TextDisabled("Computing incoming changes...");
+        return;
+    }
+    if (!preview->error.empty()) {
+        ImGui::TextColored(ImVec4(1.0f, 0.1f, 0.1f, 1.0f), "Incoming: %s", preview->error.c_str());
+        return;
     }
+
     ImGui::SameLine();
-    if (ImGui::Button("Push")) {
-        if (gitReposLock.try_lock()) {
-            for (GitRepo& repo : gitRepos) {
-                if (repo.task == GitTask::NONE) {
-                    repo.task = GitTask::PUSH;
-                }
+    ImGui::Text(
+        "Incoming: %zu commits, %zu files changed, +%zu -%zu",
+        preview->commitCount,
+        preview->fileCount,
+        preview->insertions,
+        preview->deletions);
+    if (ImGui::TreeNodeEx("IncomingCommits", 0, "Commits (%zu)", preview->commitCount)) {
+        for (const IncomingCommit& commit : preview->commits) {
+            ImGui::TextDisabled("%.10s", git_oid_tostr_s(&commit.id));
+            ImGui::SameLine();
+            ImGui::Text("%s: %s", commit.author.c_str(), commit.summary.c_str());
+        }
+        if (preview->commits.size() < preview->commitCount) {
+            ImGui::TextDisabled("... %zu more", preview->commitCount - preview->commits.size());
+        }
+        ImGui::TreePop();
+    }
+    if (ImGui::TreeNodeEx("IncomingFiles", 0, "Files (%zu)", preview->fileCount)) {
+        for (const IncomingFile& file : preview->files) {
+            if (file.binary) {
+                ImGui::TextDisabled("%-15s", "binary");
             }
-            gitReposLock.unlock();
+            else {
+                ImGui::Text("+%-6zu -%-6zu", file.insertions, file.deletions);
+            }
+            ImGui::SameLine();
+            if (file.status == GIT_DELTA_RENAMED) {
+                ImGui::Text("%s -> %s", file.oldPath.c_str(), file.path.c_str());
+            }
+            else {
+                ImGui::Text("%s", file.path.c_str());
+            }
+        }
+        if (preview->files.size() < preview->fileCount) {
+            ImGui::TextDisabled("... %zu more", preview->fileCount - preview->files.size());
         }
+        ImGui::TreePop();
     }
 }
 
+//--------------------------------------
+// renderGitRepoRow()
+//--------------------------------------
+void renderGitRepoRow(size_t row, const std::string& label)
+{
+    GitRepo& repo = repoTable.repos[row];
+    GitTask& task = repoTable.tasks[row];
+    ImGui::PushID(static_cast<int>(repoTable.ids[row].slot));
+
+    if (ImGui::Button("Fetch") && task == GitTask::NONE) {
+        task = GitTask::FETCH;
+    }
+
+    ImGui::SameLine();
+    if (ImGui::Button("Fast Forward") && task == GitTask::NONE) {
+        task = GitTask::FASTFORWARD;
+    }
+
+    ImGui::SameLine();
+    if (ImGui::Button("Push") && task == GitTask::NONE) {
+        task = GitTask::PUSH;
+    }
+
+    ImGui::SameLine();
+    if (ImGui::Button("Rebase") && task == GitTask::NONE) {
+        task = GitTask::REBASE;
+    }
+
+    ImGui::SameLine();
+    renderGitState(repoTable.state(row));
+
+    ImGui::SameLine();
+    ImGui::Text(label.c_str());
+    std::optional<SubmoduleProgress> submodules;
+    if (task == GitTask::PROCESSING) {
+        submodules = fastForwardPipeline.submoduleProgress(repoTable.ids[row]);
+    }
+    if (submodules.has_value()) {
+        ImGui::SameLine();
+        ImGui::TextDisabled("submodules %u/%zu", submodules->finished, submodules->entries.size());
+    }
+    if (!repo.branch.empty()) {
+        ImGui::SameLine();
+        ImGui::TextDisabled("(%s)", repo.branch.c_str());
+    }
+    if (repo.layout != RepoLayout::STANDARD) {
+        ImGui::SameLine();
+        ImGui::TextDisabled("[%s]", RepoLayoutToString(repo.layout));
+    }
+
+    if (submodules.has_value()) {
+        ImGui::Indent();
+        renderSubmoduleProgress(submodules.value(), SubmoduleProgress::TOP_LEVEL);
+        ImGui::Unindent();
+    }
+
+    if (!ImGui::CollapsingHeader("Info")) {
+        incomingPreviews.cancel(repoTable.ids[row]);
+    }
+    else {
+        if (repoTable.state(row) == GitState::FASTFORWARD) {
+            renderIncomingPreview(row);
+        }
+        if (repo.layout == RepoLayout::LINKED_WORKTREE) {
+            ImGui::Text("Objects and fetches shared with %s", repo.commonDirectory.string().c_str());
+        }
+        if (repo.fetchPolicy.depth != GIT_FETCH_DEPTH_FULL || !repo.fetchPolicy.filter.empty()) {
+            ImGui::Text(
+                "Fetch policy '%s': depth %d%s%s",
+                repo.fetchPolicy.pattern.c_str(),
+                repo.fetchPolicy.depth,
+                repo.fetchPolicy.filter.empty() ? "" : ", filter ",
+                repo.fetchPolicy.filter.c_str());
+        }
+        if (repo.fetchStats.receivedObjects > 0) {
+            ImGui::Text(
+                "Last fetch: %llu objects, %s; this session %s at full depth, %s depth-limited",
+                static_cast<unsigned long long>(repo.fetchStats.receivedObjects),
+                formatBytes(repo.fetchStats.receivedBytes).c_str(),
+                formatBytes(repo.fetchStats.fullDepthBytes).c_str(),
+                formatBytes(repo.fetchStats.limitedDepthBytes).c_str());
+        }
+        AllocationStats allocations = repoAllocationStats(repo.traceTag);
+        if (allocations.allocations > 0) {
+            ImGui::Text(
+                "libgit2 memory: %s live, %s allocated over %llu allocations",
+                formatBytes(allocations.liveBytes > 0 ? allocations.liveBytes : 0).c_str(),
+                formatBytes(allocations.totalBytes).c_str(),
+                static_cast<unsigned long long>(allocations.allocations));
+        }
+        if (ImGui::SmallButton("Show Log")) {
+            logRepoFilter = repo.traceTag;
+        }
+        ImGui::SameLine();
+        renderBranchMatrix(row);
+        renderCommitLog(row);
+        if (task == GitTask::NONE) {
+            ImGui::TextColored(ImVec4(1.0f, 1.0f, 1.0f, 1.0f), repo.message.c_str());
+        }
+        else {
+            ImGui::TextColored(ImVec4(0.5f, 0.0f, 0.0f, 1.0f), "Task in progress");
+        }
+    }
+
+    ImGui::PopID();
+}
+
+//--------------------------------------
+// queueSubtreeTask()
+//--------------------------------------
+void queueSubtreeTask(uint32_t node, GitTask subtreeTask)
+{
+    repoTreeRows.clear();
+    repoTree.collectRows(node, repoTreeRows);
+    for (uint32_t row : repoTreeRows) {
+        if (repoTable.tasks[row] == GitTask::NONE) {
+            repoTable.tasks[row] = subtreeTask;
+        }
+    }
+}
+
+//--------------------------------------
+// renderGitRepoTreeNode()
+//--------------------------------------
+void renderGitRepoTreeNode(uint32_t index)
+{
+    constexpr static std::array<GitState, 6> countedStates = {
+        GitState::UPTODATE,
+        GitState::FASTFORWARD,
+        GitState::PUSH,
+        GitState::DIVERGED,
+        GitState::REBASE,
+        GitState::ERROR_STATE};
+
+    const RepoTreeNode& node = repoTree.node(index);
+    if (node.children.empty()) {
+        if (node.row != REPO_TREE_NONE) {
+            renderGitRepoRow(node.row, node.name);
+        }
+        return;
+    }
+
+    ImGui::PushID(static_cast<int>(index));
+    bool open = ImGui::TreeNode(node.name.c_str());
+
+    ImGui::SameLine();
+    if (ImGui::SmallButton("Fetch")) {
+        queueSubtreeTask(index, GitTask::FETCH);
+    }
+    ImGui::SameLine();
+    if (ImGui::SmallButton("Fast Forward")) {
+        queueSubtreeTask(index, GitTask::FASTFORWARD);
+    }
+    ImGui::SameLine();
+    if (ImGui::SmallButton("Push")) {
+        queueSubtreeTask(index, GitTask::PUSH);
+    }
+    for (GitState state : countedStates) {
+        uint32_t count = node.counts[static_cast<size_t>(state)];
+        if (count > 0) {
+            ImGui::SameLine();
+            ImGui::TextColored(gitStateColor(state), "%u %s", count, GitStateToString(state).c_str());
+        }
+    }
+
+    if (open) {
+        if (node.row != REPO_TREE_NONE) {
+            renderGitRepoRow(node.row, ".");
+        }
+        for (uint32_t child : node.children) {
+            renderGitRepoTreeNode(child);
+        }
+        ImGui::TreePop();
+    }
+    ImGui::PopID();
+}
+
 //--------------------------------------
 // renderGitRepoList()
 //--------------------------------------
 void renderGitRepoList()
 {
+    if (scanInProgress) {
+        ImGui::Text("Scanning....");
+    }
+
+    ImGui::Checkbox("Tree view", &repoTreeView);
+    ImGui::SameLine();
+    bool updateSubmodules = fastForwardPipeline.updatesSubmodules();
+    if (ImGui::Checkbox("Fast-forward submodules", &updateSubmodules)) {
+        fastForwardPipeline.setSubmoduleUpdates(updateSubmodules);
+    }
+    ImGui::SameLine();
+    bool autoStash = fastForwardPipeline.autoStashes();
+    if (ImGui::Checkbox("Auto-stash", &autoStash)) {
+        fastForwardPipeline.setAutoStash(autoStash);
+    }
+    if (!repoTreeView) {
+        ImGui::SameLine();
+        ImGui::SetNextItemWidth(300.0f);
+        ImGui::InputTextWithHint(
+            "##RepoFilter", "Filter by path or branch", repoFilterInput.data(), repoFilterInput.size());
+        ImGui::SameLine();
+        ImGui::Checkbox("Best matches first", &repoFilterRanked);
+        ImGui::SameLine();
+        ImGui::SetNextItemWidth(150.0f);
+        if (ImGui::BeginCombo("Sort by", RepoSortColumnToString(repoSortColumn))) {
+            for (uint8_t column = 0; column < static_cast<uint8_t>(RepoSortColumn::COUNT); column++) {
+                bool selected = static_cast<RepoSortColumn>(column) == repoSortColumn;
+                if (ImGui::Selectable(RepoSortColumnToString(static_cast<RepoSortColumn>(column)), selected)) {
+                    repoSortColumn = static_cast<RepoSortColumn>(column);
+                }
+            }
+            ImGui::EndCombo();
+        }
+        ImGui::SameLine();
+        ImGui::Checkbox("Descending", &repoSortDescending);
+    }
+
     // Git Repo list
-    if (gitReposLock.try_lock()) {
-        if (gitRepos.size() > 0) {
-            uint16_t id = 0;
-            for (GitRepo& repo : gitRepos) {
-                ImGui::PushID(id);
-
-                if (ImGui::Button("Fetch") && repo.task == GitTask::NONE) {
-                    repo.task = GitTask::FETCH;
+    {
+        std::lock_guard<std::mutex> lock(repoTableLock);
+        if (repoTable.empty()) {
+            ImGui::Text("No Git Directories loaded");
+        }
+        else if (repoTreeView) {
+            repoTree.sync(repoTable);
+            const RepoTreeNode& root = repoTree.node(REPO_TREE_ROOT);
+            if (root.row != REPO_TREE_NONE) {
+                renderGitRepoRow(root.row, repoDisplayPath(repoTable.repos[root.row].repoPath).string());
+            }
+            for (uint32_t child : root.children) {
+                renderGitRepoTreeNode(child);
+            }
+        }
+        else {
+            const std::vector<RepoFilterMatch>& matches = repoFilter.apply(repoTable, repoFilterInput.data());
+            const std::vector<uint32_t>& order = repoSorter.apply(repoTable, repoSortColumn, repoSortDescending);
+            const std::vector<uint32_t>* rows = &order;
+            if (!repoFilter.query().empty()) {
+                ImGui::Text("%zu of %zu repos", matches.size(), repoTable.size());
+
+                // Matches come in table order; pick them out of the sorted
+                // order, and only when either has changed. Scores only change
+                // with the matches.
+                if (repoFilter.revision() != sortedMatchesFilterRevision) {
+                    matchScores.assign(repoTable.size(), 0);
+                    for (const RepoFilterMatch& match : matches) {
+                        matchScores[match.row] = repoFilter.score(match.row);
+                    }
+                }
+                if (repoFilter.revision() != sortedMatchesFilterRevision
+                    || repoSorter.revision() != sortedMatchesSortRevision || repoFilterRanked != sortedMatchesRanked) {
+                    sortedMatches.clear();
+                    for (uint32_t row : order) {
+                        if (matchScores[row] != 0) {
+                            sortedMatches.push_back(row);
+                        }
+                    }
+                    if (repoFilterRanked) {
+                        std::stable_sort(sortedMatches.begin(), sortedMatches.end(), [](uint32_t a, uint32_t b) {
+                            return matchScores[a] > matchScores[b];
+                        });
+                    }
+                    sortedMatchesFilterRevision = repoFilter.revision();
+                    sortedMatchesSortRevision = repoSorter.revision();
+                    sortedMatchesRanked = repoFilterRanked;
                 }
+                rows = &sortedMatches;
+            }
 
-                ImGui::SameLine();
-                if (ImGui::Button("Fast Forward") && repo.task == GitTask::NONE) {
-                    repo.task = GitTask::FASTFORWARD;
+            // Only the rows in view are laid out. Expanded rows are taller
+            // than the clipper's estimate, which only skews the scroll extent
+            ImGuiListClipper clipper;
+            clipper.Begin(static_cast<int>(rows->size()));
+            while (clipper.Step()) {
+                for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; i++) {
+                    uint32_t row = (*rows)[i];
+                    renderGitRepoRow(row, repoDisplayPath(repoTable.repos[row].repoPath).string());
                 }
+            }
+        }
+    }
+}
 
-                ImGui::SameLine();
-                if (ImGui::Button("Push") && repo.task == GitTask::PUSH) {
-                    repo.task = GitTask::PUSH;
+//--------------------------------------
+// renderLogPane()
+//--------------------------------------
+void renderLogPane()
+{
+    if (!ImGui::CollapsingHeader("Log")) {
+        return;
+    }
+
+    constexpr LogLevel levels[] = {
+        LogLevel::LEVEL_NONE, LogLevel::LEVEL_ERROR, LogLevel::LEVEL_WARN, LogLevel::LEVEL_INFO, LogLevel::LEVEL_DEBUG, LogLevel::LEVEL_TRACE};
+    constexpr const char* levelNames[] = {"OFF", "ERROR", "WARNING", "INFO", "DEBUG", "TRACE"};
+    int levelIndex = static_cast<int>(std::find(std::begin(levels), std::end(levels), logSink().getCaptureLevel())
+                                      - std::begin(levels));
+    ImGui::SetNextItemWidth(120.0f);
+    if (ImGui::Combo("Level", &levelIndex, levelNames, IM_ARRAYSIZE(levelNames))) {
+        logSink().setCaptureLevel(levels[levelIndex]);
+        libgit2TraceAvailable = setLibgit2Tracing(libgit2TraceEnabled);
+    }
+    ImGui::SameLine();
+    if (ImGui::Checkbox("libgit2 trace", &libgit2TraceEnabled)) {
+        libgit2TraceAvailable = setLibgit2Tracing(libgit2TraceEnabled);
+    }
+    if (!libgit2TraceAvailable) {
+        ImGui::SameLine();
+        ImGui::TextColored(ImVec4(1.0f, 0.1f, 0.1f, 1.0f), "libgit2 was built without tracing");
+    }
+    ImGui::SameLine();
+    if (ImGui::Button("Clear")) {
+        logSink().clear();
+    }
+    if (logRepoFilter != 0) {
+        ImGui::SameLine();
+        ImGui::Text("Repo: %s", traceTagName(logRepoFilter).c_str());
+        ImGui::SameLine();
+        if (ImGui::SmallButton("Show All")) {
+            logRepoFilter = 0;
+            logEntriesChangeCount = UINT64_MAX;
+        }
+    }
+
+    // Re-snapshot only when something was logged or the filter changed
+    static uint32_t snapshotRepoFilter = 0;
+    uint64_t changeCount = logSink().changeCount();
+    if (changeCount != logEntriesChangeCount || snapshotRepoFilter != logRepoFilter) {
+        logSink().snapshot(logEntries, logRepoFilter);
+        logEntriesChangeCount = changeCount;
+        snapshotRepoFilter = logRepoFilter;
+    }
+
+    ImGui::BeginChild("LogEntries", ImVec2(0, 200));
+    ImGuiListClipper clipper;
+    clipper.Begin(static_cast<int>(logEntries.size()));
+    while (clipper.Step()) {
+        for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; i++) {
+            const LogEntry& entry = logEntries[i];
+            ImVec4 color = ImVec4(0.8f, 0.8f, 0.8f, 1.0f);
+            if (entry.level == LogLevel::LEVEL_ERROR) {
+                color = ImVec4(1.0f, 0.1f, 0.1f, 1.0f);
+            }
+            else if (entry.level == LogLevel::LEVEL_WARN) {
+                color = ImVec4(0.77f, 0.8f, 0.145f, 1.0f);
+            }
+            ImGui::TextColored(
+                color,
+                "%9.3f %-7s %s #%u %s: %s",
+                entry.timeNs / 1e9,
+                LogLevelToString(entry.level),
+                entry.source == LogSource::LIBGIT2 ? "libgit2" : "app",
+                entry.taskId,
+                traceTagName(entry.repoTag).c_str(),
+                entry.text);
+        }
+    }
+    ImGui::EndChild();
+}
+
+//--------------------------------------
+// renderAllocatorMetrics()
+//--------------------------------------
+void renderAllocatorMetrics()
+{
+    if (!gitAllocatorState().installed) {
+        ImGui::Text("libgit2 allocator: system (start with --allocator tracking to measure)");
+        return;
+    }
+
+    int mode = static_cast<int>(gitAllocatorMode());
+    const char* modeNames[] = {
+        AllocatorModeToString(AllocatorMode::PASSTHROUGH),
+        AllocatorModeToString(AllocatorMode::TRACKING),
+        AllocatorModeToString(AllocatorMode::POOLED)};
+    ImGui::SetNextItemWidth(150.0f);
+    if (ImGui::Combo("libgit2 allocator", &mode, modeNames, IM_ARRAYSIZE(modeNames))) {
+        setGitAllocatorMode(static_cast<AllocatorMode>(mode));
+    }
+    AllocationStats total = totalAllocationStats();
+    ImGui::SameLine();
+    ImGui::Text(
+        "%s live, %s allocated, pool hit rate %.1f%%",
+        formatBytes(total.liveBytes > 0 ? total.liveBytes : 0).c_str(),
+        formatBytes(total.totalBytes).c_str(),
+        poolHitRate() * 100.0);
+
+    if (ImGui::BeginTable("Allocations", 4, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg | ImGuiTableFlags_SizingFixedFit)) {
+        ImGui::TableSetupColumn("Operation");
+        ImGui::TableSetupColumn("Live");
+        ImGui::TableSetupColumn("Allocated");
+        ImGui::TableSetupColumn("Allocations");
+        ImGui::TableHeadersRow();
+        for (size_t operation = 0; operation <= TRACE_PHASE_COUNT; operation++) {
+            AllocationStats stats = operationAllocationStats(static_cast<TracePhase>(operation));
+            if (stats.allocations == 0) {
+                continue;
+            }
+            ImGui::TableNextRow();
+            ImGui::TableNextColumn();
+            ImGui::Text(operation == TRACE_PHASE_COUNT ? "other" : TracePhaseToString(static_cast<TracePhase>(operation)));
+            ImGui::TableNextColumn();
+            ImGui::Text(formatBytes(stats.liveBytes > 0 ? stats.liveBytes : 0).c_str());
+            ImGui::TableNextColumn();
+            ImGui::Text(formatBytes(stats.totalBytes).c_str());
+            ImGui::TableNextColumn();
+            ImGui::Text("%llu", static_cast<unsigned long long>(stats.allocations));
+        }
+        ImGui::EndTable();
+    }
+}
+
+//--------------------------------------
+// renderFastForwardMetrics()
+//--------------------------------------
+void renderFastForwardMetrics()
+{
+    FastForwardPipelineStats stats = fastForwardPipeline.stats();
+    if (stats.repos == 0) {
+        return;
+    }
+
+    ImGui::Text(
+        "%s fast-forward: %llu repos, %llu submodules, %.1fs, checkout queue %zu (peak %zu of %zu)",
+        fastForwardPipeline.busy() ? "Current" : "Last",
+        static_cast<unsigned long long>(stats.repos),
+        static_cast<unsigned long long>(stats.submodules),
+        stats.wallSeconds,
+        stats.queueDepth,
+        stats.queueHighWater,
+        stats.queueCapacity);
+    if (stats.stashed > 0) {
+        ImGui::Text(
+            "Auto-stashed %llu repos, %llu with changes left in stash@{0}",
+            static_cast<unsigned long long>(stats.stashed),
+            static_cast<unsigned long long>(stats.stashConflicts));
+    }
+    if (ImGui::BeginTable("Pipeline", 5, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg | ImGuiTableFlags_SizingFixedFit)) {
+        ImGui::TableSetupColumn("Stage");
+        ImGui::TableSetupColumn("Workers");
+        ImGui::TableSetupColumn("Jobs");
+        ImGui::TableSetupColumn("Busy");
+        ImGui::TableSetupColumn("Blocked (s)");
+        ImGui::TableHeadersRow();
+        for (auto [name, stage] : {std::pair{"Network", stats.network}, std::pair{"Disk", stats.disk}}) {
+            ImGui::TableNextRow();
+            ImGui::TableNextColumn();
+            ImGui::Text(name);
+            ImGui::TableNextColumn();
+            ImGui::Text("%u", stage.workers);
+            ImGui::TableNextColumn();
+            ImGui::Text("%llu", static_cast<unsigned long long>(stage.jobs));
+            ImGui::TableNextColumn();
+            ImGui::Text("%.0f%%", stage.utilization(stats.wallSeconds) * 100.0);
+            ImGui::TableNextColumn();
+            ImGui::Text("%.1f", stage.blockedSeconds);
+        }
+        ImGui::EndTable();
+    }
+}
+
+//--------------------------------------
+// renderMetricsPanel()
+//--------------------------------------
+void renderMetricsPanel()
+{
+    if (!ImGui::CollapsingHeader("Metrics")) {
+        return;
+    }
+
+    renderAllocatorMetrics();
+    renderFastForwardMetrics();
+
+    std::vector<LatencySeries> series = collectLatencySeries();
+    if (series.empty()) {
+        ImGui::Text("No operations recorded yet");
+        return;
+    }
+
+    if (ImGui::BeginTable("Latency", 7, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg | ImGuiTableFlags_SizingFixedFit)) {
+        ImGui::TableSetupColumn("Operation");
+        ImGui::TableSetupColumn("Host");
+        ImGui::TableSetupColumn("Count");
+        ImGui::TableSetupColumn("p50 (ms)");
+        ImGui::TableSetupColumn("p90 (ms)");
+        ImGui::TableSetupColumn("p99 (ms)");
+        ImGui::TableSetupColumn("Max (ms)");
+        ImGui::TableHeadersRow();
+        for (const LatencySeries& s : series) {
+            ImGui::TableNextRow();
+            ImGui::TableNextColumn();
+            ImGui::Text(LatencyOpToString(s.op));
+            ImGui::TableNextColumn();
+            ImGui::Text(s.host.empty() ? "all" : s.host.c_str());
+            ImGui::TableNextColumn();
+            ImGui::Text("%llu", static_cast<unsigned long long>(s.summary.count));
+            for (uint64_t micros : {s.summary.p50, s.summary.p90, s.summary.p99, s.summary.max}) {
+                ImGui::TableNextColumn();
+                ImGui::Text("%.1f", micros / 1000.0);
+            }
+        }
+        ImGui::EndTable();
+    }
+}
+
+//--------------------------------------
+// renderMaintenancePanel()
+//--------------------------------------
+void renderMaintenancePanel()
+{
+    if (!ImGui::CollapsingHeader("Maintenance")) {
+        return;
+    }
+
+    if (maintenanceRunner.isRunning()) {
+        ImGui::Text("Maintaining %zu of %zu repos", maintenanceRunner.progress(), maintenanceRunner.repoCount());
+        ImGui::SameLine();
+        if (ImGui::Button("Cancel")) {
+            maintenanceRunner.cancel();
+        }
+    }
+    else if (ImGui::Button("Run Maintenance")) {
+        // Repos with a task running are left for the next run
+        std::vector<std::filesystem::path> gitDirectories;
+        {
+            std::lock_guard<std::mutex> lock(repoTableLock);
+            for (size_t row = 0; row < repoTable.size(); row++) {
+                if (repoTable.tasks[row] == GitTask::NONE) {
+                    gitDirectories.push_back(repoTable.repos[row].repoPath);
                 }
+            }
+        }
+        maintenanceRunner.start(std::move(gitDirectories), MAINTENANCE_PACK_THRESHOLD);
+    }
+    ImGui::SameLine();
+    ImGui::TextDisabled(
+        "Writes a multi-pack-index once %zu+ packs aren't covered by one, and a commit-graph where missing or %zu+ "
+        "packs behind",
+        MAINTENANCE_PACK_THRESHOLD,
+        MAINTENANCE_GRAPH_PACK_THRESHOLD);
 
-                ImGui::SameLine();
-                renderGitState(repo.state);
+    std::vector<MaintenanceResult> results = maintenanceRunner.results();
+    if (ImGui::BeginTable("Maintenance", 6, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg | ImGuiTableFlags_SizingFixedFit)) {
+        ImGui::TableSetupColumn("Repo");
+        ImGui::TableSetupColumn("Packs");
+        ImGui::TableSetupColumn("Indexes");
+        ImGui::TableSetupColumn("Lookup before (us)");
+        ImGui::TableSetupColumn("Lookup after (us)");
+        ImGui::TableSetupColumn("Result");
+        ImGui::TableHeadersRow();
+        for (const MaintenanceResult& result : results) {
+            if (!result.maintained && result.ok) {
+                continue;
+            }
+            ImGui::TableNextRow();
+            ImGui::TableNextColumn();
+            ImGui::Text(repoDisplayPath(result.gitDirectory).string().c_str());
+            ImGui::TableNextColumn();
+            ImGui::Text("%zu", result.before.packs);
+            ImGui::TableNextColumn();
+            ImGui::Text(
+                "%s%s",
+                result.after.multiPackIndex ? "midx " : "",
+                result.after.commitGraph ? "commit-graph" : "");
+            ImGui::TableNextColumn();
+            ImGui::Text("%.2f", result.lookupBeforeUs);
+            ImGui::TableNextColumn();
+            ImGui::Text("%.2f", result.lookupAfterUs);
+            ImGui::TableNextColumn();
+            if (result.ok) {
+                ImGui::Text(result.message.c_str());
+            }
+            else {
+                ImGui::TextColored(ImVec4(1.0f, 0.1f, 0.1f, 1.0f), result.message.c_str());
+            }
+        }
+        ImGui::EndTable();
+    }
+}
 
-                ImGui::SameLine();
-                ImGui::Text(repo.repoPath.parent_path().string().c_str());
+//--------------------------------------
+// renderSharedObjectsPanel()
+//--------------------------------------
+void renderSharedObjectsPanel()
+{
+    if (!ImGui::CollapsingHeader("Shared Objects")) {
+        return;
+    }
 
-                if (ImGui::CollapsingHeader("Info")) {
-                    if (repo.task == GitTask::NONE) {
-                        ImGui::TextColored(ImVec4(1.0f, 1.0f, 1.0f, 1.0f), repo.message.c_str());
-                    }
-                    else {
-                        ImGui::TextColored(ImVec4(0.5f, 0.0f, 0.0f, 1.0f), "Task in progress");
-                    }
+    bool running = sharedObjectsRunner.isRunning();
+    std::string status;
+    std::vector<SharedObjectGroup> groups = sharedObjectsRunner.results(status);
+    ImGui::BeginDisabled(running);
+    if (ImGui::Button("Analyze")) {
+        std::vector<std::filesystem::path> gitDirectories;
+        {
+            std::lock_guard<std::mutex> lock(repoTableLock);
+            for (size_t row = 0; row < repoTable.size(); row++) {
+                gitDirectories.push_back(repoTable.repos[row].repoPath);
+            }
+        }
+        sharedObjectsRunner.analyze(std::move(gitDirectories), baseDirectory);
+    }
+    ImGui::EndDisabled();
+    ImGui::SameLine();
+    ImGui::TextDisabled(running ? "Working..." : status.c_str());
+
+    for (size_t i = 0; i < groups.size(); i++) {
+        const SharedObjectGroup& group = groups[i];
+        ImGui::PushID(static_cast<int>(i));
+        size_t shared = std::count_if(group.members.begin(), group.members.end(), [&](const SharedObjectMember& m) {
+            return group.isShared(m);
+        });
+        bool open = ImGui::TreeNodeEx(
+            "group",
+            0,
+            "%s: %zu repos, %zu shared, %s duplicated",
+            group.originUrl.c_str(),
+            group.members.size(),
+            shared,
+            formatBytes(group.duplicateBytes).c_str());
+
+        // Repos being converted must stay idle, so only offer it when all are,
+        // and keep them busy until poll() reopens them
+        std::lock_guard<std::mutex> lock(repoTableLock);
+        std::vector<size_t> rows;
+        bool idle = true;
+        for (size_t row = 0; row < repoTable.size(); row++) {
+            for (const SharedObjectMember& member : group.members) {
+                if (repoTable.repos[row].repoPath == member.gitDirectory) {
+                    rows.push_back(row);
+                    idle = idle && repoTable.tasks[row] == GitTask::NONE;
                 }
+            }
+        }
+        ImGui::SameLine();
+        ImGui::BeginDisabled(running || !idle || group.duplicateBytes == 0);
+        if (ImGui::SmallButton("Share") && sharedObjectsRunner.share(i)) {
+            for (size_t row : rows) {
+                repoTable.tasks[row] = GitTask::PROCESSING;
+                repoTable.setState(row, GitState::PROCESSING);
+                sharingRepos.push_back(repoTable.ids[row]);
+            }
+        }
+        ImGui::EndDisabled();
+
+        if (open) {
+            ImGui::TextDisabled("Store: %s", group.store.string().c_str());
+            for (const SharedObjectMember& member : group.members) {
+                ImGui::Text(
+                    "%s  %s%s",
+                    repoDisplayPath(member.gitDirectory).string().c_str(),
+                    formatBytes(member.objectBytes).c_str(),
+                    member.alternateMissing    ? "  (missing alternate)"
+                    : group.isShared(member)   ? "  (shared)"
+                    : member.alternate.empty() ? ""
+                                               : "  (other alternate)");
+            }
+            ImGui::TreePop();
+        }
+        ImGui::PopID();
+    }
+}
+
+//--------------------------------------
+// renderContentSearchPanel()
+//--------------------------------------
+// Matches stream in while the search runs; only the visible rows are drawn.
+void renderContentSearchPanel()
+{
+    if (!ImGui::CollapsingHeader("Search")) {
+        return;
+    }
+
+    bool running = contentSearch.isRunning();
+    ImGui::SetNextItemWidth(400.0f);
+    bool submitted = ImGui::InputText(
+        "##ContentSearch", contentSearchInput.data(), contentSearchInput.size(), ImGuiInputTextFlags_EnterReturnsTrue);
+    ImGui::SameLine();
+    ImGui::Checkbox("Regex", &contentSearchRegex);
+    ImGui::SameLine();
+    if (running) {
+        if (ImGui::Button("Cancel")) {
+            contentSearch.cancel();
+        }
+    }
+    else if (ImGui::Button("Search") || submitted) {
+        std::vector<ContentSearchRepo> repos;
+        {
+            std::lock_guard<std::mutex> lock(repoTableLock);
+            for (size_t row = 0; row < repoTable.size(); row++) {
+                repos.push_back({repoTable.repos[row].repoPath, repoTable.repos[row].traceTag});
+            }
+        }
+        ContentSearchQuery query{contentSearchInput.data(), contentSearchRegex};
+        contentSearchError.clear();
+        contentSearch.start(std::move(repos), query, contentSearchError);
+    }
+    ImGui::SameLine();
+    if (!contentSearchError.empty()) {
+        ImGui::TextColored(ImVec4(1.0f, 0.1f, 0.1f, 1.0f), "%s", contentSearchError.c_str());
+        return;
+    }
+    ImGui::TextDisabled(
+        "%zu of %zu repos, %zu matches; %zu blobs scanned (%s), %zu cached, %zu binary or oversized",
+        contentSearch.progress(),
+        contentSearch.repoCount(),
+        contentSearch.matchCount(),
+        contentSearch.scannedBlobs(),
+        formatBytes(contentSearch.scannedBytes()).c_str(),
+        contentSearch.cachedBlobs(),
+        contentSearch.skippedBlobs());
+
+    std::lock_guard<std::mutex> lock(contentSearch.mutex());
+    const std::vector<ContentMatch>& matches = contentSearch.matches();
+    if (matches.size() >= CONTENT_SEARCH_MAX_MATCHES) {
+        ImGui::TextDisabled("Showing the first %zu matches", CONTENT_SEARCH_MAX_MATCHES);
+    }
+    ImGui::BeginChild("ContentSearchMatches", ImVec2(0, 250));
+    ImGuiListClipper clipper;
+    clipper.Begin(static_cast<int>(matches.size()));
+    while (clipper.Step()) {
+        for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; i++) {
+            const ContentMatch& match = matches[i];
+            ImGui::TextDisabled(
+                "%s", repoDisplayPath(contentSearch.repo(match.repo).repoPath).filename().string().c_str());
+            ImGui::SameLine();
+            ImGui::Text("%s:%u", match.path.c_str(), match.line);
+            ImGui::SameLine();
+            ImGui::TextUnformatted(match.text.c_str());
+        }
+    }
+    ImGui::EndChild();
+}
 
-                ImGui::PopID();
-                id++;
+//--------------------------------------
+// renderBatchPlanPanel()
+//--------------------------------------
+// Dry run of a mass operation over the repos the filter matches, all of them
+// without a filter, with what it would do to each and how long it should
+// take. Executing it queues the items longest first.
+void renderBatchPlanPanel()
+{
+    if (!ImGui::CollapsingHeader("Batch Plan")) {
+        return;
+    }
+
+    constexpr GitTask goals[] = {GitTask::FETCH, GitTask::FASTFORWARD, GitTask::PUSH};
+    constexpr const char* goalNames[] = {"Fetch", "Fast Forward", "Push"};
+    ImGui::SetNextItemWidth(150.0f);
+    ImGui::Combo("##BatchPlanGoal", &batchPlanGoal, goalNames, IM_ARRAYSIZE(goalNames));
+    ImGui::SameLine();
+
+    std::lock_guard<std::mutex> lock(repoTableLock);
+    BatchPlanLanes lanes{hostLimiter().perHost(), fastForwardPipeline.networkWorkers()};
+    if (ImGui::Button("Plan")) {
+        const std::vector<RepoFilterMatch>& matches = repoFilter.apply(repoTable, repoFilterInput.data());
+        std::vector<uint32_t> rows;
+        if (repoFilter.query().empty()) {
+            for (size_t row = 0; row < repoTable.size(); row++) {
+                rows.push_back(static_cast<uint32_t>(row));
             }
         }
         else {
-            ImGui::Text("No Git Directories loaded");
+            for (const RepoFilterMatch& match : matches) {
+                rows.push_back(match.row);
+            }
         }
-        gitReposLock.unlock();
+        batchPlan = buildBatchPlan(repoTable, rows, goals[batchPlanGoal], fastForwardPipeline.autoStashes(), lanes);
     }
-    else {
-        ImGui::Text("Scanning....");
+    ImGui::SameLine();
+    bool running = batchPlanRunner.running();
+    ImGui::BeginDisabled(running || batchPlan.runnable == 0);
+    if (ImGui::Button("Execute")) {
+        batchPlanRunner.start(batchPlan, lanes);
+        batchPlan = BatchPlan();
     }
+    ImGui::EndDisabled();
+    if (batchPlanRunner.total() > 0) {
+        ImGui::SameLine();
+        ImGui::TextDisabled(
+            "%s: %zu of %zu done, %.1fs of an estimated %.1fs",
+            running ? "Running" : "Last plan",
+            batchPlanRunner.done(),
+            batchPlanRunner.total(),
+            running ? batchPlanRunner.elapsed() : 0.0,
+            batchPlanRunner.estimate());
+    }
+    if (batchPlan.goal == GitTask::NONE) {
+        return;
+    }
+
+    std::string counts;
+    for (size_t action = 0; action < PLAN_ACTION_COUNT; action++) {
+        if (batchPlan.counts[action] > 0) {
+            counts += (counts.empty() ? "" : ", ") + std::to_string(batchPlan.counts[action]) + " "
+                      + PlanActionToString(static_cast<PlanAction>(action));
+        }
+    }
+    ImGui::Text("%zu repos: %s", batchPlan.items.size(), counts.c_str());
+    ImGui::Text(
+        "Estimated %.1fs of work, %.1fs wall time longest first (%.1fs in table order)",
+        batchPlan.workSeconds,
+        batchPlan.wallSeconds,
+        batchPlan.tableOrderWallSeconds);
+    ImGui::TextDisabled(
+        "Repo times are kept in %s; host medians only cover this session's tasks.", TASK_TIMINGS_FILE_NAME);
+
+    ImGui::BeginChild("BatchPlanItems", ImVec2(0, 250));
+    if (ImGui::BeginTable("BatchPlan", 4, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg | ImGuiTableFlags_SizingFixedFit)) {
+        ImGui::TableSetupColumn("Repo");
+        ImGui::TableSetupColumn("Action");
+        ImGui::TableSetupColumn("Estimate (s)");
+        ImGui::TableSetupColumn("From");
+        ImGui::TableHeadersRow();
+        ImGuiListClipper clipper;
+        clipper.Begin(static_cast<int>(batchPlan.items.size()));
+        while (clipper.Step()) {
+            for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; i++) {
+                const PlanItem& item = batchPlan.items[i];
+                bool blocked = item.action == PlanAction::BLOCKED_DIRTY || item.action == PlanAction::BLOCKED_DIVERGED;
+                ImGui::TableNextRow();
+                ImGui::TableNextColumn();
+                ImGui::Text(repoDisplayPath(item.repoPath).string().c_str());
+                ImGui::TableNextColumn();
+                if (blocked) {
+                    ImGui::TextColored(ImVec4(1.0f, 0.6f, 0.1f, 1.0f), "%s", PlanActionToString(item.action));
+                }
+                else {
+                    ImGui::Text("%s", PlanActionToString(item.action));
+                }
+                if (static_cast<size_t>(i) >= batchPlan.runnable) {
+                    continue;
+                }
+                ImGui::TableNextColumn();
+                ImGui::Text("%.1f", item.estimate);
+                ImGui::TableNextColumn();
+                ImGui::TextDisabled("%s", PlanEstimateToString(item.source));
+            }
+        }
+        ImGui::EndTable();
+    }
+    ImGui::EndChild();
 }
 
 //--------------------------------------
@@ -221,9 +1296,39 @@ void renderCredentialInput()
     ImGui::InputText("Git Personal Access Token", credentialInput.data(), credentialInput.size());
 
     if (ImGui::Button("Submit")) {
-        cpputils::windows::Credential credential = {usernameInput.data(), credentialInput.data()};
-        credentialResult = cpputils::windows::writeCredential(GIT_REPO_MANAGER_CREDENTIAL_TARGE_NAME, credential);
+        Credential credential(usernameInput.data(), credentialInput.data());
+
+        // Hosts with a credential of their own never fall back to the default,
+        // so the hosts that rejected theirs get the new one stored under them
+        std::set<std::string> rejectedHosts;
+        for (const std::string& host : authBreaker().openHosts()) {
+            rejectedHosts.insert(host);
+        }
+        {
+            std::lock_guard<std::mutex> lock(repoTableLock);
+            for (const auto& [id, task] : authRejectedTasks) {
+                std::optional<size_t> row = repoTable.find(id);
+                if (row.has_value() && !repoTable.repos[row.value()].remoteHost.empty()) {
+                    rejectedHosts.insert(repoTable.repos[row.value()].remoteHost);
+                }
+            }
+        }
+        credentialResult = credentialCache().store("", credential);
+        for (const std::string& host : rejectedHosts) {
+            credentialResult = credentialCache().store(host, credential) && credentialResult;
+        }
         credentialHasBeenInput = true;
+
+        // Give hosts that rejected the old credential another try
+        authBreaker().reset();
+        std::lock_guard<std::mutex> lock(repoTableLock);
+        for (const auto& [id, task] : authRejectedTasks) {
+            std::optional<size_t> row = repoTable.find(id);
+            if (row.has_value() && repoTable.tasks[row.value()] == GitTask::NONE) {
+                repoTable.tasks[row.value()] = task;
+            }
+        }
+        authRejectedTasks.clear();
         std::fill(usernameInput.begin(), usernameInput.end(), 0);
         std::fill(credentialInput.begin(), credentialInput.end(), 0);
     }
@@ -237,6 +1342,23 @@ void renderCredentialInput()
             ImGui::TextColored(ImVec4(1.0f, 0.1f, 0.1f, 1.0f), "Error Saving Credential");
         }
     }
+    std::vector<std::string> rejectingHosts = authBreaker().openHosts();
+    if (!rejectingHosts.empty()) {
+        std::string hosts;
+        for (const std::string& host : rejectingHosts) {
+            hosts += (hosts.empty() ? "" : ", ") + host;
+        }
+        ImGui::TextColored(
+            ImVec4(1.0f, 0.1f, 0.1f, 1.0f),
+            "Credentials rejected by %s; %zu tasks will retry with a new credential",
+            hosts.c_str(),
+            authRejectedTasks.size());
+    }
+    ImGui::TextDisabled(
+        "%s: %llu lookups, %llu cache hits",
+        credentialCache().storeName(),
+        static_cast<unsigned long long>(credentialCache().lookups()),
+        static_cast<unsigned long long>(credentialCache().hits()));
 }
 
 //--------------------------------------
@@ -245,6 +1367,7 @@ void renderCredentialInput()
 void render(GLFWwindow* window)
 {
     glfwMakeContextCurrent(window);
+    setTraceThreadName("render");
 
     while (!glfwWindowShouldClose(window)) {
         // Start the Dear ImGui frame
@@ -263,6 +1386,12 @@ void render(GLFWwindow* window)
         renderSelectionBar();
         renderMassRepoToolbar();
         renderGitRepoList();
+        renderLogPane();
+        renderMetricsPanel();
+        renderMaintenancePanel();
+        renderSharedObjectsPanel();
+        renderContentSearchPanel();
+        renderBatchPlanPanel();
         renderCredentialInput();
 
         ImGui::End();
@@ -281,78 +1410,234 @@ void render(GLFWwindow* window)
     }
 }
 
+//--------------------------------------
+// keepTaskTimings()
+//--------------------------------------
+// Copies the rows' task times into taskTimings, so they outlive a rescan and
+// are saved at exit. Caller holds repoTableLock.
+void keepTaskTimings()
+{
+    for (size_t row = 0; row < repoTable.size(); row++) {
+        const RepoTaskTimings& timings = repoTable.repos[row].timings;
+        if (std::any_of(timings.runs.begin(), timings.runs.end(), [](uint32_t runs) { return runs > 0; })) {
+            taskTimings[repoTable.repos[row].repoPath.string()] = timings;
+        }
+    }
+}
+
+//--------------------------------------
+// startRepoTask()
+//--------------------------------------
+// Hands the row's queued task to a worker. Caller holds repoTableLock.
+void startRepoTask(size_t row)
+{
+    GitTask task = repoTable.tasks[row];
+    if (task == GitTask::NONE || task == GitTask::PROCESSING) {
+        return;
+    }
+    repoTable.setState(row, GitState::PROCESSING);
+    repoTable.tasks[row] = GitTask::PROCESSING;
+    repoTable.repos[row].taskQueued = std::chrono::steady_clock::now();
+    if (task == GitTask::FASTFORWARD) {
+        fastForwardPipeline.submit(repoTable.ids[row], repoTable.repos[row], repoTable.sortKeys(row));
+        return;
+    }
+    if (task == GitTask::REBASE) {
+        fastForwardPipeline.submitRebase(repoTable.ids[row], repoTable.repos[row], repoTable.sortKeys(row));
+        return;
+    }
+    std::thread t = std::thread(
+        [id = repoTable.ids[row], task, gitRepo = repoTable.repos[row], sortKeys = repoTable.sortKeys(row)]() mutable {
+            auto start = std::chrono::steady_clock::now();
+            GitState state = runGitTask(task, gitRepo, sortKeys);
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            repoTaskResults.post(
+                {id,
+                 state,
+                 std::move(gitRepo.message),
+                 gitRepo.fetchStats,
+                 sortKeys,
+                 task,
+                 authAttempt.rejected,
+                 seconds,
+                 gitRepo.blockedByLocalChanges});
+        });
+    t.detach();
+}
+
 //--------------------------------------
 // poll()
 //--------------------------------------
 void poll()
 {
-    for (GitRepo& repo : gitRepos) {
-        switch (repo.task) {
-            case GitTask::FETCH: {
-                repo.state = GitState::PROCESSING;
-                repo.task = GitTask::PROCESSING;
-                std::thread t = std::thread([&]() { fetchRepo(repo); });
-                t.detach();
-                break;
-            }
-            case GitTask::FASTFORWARD: {
-                repo.state = GitState::PROCESSING;
-                repo.task = GitTask::PROCESSING;
-                std::thread t = std::thread([&]() { fastfowardRepo(repo); });
-                t.detach();
-                break;
-            }
-            case GitTask::PUSH: {
-                repo.state = GitState::PROCESSING;
-                repo.task = GitTask::PROCESSING;
-                std::thread t = std::thread([&]() { pushRepo(repo); });
-                t.detach();
+    bool sharing = false;
+    {
+        std::lock_guard<std::mutex> lock(repoTableLock);
+
+        repoTaskResults.drain(completedTasks);
+        applyRepoTaskResults(repoTable, completedTasks);
+        for (const RepoTaskResult& result : completedTasks) {
+            incomingPreviews.forget(result.id);
+            if (result.authRejected) {
+                authRejectedTasks.emplace_back(result.id, result.task);
             }
         }
-    }
 
-    if (reloadDirectory) {
-        std::lock_guard<std::mutex> lock(gitReposLock);
+        // A running plan's items go first and in plan order
+        batchPlanRunner.completed(completedTasks);
+        batchPlanRunner.next(repoTable, plannedRows);
+        for (size_t row : plannedRows) {
+            startRepoTask(row);
+        }
+        for (size_t row = 0; row < repoTable.size(); row++) {
+            startRepoTask(row);
+        }
 
-        // Clear exiting repo references
-        for (GitRepo& repo : gitRepos) {
-            git_repository_free(repo.repo);
+        // Open handles read alternates only once, so after a conversion they
+        // can't see the objects that moved; the rescan opens them again
+        if (!sharingRepos.empty() && !sharedObjectsRunner.isRunning()) {
+            for (RepoId id : sharingRepos) {
+                std::optional<size_t> row = repoTable.find(id);
+                if (row.has_value()) {
+                    repoTable.tasks[row.value()] = GitTask::NONE;
+                    repoTable.repos[row.value()].refSnapshot = RefSnapshot();
+                }
+            }
+            sharingRepos.clear();
+            reloadDirectory = true;
         }
-        gitRepos.clear();
+        sharing = !sharingRepos.empty();
+    }
 
+    // A rescan would hand out idle rows for repos still being converted
+    if (!sharing && reloadDirectory.exchange(false)) {
+        scanInProgress = true;
+
+        // Scan without the lock so the list keeps drawing; results from tasks
+        // still running on the old repos are dropped by their stale ids
+        std::vector<std::tuple<GitRepo, GitState, RepoSortKeys>> scanned;
         if (TEST_REPOS_OVERRIDE) {
-            for (const GitRepo& repo : testRepos) {
-                gitRepos.push_back(repo);
+            for (const TestRepo& testRepo : testRepos) {
+                GitRepo repo;
+                repo.repoPath = testRepo.repoPath;
+                repo.message = testRepo.message;
+                scanned.emplace_back(repo, testRepo.state, RepoSortKeys());
             }
         }
         else {
-            std::filesystem::path root = baseDirectory.data();
-            try {
-                for (const auto& entry : std::filesystem::recursive_directory_iterator(
-                         root, std::filesystem::directory_options::skip_permission_denied)) {
-                    if (entry.is_directory() && entry.path().filename() == ".git") {
-                        std::optional<GitRepo> repo = makeGitRepo(entry.path());
-                        if (repo.has_value()) {
-                            gitRepos.push_back(repo.value());
-                        }
+            // Repos whose refs haven't moved since the last scan are carried over
+            std::unordered_map<std::string, std::pair<GitRepo, RepoSortKeys>> previous;
+            {
+                std::lock_guard<std::mutex> lock(repoTableLock);
+                keepTaskTimings();
+                for (size_t row = 0; row < repoTable.size(); row++) {
+                    auto entry = previous.emplace(
+                        repoTable.repos[row].repoPath.string(),
+                        std::make_pair(repoTable.repos[row], repoTable.sortKeys(row)));
+
+                    // A task may still be driving the old handle, and the new
+                    // row is idle, so a task started on it must get its own
+                    if (repoTable.tasks[row] != GitTask::NONE) {
+                        entry.first->second.first.refSnapshot = RefSnapshot();
                     }
                 }
             }
-            catch (const std::filesystem::filesystem_error& e) {
-                std::cerr << "Error accessing " << root << ": " << e.what() << std::endl;
+
+            std::filesystem::path root = baseDirectory.data();
+            fetchPolicies = loadFetchPolicies(FETCH_POLICY_FILE_NAME);
+            for (const DiscoveredRepo& discovered : discoverRepos(root)) {
+                GitState state = GitState::NONE;
+                RepoSortKeys sortKeys;
+                const GitRepo* previousRepo = nullptr;
+                auto it = previous.find(discovered.openPath.string());
+                if (it != previous.end()) {
+                    previousRepo = &it->second.first;
+                    sortKeys = it->second.second;
+                }
+                std::optional<GitRepo> repo = rescanGitRepo(discovered, previousRepo, state, sortKeys);
+                if (repo.has_value()) {
+                    auto timings = taskTimings.find(repo->repoPath.string());
+                    if (previousRepo == nullptr && timings != taskTimings.end()) {
+                        repo->timings = timings->second;
+                    }
+                    repo->fetchPolicy = findFetchPolicy(fetchPolicies, repoDisplayPath(discovered.openPath), root);
+                    scanned.emplace_back(std::move(repo.value()), state, sortKeys);
+                }
             }
         }
 
-        reloadDirectory = false;
+        std::lock_guard<std::mutex> lock(repoTableLock);
+        repoTable.clear();
+        authRejectedTasks.clear();
+        for (auto& [repo, state, sortKeys] : scanned) {
+            repoTable.insert(std::move(repo), state, sortKeys);
+        }
+        scanInProgress = false;
     }
 }
 
 //--------------------------------------
 // main()
 //--------------------------------------
-int main()
+int main(int argc, char** argv)
 {
+    CommandLineOptions options = parseCommandLine(argc, argv);
+    if (!options.valid) {
+        return EXIT_FAILURE;
+    }
+
+    // Must be installed before libgit2 allocates anything
+    if (options.allocatorMode.has_value() && !installGitAllocator(options.allocatorMode.value())) {
+        std::cerr << "Error installing the libgit2 allocator, using libgit2's own" << std::endl;
+    }
     git_libgit2_init();
+    setTraceThreadName("main");
+    if (options.traceFile.has_value()) {
+        traceOutputPath = options.traceFile.value();
+    }
+    if (options.logLevel.has_value()) {
+        logSink().setCaptureLevel(options.logLevel.value());
+    }
+    fastForwardPipeline.configure(options.fastForwardNetworkWorkers, options.fastForwardDiskWorkers);
+    fastForwardPipeline.setSubmoduleUpdates(options.fastForwardSubmodules);
+    fastForwardPipeline.setAutoStash(options.fastForwardAutoStash);
+    hostLimiter().setLimit(options.fetchesPerHost);
+    if (options.credential.has_value()) {
+        auto store = std::make_unique<MemoryCredentialStore>();
+        store->write("", options.credential.value());
+        credentialCache().setStore(std::move(store));
+    }
+    if (options.libgit2Trace) {
+        libgit2TraceEnabled = true;
+        libgit2TraceAvailable = setLibgit2Tracing(true);
+    }
+
+    if (options.loopbackServer.has_value()) {
+        int result = runLoopbackServer(options.loopbackServer.value());
+        git_libgit2_shutdown();
+        return result;
+    }
+    if (options.statusBenchmark.has_value()) {
+        int result = runStatusBenchmark(options.statusBenchmark.value());
+        git_libgit2_shutdown();
+        return result;
+    }
+    if (options.branchBenchmark.has_value()) {
+        int result = runBranchMatrixBenchmark(options.branchBenchmark.value());
+        git_libgit2_shutdown();
+        return result;
+    }
+    if (options.maintenance.has_value()) {
+        int result = runMaintenance(options.maintenance.value());
+        git_libgit2_shutdown();
+        return result;
+    }
+    if (options.sharedObjects.has_value()) {
+        int result = runSharedObjects(options.sharedObjects.value());
+        git_libgit2_shutdown();
+        return result;
+    }
+    taskTimings = loadTaskTimings(TASK_TIMINGS_FILE_NAME);
 
     OpenGLApplication::ApplicationConfig appConfig;
     appConfig.windowName = "GitRepoManager";
@@ -385,6 +1670,27 @@ int main()
         return EXIT_FAILURE;
     }
 
+    // Workers that hold libgit2 objects finish before libgit2 shuts down
+    fastForwardPipeline.stop();
+    maintenanceRunner.cancel();
+    branchMatrices.stop();
+    commitLogs.closeAll();
+    incomingPreviews.stop();
+    contentSearch.cancel();
+    {
+        std::lock_guard<std::mutex> lock(repoTableLock);
+        keepTaskTimings();
+    }
+    if (!saveTaskTimings(TASK_TIMINGS_FILE_NAME, taskTimings)) {
+        std::cerr << "Error writing task timings to " << TASK_TIMINGS_FILE_NAME << std::endl;
+    }
+    if (options.traceFile.has_value() && writeChromeTrace(traceOutputPath) < 0) {
+        std::cerr << "Error writing trace to " << traceOutputPath << std::endl;
+    }
+    if (options.metricsFile.has_value() && !writeLatencyMetrics(options.metricsFile.value())) {
+        std::cerr << "Error writing metrics to " << options.metricsFile.value() << std::endl;
+    }
+
     git_libgit2_shutdown();
 
     return EXIT_SUCCESS;
@@ -392,5 +1698,5 @@ int main()
 
 int WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine, int nShowCmd)
 {
-    main();
+    return main(__argc, __argv);
 }
\ No newline at end of file